@@ -23,11 +23,24 @@ Context::Context()
           options.blocking = false;
           return options;
         }())),
+      segmented_log(std::make_unique<SegmentedLog>(
+                        executor, telemetry_log.get())),
       remote_debug(std::make_unique<TelemetryRemoteDebugServer>(executor)),
+      multicast(std::make_unique<TelemetryMulticastPublisher>(executor)),
       telemetry_registry(std::make_unique<TelemetryRegistry>(
-                             context, telemetry_log.get(), remote_debug.get())),
+                             context, telemetry_log.get(), remote_debug.get(),
+                             multicast.get())),
       factory(std::make_unique<mjlib::io::StreamFactory>(executor))
 {
+  // Records are held while the log switches files, then written to
+  // the new one.
+  segmented_log->switch_signal()->connect([this](bool switching) {
+      if (switching) {
+        telemetry_registry->SuspendLog();
+      } else {
+        telemetry_registry->ResumeLog();
+      }
+    });
 }
 
 Context::~Context() {}
@@ -27,6 +27,8 @@
 namespace mjmech {
 namespace base {
 
+class SegmentedLog;
+class TelemetryMulticastPublisher;
 class TelemetryRemoteDebugServer;
 class TelemetryRegistry;
 
@@ -38,7 +40,9 @@ struct Context : boost::noncopyable {
   mjlib::io::RealtimeExecutor rt_executor{context.get_executor()};
   boost::asio::any_io_executor executor{rt_executor};
   std::unique_ptr<mjlib::telemetry::FileWriter> telemetry_log;
+  std::unique_ptr<SegmentedLog> segmented_log;
   std::unique_ptr<TelemetryRemoteDebugServer> remote_debug;
+  std::unique_ptr<TelemetryMulticastPublisher> multicast;
   std::unique_ptr<TelemetryRegistry> telemetry_registry;
   std::unique_ptr<mjlib::io::StreamFactory> factory;
 };
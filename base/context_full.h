@@ -19,5 +19,7 @@
 
 #include "mjlib/io/stream_factory.h"
 
+#include "segmented_log.h"
+#include "telemetry_multicast.h"
 #include "telemetry_registry.h"
 #include "telemetry_remote_debug_server.h"
@@ -0,0 +1,103 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/signals2/connection.hpp>
+
+#include "mjlib/base/fail.h"
+#include "mjlib/base/time_conversions.h"
+#include "mjlib/io/repeating_timer.h"
+
+#include "base/logging.h"
+
+namespace mjmech {
+namespace base {
+
+/// Call DrainLogMessages periodically from a dedicated thread, so
+/// that neither the polling nor the conversion of queued messages
+/// happens on the thread running @p executor.
+///
+/// The drained messages are handed to @p executor in a single batch
+/// per period, and only when there are any, where they are emitted
+/// from signal().
+class LogMessageDrainer : boost::noncopyable {
+ public:
+  LogMessageDrainer(const boost::asio::any_io_executor& executor,
+                    double period_s)
+      : executor_(executor) {
+    connection_ = GetLogMessageSignal()->connect(
+        [this](const TextLogMessage* message) {
+          child_batch_->push_back(*message);
+        });
+
+    child_timer_.start(
+        mjlib::base::ConvertSecondsToDuration(period_s),
+        [this](const mjlib::base::error_code& ec) {
+          mjlib::base::FailIf(ec);
+          CHILD_Drain();
+        });
+    thread_ = std::thread(std::bind(&LogMessageDrainer::CHILD_Run, this));
+  }
+
+  ~LogMessageDrainer() {
+    child_context_.stop();
+    thread_.join();
+  }
+
+  TextLogMessageSignal* signal() { return &signal_; }
+
+ private:
+  using Batch = std::vector<TextLogMessage>;
+
+  void CHILD_Run() {
+    boost::asio::io_context::work work{child_context_};
+    child_context_.run();
+  }
+
+  void CHILD_Drain() {
+    if (DrainLogMessages() == 0) { return; }
+
+    boost::asio::post(
+        executor_,
+        [this, batch = std::move(child_batch_)]() {
+          for (const auto& message : *batch) { signal_(&message); }
+        });
+    child_batch_ = std::make_shared<Batch>();
+  }
+
+  boost::asio::any_io_executor executor_;
+  TextLogMessageSignal signal_;
+
+  boost::signals2::scoped_connection connection_;
+
+  boost::asio::io_context child_context_;
+  std::thread thread_;
+
+  // Only accessed from the child thread.
+  mjlib::io::RepeatingTimer child_timer_{child_context_.get_executor()};
+  std::shared_ptr<Batch> child_batch_ = std::make_shared<Batch>();
+};
+
+}
+}
@@ -19,21 +19,33 @@
 
 #include <boost/noncopyable.hpp>
 
+#include <fmt/format.h>
+
 #include <log4cpp/OstreamAppender.hh>
 #include <log4cpp/PatternLayout.hh>
 //#include <log4cpp/Formatter.hh>
 
+#include "base/text_log_ring.h"
+
 namespace mjmech {
 namespace base {
 
 namespace {
 //boost::once_flag singleton_ready = BOOST_ONCE_INIT;
 
+// The number of log entries which may be waiting to be drained.
+constexpr size_t kTextLogRingSize = 1024;
+
+const boost::posix_time::ptime kEpoch(boost::gregorian::date(1970, 1, 1));
+
+/// Queue every event for DrainLogMessages.  This may be invoked from
+/// any thread, including the realtime one, so it must not allocate
+/// or block.
 class SignalAppender : public log4cpp::AppenderSkeleton {
  public:
-  SignalAppender(TextLogMessageSignal* signal)
+  SignalAppender(TextLogRing* ring)
       : log4cpp::AppenderSkeleton("signal"),
-        signal_(signal) {
+        ring_(ring) {
     // We want to log everything
     setThreshold(log4cpp::Priority::DEBUG);
   }
@@ -41,19 +53,15 @@ class SignalAppender : public log4cpp::AppenderSkeleton {
   virtual ~SignalAppender() {}
 
   virtual void _append(const log4cpp::LoggingEvent& event) {
-    TextLogMessage msg;
-    msg.timestamp =
-        boost::posix_time::ptime(boost::gregorian::date(1970,1,1)) +
-        boost::posix_time::seconds(event.timeStamp.getSeconds()) +
-        boost::posix_time::microseconds(event.timeStamp.getMicroSeconds());
-    msg.thread = event.threadName;
-    msg.priority = log4cpp::Priority::getPriorityName(event.priority);
-    msg.priority_int = event.priority;
-    msg.ndc = event.ndc;
-    msg.category = event.categoryName;
-    msg.message = event.message;
-
-    (*signal_)(&msg);
+    ring_->Push([&](TextLogRing::Entry* entry) {
+        entry->timestamp_us =
+            static_cast<int64_t>(event.timeStamp.getSeconds()) * 1000000 +
+            event.timeStamp.getMicroSeconds();
+        entry->priority = event.priority;
+        TextLogRing::Entry::Copy(entry->thread, event.threadName);
+        TextLogRing::Entry::Copy(entry->category, event.categoryName);
+        TextLogRing::Entry::Copy(entry->message, event.message);
+      });
   }
 
   virtual bool requiresLayout () const {
@@ -98,6 +106,39 @@ class LoggerSetup : boost::noncopyable {
     return &signal_;
   }
 
+  size_t DrainLogMessages() {
+    size_t result = 0;
+    TextLogRing::Entry entry;
+    while (ring_.Pop(&entry)) {
+      TextLogMessage msg;
+      msg.timestamp =
+          kEpoch + boost::posix_time::microseconds(entry.timestamp_us);
+      msg.thread = entry.thread;
+      msg.priority = log4cpp::Priority::getPriorityName(entry.priority);
+      msg.priority_int = entry.priority;
+      msg.category = entry.category;
+      msg.message = entry.message;
+      signal_(&msg);
+      result++;
+    }
+
+    const auto overflows = ring_.overflows();
+    if (overflows != reported_overflows_) {
+      TextLogMessage msg;
+      msg.timestamp = boost::posix_time::microsec_clock::universal_time();
+      msg.priority_int = log4cpp::Priority::WARN;
+      msg.priority = log4cpp::Priority::getPriorityName(msg.priority_int);
+      msg.category = "logging";
+      msg.message = fmt::format("dropped {} log messages",
+                                overflows - reported_overflows_);
+      reported_overflows_ = overflows;
+      signal_(&msg);
+      result++;
+    }
+
+    return result;
+  }
+
  private:
   LoggerSetup() {
     log4cpp::OstreamAppender* appender =
@@ -113,7 +154,7 @@ class LoggerSetup : boost::noncopyable {
     // passes ownership
     root.addAppender(appender);
 
-    SignalAppender* appender2 = new SignalAppender(&signal_);
+    SignalAppender* appender2 = new SignalAppender(&ring_);
     // passes ownership
     root.addAppender(appender2);
   };
@@ -137,7 +178,11 @@ class LoggerSetup : boost::noncopyable {
     }
   }
 
+  TextLogRing ring_{kTextLogRingSize};
   TextLogMessageSignal signal_;
+
+  // Only accessed from the thread calling DrainLogMessages.
+  uint64_t reported_overflows_ = 0;
 };
 
 
@@ -155,6 +200,10 @@ TextLogMessageSignal* GetLogMessageSignal() {
   return LoggerSetup::get()->GetLogMessageSignal();
 }
 
+size_t DrainLogMessages() {
+  return LoggerSetup::get()->DrainLogMessages();
+}
+
 LogRef GetLogInstance(const std::string& name) {
   LoggerSetup::get();
   return log4cpp::Category::getInstance(name);
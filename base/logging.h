@@ -76,7 +76,15 @@ struct TextLogMessage {
 typedef boost::signals2::signal<void (const TextLogMessage*)
                                 > TextLogMessageSignal;
 
+/// The signal is only emitted from DrainLogMessages.
 TextLogMessageSignal* GetLogMessageSignal();
 
+/// Emit every log message queued since the last call, and return how
+/// many were emitted.  Messages are queued without allocation from
+/// any thread, but this must always be called from the same one.  If
+/// the queue overflowed, a message noting how many were lost is
+/// emitted.
+size_t DrainLogMessages();
+
 }
 }
@@ -30,6 +30,7 @@
 #include "base/format_hex.h"
 #include "base/git_info.h"
 #include "base/handler_util.h"
+#include "base/log_message_drainer.h"
 #include "base/logging.h"
 #include "base/timestamped_log.h"
 
@@ -48,6 +49,7 @@ int safe_main(int argc, char**argv) {
   double event_timeout_s = 0;
   double idle_timeout_s = 0;
   int cpu_affinity = -1;
+  double text_log_period_s = 0.01;
 
   auto group = clipp::group(
       (clipp::option("c", "config") & clipp::value("", config_file)) %
@@ -60,7 +62,9 @@ int safe_main(int argc, char**argv) {
       "disable real-time signals and other debugging hindrances",
       (clipp::option("rt.event_timeout_s") & clipp::value("", event_timeout_s)),
       (clipp::option("rt.idle_timeout_s") & clipp::value("", idle_timeout_s)),
-      (clipp::option("rt.cpu_affinity") & clipp::value("", cpu_affinity))
+      (clipp::option("rt.cpu_affinity") & clipp::value("", cpu_affinity)),
+      (clipp::option("text_log_period_s") &
+       clipp::value("", text_log_period_s))
   );
 
   group.push_back(MakeLoggingOptions());
@@ -68,6 +72,22 @@ int safe_main(int argc, char**argv) {
   group.push_back(mjlib::base::ClippArchive("remote_debug.")
                   .Accept(context.remote_debug->parameters()).release());
 
+  group.push_back(mjlib::base::ClippArchive("telemetry_log.")
+                  .Accept(context.telemetry_registry->log_parameters())
+                  .release());
+
+  group.push_back(mjlib::base::ClippArchive("multicast.")
+                  .Accept(context.multicast->parameters()).release());
+
+  group.push_back(mjlib::base::ClippArchive("log_segment.")
+                  .Accept(context.segmented_log->parameters())
+                  .release());
+
+  group.push_back(mjlib::base::ClippArchive("flight_recorder.")
+                  .Accept(context.telemetry_registry->
+                          flight_recorder_parameters())
+                  .release());
+
   group.push_back(module.program_options());
 
   mjlib::base::ClippParse(argc, argv, group);
@@ -84,26 +104,19 @@ int safe_main(int argc, char**argv) {
     mjlib::base::ClippParse(argc, argv, group);
   }
 
+  // Check these now, rather than when a record is first emitted.
+  context.telemetry_registry->StartLog();
+
   if (!log_file.empty()) {
-    OpenMaybeTimestampedLog(context.telemetry_log.get(),
-                            log_file,
-                            log_short_name ? kShort : kTimestamped);
+    context.segmented_log->Open(log_file,
+                                log_short_name ? kShort : kTimestamped);
   }
 
-  // TODO theamk: move this to logging.cc
-  TextLogMessageSignal log_signal_mt;
-  context.telemetry_registry->Register("text_log", &log_signal_mt);
-
-  // TODO theamk: should this marshalling be done by telemetry log
-  // itself?
-  TextLogMessageSignal* log_signal = GetLogMessageSignal();
-  log_signal->connect(
-      [&log_signal_mt, &context](const TextLogMessage* msg) {
-        const TextLogMessage msg_copy = *msg;
-        boost::asio::post(
-            context.executor,
-            [msg_copy, &log_signal_mt]() {log_signal_mt(&msg_copy);});
-      });
+  // Log messages are queued from whichever thread produced them, and
+  // drained on a thread of their own.  Only batches of new messages
+  // reach the telemetry log through this executor.
+  LogMessageDrainer text_log_drainer(context.executor, text_log_period_s);
+  context.telemetry_registry->Register("text_log", text_log_drainer.signal());
 
   //WriteTextLogToTelemetryLog(&context.telemetry_registry);
 
@@ -146,6 +159,7 @@ int safe_main(int argc, char**argv) {
           });
 
   context.remote_debug->AsyncStart(joiner->Wrap("starting remote_debug"));
+  context.multicast->AsyncStart(joiner->Wrap("starting multicast"));
   module.AsyncStart(joiner->Wrap("starting main module"));
 
 
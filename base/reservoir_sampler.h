@@ -14,7 +14,9 @@
 
 #pragma once
 
+#include <cstddef>
 #include <random>
+#include <vector>
 
 namespace mjmech {
 namespace base {
@@ -30,23 +32,29 @@ class ReservoirSampler {
       : size_(size) {}
 
   using Container = std::vector<T>;
-  using iterator = Container::iterator;
-  using const_iterator = Container::const_iterator;
+  using iterator = typename Container::iterator;
+  using const_iterator = typename Container::const_iterator;
 
   void Add(T value) {
     count_++;
 
     if (samples_.size() < size_) {
-      samples.push_back(std::move(value));
+      samples_.push_back(std::move(value));
     } else {
-      const std::size_t M = static_cast<std::size_t>(
-          std::uniform_int<>(0, count_ - 1)(rng_));
+      const std::size_t M = std::uniform_int_distribution<std::size_t>(
+          0, count_ - 1)(rng_);
       if (M < size_) {
         samples_[M] = value;
       }
     }
   }
 
+  /// The number of values which have been added.
+  std::size_t count() const { return count_; }
+
+  /// The number of values in the sample.
+  std::size_t size() const { return samples_.size(); }
+
   iterator begin() { return samples_.begin(); }
   iterator end() { return samples_.end(); }
 
@@ -59,7 +67,7 @@ class ReservoirSampler {
 
   std::mt19937 rng_;
   std::size_t count_ = 0;
-}
+};
 
 }
 }
@@ -0,0 +1,273 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/segmented_log.h"
+
+#include <deque>
+#include <functional>
+#include <optional>
+#include <thread>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/filesystem.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/assert.h"
+#include "mjlib/base/fail.h"
+#include "mjlib/base/time_conversions.h"
+#include "mjlib/io/now.h"
+#include "mjlib/io/repeating_timer.h"
+
+#include "base/logging.h"
+
+namespace mjmech {
+namespace base {
+
+namespace {
+namespace fs = boost::filesystem;
+
+constexpr double kBytesPerMb = 1024.0 * 1024.0;
+}
+
+class SegmentedLog::Impl {
+ public:
+  Impl(const boost::asio::any_io_executor& executor,
+       mjlib::telemetry::FileWriter* writer)
+      : executor_(executor),
+        writer_(writer) {
+    thread_ = std::thread(std::bind(&Impl::CHILD_Run, this));
+  }
+
+  ~Impl() {
+    // Let any switch which has been posted complete, so that the last
+    // segment is closed.
+    child_work_.reset();
+    thread_.join();
+  }
+
+  void Open(std::string_view filename, TimestampMode mode) {
+    active_ = parameters_;
+    base_name_ = MakeMaybeTimestampedLogName(filename, mode);
+    index_ = 0;
+    open_ = true;
+
+    if (!segmented()) {
+      Switch(base_name_);
+      return;
+    }
+
+    Switch(MakeSegmentName(base_name_, index_));
+
+    if (!timer_started_) {
+      timer_started_ = true;
+      timer_.start(
+          mjlib::base::ConvertSecondsToDuration(active_.check_period_s),
+          std::bind(&Impl::HandleTimer, this, std::placeholders::_1));
+    }
+  }
+
+  void Close() {
+    open_ = false;
+    Switch("");
+  }
+
+  bool IsOpen() const { return open_; }
+
+  Parameters parameters_;
+  SwitchSignal switch_signal_;
+
+ private:
+  bool segmented() const {
+    return active_.segment_mb > 0.0 || active_.segment_s > 0.0;
+  }
+
+  /// Close the writer, then open @p name unless it is empty.  The
+  /// file operations may block, so they are done in the child
+  /// thread.
+  void Switch(const std::string& name) {
+    if (switching_ == 0) { switch_signal_(true); }
+    switching_++;
+
+    segment_start_ = mjlib::io::Now(executor_.context());
+
+    const double quota_bytes =
+        segmented() ? active_.quota_mb * kBytesPerMb : 0.0;
+    boost::asio::post(
+        child_context_,
+        std::bind(&Impl::CHILD_Switch, this, name, segmented(), quota_bytes));
+  }
+
+  void FinishSwitch() {
+    MJ_ASSERT(switching_ > 0);
+    switching_--;
+    if (switching_ == 0) { switch_signal_(false); }
+  }
+
+  void Rotate() {
+    index_++;
+    Switch(MakeSegmentName(base_name_, index_));
+  }
+
+  void HandleTimer(const mjlib::base::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) { return; }
+    mjlib::base::FailIf(ec);
+
+    // Wait for any switch in progress to complete.
+    if (!open_ || !segmented() || switching_ > 0) { return; }
+
+    const auto now = mjlib::io::Now(executor_.context());
+    if (active_.segment_s > 0.0 &&
+        mjlib::base::ConvertDurationToSeconds(now - segment_start_) >=
+        active_.segment_s) {
+      Rotate();
+      return;
+    }
+
+    if (active_.segment_mb > 0.0) {
+      boost::asio::post(
+          child_context_,
+          std::bind(&Impl::CHILD_CheckSize, this,
+                    MakeSegmentName(base_name_, index_), index_,
+                    active_.segment_mb * kBytesPerMb));
+    }
+  }
+
+  void HandleSizeExceeded(int index) {
+    // The segment may have been rotated or closed in the meantime.
+    if (!open_ || index != index_ || switching_ > 0) { return; }
+    Rotate();
+  }
+
+  void CHILD_Run() {
+    child_context_.run();
+  }
+
+  void CHILD_CheckSize(const std::string& name, int index, double max_bytes) {
+    boost::system::error_code ec;
+    const auto size = fs::file_size(name, ec);
+    if (ec || size < max_bytes) { return; }
+
+    boost::asio::post(
+        executor_,
+        std::bind(&Impl::HandleSizeExceeded, this, index));
+  }
+
+  void CHILD_Switch(const std::string& name, bool segment,
+                    double quota_bytes) {
+    try {
+      if (writer_->IsOpen()) { writer_->Close(); }
+      if (!name.empty()) {
+        writer_->Open(name);
+        if (segment) { CHILD_AddSegment(name, quota_bytes); }
+      }
+    } catch (std::exception& e) {
+      log_.warn(fmt::format("error switching log to '{}': {}",
+                            name, e.what()));
+    }
+
+    boost::asio::post(executor_, std::bind(&Impl::FinishSwitch, this));
+  }
+
+  void CHILD_AddSegment(const std::string& name, double quota_bytes) {
+    child_segments_.push_back(name);
+    if (quota_bytes <= 0.0) { return; }
+
+    double total = 0.0;
+    for (const auto& segment : child_segments_) {
+      boost::system::error_code ec;
+      const auto size = fs::file_size(segment, ec);
+      if (!ec) { total += size; }
+    }
+
+    // The newest segment is the one being written, so always keep it.
+    while (total > quota_bytes && child_segments_.size() > 1) {
+      const auto oldest = child_segments_.front();
+      child_segments_.pop_front();
+
+      boost::system::error_code ec;
+      const auto size = fs::file_size(oldest, ec);
+      if (!ec) { total -= size; }
+      fs::remove(oldest, ec);
+      log_.warn(fmt::format("removed log segment {} to stay under quota",
+                            oldest));
+    }
+  }
+
+  boost::asio::any_io_executor executor_;
+  mjlib::telemetry::FileWriter* const writer_;
+
+  base::LogRef log_ = base::GetLogInstance("SegmentedLog");
+
+  Parameters active_;
+  std::string base_name_;
+  int index_ = 0;
+  bool open_ = false;
+  boost::posix_time::ptime segment_start_;
+
+  // The number of switches posted to the child which have not yet
+  // completed.
+  int switching_ = 0;
+
+  mjlib::io::RepeatingTimer timer_{executor_};
+  bool timer_started_ = false;
+
+  boost::asio::io_context child_context_;
+  std::optional<boost::asio::executor_work_guard<
+    boost::asio::io_context::executor_type>> child_work_{
+    child_context_.get_executor()};
+  std::thread thread_;
+
+  // Only accessed from the child thread.
+  std::deque<std::string> child_segments_;
+};
+
+SegmentedLog::SegmentedLog(const boost::asio::any_io_executor& executor,
+                           mjlib::telemetry::FileWriter* writer)
+    : impl_(std::make_unique<Impl>(executor, writer)) {}
+
+SegmentedLog::~SegmentedLog() {}
+
+SegmentedLog::Parameters* SegmentedLog::parameters() {
+  return &impl_->parameters_;
+}
+
+void SegmentedLog::Open(std::string_view filename, TimestampMode mode) {
+  impl_->Open(filename, mode);
+}
+
+void SegmentedLog::Close() {
+  impl_->Close();
+}
+
+bool SegmentedLog::IsOpen() const {
+  return impl_->IsOpen();
+}
+
+SegmentedLog::SwitchSignal* SegmentedLog::switch_signal() {
+  return &impl_->switch_signal_;
+}
+
+std::string SegmentedLog::MakeSegmentName(std::string_view filename,
+                                          int index) {
+  const fs::path path{std::string(filename)};
+  return (path.parent_path() /
+          fmt::format("{}-{:04d}{}", path.stem().native(), index,
+                      path.extension().native())).native();
+}
+
+}
+}
@@ -0,0 +1,103 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/signals2/signal.hpp>
+
+#include "mjlib/base/visitor.h"
+#include "mjlib/telemetry/file_writer.h"
+
+#include "base/timestamped_log.h"
+
+namespace mjmech {
+namespace base {
+
+/// Open a FileWriter, and optionally roll it over to a new file
+/// after a given size or duration.
+///
+/// Each segment is a complete log on its own, as the FileWriter
+/// re-emits all schemas when opened.  Opening and closing files, file
+/// size checks and the removal of old segments all happen in a
+/// background thread.
+class SegmentedLog : boost::noncopyable {
+ public:
+  struct Parameters {
+    // Start a new segment when the current one reaches this size.  If
+    // 0, no size limit is applied.
+    double segment_mb = 0.0;
+
+    // Start a new segment after this long.  If 0, no time limit is
+    // applied.
+    double segment_s = 0.0;
+
+    // If non-zero, delete the oldest segments written by this
+    // process once they total more than this.  The current segment
+    // is never deleted.
+    double quota_mb = 0.0;
+
+    double check_period_s = 1.0;
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(segment_mb));
+      a->Visit(MJ_NVP(segment_s));
+      a->Visit(MJ_NVP(quota_mb));
+      a->Visit(MJ_NVP(check_period_s));
+    }
+  };
+
+  SegmentedLog(const boost::asio::any_io_executor&,
+               mjlib::telemetry::FileWriter*);
+  ~SegmentedLog();
+
+  /// Parameters are read when the log is opened.
+  Parameters* parameters();
+
+  /// Open the log, in the same manner as OpenMaybeTimestampedLog.  If
+  /// segmenting is enabled, an index is appended to the name of each
+  /// segment.  The file is opened in the background, see
+  /// switch_signal.
+  void Open(std::string_view filename, TimestampMode);
+
+  void Close();
+
+  /// Return true if Open has been called more recently than Close.
+  /// Unlike FileWriter::IsOpen, this may be used while a switch is in
+  /// progress.
+  bool IsOpen() const;
+
+  /// Emitted with true before the FileWriter is opened, closed or
+  /// moved to a new segment in the background, and with false once
+  /// that is complete.  The FileWriter must not be used in between.
+  using SwitchSignal = boost::signals2::signal<void (bool)>;
+  SwitchSignal* switch_signal();
+
+  /// Return the name of @p filename with @p index inserted before
+  /// the extension.
+  static std::string MakeSegmentName(std::string_view filename, int index);
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
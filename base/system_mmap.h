@@ -26,8 +26,9 @@ class SystemMmap {
  public:
   SystemMmap() {}
 
-  SystemMmap(int fd, size_t size, uint64_t offset) {
-    ptr_ = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+  SystemMmap(int fd, size_t size, uint64_t offset,
+             int prot = PROT_READ | PROT_WRITE) {
+    ptr_ = ::mmap(0, size, prot, MAP_SHARED, fd, offset);
     size_ = size;
     mjlib::base::system_error::throw_if(ptr_ == MAP_FAILED);
   }
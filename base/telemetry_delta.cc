@@ -0,0 +1,160 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/telemetry_delta.h"
+
+#include <cstdint>
+
+namespace mjmech {
+namespace base {
+
+namespace {
+constexpr char kKeyframe = 0;
+constexpr char kDelta = 1;
+
+void WriteVaruint(uint64_t value, std::string* output) {
+  do {
+    const uint8_t this_byte = value & 0x7f;
+    value >>= 7;
+    output->push_back(static_cast<char>(this_byte | (value ? 0x80 : 0x00)));
+  } while (value);
+}
+
+std::optional<uint64_t> ReadVaruint(std::string_view* input) {
+  uint64_t result = 0;
+  int shift = 0;
+  while (!input->empty() && shift < 64) {
+    const uint8_t this_byte = static_cast<uint8_t>(input->front());
+    input->remove_prefix(1);
+    result |= static_cast<uint64_t>(this_byte & 0x7f) << shift;
+    if ((this_byte & 0x80) == 0) { return result; }
+    shift += 7;
+  }
+  return {};
+}
+}
+
+std::optional<std::string_view> ParseTelemetryDeltaRecord(
+    std::string_view logged) {
+  const auto maybe_size = ReadVaruint(&logged);
+  if (!maybe_size || *maybe_size > logged.size()) { return {}; }
+  return logged.substr(0, *maybe_size);
+}
+
+void TelemetryDeltaEncoder::Encode(std::string_view record,
+                                   std::string* output) {
+  output->clear();
+
+  const bool keyframe =
+      !have_previous_ ||
+      record.size() != previous_.size() ||
+      since_keyframe_ + 1 >= options_.keyframe_interval;
+
+  if (!keyframe) {
+    output->push_back(kDelta);
+
+    const size_t size = record.size();
+    size_t i = 0;
+    while (i < size) {
+      const size_t zero_start = i;
+      while (i < size && record[i] == previous_[i]) { i++; }
+      if (i == size) { break; }  // Trailing zeros are implicit.
+      const size_t zero_count = i - zero_start;
+
+      // Collect literals until we see at least two zeros in a row,
+      // since a single zero is cheaper to store as a literal than as
+      // a new run.
+      const size_t literal_start = i;
+      while (i < size) {
+        if (record[i] != previous_[i]) {
+          i++;
+          continue;
+        }
+        if (i + 1 < size && record[i + 1] != previous_[i + 1]) {
+          i += 2;
+          continue;
+        }
+        break;
+      }
+      const size_t literal_count = i - literal_start;
+
+      WriteVaruint(zero_count, output);
+      WriteVaruint(literal_count, output);
+      for (size_t j = literal_start; j < i; j++) {
+        output->push_back(record[j] ^ previous_[j]);
+      }
+    }
+  }
+
+  if (keyframe || output->size() >= record.size() + 1) {
+    // Either we had to, or the delta didn't save anything.
+    output->clear();
+    output->push_back(kKeyframe);
+    output->append(record.data(), record.size());
+    since_keyframe_ = 0;
+  } else {
+    since_keyframe_++;
+  }
+
+  previous_.assign(record.data(), record.size());
+  have_previous_ = true;
+}
+
+bool TelemetryDeltaDecoder::Decode(std::string_view encoded,
+                                   std::string* output) {
+  if (encoded.empty()) { return false; }
+
+  const char type = encoded.front();
+  encoded.remove_prefix(1);
+
+  if (type == kKeyframe) {
+    previous_.assign(encoded.data(), encoded.size());
+    valid_ = true;
+    *output = previous_;
+    return true;
+  }
+
+  if (type != kDelta || !valid_) { return false; }
+
+  size_t offset = 0;
+  while (!encoded.empty()) {
+    const auto maybe_zeros = ReadVaruint(&encoded);
+    const auto maybe_literals = ReadVaruint(&encoded);
+    if (!maybe_zeros || !maybe_literals ||
+        *maybe_literals > encoded.size()) {
+      valid_ = false;
+      return false;
+    }
+    offset += *maybe_zeros;
+    if (offset + *maybe_literals > previous_.size()) {
+      valid_ = false;
+      return false;
+    }
+    for (size_t i = 0; i < *maybe_literals; i++) {
+      previous_[offset + i] ^= encoded[i];
+    }
+    offset += *maybe_literals;
+    encoded.remove_prefix(*maybe_literals);
+  }
+
+  *output = previous_;
+  return true;
+}
+
+bool TelemetryDeltaDecoder::IsKeyframe(std::string_view encoded) {
+  return !encoded.empty() && encoded.front() == kKeyframe;
+}
+
+}
+}
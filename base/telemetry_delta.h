@@ -0,0 +1,94 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "mjlib/base/visitor.h"
+
+namespace mjmech {
+namespace base {
+
+/// Records which are delta encoded are logged under their original
+/// name with this suffix appended, using the TelemetryDeltaRecord
+/// schema.  The original name keeps its schema, but has no data.
+constexpr const char* kTelemetryDeltaSuffix = ".delta";
+
+/// The form that delta encoded records take in a log.
+///
+/// The first byte of 'data' is 0 for a keyframe, in which case the
+/// rest is the complete serialized record.  If it is 1, the rest is
+/// the XOR of this record and the previous one, stored as a sequence
+/// of (varuint zero count, varuint literal count, literal bytes).
+/// Any trailing zeros are omitted.
+struct TelemetryDeltaRecord {
+  std::string data;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(data));
+  }
+};
+
+/// Given the raw logged bytes of a TelemetryDeltaRecord, return the
+/// contents of its 'data' field, or nothing if it is malformed.
+std::optional<std::string_view> ParseTelemetryDeltaRecord(
+    std::string_view logged);
+
+class TelemetryDeltaEncoder {
+ public:
+  struct Options {
+    // Emit a complete record at least this often, so that readers
+    // can start decoding from somewhere other than the beginning.
+    int keyframe_interval = 100;
+  };
+
+  TelemetryDeltaEncoder(const Options& options)
+      : options_(options) {}
+
+  /// Encode @p record, replacing the contents of @p output.
+  void Encode(std::string_view record, std::string* output);
+
+  /// Make the next record a keyframe.
+  void Reset() { have_previous_ = false; }
+
+ private:
+  const Options options_;
+  std::string previous_;
+  bool have_previous_ = false;
+  int since_keyframe_ = 0;
+};
+
+class TelemetryDeltaDecoder {
+ public:
+  /// Decode the next record of a channel into @p output.  Return
+  /// false if that was not possible, either because @p encoded is
+  /// malformed, or because it is a delta and no keyframe has been
+  /// seen since the last Reset.
+  bool Decode(std::string_view encoded, std::string* output);
+
+  void Reset() { valid_ = false; }
+
+  static bool IsKeyframe(std::string_view encoded);
+
+ private:
+  std::string previous_;
+  bool valid_ = false;
+};
+
+}
+}
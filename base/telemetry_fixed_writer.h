@@ -0,0 +1,218 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include <boost/assert.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <Eigen/Core>
+
+#include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/telemetry/binary_write_archive.h"
+#include "mjlib/telemetry/format.h"
+
+namespace mjmech {
+namespace base {
+
+namespace detail {
+template <typename T, typename Archive, typename = void>
+struct TelemetryHasSerialize : std::false_type {};
+
+template <typename T, typename Archive>
+struct TelemetryHasSerialize<
+  T, Archive,
+  std::void_t<decltype(std::declval<T&>().Serialize(
+                           std::declval<Archive*>()))>> : std::true_type {};
+
+template <typename T>
+struct TelemetryIsStdArray : std::false_type {};
+
+template <typename T, size_t N>
+struct TelemetryIsStdArray<std::array<T, N>> : std::true_type {};
+
+template <typename T>
+constexpr bool TelemetryIsTime() {
+  return std::is_same_v<T, boost::posix_time::ptime> ||
+      std::is_same_v<T, boost::posix_time::time_duration>;
+}
+
+/// Determines whether every field of a structure has a fixed size
+/// encoding, and if so, what the total is.
+class TelemetryFixedLayoutArchive {
+ public:
+  template <typename NameValuePair>
+  void Visit(const NameValuePair& nvp) {
+    Add(nvp.value());
+  }
+
+  template <typename T>
+  void Add(T* value) {
+    using U = std::remove_cv_t<T>;
+    if constexpr (std::is_same_v<U, bool>) {
+      size += 1;
+    } else if constexpr (std::is_arithmetic_v<U>) {
+      size += sizeof(U);
+    } else if constexpr (TelemetryIsTime<U>()) {
+      size += sizeof(int64_t);
+    } else if constexpr (std::is_same_v<U, Eigen::Vector3d>) {
+      size += 3 * sizeof(double);
+    } else if constexpr (TelemetryIsStdArray<U>::value) {
+      for (auto& item : *value) { Add(&item); }
+    } else if constexpr (
+        TelemetryHasSerialize<U, TelemetryFixedLayoutArchive>::value) {
+      const_cast<U*>(value)->Serialize(this);
+    } else {
+      // Strings, vectors, optionals, enumerations, and anything else
+      // are encoded with a variable size.
+      fixed = false;
+    }
+  }
+
+  bool fixed = true;
+  size_t size = 0;
+};
+
+/// Writes each field directly into a buffer known to be large
+/// enough.
+class TelemetryFixedWriteArchive {
+ public:
+  explicit TelemetryFixedWriteArchive(char* ptr) : ptr_(ptr) {}
+
+  template <typename NameValuePair>
+  void Visit(const NameValuePair& nvp) {
+    Write(nvp.value());
+  }
+
+  template <typename T>
+  void Write(const T* value) {
+    using U = std::remove_cv_t<T>;
+    if constexpr (std::is_same_v<U, bool>) {
+      *ptr_++ = *value ? 1 : 0;
+    } else if constexpr (std::is_arithmetic_v<U>) {
+      std::memcpy(ptr_, value, sizeof(U));
+      ptr_ += sizeof(U);
+    } else if constexpr (TelemetryIsTime<U>()) {
+      // Use the telemetry encoding for these, so that special values
+      // are handled identically.
+      mjlib::base::BufferWriteStream stream({ptr_, sizeof(int64_t)});
+      mjlib::telemetry::WriteStream(stream).Write(*value);
+      ptr_ += sizeof(int64_t);
+    } else if constexpr (std::is_same_v<U, Eigen::Vector3d>) {
+      std::memcpy(ptr_, value->data(), 3 * sizeof(double));
+      ptr_ += 3 * sizeof(double);
+    } else if constexpr (TelemetryIsStdArray<U>::value) {
+      for (const auto& item : *value) { Write(&item); }
+    } else if constexpr (
+        TelemetryHasSerialize<U, TelemetryFixedWriteArchive>::value) {
+      const_cast<U*>(value)->Serialize(this);
+    } else {
+      // This is never reached, as such types are not fixed.
+      BOOST_ASSERT(false);
+    }
+  }
+
+  char* ptr() const { return ptr_; }
+
+ private:
+  char* ptr_;
+};
+}
+
+/// A serializer for types whose every field has a fixed size
+/// encoding, which produces exactly the same bytes as
+/// BinaryWriteArchive, but writes each field directly into one
+/// buffer, and the result into the stream with a single call.
+///
+/// The layout of each type is determined once, on first use.  As a
+/// check, a default constructed instance is then serialized with both
+/// this and BinaryWriteArchive, and if they differ the type is
+/// treated as not fixed.
+///
+/// NOTE: Numeric values are copied in host byte order, which is
+/// assumed to be little endian as the telemetry format is.
+template <typename T>
+class TelemetryFixedWriter {
+ public:
+  static constexpr size_t kMaxSize = 2048;
+
+  struct Layout {
+    bool fixed = false;
+    size_t size = 0;
+  };
+
+  static const Layout& layout() {
+    static const Layout result = ComputeLayout();
+    return result;
+  }
+
+  /// Write @p data to @p dest, which must have room for
+  /// layout().size bytes.  Return the end of the data.
+  static char* Write(const T* data, char* dest) {
+    detail::TelemetryFixedWriteArchive archive(dest);
+    archive.Write(data);
+    return archive.ptr();
+  }
+
+ private:
+  static Layout ComputeLayout() {
+    T sample{};
+    detail::TelemetryFixedLayoutArchive layout_archive;
+    layout_archive.Add(&sample);
+
+    Layout result;
+    if (!layout_archive.fixed || layout_archive.size > kMaxSize) {
+      return result;
+    }
+
+    char buf[kMaxSize] = {};
+    const auto end = Write(&sample, buf);
+
+    mjlib::base::FastOStringStream generic;
+    mjlib::telemetry::BinaryWriteArchive(generic).Accept(&sample);
+
+    const std::string_view fast(buf, end - buf);
+    if (fast != generic.str()) { return result; }
+
+    result.fixed = true;
+    result.size = fast.size();
+    return result;
+  }
+};
+
+/// Serialize @p data to @p stream, using TelemetryFixedWriter when
+/// possible and BinaryWriteArchive otherwise.
+template <typename Stream, typename T>
+void WriteTelemetry(Stream& stream, const T* data) {
+  using Writer = TelemetryFixedWriter<T>;
+  const auto& layout = Writer::layout();
+  if (!layout.fixed) {
+    mjlib::telemetry::BinaryWriteArchive(stream).Accept(data);
+    return;
+  }
+
+  char buf[Writer::kMaxSize];
+  Writer::Write(data, buf);
+  stream.write(std::string_view(buf, layout.size));
+}
+
+}
+}
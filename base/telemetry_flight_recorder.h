@@ -0,0 +1,305 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/signals2/signal.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/time_conversions.h"
+#include "mjlib/base/visitor.h"
+#include "mjlib/io/now.h"
+#include "mjlib/telemetry/binary_write_archive.h"
+#include "mjlib/telemetry/file_writer.h"
+
+#include "base/logging.h"
+#include "base/telemetry_fixed_writer.h"
+#include "base/timestamped_log.h"
+
+namespace mjmech {
+namespace base {
+
+/// By default, the flight recorder keeps copies of each record.
+/// Records which refer to data they do not own must be specialized
+/// to false, in which case they are serialized when emitted instead.
+template <typename T>
+struct TelemetryFlightRecorderCopy : std::true_type {};
+
+/// Keep the most recent instances of every record in preallocated
+/// memory, so that the moments leading up to an event can be written
+/// to a standalone log after the fact, without paying for logging
+/// everything all the time.
+///
+/// Instances are copied into the ring without serialization.  Once
+/// the ring is full and the contained types have reached their
+/// steady state size, recording performs no allocation.
+class TelemetryFlightRecorder : boost::noncopyable {
+ public:
+  struct Parameters {
+    // The length of history to write when dumping.  If 0, nothing is
+    // recorded.
+    double duration_s = 0.0;
+
+    // The number of instances retained for each record.  This should
+    // be at least duration_s times the rate of the fastest record.
+    int max_samples = 2000;
+
+    // Dumps are written to this name with a timestamp inserted.
+    std::string filename_base = "flight-recorder.log";
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(duration_s));
+      a->Visit(MJ_NVP(max_samples));
+      a->Visit(MJ_NVP(filename_base));
+    }
+  };
+
+  TelemetryFlightRecorder(boost::asio::io_context& context)
+      : context_(context) {}
+
+  ~TelemetryFlightRecorder() {
+    if (dump_thread_.joinable()) {
+      dump_work_.reset();
+      dump_thread_.join();
+    }
+  }
+
+  Parameters* parameters() { return &parameters_; }
+
+  template <typename T>
+  void Register(const std::string& name,
+                boost::signals2::signal<void (const T*)>* signal) {
+    using RecordType = std::conditional_t<
+      TelemetryFlightRecorderCopy<T>::value,
+      CopyRecord<T>, SerializedRecord<T>>;
+    auto record = std::make_shared<RecordType>();
+    record->name = name;
+    records_.push_back(record);
+    signal->connect([this, record](const T* data) {
+        if (frozen_ || parameters_.duration_s <= 0.0) { return; }
+        record->Emit(mjlib::io::Now(context_), data,
+                     std::max(1, parameters_.max_samples));
+      });
+  }
+
+  /// Write the retained history of every record to a new log file.
+  /// Serialization and writing happens in a background thread, and
+  /// no new instances are recorded until it completes.
+  ///
+  /// This never waits, so it may be called from the control thread.
+  /// Return false, and do nothing, if the recorder is disabled or a
+  /// dump is already in progress.
+  bool Dump() {
+    if (frozen_ || parameters_.duration_s <= 0.0) { return false; }
+
+    frozen_ = true;
+
+    if (!dump_thread_.joinable()) {
+      dump_work_.emplace(dump_context_.get_executor());
+      dump_thread_ = std::thread([this]() { dump_context_.run(); });
+    }
+
+    const auto start =
+        mjlib::io::Now(context_) -
+        mjlib::base::ConvertSecondsToDuration(parameters_.duration_s);
+    boost::asio::post(
+        dump_context_,
+        std::bind(&TelemetryFlightRecorder::WriteDump, this,
+                  parameters_.filename_base, start));
+    return true;
+  }
+
+ private:
+  struct RecordBase {
+    virtual ~RecordBase() {}
+
+    virtual std::string schema() const = 0;
+    virtual size_t size() const = 0;
+
+    /// Return the timestamp of the given instance, where 0 is the
+    /// oldest.
+    virtual boost::posix_time::ptime timestamp(size_t) const = 0;
+    virtual void Write(size_t, mjlib::telemetry::FileWriter::Identifier,
+                       mjlib::telemetry::FileWriter*) const = 0;
+
+    std::string name;
+  };
+
+  template <typename Stored>
+  struct Ring {
+    void Add(boost::posix_time::ptime timestamp, size_t max_samples) {
+      if (timestamps.size() < max_samples) {
+        timestamps.push_back(timestamp);
+        items.emplace_back();
+        current = items.size() - 1;
+        return;
+      }
+      current = (count % timestamps.size());
+      timestamps[current] = timestamp;
+    }
+
+    size_t Index(size_t i) const {
+      if (timestamps.size() < count) {
+        // We have wrapped, the oldest is just after the newest.
+        return (count + i) % timestamps.size();
+      }
+      return i;
+    }
+
+    std::vector<boost::posix_time::ptime> timestamps;
+    std::vector<Stored> items;
+    size_t current = 0;
+    size_t count = 0;
+  };
+
+  template <typename T, typename Stored>
+  struct RecordImpl : RecordBase {
+    std::string schema() const override {
+      return mjlib::telemetry::BinarySchemaArchive::template schema<T>();
+    }
+
+    size_t size() const override {
+      return ring.timestamps.size();
+    }
+
+    boost::posix_time::ptime timestamp(size_t i) const override {
+      return ring.timestamps[ring.Index(i)];
+    }
+
+    Ring<Stored> ring;
+  };
+
+  template <typename T>
+  struct CopyRecord : RecordImpl<T, T> {
+    void Emit(boost::posix_time::ptime timestamp, const T* data,
+              size_t max_samples) {
+      this->ring.Add(timestamp, max_samples);
+      // Copy assignment lets any containers reuse their storage.
+      this->ring.items[this->ring.current] = *data;
+      this->ring.count++;
+    }
+
+    void Write(size_t i, mjlib::telemetry::FileWriter::Identifier id,
+               mjlib::telemetry::FileWriter* writer) const override {
+      const auto index = this->ring.Index(i);
+      auto buffer = writer->GetBuffer();
+      WriteTelemetry(*buffer, &this->ring.items[index]);
+      writer->WriteData(this->ring.timestamps[index], id, std::move(buffer));
+    }
+  };
+
+  template <typename T>
+  struct SerializedRecord : RecordImpl<T, std::string> {
+    void Emit(boost::posix_time::ptime timestamp, const T* data,
+              size_t max_samples) {
+      this->ring.Add(timestamp, max_samples);
+      mjlib::base::FastOStringStream stream;
+      WriteTelemetry(stream, data);
+      this->ring.items[this->ring.current] = stream.str();
+      this->ring.count++;
+    }
+
+    void Write(size_t i, mjlib::telemetry::FileWriter::Identifier id,
+               mjlib::telemetry::FileWriter* writer) const override {
+      const auto index = this->ring.Index(i);
+      auto buffer = writer->GetBuffer();
+      buffer->write(this->ring.items[index]);
+      writer->WriteData(this->ring.timestamps[index], id, std::move(buffer));
+    }
+  };
+
+  /// This runs in the background thread.  The recorder is frozen, so
+  /// nothing else touches the records until it is complete.
+  void WriteDump(const std::string& filename_base,
+                 boost::posix_time::ptime start) {
+    try {
+      WriteDumpFile(filename_base, start);
+    } catch (std::exception& e) {
+      log_.warn(fmt::format("flight recorder dump failed: {}", e.what()));
+    }
+
+    boost::asio::post(context_, [this]() { frozen_ = false; });
+  }
+
+  void WriteDumpFile(const std::string& filename_base,
+                     boost::posix_time::ptime start) {
+    mjlib::telemetry::FileWriter writer;
+    OpenMaybeTimestampedLog(&writer, filename_base, kTimestamped);
+
+    // Merge all records into a single time ordered stream.
+    std::vector<std::tuple<boost::posix_time::ptime, size_t, size_t>> items;
+    std::vector<mjlib::telemetry::FileWriter::Identifier> identifiers;
+    for (size_t r = 0; r < records_.size(); r++) {
+      const auto& record = *records_[r];
+      identifiers.push_back(writer.AllocateIdentifier(record.name));
+      writer.WriteSchema(identifiers.back(), record.schema());
+
+      for (size_t i = 0; i < record.size(); i++) {
+        const auto timestamp = record.timestamp(i);
+        if (timestamp < start) { continue; }
+        items.push_back(std::make_tuple(timestamp, r, i));
+      }
+    }
+    std::stable_sort(items.begin(), items.end(),
+                     [](const auto& lhs, const auto& rhs) {
+                       return std::get<0>(lhs) < std::get<0>(rhs);
+                     });
+
+    for (const auto& item : items) {
+      const auto r = std::get<1>(item);
+      records_[r]->Write(std::get<2>(item), identifiers[r], &writer);
+    }
+
+    writer.Close();
+
+    log_.warn(fmt::format("flight recorder wrote {} instances",
+                          items.size()));
+  }
+
+  boost::asio::io_context& context_;
+  Parameters parameters_;
+  base::LogRef log_ = base::GetLogInstance("TelemetryFlightRecorder");
+
+  std::vector<std::shared_ptr<RecordBase>> records_;
+
+  // Only accessed from the context_ thread.
+  bool frozen_ = false;
+
+  // Dumps are written by a single long lived thread, so that
+  // requesting one never has to wait for a previous one.  Most runs
+  // never dump, so it is only started by the first Dump.
+  boost::asio::io_context dump_context_;
+  std::optional<boost::asio::executor_work_guard<
+    boost::asio::io_context::executor_type>> dump_work_;
+  std::thread dump_thread_;
+};
+
+}
+}
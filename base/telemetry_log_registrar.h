@@ -14,13 +14,30 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/signals2/signal.hpp>
 
+#include <fmt/format.h>
+
+#include "mjlib/base/stream.h"
+#include "mjlib/base/visitor.h"
 #include "mjlib/io/now.h"
 #include "mjlib/telemetry/binary_write_archive.h"
 #include "mjlib/telemetry/file_writer.h"
 
+#include "base/logging.h"
+#include "base/telemetry_delta.h"
+#include "base/telemetry_fixed_writer.h"
+#include "base/telemetry_rate_policy.h"
 
 namespace mjmech {
 namespace base {
@@ -28,44 +45,291 @@ namespace base {
 /// TelemetryLog instance using the TelemetryArchive for
 /// serialization.
 ///
+/// Each record may be given a TelemetryRatePolicy, which is applied
+/// before the record is serialized.
+///
 /// NOTE: Ideally this would be noncopyable, but std::tuple doesn't
 /// currently allow construction of noncopyable members.
-///
-/// NOTE: In the future, this could have policies around which records
-/// are written to the log and at what rate.
 class TelemetryLogRegistrar {
  public:
+  struct Parameters {
+    // A comma separated list of record names which are logged as
+    // periodic keyframes plus deltas against the previous instance.
+    // See TelemetryDeltaRecord.
+    std::string delta_records;
+    int delta_keyframe_interval = 100;
+
+    // A comma separated list of "record=policy" entries, where policy
+    // is as described in TelemetryRatePolicy.  Records not listed
+    // are logged at full rate.
+    std::string policies;
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(delta_records));
+      a->Visit(MJ_NVP(delta_keyframe_interval));
+      a->Visit(MJ_NVP(policies));
+    }
+  };
+
   TelemetryLogRegistrar(boost::asio::io_context& context,
                         mjlib::telemetry::FileWriter* telemetry_log)
       : context_(context),
-        telemetry_log_(telemetry_log) {}
+        telemetry_log_(telemetry_log),
+        parameters_(std::make_shared<Parameters>()),
+        config_(std::make_shared<Config>()),
+        records_(std::make_shared<std::vector<std::shared_ptr<Record>>>()),
+        segment_(std::make_shared<Segment>()),
+        scratch_(std::make_shared<ScratchStream>()),
+        trigger_(std::make_shared<boost::posix_time::ptime>()) {}
+
+  /// Parameters take effect when Start is called, so they may be
+  /// changed after records are registered.
+  Parameters* parameters() { return parameters_.get(); }
+
+  /// Parse and validate the parameters, throwing if they are invalid.
+  /// Until this is called, every record is logged at full rate
+  /// without delta encoding.
+  void Start() {
+    Config config;
+    config.policies = TelemetryRatePolicy::ParseList(parameters_->policies);
+    boost::split(config.delta_names, parameters_->delta_records,
+                 boost::is_any_of(","));
+    config.started = true;
+    *config_ = std::move(config);
+
+    for (const auto& record : *records_) {
+      if (!record->configured) { Configure(record.get()); }
+    }
+  }
+
+  /// Start the full rate window of every "triggered" record.  This
+  /// is intended to be invoked on faults or mode changes.
+  void Trigger() {
+    *trigger_ = mjlib::io::Now(context_);
+  }
+
+  /// Stop using the writer until Resume is called, for instance while
+  /// another thread switches it to a new file.  Records emitted in the
+  /// meantime are held, and each delta encoded record starts over with
+  /// a keyframe, as they will be written to the new file.
+  void Suspend() {
+    segment_->suspended = true;
+    segment_->generation++;
+  }
+
+  /// Use the writer again, writing everything held since Suspend if
+  /// it is open.
+  void Resume() {
+    auto& segment = *segment_;
+    segment.suspended = false;
+
+    if (telemetry_log_->IsOpen()) {
+      const std::string_view held = segment.held.buffer;
+      for (const auto& item : segment.items) {
+        auto buffer = telemetry_log_->GetBuffer();
+        buffer->write(held.substr(item.offset, item.size));
+        telemetry_log_->WriteData(
+            item.timestamp, item.identifier, std::move(buffer));
+      }
+    }
+    if (segment.dropped) {
+      log_.warn(fmt::format("dropped {} records while switching logs",
+                            segment.dropped));
+    }
+
+    // Keep the storage for the next time.
+    segment.items.clear();
+    segment.held.buffer.clear();
+    segment.dropped = 0;
+  }
 
   template <typename T>
   void Register(const std::string& name,
                 boost::signals2::signal<void (const T*)>* signal) {
-    const auto identifier = telemetry_log_->AllocateIdentifier(name);
+    auto record = std::make_shared<Record>();
+    record->name = name;
+    record->identifier = telemetry_log_->AllocateIdentifier(name);
     telemetry_log_->WriteSchema(
-        identifier,
+        record->identifier,
         mjlib::telemetry::BinarySchemaArchive::template schema<T>());
+    if (config_->started) { Configure(record.get()); }
+    records_->push_back(record);
     signal->connect(std::bind(&TelemetryLogRegistrar::HandleData<T>,
-                              this, identifier,
+                              this, record,
                               std::placeholders::_1));
   }
 
+ private:
+  struct Record {
+    std::string name;
+    mjlib::telemetry::FileWriter::Identifier identifier = {};
+    bool configured = false;
+
+    std::optional<TelemetryRatePolicy> policy;
+
+    // Only used for delta encoded records.
+    std::optional<TelemetryDeltaEncoder> delta_encoder;
+    int generation = 0;
+    mjlib::telemetry::FileWriter::Identifier delta_identifier = {};
+    TelemetryDeltaRecord delta_record;
+  };
+
+  // Records which must be inspected before they are written are
+  // serialized here first, so that its storage is reused.
+  struct ScratchStream : mjlib::base::WriteStream {
+    void write(const std::string_view& data) override {
+      buffer.append(data.data(), data.size());
+    }
+
+    std::string buffer;
+  };
+
+  struct Segment {
+    bool suspended = false;
+
+    // Incremented each time the writer may change files.
+    int generation = 0;
+
+    // Records emitted while suspended, serialized back to back in
+    // held.
+    struct Item {
+      boost::posix_time::ptime timestamp;
+      mjlib::telemetry::FileWriter::Identifier identifier = {};
+      size_t offset = 0;
+      size_t size = 0;
+    };
+    std::vector<Item> items;
+    ScratchStream held;
+    size_t dropped = 0;
+  };
+
+  // Switches normally take milliseconds.  If one takes much longer,
+  // records beyond this are dropped rather than held.
+  static constexpr size_t kMaxHeldBytes = 16 << 20;
+
+  // The parameters, as parsed by Start.
+  struct Config {
+    bool started = false;
+    std::map<std::string, TelemetryRatePolicy::Options> policies;
+    std::set<std::string> delta_names;
+  };
+
+  void Configure(Record* record) {
+    record->configured = true;
+
+    const auto it = config_->policies.find(record->name);
+    if (it != config_->policies.end() &&
+        it->second.mode != TelemetryRatePolicy::kFull) {
+      record->policy.emplace(it->second);
+    }
+
+    if (config_->delta_names.count(record->name) == 0) { return; }
+
+    record->delta_encoder.emplace([&]() {
+        TelemetryDeltaEncoder::Options options;
+        options.keyframe_interval = parameters_->delta_keyframe_interval;
+        return options;
+      }());
+    record->delta_identifier = telemetry_log_->AllocateIdentifier(
+        record->name + kTelemetryDeltaSuffix);
+    telemetry_log_->WriteSchema(
+        record->delta_identifier,
+        mjlib::telemetry::BinarySchemaArchive::template
+        schema<TelemetryDeltaRecord>());
+  }
+
+  /// Keep @p serialized to be written when Resume is called.
+  void Hold(boost::posix_time::ptime timestamp,
+            mjlib::telemetry::FileWriter::Identifier identifier,
+            std::string_view serialized) {
+    auto& segment = *segment_;
+    auto& held = segment.held.buffer;
+    if (held.size() + serialized.size() > kMaxHeldBytes) {
+      segment.dropped++;
+      return;
+    }
+    segment.items.push_back({timestamp, identifier,
+                             held.size(), serialized.size()});
+    held.append(serialized.data(), serialized.size());
+  }
+
   template <typename T>
-  void HandleData(mjlib::telemetry::FileWriter::Identifier identifier,
-                  const T* data) {
+  void HandleData(std::shared_ptr<Record> record, const T* data) {
+    // While suspended, the writer may not be used at all, not even to
+    // see whether it is open.
+    const bool suspended = segment_->suspended;
+
     // If the log isn't open, don't even bother serializing things.
-    if (!telemetry_log_->IsOpen()) { return; }
+    if (!suspended && !telemetry_log_->IsOpen()) { return; }
+
+    const auto now = mjlib::io::Now(context_);
+    if (record->policy && !record->policy->Accept(now, *trigger_)) {
+      return;
+    }
+
+    const bool on_change =
+        record->policy &&
+        record->policy->options().mode == TelemetryRatePolicy::kOnChange;
+    if (on_change || record->delta_encoder || suspended) {
+      scratch_->buffer.clear();
+      WriteTelemetry(*scratch_, data);
+      if (on_change &&
+          !record->policy->AcceptSerialized(scratch_->buffer)) {
+        return;
+      }
+    }
+
+    if (!record->delta_encoder) {
+      if (suspended) {
+        Hold(now, record->identifier, scratch_->buffer);
+        return;
+      }
+      auto buffer = telemetry_log_->GetBuffer();
+      if (on_change) {
+        buffer->write(scratch_->buffer);
+      } else {
+        WriteTelemetry(*buffer, data);
+      }
+      telemetry_log_->WriteData(now, record->identifier, std::move(buffer));
+      return;
+    }
+
+    if (record->generation != segment_->generation) {
+      // Each file must be decodable on its own.
+      record->generation = segment_->generation;
+      record->delta_encoder->Reset();
+    }
+
+    // The encoder keeps its own copy of the previous instance, and
+    // the encoded form is kept in the record, both reusing storage.
+    record->delta_encoder->Encode(
+        scratch_->buffer, &record->delta_record.data);
+
+    if (suspended) {
+      scratch_->buffer.clear();
+      mjlib::telemetry::BinaryWriteArchive(*scratch_).Accept(
+          &record->delta_record);
+      Hold(now, record->delta_identifier, scratch_->buffer);
+      return;
+    }
 
-    auto buffer = telemetry_log_->GetBuffer();
-    mjlib::telemetry::BinaryWriteArchive(*buffer).Accept(data);
+    auto delta_buffer = telemetry_log_->GetBuffer();
+    mjlib::telemetry::BinaryWriteArchive(*delta_buffer).Accept(
+        &record->delta_record);
     telemetry_log_->WriteData(
-        mjlib::io::Now(context_), identifier, std::move(buffer));
+        now, record->delta_identifier, std::move(delta_buffer));
   }
 
   boost::asio::io_context& context_;
   mjlib::telemetry::FileWriter* const telemetry_log_;
+  std::shared_ptr<Parameters> parameters_;
+  std::shared_ptr<Config> config_;
+  std::shared_ptr<std::vector<std::shared_ptr<Record>>> records_;
+  std::shared_ptr<Segment> segment_;
+  std::shared_ptr<ScratchStream> scratch_;
+  std::shared_ptr<boost::posix_time::ptime> trigger_;
+  base::LogRef log_ = base::GetLogInstance("TelemetryLogRegistrar");
 };
 }
 }
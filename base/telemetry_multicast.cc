@@ -0,0 +1,444 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/telemetry_multicast.h"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+
+#include <boost/asio/post.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/fail.h"
+#include "mjlib/base/time_conversions.h"
+#include "mjlib/io/now.h"
+#include "mjlib/io/repeating_timer.h"
+
+#include "base/logging.h"
+#include "base/udp_data_link.h"
+
+namespace mjmech {
+namespace base {
+
+namespace {
+using Format = TelemetryMulticastFormat;
+
+const boost::posix_time::ptime kEpoch(boost::gregorian::date(1970, 1, 1));
+
+template <typename T>
+void WriteLe(T value, std::string* output) {
+  for (size_t i = 0; i < sizeof(T); i++) {
+    output->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+template <typename T>
+T ReadLe(std::string_view data) {
+  T result = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    result |= static_cast<T>(static_cast<uint8_t>(data[i])) << (8 * i);
+  }
+  return result;
+}
+}
+
+std::vector<std::string> TelemetryMulticastFormat::MakeDatagrams(
+    Type type, uint32_t* packet_sequence, uint16_t identifier,
+    uint16_t record_sequence, std::string_view record, size_t max_datagram) {
+  if (max_datagram <= kHeaderSize) { return {}; }
+
+  const size_t per_datagram = max_datagram - kHeaderSize;
+  const size_t count = std::max<size_t>(
+      1, (record.size() + per_datagram - 1) / per_datagram);
+  if (count > 255) { return {}; }
+
+  std::vector<std::string> result;
+  for (size_t i = 0; i < count; i++) {
+    const auto slice = record.substr(i * per_datagram, per_datagram);
+
+    std::string datagram;
+    datagram.reserve(kHeaderSize + slice.size());
+    datagram.push_back(static_cast<char>(kMagic));
+    datagram.push_back(static_cast<char>(type));
+    WriteLe<uint32_t>((*packet_sequence)++, &datagram);
+    WriteLe<uint16_t>(identifier, &datagram);
+    WriteLe<uint16_t>(record_sequence, &datagram);
+    datagram.push_back(static_cast<char>(i));
+    datagram.push_back(static_cast<char>(count));
+    datagram.append(slice);
+    result.push_back(std::move(datagram));
+  }
+
+  return result;
+}
+
+std::string TelemetryMulticastFormat::MakeSchemaRecord(
+    std::string_view name, std::string_view schema) {
+  const size_t name_size = std::min<size_t>(name.size(), 255);
+  std::string result;
+  result.push_back(static_cast<char>(name_size));
+  result.append(name.substr(0, name_size));
+  result.append(schema);
+  return result;
+}
+
+std::string TelemetryMulticastFormat::MakeDataRecord(
+    boost::posix_time::ptime timestamp, std::string_view data) {
+  std::string result;
+  WriteLe<int64_t>((timestamp - kEpoch).total_microseconds(), &result);
+  result.append(data);
+  return result;
+}
+
+class TelemetryMulticastPublisher::Impl {
+ public:
+  Impl(const boost::asio::any_io_executor& executor)
+      : executor_(executor) {}
+
+  void AsyncStart(mjlib::io::ErrorCallback callback) {
+    if (!parameters_.dest.empty()) {
+      UdpDataLink::Parameters link_params;
+      link_params.dest = parameters_.dest;
+      link_params.link_mtu = parameters_.link_mtu;
+      link_ = std::make_unique<UdpDataLink>(executor_, log_, link_params);
+
+      max_datagram_ = link_->get_max_data_size();
+      policies_ = TelemetryRatePolicy::ParseList(parameters_.policies);
+
+      SendSchemas();
+      schema_timer_.start(
+          mjlib::base::ConvertSecondsToDuration(parameters_.schema_period_s),
+          std::bind(&Impl::HandleSchemaTimer, this, std::placeholders::_1));
+    }
+
+    boost::asio::post(
+        executor_,
+        std::bind(std::move(callback), mjlib::base::error_code()));
+  }
+
+  void HandleSchemaTimer(const mjlib::base::error_code& ec) {
+    mjlib::base::FailIf(ec);
+    SendSchemas();
+  }
+
+  void SendSchemas() {
+    for (auto& record : records_) {
+      Send(Format::kSchema, record.get(), schema_sequence_,
+           Format::MakeSchemaRecord(record->name, record->schema));
+    }
+    schema_sequence_++;
+  }
+
+  void Send(Format::Type type, Record* record, uint16_t record_sequence,
+            const std::string& data) {
+    const auto datagrams = Format::MakeDatagrams(
+        type, &packet_sequence_, record->identifier, record_sequence,
+        data, max_datagram_);
+    if (datagrams.empty()) {
+      // This may happen for every instance, so is only reported once.
+      if (too_large_.insert(record->identifier).second) {
+        log_.warn(fmt::format("record '{}' is too large to multicast",
+                              record->name));
+      }
+      return;
+    }
+    for (const auto& datagram : datagrams) {
+      link_->Send(datagram);
+    }
+  }
+
+  boost::asio::any_io_executor executor_;
+  Parameters parameters_;
+  LogRef log_ = GetLogInstance("TelemetryMulticastPublisher");
+
+  std::unique_ptr<UdpDataLink> link_;
+  mjlib::io::RepeatingTimer schema_timer_{executor_};
+  size_t max_datagram_ = 0;
+  std::map<std::string, TelemetryRatePolicy::Options> policies_;
+
+  std::vector<std::unique_ptr<Record>> records_;
+  uint32_t packet_sequence_ = 0;
+  uint16_t schema_sequence_ = 0;
+  std::set<uint16_t> too_large_;
+};
+
+TelemetryMulticastPublisher::TelemetryMulticastPublisher(
+    const boost::asio::any_io_executor& executor)
+    : impl_(std::make_unique<Impl>(executor)) {}
+
+TelemetryMulticastPublisher::~TelemetryMulticastPublisher() {}
+
+TelemetryMulticastPublisher::Parameters*
+TelemetryMulticastPublisher::parameters() {
+  return &impl_->parameters_;
+}
+
+void TelemetryMulticastPublisher::AsyncStart(
+    mjlib::io::ErrorCallback callback) {
+  impl_->AsyncStart(std::move(callback));
+}
+
+TelemetryMulticastPublisher::Record* TelemetryMulticastPublisher::AddRecord(
+    const std::string& name, const std::string& schema) {
+  auto record = std::make_unique<Record>();
+  record->name = name;
+  record->schema = schema;
+  record->identifier = impl_->records_.size();
+  impl_->records_.push_back(std::move(record));
+  return impl_->records_.back().get();
+}
+
+bool TelemetryMulticastPublisher::Accept(Record* record) {
+  if (!impl_->link_) { return false; }
+
+  if (!record->configured) {
+    record->configured = true;
+    const auto it = impl_->policies_.find(record->name);
+    if (it != impl_->policies_.end()) { record->policy.emplace(it->second); }
+  }
+
+  if (!record->policy) { return true; }
+
+  // on_change policies are not applied, as viewers which join late
+  // would never see unchanging records.  Triggered policies are
+  // always in their decimated phase.
+  return record->policy->Accept(mjlib::io::Now(impl_->executor_.context()),
+                                boost::posix_time::ptime());
+}
+
+void TelemetryMulticastPublisher::Publish(Record* record,
+                                          const std::string& data) {
+  impl_->Send(
+      Format::kData, record, record->sequence++,
+      Format::MakeDataRecord(
+          mjlib::io::Now(impl_->executor_.context()), data));
+}
+
+class TelemetryMulticastReceiver::Impl {
+ public:
+  void Feed(std::string_view datagram) {
+    stats_.datagrams++;
+
+    if (datagram.size() < Format::kHeaderSize ||
+        static_cast<uint8_t>(datagram[0]) != Format::kMagic) {
+      stats_.malformed++;
+      return;
+    }
+
+    const auto type = static_cast<uint8_t>(datagram[1]);
+    const auto packet_sequence = ReadLe<uint32_t>(datagram.substr(2));
+    const auto identifier = ReadLe<uint16_t>(datagram.substr(6));
+    const auto record_sequence = ReadLe<uint16_t>(datagram.substr(8));
+    const auto index = static_cast<uint8_t>(datagram[10]);
+    const auto count = static_cast<uint8_t>(datagram[11]);
+    if (count == 0 || index >= count ||
+        (type != Format::kSchema && type != Format::kData)) {
+      stats_.malformed++;
+      return;
+    }
+
+    if (have_packet_sequence_) {
+      // Differences are taken modulo 2^32, so wrapping is harmless.
+      const uint32_t delta = packet_sequence - next_packet_sequence_;
+      if (delta < 0x80000000u) {
+        stats_.lost_datagrams += delta;
+      } else if (next_packet_sequence_ - packet_sequence > kReorderWindow) {
+        // Too far back to be reordering, so the publisher started
+        // over.
+        Reset();
+      }
+    }
+    have_packet_sequence_ = true;
+    next_packet_sequence_ = packet_sequence + 1;
+
+    auto& partial = partials_[std::make_pair(type, identifier)];
+    if (partial.fragments.empty() || partial.sequence != record_sequence ||
+        partial.fragments.size() != count) {
+      if (partial.received != 0) { stats_.incomplete_records++; }
+      partial.sequence = record_sequence;
+      partial.fragments.assign(count, {});
+      partial.present.assign(count, false);
+      partial.received = 0;
+    }
+
+    if (partial.present[index]) { return; }
+    partial.present[index] = true;
+    partial.fragments[index].assign(datagram.substr(Format::kHeaderSize));
+    partial.received++;
+
+    if (partial.received != count) { return; }
+
+    std::string record;
+    for (const auto& fragment : partial.fragments) { record += fragment; }
+    partial.fragments.clear();
+    partial.received = 0;
+
+    stats_.records++;
+
+    if (type == Format::kSchema) {
+      HandleSchema(identifier, record);
+    } else {
+      HandleData(identifier, record);
+    }
+  }
+
+  void HandleSchema(uint16_t identifier, std::string_view record) {
+    if (record.empty() ||
+        record.size() < 1u + static_cast<uint8_t>(record[0])) {
+      stats_.malformed++;
+      return;
+    }
+
+    const size_t name_size = static_cast<uint8_t>(record[0]);
+    const auto name = record.substr(1, name_size);
+    const auto schema_data = record.substr(1 + name_size);
+
+    const auto it = schemas_.find(identifier);
+    if (it != schemas_.end()) {
+      // Schemas are re-sent periodically.
+      if (it->second.name == name && it->second.schema == schema_data) {
+        return;
+      }
+
+      // The publisher started over with different records, so none of
+      // what we know about the old ones applies.
+      Reset();
+    }
+
+    auto& schema = schemas_[identifier];
+    schema.identifier = identifier;
+    schema.name = std::string(name);
+    schema.schema = std::string(schema_data);
+    schema_signal_(&schema);
+  }
+
+  void Reset() {
+    stats_.restarts++;
+    partials_.clear();
+    schemas_.clear();
+    identifiers_.clear();
+    have_packet_sequence_ = false;
+  }
+
+  void HandleData(uint16_t identifier, std::string_view record) {
+    // Data can't be interpreted until we have its schema.
+    if (schemas_.count(identifier) == 0) { return; }
+    if (record.size() < sizeof(int64_t)) {
+      stats_.malformed++;
+      return;
+    }
+
+    Data data;
+    data.identifier = identifier;
+    data.timestamp =
+        kEpoch + boost::posix_time::microseconds(ReadLe<int64_t>(record));
+    data.data = std::string(record.substr(sizeof(int64_t)));
+    data_signal_(&data);
+  }
+
+  struct Partial {
+    uint16_t sequence = 0;
+    std::vector<std::string> fragments;
+    std::vector<bool> present;
+    size_t received = 0;
+  };
+
+  // Datagrams can arrive out of order, but not by this many.
+  static constexpr uint32_t kReorderWindow = 1024;
+
+  std::map<std::pair<uint8_t, uint16_t>, Partial> partials_;
+  std::map<uint16_t, Schema> schemas_;
+
+  bool have_packet_sequence_ = false;
+  uint32_t next_packet_sequence_ = 0;
+
+  Stats stats_;
+
+  boost::signals2::signal<void (const Schema*)> schema_signal_;
+  boost::signals2::signal<void (const Data*)> data_signal_;
+
+  // Used by WriteTo.  The writer identifier for each publisher
+  // identifier, and the schema and writer identifier for each name
+  // written so far.
+  std::map<uint16_t, mjlib::telemetry::FileWriter::Identifier> identifiers_;
+
+  struct Written {
+    std::string schema;
+    mjlib::telemetry::FileWriter::Identifier identifier = {};
+  };
+  std::map<std::string, Written> written_;
+
+  LogRef log_ = GetLogInstance("TelemetryMulticastReceiver");
+};
+
+TelemetryMulticastReceiver::TelemetryMulticastReceiver()
+    : impl_(std::make_unique<Impl>()) {}
+
+TelemetryMulticastReceiver::~TelemetryMulticastReceiver() {}
+
+void TelemetryMulticastReceiver::Feed(std::string_view datagram) {
+  impl_->Feed(datagram);
+}
+
+boost::signals2::signal<void (const TelemetryMulticastReceiver::Schema*)>*
+TelemetryMulticastReceiver::schema_signal() {
+  return &impl_->schema_signal_;
+}
+
+boost::signals2::signal<void (const TelemetryMulticastReceiver::Data*)>*
+TelemetryMulticastReceiver::data_signal() {
+  return &impl_->data_signal_;
+}
+
+const TelemetryMulticastReceiver::Stats&
+TelemetryMulticastReceiver::stats() const {
+  return impl_->stats_;
+}
+
+void TelemetryMulticastReceiver::WriteTo(
+    mjlib::telemetry::FileWriter* writer) {
+  auto* impl = impl_.get();
+  schema_signal()->connect([impl, writer](const Schema* schema) {
+      // After a publisher restart, each name is seen again.
+      const auto it = impl->written_.find(schema->name);
+      if (it == impl->written_.end()) {
+        const auto id = writer->AllocateIdentifier(schema->name);
+        writer->WriteSchema(id, schema->schema);
+        impl->written_[schema->name] = {schema->schema, id};
+        impl->identifiers_[schema->identifier] = id;
+        return;
+      }
+      if (it->second.schema != schema->schema) {
+        // A log holds only one schema for each name.
+        impl->log_.warn(fmt::format(
+            "schema for '{}' changed, its data is not recorded",
+            schema->name));
+        return;
+      }
+      impl->identifiers_[schema->identifier] = it->second.identifier;
+    });
+  data_signal()->connect([impl, writer](const Data* data) {
+      const auto it = impl->identifiers_.find(data->identifier);
+      if (it == impl->identifiers_.end()) { return; }
+      auto buffer = writer->GetBuffer();
+      buffer->write(data->data);
+      writer->WriteData(data->timestamp, it->second, std::move(buffer));
+    });
+}
+
+}
+}
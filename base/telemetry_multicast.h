@@ -0,0 +1,195 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/signals2/signal.hpp>
+
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/visitor.h"
+#include "mjlib/io/async_types.h"
+#include "mjlib/telemetry/binary_write_archive.h"
+#include "mjlib/telemetry/file_writer.h"
+
+#include "base/telemetry_fixed_writer.h"
+#include "base/telemetry_rate_policy.h"
+
+namespace mjmech {
+namespace base {
+
+/// The datagram format used to multicast telemetry.
+///
+/// Every datagram starts with a header:
+///  * uint8 kMagic
+///  * uint8 Type
+///  * uint32 packet sequence, incremented for every datagram sent
+///  * uint16 record identifier
+///  * uint16 record sequence, incremented for every record sent
+///  * uint8 fragment index
+///  * uint8 fragment count
+///
+/// followed by a slice of the record.  Multi-byte fields are little
+/// endian.  Once reassembled, a kSchema record is a uint8 name size,
+/// the name, then the binary schema.  A kData record is an int64
+/// timestamp in microseconds since the epoch, then the serialized
+/// data.
+struct TelemetryMulticastFormat {
+  static constexpr uint8_t kMagic = 0xfc;
+  static constexpr size_t kHeaderSize = 12;
+
+  enum Type : uint8_t {
+    kSchema = 0,
+    kData = 1,
+  };
+
+  /// Split one record into datagrams of no more than @p max_datagram
+  /// bytes.  Returns nothing if that would take more than 255.
+  static std::vector<std::string> MakeDatagrams(
+      Type, uint32_t* packet_sequence, uint16_t identifier,
+      uint16_t record_sequence, std::string_view record,
+      size_t max_datagram);
+
+  static std::string MakeSchemaRecord(std::string_view name,
+                                      std::string_view schema);
+  static std::string MakeDataRecord(boost::posix_time::ptime timestamp,
+                                    std::string_view data);
+};
+
+/// Publish every registered record to a multicast group, so that any
+/// number of viewers may watch without additional load.
+///
+/// Schemas for all records are re-sent every schema_period_s, so
+/// viewers may join at any time.
+class TelemetryMulticastPublisher : boost::noncopyable {
+ public:
+  struct Parameters {
+    // The destination, as for UdpDataLink.  If empty, nothing is
+    // published.
+    std::string dest;
+    int link_mtu = 1400;
+    double schema_period_s = 1.0;
+
+    // Per-record rate policies, as for TelemetryLogRegistrar.
+    std::string policies;
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(dest));
+      a->Visit(MJ_NVP(link_mtu));
+      a->Visit(MJ_NVP(schema_period_s));
+      a->Visit(MJ_NVP(policies));
+    }
+  };
+
+  TelemetryMulticastPublisher(const boost::asio::any_io_executor&);
+  ~TelemetryMulticastPublisher();
+
+  Parameters* parameters();
+
+  void AsyncStart(mjlib::io::ErrorCallback);
+
+  template <typename T>
+  void Register(const std::string& name,
+                boost::signals2::signal<void (const T*)>* signal) {
+    auto record = AddRecord(
+        name, mjlib::telemetry::BinarySchemaArchive::template schema<T>());
+    signal->connect([this, record](const T* data) {
+        if (!Accept(record)) { return; }
+        mjlib::base::FastOStringStream stream;
+        WriteTelemetry(stream, data);
+        Publish(record, stream.str());
+      });
+  }
+
+ private:
+  struct Record {
+    std::string name;
+    std::string schema;
+    uint16_t identifier = 0;
+    uint16_t sequence = 0;
+    bool configured = false;
+    std::optional<TelemetryRatePolicy> policy;
+  };
+
+  Record* AddRecord(const std::string& name, const std::string& schema);
+
+  /// Return true if this instance of @p record should be sent.
+  bool Accept(Record*);
+  void Publish(Record*, const std::string& data);
+
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+/// Reassemble datagrams sent by a TelemetryMulticastPublisher.
+class TelemetryMulticastReceiver : boost::noncopyable {
+ public:
+  TelemetryMulticastReceiver();
+  ~TelemetryMulticastReceiver();
+
+  void Feed(std::string_view datagram);
+
+  struct Schema {
+    uint16_t identifier = 0;
+    std::string name;
+    std::string schema;
+  };
+
+  struct Data {
+    uint16_t identifier = 0;
+    boost::posix_time::ptime timestamp;
+    std::string data;
+  };
+
+  /// Emitted the first time each record's schema is seen, and again
+  /// if the publisher restarts.  A restart is recognized by the
+  /// packet sequence going back, or a record's schema changing.
+  boost::signals2::signal<void (const Schema*)>* schema_signal();
+
+  /// Emitted for each data record whose schema is known.
+  boost::signals2::signal<void (const Data*)>* data_signal();
+
+  struct Stats {
+    uint64_t datagrams = 0;
+    uint64_t lost_datagrams = 0;
+    uint64_t malformed = 0;
+    uint64_t incomplete_records = 0;
+    uint64_t records = 0;
+    uint64_t restarts = 0;
+  };
+
+  const Stats& stats() const;
+
+  /// Write everything received to @p writer, which results in a log
+  /// readable by all the usual tools.
+  void WriteTo(mjlib::telemetry::FileWriter* writer);
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
@@ -0,0 +1,168 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/telemetry_rate_policy.h"
+
+#include <cstdlib>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/system_error.h"
+#include "mjlib/base/time_conversions.h"
+
+namespace mjmech {
+namespace base {
+
+namespace {
+double ParseNumber(const std::string& value, std::string_view spec) {
+  char* end = nullptr;
+  const double result = std::strtod(value.c_str(), &end);
+  if (value.empty() || end != value.c_str() + value.size()) {
+    throw mjlib::base::system_error::einval(
+        fmt::format("invalid number '{}' in telemetry policy '{}'",
+                    value, spec));
+  }
+  return result;
+}
+
+int ParsePositiveInt(const std::string& value, std::string_view spec) {
+  const double result = ParseNumber(value, spec);
+  if (result < 1 || result != static_cast<int>(result)) {
+    throw mjlib::base::system_error::einval(
+        fmt::format("count must be a positive integer in telemetry "
+                    "policy '{}'", spec));
+  }
+  return static_cast<int>(result);
+}
+}
+
+TelemetryRatePolicy::Options TelemetryRatePolicy::Parse(std::string_view spec) {
+  std::vector<std::string> fields;
+  boost::split(fields, spec, boost::is_any_of(":"));
+  for (auto& field : fields) { boost::trim(field); }
+
+  auto require_fields = [&](size_t count) {
+    if (fields.size() != count) {
+      throw mjlib::base::system_error::einval(
+          fmt::format("telemetry policy '{}' needs {} argument(s)",
+                      spec, count - 1));
+    }
+  };
+
+  Options result;
+  const auto& name = fields.front();
+  if (name == "full") {
+    require_fields(1);
+    result.mode = kFull;
+  } else if (name == "every") {
+    require_fields(2);
+    result.mode = kEvery;
+    result.every = ParsePositiveInt(fields[1], spec);
+  } else if (name == "max_hz") {
+    require_fields(2);
+    result.mode = kMaxHz;
+    result.max_hz = ParseNumber(fields[1], spec);
+    if (!(result.max_hz > 0.0)) {
+      throw mjlib::base::system_error::einval(
+          fmt::format("rate must be positive in telemetry policy '{}'", spec));
+    }
+  } else if (name == "on_change") {
+    require_fields(1);
+    result.mode = kOnChange;
+  } else if (name == "triggered") {
+    require_fields(3);
+    result.mode = kTriggered;
+    result.window_s = ParseNumber(fields[1], spec);
+    result.every = ParsePositiveInt(fields[2], spec);
+  } else {
+    throw mjlib::base::system_error::einval(
+        fmt::format("unknown telemetry policy '{}'", spec));
+  }
+
+  return result;
+}
+
+std::map<std::string, TelemetryRatePolicy::Options>
+TelemetryRatePolicy::ParseList(std::string_view list) {
+  std::map<std::string, Options> result;
+
+  std::vector<std::string> entries;
+  boost::split(entries, list, boost::is_any_of(","));
+  for (const auto& entry : entries) {
+    if (boost::trim_copy(entry).empty()) { continue; }
+
+    const auto equals = entry.find('=');
+    if (equals == std::string::npos) {
+      throw mjlib::base::system_error::einval(
+          fmt::format("telemetry policy entry '{}' has no '='", entry));
+    }
+    result[boost::trim_copy(entry.substr(0, equals))] =
+        Parse(boost::trim_copy(entry.substr(equals + 1)));
+  }
+
+  return result;
+}
+
+bool TelemetryRatePolicy::Accept(boost::posix_time::ptime now,
+                                 boost::posix_time::ptime trigger) {
+  switch (options_.mode) {
+    case kFull:
+    case kOnChange: {
+      return true;
+    }
+    case kEvery: {
+      const bool result = (count_ == 0);
+      count_ = (count_ + 1) % options_.every;
+      return result;
+    }
+    case kMaxHz: {
+      if (!last_.is_not_a_date_time() &&
+          mjlib::base::ConvertDurationToSeconds(now - last_) <
+          1.0 / options_.max_hz) {
+        return false;
+      }
+      last_ = now;
+      return true;
+    }
+    case kTriggered: {
+      if (!trigger.is_not_a_date_time() && now >= trigger &&
+          mjlib::base::ConvertDurationToSeconds(now - trigger) <=
+          options_.window_s) {
+        // Start the decimated phase fresh once the window closes.
+        count_ = 0;
+        return true;
+      }
+      const bool result = (count_ == 0);
+      count_ = (count_ + 1) % options_.every;
+      return result;
+    }
+  }
+  return true;
+}
+
+bool TelemetryRatePolicy::AcceptSerialized(std::string_view serialized) {
+  if (options_.mode != kOnChange) { return true; }
+
+  if (have_previous_ && serialized == previous_) { return false; }
+
+  previous_.assign(serialized);
+  have_previous_ = true;
+  return true;
+}
+
+}
+}
@@ -0,0 +1,83 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace mjmech {
+namespace base {
+
+/// Decides which instances of a single record are logged.
+///
+/// Policies are written as text, one of:
+///  * "full" - every instance
+///  * "every:N" - every Nth instance
+///  * "max_hz:F" - no more than F instances per second
+///  * "on_change" - only instances whose serialized form differs
+///    from the last one logged (records with a timestamp field will
+///    rarely benefit)
+///  * "triggered:W:N" - every instance for W seconds after a trigger,
+///    every Nth instance otherwise
+class TelemetryRatePolicy {
+ public:
+  enum Mode {
+    kFull,
+    kEvery,
+    kMaxHz,
+    kOnChange,
+    kTriggered,
+  };
+
+  struct Options {
+    Mode mode = kFull;
+    int every = 1;
+    double max_hz = 0.0;
+    double window_s = 0.0;
+  };
+
+  /// Parse a single policy.  Throws system_error if it is malformed.
+  static Options Parse(std::string_view);
+
+  /// Parse a comma separated list of "record=policy" entries.
+  static std::map<std::string, Options> ParseList(std::string_view);
+
+  TelemetryRatePolicy(const Options& options) : options_(options) {}
+
+  /// Return true if the instance emitted at @p now should be logged.
+  /// This is checked before any serialization takes place.
+  /// @p trigger is the time of the most recent trigger, or
+  /// not_a_date_time if there has been none.
+  bool Accept(boost::posix_time::ptime now, boost::posix_time::ptime trigger);
+
+  /// For kOnChange, return true if @p serialized differs from the
+  /// last accepted instance.  Always true for other modes.
+  bool AcceptSerialized(std::string_view serialized);
+
+  const Options& options() const { return options_; }
+
+ private:
+  const Options options_;
+  int count_ = 0;
+  boost::posix_time::ptime last_;
+  std::string previous_;
+  bool have_previous_ = false;
+};
+
+}
+}
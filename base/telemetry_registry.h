@@ -21,7 +21,9 @@
 
 #include "mjlib/telemetry/file_writer.h"
 
+#include "base/telemetry_flight_recorder.h"
 #include "base/telemetry_log_registrar.h"
+#include "base/telemetry_multicast.h"
 #include "base/telemetry_remote_debug_registrar.h"
 
 namespace mjmech {
@@ -31,8 +33,10 @@ class TelemetryRegistry : boost::noncopyable {
  public:
   TelemetryRegistry(boost::asio::io_context& context,
                     mjlib::telemetry::FileWriter* log,
-                    TelemetryRemoteDebugServer* debug)
-      : log_(context, log), debug_(debug) {}
+                    TelemetryRemoteDebugServer* debug,
+                    TelemetryMulticastPublisher* multicast)
+      : log_(context, log), debug_(debug), multicast_(multicast),
+        flight_recorder_(context) {}
 
   /// Register a serializable object, and return a function object
   /// which when called will disseminate the
@@ -50,6 +54,8 @@ class TelemetryRegistry : boost::noncopyable {
 
     log_.Register(record_name, &ptr->signal);
     debug_.Register(record_name, &ptr->signal);
+    multicast_->Register(record_name, &ptr->signal);
+    flight_recorder_.Register(record_name, &ptr->signal);
 
     records_.insert(
         std::make_pair(
@@ -64,6 +70,30 @@ class TelemetryRegistry : boost::noncopyable {
     signal->connect(Register<DataObject>(record_name));
   }
 
+  TelemetryLogRegistrar::Parameters* log_parameters() {
+    return log_.parameters();
+  }
+
+  /// Apply the log parameters, throwing if they are invalid.  See
+  /// TelemetryLogRegistrar::Start.
+  void StartLog() { log_.Start(); }
+
+  /// See TelemetryLogRegistrar::Suspend and Resume.
+  void SuspendLog() { log_.Suspend(); }
+  void ResumeLog() { log_.Resume(); }
+
+  /// Open the full rate window for any records logged with a
+  /// "triggered" policy.
+  void TriggerLog() { log_.Trigger(); }
+
+  TelemetryFlightRecorder::Parameters* flight_recorder_parameters() {
+    return flight_recorder_.parameters();
+  }
+
+  /// Write the recent history of all records to a standalone log.
+  /// See TelemetryFlightRecorder::Dump.
+  bool DumpFlightRecorder() { return flight_recorder_.Dump(); }
+
  private:
   struct Base {
     virtual ~Base() {}
@@ -80,6 +110,8 @@ class TelemetryRegistry : boost::noncopyable {
 
   TelemetryLogRegistrar log_;
   TelemetryRemoteDebugRegistrar debug_;
+  TelemetryMulticastPublisher* const multicast_;
+  TelemetryFlightRecorder flight_recorder_;
 };
 
 }
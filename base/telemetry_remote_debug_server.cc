@@ -14,11 +14,16 @@
 
 #include "telemetry_remote_debug_server.h"
 
+#include <algorithm>
+#include <set>
+
 #include <boost/asio/post.hpp>
 
 #include "mjlib/base/json5_read_archive.h"
 #include "mjlib/base/json5_write_archive.h"
 #include "mjlib/base/fail.h"
+#include "mjlib/base/time_conversions.h"
+#include "mjlib/io/now.h"
 
 namespace mjmech {
 namespace base {
@@ -51,11 +56,15 @@ class TelemetryRemoteDebugServer::Impl : boost::noncopyable {
   struct Message {
     std::string command;
     std::vector<std::string> names;
+    double rate_hz = 10.0;
+    std::string encoding = "json";
 
     template <typename Archive>
     void Serialize(Archive* a) {
       a->Visit(MJ_NVP(command));
       a->Visit(MJ_NVP(names));
+      a->Visit(MJ_NVP(rate_hz));
+      a->Visit(MJ_NVP(encoding));
     }
   };
 
@@ -66,6 +75,12 @@ class TelemetryRemoteDebugServer::Impl : boost::noncopyable {
       DoEnumerate(from);
     } else if (message.command == "get") {
       DoGet(message, from);
+    } else if (message.command == "subscribe") {
+      DoSubscribe(message, from);
+    } else if (message.command == "unsubscribe") {
+      DoUnsubscribe(message, from);
+    } else if (message.command == "schema") {
+      DoSchema(message, from);
     } else {
       std::cerr << "unknown remote debug command: '"
                 << message.command << "'\n";
@@ -108,10 +123,190 @@ class TelemetryRemoteDebugServer::Impl : boost::noncopyable {
         continue;
       }
 
-      it->second->Respond(from);
+      SendData(it->second->Json(), from);
+    }
+  }
+
+  struct SubscribeResponse {
+    std::string type = "subscribe";
+    std::vector<std::string> names;
+    double timeout_s = 0.0;
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(type));
+      a->Visit(MJ_NVP(names));
+      a->Visit(MJ_NVP(timeout_s));
+    }
+  };
+
+  void DoSubscribe(const Message& message, const udp::endpoint& from) {
+    const auto encoding =
+        (message.encoding == "binary") ? kBinary : kJson;
+    const auto now = Now();
+
+    SubscribeResponse response;
+    response.timeout_s = parameters_.subscription_timeout_s;
+
+    for (const auto& name : message.names) {
+      auto it = handlers_.find(name);
+      if (it == handlers_.end()) {
+        std::cerr << "subscription for unknown name: '" + name + "'\n";
+        continue;
+      }
+
+      // A record which cannot be sent is refused up front, rather than
+      // failing again on every update.
+      if (encoding == kBinary &&
+          !SendFragments(name, kBinarySchema, it->second->Schema(), from)) {
+        continue;
+      }
+      response.names.push_back(name);
+
+      auto& subscriptions = subscriptions_[name];
+      auto sub_it = std::find_if(
+          subscriptions.begin(), subscriptions.end(),
+          [&](const auto& sub) {
+            return sub.endpoint == from && sub.encoding == encoding;
+          });
+      if (sub_it == subscriptions.end()) {
+        subscriptions.push_back({});
+        sub_it = subscriptions.end() - 1;
+        sub_it->endpoint = from;
+        sub_it->encoding = encoding;
+        sub_it->next = now;
+        it->second->subscriptions++;
+      }
+
+      // Re-subscribing just renews and updates the rate.
+      sub_it->period =
+          (message.rate_hz > 0.0) ?
+          mjlib::base::ConvertSecondsToDuration(1.0 / message.rate_hz) :
+          boost::posix_time::time_duration();
+      sub_it->expires =
+          now + mjlib::base::ConvertSecondsToDuration(
+              parameters_.subscription_timeout_s);
+    }
+
+    SendData(mjlib::base::Json5WriteArchive::Write(response), from);
+  }
+
+  void DoUnsubscribe(const Message& message, const udp::endpoint& from) {
+    for (auto& pair : subscriptions_) {
+      if (!message.names.empty() &&
+          std::find(message.names.begin(), message.names.end(),
+                    pair.first) == message.names.end()) {
+        continue;
+      }
+      auto& subscriptions = pair.second;
+      auto* handler = handlers_.at(pair.first).get();
+      subscriptions.erase(
+          std::remove_if(
+              subscriptions.begin(), subscriptions.end(),
+              [&](const auto& sub) {
+                if (sub.endpoint != from) { return false; }
+                handler->subscriptions--;
+                return true;
+              }),
+          subscriptions.end());
+    }
+  }
+
+  void DoSchema(const Message& message, const udp::endpoint& from) {
+    for (const auto& name : message.names) {
+      auto it = handlers_.find(name);
+      if (it == handlers_.end()) { continue; }
+      SendFragments(name, kBinarySchema, it->second->Schema(), from);
+    }
+  }
+
+  void HandleUpdate(const std::string& name, Handler* handler) {
+    handler->dirty = false;
+
+    auto it = subscriptions_.find(name);
+    if (it == subscriptions_.end()) { return; }
+    auto& subscriptions = it->second;
+
+    const auto now = Now();
+
+    subscriptions.erase(
+        std::remove_if(
+            subscriptions.begin(), subscriptions.end(),
+            [&](const auto& sub) {
+              if (now < sub.expires) { return false; }
+              handler->subscriptions--;
+              return true;
+            }),
+        subscriptions.end());
+
+    // Each encoding is only produced once per update, no matter how
+    // many subscribers want it.
+    std::string encoded[2];
+    bool have_encoded[2] = {};
+    bool too_large[2] = {};
+
+    for (auto& sub : subscriptions) {
+      if (now < sub.next) { continue; }
+
+      sub.next += sub.period;
+      if (sub.next < now) { sub.next = now; }
+
+      const int index = (sub.encoding == kBinary) ? 1 : 0;
+      if (!have_encoded[index]) {
+        encoded[index] =
+            (sub.encoding == kBinary) ? handler->Binary() : handler->Json();
+        have_encoded[index] = true;
+      }
+      if (too_large[index]) { continue; }
+      if (!SendFragments(name, sub.encoding, encoded[index], sub.endpoint)) {
+        too_large[index] = true;
+      }
+    }
+
+    // Nothing that depends on the payload size will change, so stop
+    // trying.  The subscriber will notice the lack of updates.
+    if (too_large[0] || too_large[1]) {
+      subscriptions.erase(
+          std::remove_if(
+              subscriptions.begin(), subscriptions.end(),
+              [&](const auto& sub) {
+                if (!too_large[(sub.encoding == kBinary) ? 1 : 0]) {
+                  return false;
+                }
+                handler->subscriptions--;
+                return true;
+              }),
+          subscriptions.end());
     }
   }
 
+  /// Return false if the payload could not be sent because it needs
+  /// too many fragments.  That is only reported the first time for
+  /// each name and encoding, as this runs from HandleUpdate.
+  bool SendFragments(const std::string& name, Encoding encoding,
+                     const std::string& payload,
+                     const udp::endpoint& endpoint) {
+    const auto key = std::make_pair(name, encoding);
+    const auto fragments = MakeFragments(
+        name, encoding, sequences_[key]++,
+        payload, parameters_.max_datagram);
+    if (fragments.empty()) {
+      if (too_large_.insert(key).second) {
+        std::cerr << "remote debug record too large to send: '"
+                  << name << "'\n";
+      }
+      return false;
+    }
+    for (const auto& fragment : fragments) {
+      SendData(fragment, endpoint);
+    }
+    return true;
+  }
+
+  boost::posix_time::ptime Now() {
+    return mjlib::io::Now(executor_.context());
+  }
+
   void HandleWrite(std::shared_ptr<std::string>,
                    mjlib::base::error_code ec) {
     mjlib::base::FailIf(ec);
@@ -124,6 +319,18 @@ class TelemetryRemoteDebugServer::Impl : boost::noncopyable {
   udp::endpoint receive_endpoint_;
 
   std::map<std::string, std::unique_ptr<Handler> > handlers_;
+
+  struct Subscription {
+    udp::endpoint endpoint;
+    Encoding encoding = kJson;
+    boost::posix_time::time_duration period;
+    boost::posix_time::ptime next;
+    boost::posix_time::ptime expires;
+  };
+
+  std::map<std::string, std::vector<Subscription>> subscriptions_;
+  std::map<std::pair<std::string, Encoding>, uint16_t> sequences_;
+  std::set<std::pair<std::string, Encoding>> too_large_;
 };
 
 TelemetryRemoteDebugServer::TelemetryRemoteDebugServer(
@@ -154,10 +361,45 @@ void TelemetryRemoteDebugServer::RegisterHandler(
   impl_->handlers_.insert(std::make_pair(name, std::move(handler)));
 }
 
-void TelemetryRemoteDebugServer::SendResponse(
-    const std::string& data,
-    const udp::endpoint& endpoint) {
-  impl_->SendData(data, endpoint);
+void TelemetryRemoteDebugServer::PostUpdate(
+    const std::string* name, Handler* handler) {
+  boost::asio::post(
+      impl_->executor_,
+      [impl = impl_.get(), name, handler]() {
+        impl->HandleUpdate(*name, handler);
+      });
+}
+
+std::vector<std::string> TelemetryRemoteDebugServer::MakeFragments(
+    std::string_view name, Encoding encoding, uint16_t sequence,
+    std::string_view payload, size_t max_datagram) {
+  const size_t name_size = std::min<size_t>(name.size(), 255);
+  const size_t overhead = kFragmentHeaderSize + name_size;
+  if (max_datagram <= overhead) { return {}; }
+
+  const size_t per_fragment = max_datagram - overhead;
+  const size_t count =
+      std::max<size_t>(1, (payload.size() + per_fragment - 1) / per_fragment);
+  if (count > 255) { return {}; }
+
+  std::vector<std::string> result;
+  for (size_t i = 0; i < count; i++) {
+    const auto slice = payload.substr(i * per_fragment, per_fragment);
+
+    std::string fragment;
+    fragment.reserve(overhead + slice.size());
+    fragment.push_back(static_cast<char>(kFragmentMagic));
+    fragment.push_back(static_cast<char>(encoding));
+    fragment.push_back(static_cast<char>(sequence & 0xff));
+    fragment.push_back(static_cast<char>((sequence >> 8) & 0xff));
+    fragment.push_back(static_cast<char>(i));
+    fragment.push_back(static_cast<char>(count));
+    fragment.push_back(static_cast<char>(name_size));
+    fragment.append(name.substr(0, name_size));
+    fragment.append(slice);
+    result.push_back(std::move(fragment));
+  }
+  return result;
 }
 }
 }
@@ -14,29 +14,82 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/udp.hpp>
 #include <boost/signals2/signal.hpp>
 
+#include "mjlib/base/fast_stream.h"
 #include "mjlib/base/json5_write_archive.h"
 #include "mjlib/io/async_types.h"
+#include "mjlib/telemetry/binary_write_archive.h"
 
 namespace mjmech {
 namespace base {
 
+/// Serve the most recent value of registered records over UDP.
+///
+/// Requests are JSON objects with a "command" and list of "names".
+///  * "enumerate" - reply with the names of all records
+///  * "get" - reply with the current value of each named record as
+///    JSON
+///  * "subscribe" - push each named record at up to "rate_hz", using
+///    "encoding" of either "json" or "binary".  Subscriptions expire
+///    after subscription_timeout_s unless renewed.  For binary
+///    subscriptions, the schema of each record is sent first.
+///  * "unsubscribe" - stop pushing the named records, or all if no
+///    names are given
+///  * "schema" - send the binary schema of each named record
+///
+/// Pushed updates and schemas are sent as one or more datagrams,
+/// each with a fragment header, then the record name, then a slice
+/// of the payload.  They never exceed max_datagram bytes.
 class TelemetryRemoteDebugServer : boost::noncopyable {
  public:
   typedef boost::asio::ip::udp udp;
 
+  enum Encoding : uint8_t {
+    kJson = 0,
+    kBinary = 1,
+    kBinarySchema = 2,
+  };
+
+  /// The first byte of every fragment.  This can never begin a JSON
+  /// reply.
+  static constexpr uint8_t kFragmentMagic = 0xfd;
+
+  /// Each fragment header is:
+  ///  * uint8 kFragmentMagic
+  ///  * uint8 Encoding
+  ///  * uint16 sequence (little endian), per record and encoding
+  ///  * uint8 fragment index
+  ///  * uint8 fragment count
+  ///  * uint8 name size
+  static constexpr size_t kFragmentHeaderSize = 7;
+
+  /// Split @p payload into datagrams of no more than @p max_datagram
+  /// bytes.  Returns nothing if it would take more than 255.
+  static std::vector<std::string> MakeFragments(
+      std::string_view name, Encoding, uint16_t sequence,
+      std::string_view payload, size_t max_datagram);
+
   TelemetryRemoteDebugServer(const boost::asio::any_io_executor&);
   ~TelemetryRemoteDebugServer();
 
   struct Parameters {
     int port = 13380;
+    int max_datagram = 1400;
+    double subscription_timeout_s = 10.0;
 
     template <typename Archive>
     void Serialize(Archive* a) {
       a->Visit(MJ_NVP(port));
+      a->Visit(MJ_NVP(max_datagram));
+      a->Visit(MJ_NVP(subscription_timeout_s));
     }
   };
 
@@ -57,10 +110,22 @@ class TelemetryRemoteDebugServer : boost::noncopyable {
    public:
     virtual ~Handler() {}
 
-    /// Send now, or in the future, the contents of this registration
-    /// to the given UDP endpoint.  If a request is still outstanding,
-    /// this will be a noop.
-    virtual void Respond(const udp::endpoint&) = 0;
+    /// Return the most recent value as a JSON reply.
+    virtual std::string Json() = 0;
+
+    /// Return the most recent value using the telemetry binary
+    /// encoding.
+    virtual std::string Binary() = 0;
+
+    virtual std::string Schema() = 0;
+
+    // The number of active subscriptions to this record.  Updates
+    // are only forwarded to the server when non-zero.
+    int subscriptions = 0;
+
+    // True when an update has been posted to the server, but not yet
+    // handled.
+    bool dirty = false;
   };
 
   template <typename T>
@@ -116,14 +181,30 @@ class TelemetryRemoteDebugServer : boost::noncopyable {
     }
     virtual ~ConcreteHandler() {}
 
-
-    virtual void Respond(const udp::endpoint& endpoint) {
+    std::string Json() override {
       Response<T> response(&data_, name_);
-      parent_->SendResponse(mjlib::base::Json5WriteArchive::Write(response),
-                            endpoint);
+      return mjlib::base::Json5WriteArchive::Write(response);
+    }
+
+    std::string Binary() override {
+      mjlib::base::FastOStringStream stream;
+      mjlib::telemetry::BinaryWriteArchive(stream).Accept(&data_);
+      return stream.str();
     }
 
-    void HandleData(const T* data) { data_ = *data; }
+    std::string Schema() override {
+      return mjlib::telemetry::BinarySchemaArchive::template schema<T>();
+    }
+
+    /// This is invoked from the control path, so everything else
+    /// happens later from the server's executor.
+    void HandleData(const T* data) {
+      data_ = *data;
+      if (subscriptions && !dirty) {
+        dirty = true;
+        parent_->PostUpdate(&name_, this);
+      }
+    }
 
     TelemetryRemoteDebugServer* const parent_;
     const std::string name_;
@@ -132,8 +213,7 @@ class TelemetryRemoteDebugServer : boost::noncopyable {
 
   void RegisterHandler(const std::string&, std::unique_ptr<Handler>);
 
-  void SendResponse(const std::string& data,
-                    const udp::endpoint&);
+  void PostUpdate(const std::string*, Handler*);
 
   class Impl;
   std::unique_ptr<Impl> impl_;
@@ -0,0 +1,53 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/reservoir_sampler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/auto_unit_test.hpp>
+
+using mjmech::base::ReservoirSampler;
+
+BOOST_AUTO_TEST_CASE(ReservoirSamplerSmallTest) {
+  ReservoirSampler<int> dut(10);
+  for (int i = 0; i < 5; i++) { dut.Add(i); }
+
+  BOOST_TEST(dut.count() == 5);
+  BOOST_TEST(dut.size() == 5);
+  const std::vector<int> actual(dut.begin(), dut.end());
+  const std::vector<int> expected = {0, 1, 2, 3, 4};
+  BOOST_TEST(actual == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(ReservoirSamplerLargeTest) {
+  ReservoirSampler<int> dut(1000);
+  for (int i = 0; i < 100000; i++) { dut.Add(i); }
+
+  BOOST_TEST(dut.count() == 100000);
+  BOOST_TEST(dut.size() == 1000);
+
+  // Every value in the sample was added, and the sample is spread
+  // over the whole range.
+  std::vector<int> sample(dut.begin(), dut.end());
+  std::sort(sample.begin(), sample.end());
+  BOOST_TEST(sample.front() >= 0);
+  BOOST_TEST(sample.back() < 100000);
+  BOOST_TEST((std::unique(sample.begin(), sample.end()) == sample.end()));
+
+  const double median = sample[sample.size() / 2];
+  BOOST_TEST(median > 40000);
+  BOOST_TEST(median < 60000);
+}
@@ -0,0 +1,113 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/segmented_log.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjmech::base;
+
+BOOST_AUTO_TEST_CASE(SegmentedLogNameTest) {
+  BOOST_TEST(SegmentedLog::MakeSegmentName("foo.log", 0) == "foo-0000.log");
+  BOOST_TEST(SegmentedLog::MakeSegmentName("/tmp/a/foo-20200101-120000.log",
+                                           12) ==
+             "/tmp/a/foo-20200101-120000-0012.log");
+  BOOST_TEST(SegmentedLog::MakeSegmentName("noext", 3) == "noext-0003");
+}
+
+BOOST_AUTO_TEST_CASE(SegmentedLogRotateTest) {
+  namespace fs = boost::filesystem;
+  const auto dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  const auto filename = (dir / "test.log").native();
+
+  boost::asio::io_context context;
+  mjlib::telemetry::FileWriter writer;
+  SegmentedLog dut(context.get_executor(), &writer);
+  dut.parameters()->segment_s = 0.05;
+  dut.parameters()->check_period_s = 0.01;
+  // This is exceeded by any two segments, so only the current one is
+  // ever kept.
+  dut.parameters()->quota_mb = 1e-9;
+
+  std::vector<bool> switches;
+  dut.switch_signal()->connect([&](bool switching) {
+      // The writer is only touched in between.
+      if (!switching) { BOOST_TEST(writer.IsOpen() == dut.IsOpen()); }
+      switches.push_back(switching);
+    });
+
+  dut.Open(filename, kShort);
+  BOOST_TEST(dut.IsOpen());
+  BOOST_TEST_REQUIRE(switches.size() == 1);
+  BOOST_TEST(switches[0] == true);
+
+  context.run_for(std::chrono::milliseconds(300));
+  // Let any rotation in progress finish.
+  while (switches.back()) { context.run_one(); }
+
+  dut.Close();
+  BOOST_TEST(!dut.IsOpen());
+  context.run_for(std::chrono::milliseconds(50));
+
+  // Each switch is reported as starting, then finishing.
+  BOOST_TEST_REQUIRE(switches.size() % 2 == 0);
+  for (size_t i = 0; i < switches.size(); i++) {
+    BOOST_TEST(switches[i] == (i % 2 == 0));
+  }
+  BOOST_TEST(!writer.IsOpen());
+
+  // The open, at least a few rotations, and the close.
+  const int rotations = switches.size() / 2 - 2;
+  BOOST_TEST(rotations >= 2);
+
+  // Everything but the final segment was removed to stay under
+  // quota.
+  std::vector<std::string> remaining;
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    remaining.push_back(entry.path().native());
+  }
+  BOOST_TEST_REQUIRE(remaining.size() == 1);
+  BOOST_TEST(remaining[0] == SegmentedLog::MakeSegmentName(
+                 filename, rotations));
+
+  fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(SegmentedLogDestroyTest) {
+  namespace fs = boost::filesystem;
+  const auto dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  const auto filename = (dir / "test.log").native();
+
+  boost::asio::io_context context;
+  mjlib::telemetry::FileWriter writer;
+  {
+    SegmentedLog dut(context.get_executor(), &writer);
+    dut.Open(filename, kShort);
+    dut.Close();
+  }
+
+  // Both switches were still pending, and were completed anyway.
+  BOOST_TEST(fs::exists(filename));
+  BOOST_TEST(!writer.IsOpen());
+
+  fs::remove_all(dir);
+}
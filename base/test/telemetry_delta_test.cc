@@ -0,0 +1,115 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/telemetry_delta.h"
+
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjmech::base;
+
+BOOST_AUTO_TEST_CASE(TelemetryDeltaRoundTripTest) {
+  TelemetryDeltaEncoder::Options options;
+  options.keyframe_interval = 4;
+  TelemetryDeltaEncoder encoder(options);
+  TelemetryDeltaDecoder decoder;
+
+  std::string record(200, '\x00');
+  std::string encoded;
+  std::string decoded;
+
+  for (int i = 0; i < 20; i++) {
+    // Change a few scattered bytes each time.
+    record[10] = static_cast<char>(i);
+    record[11] = static_cast<char>(i * 3);
+    record[13] = static_cast<char>(i * 7);
+    record[150] = static_cast<char>(255 - i);
+
+    encoder.Encode(record, &encoded);
+    BOOST_TEST(TelemetryDeltaDecoder::IsKeyframe(encoded) == (i % 4 == 0));
+    if (i % 4 != 0) {
+      BOOST_TEST(encoded.size() < 20);
+    }
+
+    BOOST_TEST(decoder.Decode(encoded, &decoded));
+    BOOST_TEST(decoded == record);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDeltaSizeChangeTest) {
+  TelemetryDeltaEncoder encoder{TelemetryDeltaEncoder::Options()};
+  TelemetryDeltaDecoder decoder;
+
+  std::string encoded;
+  std::string decoded;
+
+  encoder.Encode("abcdef", &encoded);
+  BOOST_TEST(decoder.Decode(encoded, &decoded));
+
+  // A change in size always results in a keyframe.
+  encoder.Encode("abcdefg", &encoded);
+  BOOST_TEST(TelemetryDeltaDecoder::IsKeyframe(encoded));
+  BOOST_TEST(decoder.Decode(encoded, &decoded));
+  BOOST_TEST(decoded == "abcdefg");
+
+  encoder.Encode("abcdefg", &encoded);
+  BOOST_TEST(!TelemetryDeltaDecoder::IsKeyframe(encoded));
+  BOOST_TEST(encoded.size() == 1);
+  BOOST_TEST(decoder.Decode(encoded, &decoded));
+  BOOST_TEST(decoded == "abcdefg");
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDeltaNoKeyframeTest) {
+  TelemetryDeltaEncoder encoder{TelemetryDeltaEncoder::Options()};
+  std::string first;
+  std::string second;
+  encoder.Encode(std::string(50, 'a'), &first);
+  encoder.Encode(std::string(49, 'a') + "b", &second);
+
+  // A decoder which never saw the keyframe can't do anything.
+  TelemetryDeltaDecoder decoder;
+  std::string decoded;
+  BOOST_TEST(!decoder.Decode(second, &decoded));
+
+  BOOST_TEST(decoder.Decode(first, &decoded));
+  BOOST_TEST(decoder.Decode(second, &decoded));
+  BOOST_TEST(decoded == std::string(49, 'a') + "b");
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDeltaParseRecordTest) {
+  const std::string logged = std::string("\x03") + "xyz";
+  const auto maybe_data = ParseTelemetryDeltaRecord(logged);
+  BOOST_TEST(!!maybe_data);
+  BOOST_TEST(*maybe_data == "xyz");
+
+  BOOST_TEST(!ParseTelemetryDeltaRecord(std::string("\x05") + "xyz"));
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDeltaResetTest) {
+  TelemetryDeltaEncoder encoder{TelemetryDeltaEncoder::Options()};
+
+  std::string encoded;
+  encoder.Encode("abcdef", &encoded);
+  encoder.Encode("abcdeg", &encoded);
+  BOOST_TEST(!TelemetryDeltaDecoder::IsKeyframe(encoded));
+
+  // After a reset, a fresh decoder must be able to start.
+  encoder.Reset();
+  encoder.Encode("abcdeh", &encoded);
+  BOOST_TEST(TelemetryDeltaDecoder::IsKeyframe(encoded));
+
+  TelemetryDeltaDecoder decoder;
+  std::string decoded;
+  BOOST_TEST(decoder.Decode(encoded, &decoded));
+  BOOST_TEST(decoded == "abcdeh");
+}
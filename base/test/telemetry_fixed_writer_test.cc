@@ -0,0 +1,128 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/telemetry_fixed_writer.h"
+
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/base/visitor.h"
+
+#include "base/euler.h"
+#include "base/point3d.h"
+#include "base/quaternion.h"
+
+using namespace mjmech::base;
+
+namespace {
+struct Inner {
+  int16_t value = 0;
+  std::array<float, 2> pair = {};
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(value));
+    a->Visit(MJ_NVP(pair));
+  }
+};
+
+struct Fixed {
+  boost::posix_time::ptime timestamp;
+  int32_t count = 0;
+  uint8_t flags = 0;
+  bool valid = false;
+  double value = 0.0;
+  Point3D position = Point3D::Zero();
+  Quaternion attitude;
+  Euler euler_deg;
+  Inner inner;
+  boost::posix_time::time_duration elapsed;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(timestamp));
+    a->Visit(MJ_NVP(count));
+    a->Visit(MJ_NVP(flags));
+    a->Visit(MJ_NVP(valid));
+    a->Visit(MJ_NVP(value));
+    a->Visit(MJ_NVP(position));
+    a->Visit(MJ_NVP(attitude));
+    a->Visit(MJ_NVP(euler_deg));
+    a->Visit(MJ_NVP(inner));
+    a->Visit(MJ_NVP(elapsed));
+  }
+};
+
+struct Variable {
+  double value = 0.0;
+  std::vector<Inner> items;
+  std::string name;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(value));
+    a->Visit(MJ_NVP(items));
+    a->Visit(MJ_NVP(name));
+  }
+};
+
+template <typename T>
+std::string Generic(const T& data) {
+  mjlib::base::FastOStringStream stream;
+  mjlib::telemetry::BinaryWriteArchive(stream).Accept(&data);
+  return stream.str();
+}
+
+template <typename T>
+std::string Fast(const T& data) {
+  mjlib::base::FastOStringStream stream;
+  WriteTelemetry(stream, &data);
+  return stream.str();
+}
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryFixedWriterLayoutTest) {
+  const auto& layout = TelemetryFixedWriter<Fixed>::layout();
+  BOOST_TEST(layout.fixed);
+  BOOST_TEST(layout.size == 8 + 4 + 1 + 1 + 8 + 24 + 32 + 24 + 10 + 8);
+
+  BOOST_TEST(!TelemetryFixedWriter<Variable>::layout().fixed);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryFixedWriterCompatibleTest) {
+  Fixed data;
+  data.timestamp = boost::posix_time::ptime(
+      boost::gregorian::date(2020, 5, 3),
+      boost::posix_time::microseconds(1234567));
+  data.count = -12345;
+  data.flags = 0xa5;
+  data.valid = true;
+  data.value = 3.5;
+  data.position = Point3D(1.0, -2.0, 3.0);
+  data.attitude = Quaternion(0.5, 0.5, -0.5, 0.5);
+  data.euler_deg.yaw = 90.0;
+  data.inner.value = 321;
+  data.inner.pair = {{1.5f, -2.5f}};
+  data.elapsed = boost::posix_time::milliseconds(250);
+
+  BOOST_TEST(Fast(data) == Generic(data));
+  BOOST_TEST(Fast(data).size() == TelemetryFixedWriter<Fixed>::layout().size);
+
+  // Types which cannot use the fixed path are still written the
+  // usual way.
+  Variable variable;
+  variable.value = 2.0;
+  variable.items.resize(3);
+  variable.name = "test";
+  BOOST_TEST(Fast(variable) == Generic(variable));
+}
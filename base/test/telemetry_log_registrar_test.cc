@@ -14,6 +14,8 @@
 
 #include "base/telemetry_log_registrar.h"
 
+#include <array>
+
 #include <boost/test/auto_unit_test.hpp>
 
 #include "mjlib/base/visitor.h"
@@ -30,6 +32,15 @@ struct TestData {
   }
 };
 
+struct ArrayData {
+  std::array<double, 8> values = {};
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(values));
+  }
+};
+
 using namespace mjmech::base;
 }
 
@@ -41,3 +52,119 @@ BOOST_AUTO_TEST_CASE(TelemetryLogRegistrarTest) {
   // // This should have resulted in a schema being written.
 
 }
+
+BOOST_AUTO_TEST_CASE(TelemetryLogRegistrarStartTest) {
+  boost::asio::io_context context;
+  mjlib::telemetry::FileWriter writer;
+  TelemetryLogRegistrar dut(context, &writer);
+
+  dut.parameters()->policies = "imu=max_hz:100,status=on_change";
+  dut.Start();
+
+  // Errors are reported when starting, not when a record is emitted.
+  dut.parameters()->policies = "imu=sometimes";
+  BOOST_CHECK_THROW(dut.Start(), std::exception);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryLogRegistrarOnChangeTest) {
+  boost::asio::io_context context;
+  mjlib::telemetry::FileWriter writer;
+  writer.Open("test.log");
+  TelemetryLogRegistrar dut(context, &writer);
+  boost::signals2::signal<void (const TestData*)> signal;
+  dut.Register("status", &signal);
+
+  dut.parameters()->policies = "status=on_change";
+  dut.Start();
+
+  TestData data;
+  data.value = 3;
+  signal(&data);
+  signal(&data);
+  data.value = 4;
+  signal(&data);
+  signal(&data);
+
+  BOOST_TEST(writer.data.size() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryLogRegistrarDeltaTest) {
+  boost::asio::io_context context;
+  mjlib::telemetry::FileWriter writer;
+  writer.Open("test.log");
+  TelemetryLogRegistrar dut(context, &writer);
+  boost::signals2::signal<void (const ArrayData*)> signal;
+  dut.Register("status", &signal);
+
+  dut.parameters()->delta_records = "status";
+  dut.parameters()->delta_keyframe_interval = 10;
+  dut.Start();
+
+  ArrayData data;
+  std::string decoded;
+  TelemetryDeltaDecoder decoder;
+  for (int i = 0; i < 20; i++) {
+    data.values[3] = i;
+    signal(&data);
+
+    BOOST_REQUIRE(writer.data.size() == static_cast<size_t>(i + 1));
+    const auto& logged = std::get<2>(writer.data.back());
+    const auto maybe_data = ParseTelemetryDeltaRecord(logged);
+    BOOST_REQUIRE(!!maybe_data);
+    BOOST_TEST(TelemetryDeltaDecoder::IsKeyframe(*maybe_data) ==
+               (i % 10 == 0));
+    BOOST_REQUIRE(decoder.Decode(*maybe_data, &decoded));
+    BOOST_TEST(decoded == std::string(
+                   reinterpret_cast<const char*>(data.values.data()),
+                   sizeof(data.values)));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryLogRegistrarSuspendTest) {
+  boost::asio::io_context context;
+  mjlib::telemetry::FileWriter writer;
+  writer.Open("test.log");
+  TelemetryLogRegistrar dut(context, &writer);
+  boost::signals2::signal<void (const TestData*)> plain;
+  dut.Register("plain", &plain);
+  boost::signals2::signal<void (const ArrayData*)> delta;
+  dut.Register("delta", &delta);
+
+  dut.parameters()->delta_records = "delta";
+  dut.Start();
+
+  TestData plain_data;
+  ArrayData delta_data;
+  plain(&plain_data);
+  delta(&delta_data);
+  delta(&delta_data);
+  BOOST_TEST(writer.data.size() == 3);
+
+  // Nothing is written while the file is being switched, but nothing
+  // is lost either.
+  dut.Suspend();
+  writer.Close();
+  for (int i = 0; i < 3; i++) {
+    plain_data.value = i;
+    plain(&plain_data);
+    delta_data.values[0] = i;
+    delta(&delta_data);
+  }
+  writer.Open("test2.log");
+  BOOST_TEST(writer.data.size() == 3);
+  dut.Resume();
+
+  BOOST_REQUIRE(writer.data.size() == 9);
+  const auto& first_plain = std::get<2>(writer.data[3]);
+  BOOST_TEST(first_plain == std::string("\0\0", 2));
+
+  // The first delta record in the new file is a keyframe.
+  const auto maybe_data = ParseTelemetryDeltaRecord(
+      std::get<2>(writer.data[4]));
+  BOOST_REQUIRE(!!maybe_data);
+  BOOST_TEST(TelemetryDeltaDecoder::IsKeyframe(*maybe_data));
+
+  // Later records go straight to the writer.
+  plain(&plain_data);
+  BOOST_TEST(writer.data.size() == 10);
+}
@@ -0,0 +1,154 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/telemetry_multicast.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjmech::base;
+using Format = TelemetryMulticastFormat;
+
+BOOST_AUTO_TEST_CASE(TelemetryMulticastRoundTripTest) {
+  TelemetryMulticastReceiver dut;
+
+  std::vector<TelemetryMulticastReceiver::Schema> schemas;
+  std::vector<TelemetryMulticastReceiver::Data> datas;
+  dut.schema_signal()->connect([&](auto* schema) {
+      schemas.push_back(*schema);
+    });
+  dut.data_signal()->connect([&](auto* data) { datas.push_back(*data); });
+
+  uint32_t packet_sequence = 0;
+  const auto timestamp = boost::posix_time::ptime(
+      boost::gregorian::date(2020, 5, 1),
+      boost::posix_time::microseconds(1234567));
+
+  std::string payload;
+  for (int i = 0; i < 300; i++) { payload.push_back(static_cast<char>(i)); }
+
+  // Data before the schema is ignored.
+  for (const auto& datagram : Format::MakeDatagrams(
+           Format::kData, &packet_sequence, 3, 0,
+           Format::MakeDataRecord(timestamp, payload), 100)) {
+    dut.Feed(datagram);
+  }
+  BOOST_TEST(datas.empty());
+
+  for (const auto& datagram : Format::MakeDatagrams(
+           Format::kSchema, &packet_sequence, 3, 0,
+           Format::MakeSchemaRecord("qc_status", "schema"), 100)) {
+    dut.Feed(datagram);
+  }
+  BOOST_TEST_REQUIRE(schemas.size() == 1);
+  BOOST_TEST(schemas[0].identifier == 3);
+  BOOST_TEST(schemas[0].name == "qc_status");
+  BOOST_TEST(schemas[0].schema == "schema");
+
+  const auto datagrams = Format::MakeDatagrams(
+      Format::kData, &packet_sequence, 3, 1,
+      Format::MakeDataRecord(timestamp, payload), 100);
+  BOOST_TEST(datagrams.size() == 4);
+  for (const auto& datagram : datagrams) {
+    BOOST_TEST(datagram.size() <= 100);
+    dut.Feed(datagram);
+  }
+  BOOST_TEST_REQUIRE(datas.size() == 1);
+  BOOST_TEST(datas[0].identifier == 3);
+  BOOST_TEST(datas[0].timestamp == timestamp);
+  BOOST_TEST(datas[0].data == payload);
+  BOOST_TEST(dut.stats().lost_datagrams == 0);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryMulticastLossTest) {
+  TelemetryMulticastReceiver dut;
+  int records = 0;
+  dut.data_signal()->connect([&](auto*) { records++; });
+
+  uint32_t packet_sequence = 0;
+  for (const auto& datagram : Format::MakeDatagrams(
+           Format::kSchema, &packet_sequence, 0, 0,
+           Format::MakeSchemaRecord("a", ""), 100)) {
+    dut.Feed(datagram);
+  }
+
+  const auto now = boost::posix_time::ptime(boost::gregorian::date(2020, 5, 1));
+  const std::string payload(150, 'x');
+
+  // Drop the second fragment of the first record.
+  auto first = Format::MakeDatagrams(
+      Format::kData, &packet_sequence, 0, 0,
+      Format::MakeDataRecord(now, payload), 100);
+  BOOST_TEST_REQUIRE(first.size() == 2);
+  dut.Feed(first[0]);
+
+  for (const auto& datagram : Format::MakeDatagrams(
+           Format::kData, &packet_sequence, 0, 1,
+           Format::MakeDataRecord(now, payload), 100)) {
+    dut.Feed(datagram);
+  }
+
+  BOOST_TEST(records == 1);
+  BOOST_TEST(dut.stats().lost_datagrams == 1);
+  BOOST_TEST(dut.stats().incomplete_records == 1);
+
+  dut.Feed("garbage");
+  BOOST_TEST(dut.stats().malformed == 1);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryMulticastRestartTest) {
+  TelemetryMulticastReceiver dut;
+  std::vector<TelemetryMulticastReceiver::Schema> schemas;
+  dut.schema_signal()->connect([&](auto* schema) {
+      schemas.push_back(*schema);
+    });
+  std::vector<TelemetryMulticastReceiver::Data> datas;
+  dut.data_signal()->connect([&](auto* data) { datas.push_back(*data); });
+
+  const auto now = boost::posix_time::ptime(boost::gregorian::date(2020, 5, 1));
+  auto send = [&](uint32_t* packet_sequence, Format::Type type,
+                  uint16_t identifier, const std::string& record) {
+    for (const auto& datagram : Format::MakeDatagrams(
+             type, packet_sequence, identifier, 0, record, 100)) {
+      dut.Feed(datagram);
+    }
+  };
+
+  uint32_t packet_sequence = 5000;
+  send(&packet_sequence, Format::kSchema, 0,
+       Format::MakeSchemaRecord("a", "1"));
+  // Periodic repeats are not reported again.
+  send(&packet_sequence, Format::kSchema, 0,
+       Format::MakeSchemaRecord("a", "1"));
+  BOOST_TEST(schemas.size() == 1);
+
+  // A restarted publisher starts its packet sequence over, so the old
+  // schemas no longer apply until they are sent again.
+  uint32_t restarted = 0;
+  send(&restarted, Format::kData, 0, Format::MakeDataRecord(now, "x"));
+  BOOST_TEST(datas.empty());
+  BOOST_TEST(dut.stats().restarts == 1);
+  BOOST_TEST(dut.stats().lost_datagrams == 0);
+
+  send(&restarted, Format::kSchema, 0, Format::MakeSchemaRecord("a", "1"));
+  BOOST_TEST(schemas.size() == 2);
+  send(&restarted, Format::kData, 0, Format::MakeDataRecord(now, "x"));
+  BOOST_TEST(datas.size() == 1);
+
+  // A changed schema is also a restart.
+  send(&restarted, Format::kSchema, 0, Format::MakeSchemaRecord("b", "2"));
+  BOOST_TEST_REQUIRE(schemas.size() == 3);
+  BOOST_TEST(schemas.back().name == "b");
+  BOOST_TEST(dut.stats().restarts == 2);
+}
@@ -0,0 +1,117 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/telemetry_rate_policy.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjmech::base;
+namespace pt = boost::posix_time;
+
+namespace {
+const pt::ptime kStart(boost::gregorian::date(2020, 1, 1));
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryRatePolicyParseTest) {
+  const auto policies = TelemetryRatePolicy::ParseList(
+      "a=every:4, b = max_hz:12.5,c=on_change,d=triggered:2.5:10,e=full");
+  BOOST_TEST(policies.size() == 5);
+  BOOST_TEST(policies.at("a").mode == TelemetryRatePolicy::kEvery);
+  BOOST_TEST(policies.at("a").every == 4);
+  BOOST_TEST(policies.at("b").mode == TelemetryRatePolicy::kMaxHz);
+  BOOST_TEST(policies.at("b").max_hz == 12.5);
+  BOOST_TEST(policies.at("c").mode == TelemetryRatePolicy::kOnChange);
+  BOOST_TEST(policies.at("d").mode == TelemetryRatePolicy::kTriggered);
+  BOOST_TEST(policies.at("d").window_s == 2.5);
+  BOOST_TEST(policies.at("d").every == 10);
+  BOOST_TEST(policies.at("e").mode == TelemetryRatePolicy::kFull);
+
+  BOOST_TEST(TelemetryRatePolicy::ParseList("").empty());
+
+  BOOST_CHECK_THROW(TelemetryRatePolicy::Parse("every:0"), std::exception);
+  BOOST_CHECK_THROW(TelemetryRatePolicy::Parse("every"), std::exception);
+  BOOST_CHECK_THROW(TelemetryRatePolicy::Parse("max_hz:x"), std::exception);
+  BOOST_CHECK_THROW(TelemetryRatePolicy::Parse("sometimes"), std::exception);
+  BOOST_CHECK_THROW(TelemetryRatePolicy::ParseList("a"), std::exception);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryRatePolicyEveryTest) {
+  TelemetryRatePolicy::Options options;
+  options.mode = TelemetryRatePolicy::kEvery;
+  options.every = 3;
+  TelemetryRatePolicy dut(options);
+
+  int accepted = 0;
+  for (int i = 0; i < 9; i++) {
+    const bool result = dut.Accept(kStart, {});
+    BOOST_TEST(result == (i % 3 == 0));
+    if (result) { accepted++; }
+  }
+  BOOST_TEST(accepted == 3);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryRatePolicyMaxHzTest) {
+  TelemetryRatePolicy::Options options;
+  options.mode = TelemetryRatePolicy::kMaxHz;
+  options.max_hz = 10.0;
+  TelemetryRatePolicy dut(options);
+
+  // Emit at 400Hz for one second.
+  int accepted = 0;
+  for (int i = 0; i < 400; i++) {
+    if (dut.Accept(kStart + pt::microseconds(2500 * i), {})) {
+      accepted++;
+    }
+  }
+  BOOST_TEST(accepted == 10);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryRatePolicyOnChangeTest) {
+  TelemetryRatePolicy::Options options;
+  options.mode = TelemetryRatePolicy::kOnChange;
+  TelemetryRatePolicy dut(options);
+
+  BOOST_TEST(dut.Accept(kStart, {}));
+  BOOST_TEST(dut.AcceptSerialized("abc"));
+  BOOST_TEST(!dut.AcceptSerialized("abc"));
+  BOOST_TEST(dut.AcceptSerialized("abd"));
+  BOOST_TEST(dut.AcceptSerialized("abc"));
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryRatePolicyTriggeredTest) {
+  TelemetryRatePolicy::Options options;
+  options.mode = TelemetryRatePolicy::kTriggered;
+  options.window_s = 1.0;
+  options.every = 10;
+  TelemetryRatePolicy dut(options);
+
+  auto count = [&](pt::ptime start, int samples, pt::ptime trigger) {
+    int result = 0;
+    for (int i = 0; i < samples; i++) {
+      if (dut.Accept(start + pt::milliseconds(10 * i), trigger)) { result++; }
+    }
+    return result;
+  };
+
+  // Without a trigger, we are decimated.
+  BOOST_TEST(count(kStart, 100, {}) == 10);
+
+  // Within the window, everything is accepted.
+  const auto trigger = kStart + pt::seconds(5);
+  BOOST_TEST(count(trigger, 100, trigger) == 100);
+
+  // And after it closes, we go back to decimating.
+  BOOST_TEST(count(trigger + pt::seconds(2), 100, trigger) == 10);
+}
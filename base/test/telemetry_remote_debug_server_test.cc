@@ -0,0 +1,58 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/telemetry_remote_debug_server.h"
+
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjmech::base;
+using DUT = TelemetryRemoteDebugServer;
+
+BOOST_AUTO_TEST_CASE(RemoteDebugFragmentTest) {
+  std::string payload;
+  for (int i = 0; i < 250; i++) { payload.push_back(static_cast<char>(i)); }
+
+  // 7 bytes of header and 3 bytes of name leave 90 per fragment.
+  const auto fragments =
+      DUT::MakeFragments("imu", DUT::kBinary, 0x1234, payload, 100);
+  BOOST_TEST_REQUIRE(fragments.size() == 3);
+
+  std::string reassembled;
+  for (size_t i = 0; i < fragments.size(); i++) {
+    const auto& fragment = fragments[i];
+    BOOST_TEST(fragment.size() <= 100);
+    BOOST_TEST(static_cast<uint8_t>(fragment[0]) == DUT::kFragmentMagic);
+    BOOST_TEST(fragment[1] == DUT::kBinary);
+    BOOST_TEST(fragment[2] == 0x34);
+    BOOST_TEST(fragment[3] == 0x12);
+    BOOST_TEST(fragment[4] == static_cast<char>(i));
+    BOOST_TEST(fragment[5] == 3);
+    BOOST_TEST(fragment[6] == 3);
+    BOOST_TEST(fragment.substr(7, 3) == "imu");
+    reassembled += fragment.substr(DUT::kFragmentHeaderSize + 3);
+  }
+  BOOST_TEST(reassembled == payload);
+}
+
+BOOST_AUTO_TEST_CASE(RemoteDebugFragmentLimitsTest) {
+  // Empty payloads still produce a single datagram.
+  BOOST_TEST(DUT::MakeFragments("a", DUT::kJson, 0, "", 100).size() == 1);
+
+  // No room for any payload.
+  BOOST_TEST(DUT::MakeFragments("abc", DUT::kJson, 0, "x", 10).empty());
+
+  // Too many fragments.
+  BOOST_TEST(DUT::MakeFragments(
+                 "a", DUT::kJson, 0, std::string(300, 'x'), 9).empty());
+}
@@ -0,0 +1,96 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/text_log_ring.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjmech::base;
+
+BOOST_AUTO_TEST_CASE(TextLogRingBasicTest) {
+  TextLogRing dut(4);
+  TextLogRing::Entry entry;
+  BOOST_TEST(!dut.Pop(&entry));
+
+  for (int i = 0; i < 4; i++) {
+    BOOST_TEST(dut.Push([&](auto* e) {
+          e->priority = i;
+          TextLogRing::Entry::Copy(e->message, std::to_string(i));
+        }));
+  }
+
+  // The fifth is dropped and counted.
+  BOOST_TEST(!dut.Push([](auto*) {}));
+  BOOST_TEST(dut.overflows() == 1);
+
+  for (int i = 0; i < 4; i++) {
+    BOOST_TEST_REQUIRE(dut.Pop(&entry));
+    BOOST_TEST(entry.priority == i);
+    BOOST_TEST(std::string(entry.message) == std::to_string(i));
+  }
+  BOOST_TEST(!dut.Pop(&entry));
+
+  // And there is room again.
+  BOOST_TEST(dut.Push([](auto*) {}));
+}
+
+BOOST_AUTO_TEST_CASE(TextLogRingTruncateTest) {
+  TextLogRing::Entry entry;
+  TextLogRing::Entry::Copy(entry.thread, std::string(100, 'x'));
+  BOOST_TEST(std::string(entry.thread) == std::string(15, 'x'));
+}
+
+BOOST_AUTO_TEST_CASE(TextLogRingThreadTest) {
+  TextLogRing dut(64);
+
+  constexpr int kThreads = 4;
+  constexpr int kPerThread = 20000;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&dut, t]() {
+        for (int i = 0; i < kPerThread; i++) {
+          dut.Push([&](auto* e) {
+              e->priority = t;
+              e->timestamp_us = i;
+            });
+        }
+      });
+  }
+
+  // Every entry is either received, in order per producer, or
+  // counted as an overflow.
+  std::vector<int64_t> last(kThreads, -1);
+  int received = 0;
+  auto drain = [&]() {
+    TextLogRing::Entry entry;
+    while (dut.Pop(&entry)) {
+      BOOST_TEST_REQUIRE(entry.timestamp_us > last.at(entry.priority));
+      last[entry.priority] = entry.timestamp_us;
+      received++;
+    }
+  };
+
+  while (received + dut.overflows() < kThreads * kPerThread) {
+    drain();
+  }
+  for (auto& thread : threads) { thread.join(); }
+  drain();
+
+  BOOST_TEST(received + dut.overflows() == kThreads * kPerThread);
+}
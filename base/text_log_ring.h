@@ -0,0 +1,131 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#include <boost/assert.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace mjmech {
+namespace base {
+
+/// A bounded, lock-free queue of fixed size text log entries, which
+/// any number of threads may push to and a single thread drains.
+///
+/// Pushing never allocates or blocks.  If the queue is full, the
+/// entry is discarded and counted instead.
+class TextLogRing : boost::noncopyable {
+ public:
+  struct Entry {
+    int64_t timestamp_us = 0;
+    int priority = 0;
+    char thread[16] = {};
+    char category[48] = {};
+    char message[256] = {};
+
+    /// Copy @p value into @p dest, truncating if necessary, always
+    /// leaving it null terminated.
+    template <size_t N>
+    static void Copy(char (&dest)[N], std::string_view value) {
+      const size_t size = std::min(value.size(), N - 1);
+      std::memcpy(dest, value.data(), size);
+      dest[size] = 0;
+    }
+  };
+
+  /// @p size must be a power of 2.
+  explicit TextLogRing(size_t size)
+      : slots_(new Slot[size]),
+        mask_(size - 1) {
+    BOOST_ASSERT(size >= 2 && (size & (size - 1)) == 0);
+    for (size_t i = 0; i < size; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /// Claim a slot, and invoke @p fill with a pointer to its Entry.
+  /// Return false if the queue was full.  This may be called from
+  /// any thread.
+  template <typename Fill>
+  bool Push(Fill fill) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot* slot = nullptr;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const auto diff =
+          static_cast<std::ptrdiff_t>(sequence) -
+          static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        overflows_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    fill(&slot->entry);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Remove the oldest entry into @p entry.  Return false if there
+  /// were none.  This may only be called from one thread.
+  bool Pop(Entry* entry) {
+    const size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Slot* const slot = &slots_[pos & mask_];
+    const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence != pos + 1) { return false; }
+
+    *entry = slot->entry;
+    slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// The total number of entries discarded because the queue was
+  /// full.
+  uint64_t overflows() const {
+    return overflows_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence{0};
+    Entry entry;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  const size_t mask_;
+
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+  std::atomic<uint64_t> overflows_{0};
+};
+
+}
+}
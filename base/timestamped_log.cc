@@ -23,9 +23,8 @@
 namespace mjmech {
 namespace base {
 
-void OpenMaybeTimestampedLog(mjlib::telemetry::FileWriter* writer,
-                             std::string_view filename,
-                             TimestampMode mode) {
+std::string MakeMaybeTimestampedLogName(std::string_view filename,
+                                        TimestampMode mode) {
   // Make sure that the log file has a date and timestamp somewhere
   // in the name.
   namespace fs = boost::filesystem;
@@ -47,14 +46,19 @@ void OpenMaybeTimestampedLog(mjlib::telemetry::FileWriter* writer,
 
   switch (mode) {
     case kShort: {
-      writer->Open(filename);
-      break;
+      return std::string(filename);
     }
     case kTimestamped: {
-      writer->Open(stamped_path.native());
-      break;
+      return stamped_path.native();
     }
   }
+  return std::string(filename);
+}
+
+void OpenMaybeTimestampedLog(mjlib::telemetry::FileWriter* writer,
+                             std::string_view filename,
+                             TimestampMode mode) {
+  writer->Open(MakeMaybeTimestampedLogName(filename, mode));
 }
 
 }
@@ -26,6 +26,10 @@ enum TimestampMode {
   kShort,
 };
 
+/// Return the file name that OpenMaybeTimestampedLog would use.
+std::string MakeMaybeTimestampedLogName(std::string_view filename,
+                                        TimestampMode);
+
 void OpenMaybeTimestampedLog(mjlib::telemetry::FileWriter* writer,
                              std::string_view filename,
                              TimestampMode);
@@ -51,9 +51,24 @@ class Codec {
     ErrorCheck(avcodec_send_packet(context_, &*packet));
   }
 
+  /// Signal the end of the stream, so that GetFrame returns any frames
+  /// the decoder is still holding.  No more packets may be sent until
+  /// Flush is called.
+  void SendFlush() {
+    ErrorCheck(avcodec_send_packet(context_, nullptr));
+  }
+
+  /// Discard any buffered packets and frames, as is required after
+  /// seeking.
+  void Flush() {
+    avcodec_flush_buffers(context_);
+  }
+
+  /// Return nothing if another packet is needed, or after SendFlush,
+  /// once every frame has been returned.
   std::optional<Frame::Ref> GetFrame(Frame* frame) {
     const int ret = avcodec_receive_frame(context_, frame->get());
-    if (ret == AVERROR(EAGAIN)) { return {}; }
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) { return {}; }
     ErrorCheck(ret);
     return Frame::Ref::MakeInternal(frame->get());
   }
@@ -0,0 +1,366 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mjlib/base/system_error.h"
+
+#include "ffmpeg/codec.h"
+#include "ffmpeg/file.h"
+#include "ffmpeg/frame.h"
+#include "ffmpeg/packet.h"
+#include "ffmpeg/stream.h"
+#include "ffmpeg/swscale.h"
+
+namespace mjmech {
+namespace ffmpeg {
+
+/// Decodes the best video stream of a file on a background thread,
+/// keeping the converted frames around a requested position.
+///
+/// When opened, the packets of the whole stream are read, without
+/// decoding, to find the timestamp of every frame and which are
+/// keyframes.  That lets requests anywhere in the file be served by
+/// seeking to the closest preceding keyframe.
+class FrameCache {
+ public:
+  struct Options {
+    // The size of the converted frames, or the size of the video if
+    // not set.
+    std::optional<Eigen::Vector2i> size;
+    AVPixelFormat format = AV_PIX_FMT_RGB24;
+
+    // How many frames to keep after and including the requested one.
+    int ahead = 24;
+
+    // How many frames to keep before the requested one.
+    int behind = 8;
+
+    Options() {}
+  };
+
+  /// A converted frame, with rows packed.
+  struct Image {
+    int64_t pts = 0;
+    std::vector<uint8_t> data;
+  };
+
+  FrameCache(std::string_view filename, const Options& options = {})
+      : options_(options),
+        file_(filename),
+        stream_(file_.FindBestStream(File::kVideo)),
+        codec_(stream_),
+        size_(options.size.value_or(codec_.size())) {
+    BuildIndex();
+    if (frames_.empty()) {
+      throw mjlib::base::system_error::einval(
+          "Could not find frames in video");
+    }
+
+    dest_ptr_.emplace(dest_frame_.Allocate(options_.format, size_, 1));
+    thread_ = std::thread([this]() { Run(); });
+  }
+
+  ~FrameCache() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      done_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+  }
+
+  FrameCache(const FrameCache&) = delete;
+  FrameCache& operator=(const FrameCache&) = delete;
+
+  Eigen::Vector2i size() const { return size_; }
+  AVRational time_base() const { return stream_.av_stream()->time_base; }
+
+  /// The timestamps of every frame, in presentation order.
+  const std::vector<int64_t>& frames() const { return frames_; }
+
+  /// Indices into frames() of each keyframe.
+  const std::vector<size_t>& keyframes() const { return keyframes_; }
+
+  /// Request the last frame at or before @p pts, and the frames
+  /// around it.  Return it if it has been decoded, otherwise nullptr.
+  std::shared_ptr<const Image> Get(int64_t pts) {
+    const size_t index = FrameIndex(pts);
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (index != target_) {
+      target_ = index;
+      condition_.notify_all();
+    }
+    const auto it = images_.find(index);
+    if (it == images_.end()) { return {}; }
+    return it->second;
+  }
+
+ private:
+  size_t FrameIndex(int64_t pts) const {
+    const auto it = std::upper_bound(frames_.begin(), frames_.end(), pts);
+    return (it == frames_.begin()) ? 0 : (it - frames_.begin() - 1);
+  }
+
+  void BuildIndex() {
+    std::set<int64_t> key_pts;
+    while (true) {
+      auto maybe_pref = ReadPacket();
+      if (!maybe_pref) { break; }
+      const auto& packet = **maybe_pref;
+      if (packet.pts == AV_NOPTS_VALUE) { continue; }
+      frames_.push_back(packet.pts);
+      if (packet.flags & AV_PKT_FLAG_KEY) { key_pts.insert(packet.pts); }
+    }
+
+    // Packets are stored in decode order, which may differ from
+    // presentation order.
+    std::sort(frames_.begin(), frames_.end());
+    frames_.erase(std::unique(frames_.begin(), frames_.end()), frames_.end());
+    for (size_t i = 0; i < frames_.size(); i++) {
+      if (key_pts.count(frames_[i])) { keyframes_.push_back(i); }
+    }
+    if (keyframes_.empty() || keyframes_.front() != 0) {
+      keyframes_.insert(keyframes_.begin(), 0);
+    }
+
+    if (!frames_.empty()) { Seek(0); }
+  }
+
+  /// Return the next packet of our stream, or nothing at the end of
+  /// the file.
+  std::optional<Packet::Ref> ReadPacket() {
+    while (true) {
+      std::optional<Packet::Ref> maybe_pref;
+      try {
+        maybe_pref = file_.Read(&packet_);
+      } catch (mjlib::base::system_error&) {
+        return {};
+      }
+      if (!maybe_pref) { return {}; }
+      if ((*maybe_pref)->stream_index != stream_.av_stream()->index) {
+        continue;
+      }
+      return maybe_pref;
+    }
+  }
+
+  /// Position the decoder so the next frame is at or before
+  /// frame @p index.
+  void Seek(size_t index) {
+    const auto it = std::upper_bound(
+        keyframes_.begin(), keyframes_.end(), index);
+    const size_t keyframe = *std::prev(it);
+
+    File::SeekOptions seek_options;
+    seek_options.backward = true;
+    file_.Seek(stream_, frames_[keyframe], seek_options);
+    codec_.Flush();
+    draining_ = false;
+    next_ = keyframe;
+  }
+
+  /// Decode the next frame, converting it only if @p wanted says to.
+  /// Return its index, or nothing at the end of the file.
+  template <typename Wanted>
+  std::optional<size_t> DecodeOne(Wanted wanted) {
+    while (true) {
+      auto maybe_fref = codec_.GetFrame(&frame_);
+      if (maybe_fref) {
+        const auto& frame = **maybe_fref;
+        const int64_t pts = (frame.pts != AV_NOPTS_VALUE) ?
+            frame.pts : frame.best_effort_timestamp;
+        const size_t index = FrameIndex(pts);
+        if (!wanted(index)) { return index; }
+
+        if (!swscale_) {
+          swscale_.emplace(codec_, size_, options_.format,
+                           Swscale::kBicubic);
+        }
+        swscale_->Scale(*maybe_fref, *dest_ptr_);
+
+        auto image = std::make_shared<Image>();
+        image->pts = frames_[index];
+        const auto& dest = **dest_ptr_;
+        const int row_size =
+            av_image_get_linesize(options_.format, size_.x(), 0);
+        image->data.resize(row_size * size_.y());
+        for (int y = 0; y < size_.y(); y++) {
+          std::memcpy(image->data.data() + y * row_size,
+                      dest.data[0] + y * dest.linesize[0], row_size);
+        }
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        images_[index] = std::move(image);
+        return index;
+      }
+
+      // Once drained, the decoder has nothing left.
+      if (draining_) { return {}; }
+
+      auto maybe_pref = ReadPacket();
+      if (!maybe_pref) {
+        // The decoder may still hold frames which are waiting on
+        // packets that will never come.
+        codec_.SendFlush();
+        draining_ = true;
+        continue;
+      }
+      codec_.SendPacket(*maybe_pref);
+    }
+  }
+
+  /// Return the first frame within the window around @p target which
+  /// is neither decoded nor known to be unavailable.  Frames at and
+  /// after the target are preferred.
+  std::optional<size_t> FindMissing(size_t target) const {
+    const size_t size = frames_.size();
+    const size_t end = std::min(size, target + options_.ahead);
+    for (size_t i = target; i < end; i++) {
+      if (images_.count(i) == 0 && unavailable_.count(i) == 0) { return i; }
+    }
+    const size_t begin = target - std::min<size_t>(target, options_.behind);
+    for (size_t i = target; i > begin; i--) {
+      if (images_.count(i - 1) == 0 && unavailable_.count(i - 1) == 0) {
+        return i - 1;
+      }
+    }
+    return {};
+  }
+
+  bool InWindow(size_t target, size_t index) const {
+    return index + options_.behind >= target &&
+        index < target + options_.ahead;
+  }
+
+  void Run() {
+    while (true) {
+      size_t target = 0;
+      size_t missing = 0;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+          if (done_) { return; }
+
+          target = target_;
+          for (auto it = images_.begin(); it != images_.end();) {
+            if (InWindow(target, it->first)) {
+              ++it;
+            } else {
+              it = images_.erase(it);
+            }
+          }
+
+          const auto maybe_missing = FindMissing(target);
+          if (maybe_missing) {
+            missing = *maybe_missing;
+            break;
+          }
+          condition_.wait(lock);
+        }
+      }
+
+      // Decoding forward is cheaper than seeking, unless there is a
+      // keyframe in the way.
+      const auto keyframe_it = std::upper_bound(
+          keyframes_.begin(), keyframes_.end(), missing);
+      const size_t keyframe = *std::prev(keyframe_it);
+      if (missing < next_ || keyframe > next_) { Seek(missing); }
+
+      // Decode until we get to it, or the target moves elsewhere.
+      while (true) {
+        const auto maybe_index = DecodeOne([&](size_t index) {
+            std::lock_guard<std::mutex> guard(mutex_);
+            return InWindow(target_, index) && images_.count(index) == 0;
+          });
+        if (!maybe_index) {
+          // The end of the file.
+          std::lock_guard<std::mutex> guard(mutex_);
+          for (size_t i = next_; i < frames_.size(); i++) {
+            if (images_.count(i) == 0) { unavailable_.insert(i); }
+          }
+          next_ = frames_.size();
+          break;
+        }
+        const size_t index = *maybe_index;
+        next_ = index + 1;
+        if (index >= missing) {
+          std::lock_guard<std::mutex> guard(mutex_);
+          if (index > missing && images_.count(missing) == 0) {
+            // The decoder skipped over it.
+            unavailable_.insert(missing);
+          }
+          break;
+        }
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (target_ != target) { break; }
+      }
+    }
+  }
+
+  const Options options_;
+
+  // Only used by the constructor, then the background thread.
+  File file_;
+  Stream stream_;
+  Codec codec_;
+  const Eigen::Vector2i size_;
+  std::optional<Swscale> swscale_;
+  Packet packet_;
+  Frame frame_;
+  Frame dest_frame_;
+  std::optional<Frame::Ref> dest_ptr_;
+  size_t next_ = 0;
+
+  // True once the end of the file has been reached and the decoder
+  // told so, until the next seek.
+  bool draining_ = false;
+
+  // Constant once constructed.
+  std::vector<int64_t> frames_;
+  std::vector<size_t> keyframes_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool done_ = false;
+  size_t target_ = 0;
+  std::map<size_t, std::shared_ptr<const Image>> images_;
+  std::set<size_t> unavailable_;
+
+  std::thread thread_;
+};
+
+}
+}
@@ -0,0 +1,78 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ffmpeg/frame_cache.h"
+
+#include <chrono>
+#include <thread>
+
+#include <boost/test/auto_unit_test.hpp>
+
+#include "base/runfiles.h"
+
+using namespace mjmech::ffmpeg;
+
+namespace {
+std::shared_ptr<const FrameCache::Image> WaitFor(FrameCache* dut,
+                                                 int64_t pts) {
+  for (int i = 0; i < 1000; i++) {
+    auto result = dut->Get(pts);
+    if (result) { return result; }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return {};
+}
+}
+
+BOOST_AUTO_TEST_CASE(FrameCacheTest) {
+  mjmech::base::TestRunfiles runfiles;
+
+  const std::string path = "ffmpeg/test/data/sample_log.mp4";
+  FrameCache dut{runfiles.Rlocation(path), []() {
+      FrameCache::Options options;
+      options.size = Eigen::Vector2i(640, 480);
+      return options;
+    }()};
+
+  BOOST_TEST(dut.size() == Eigen::Vector2i(640, 480));
+
+  const auto& frames = dut.frames();
+  BOOST_TEST_REQUIRE(frames.size() > 10);
+  BOOST_TEST(std::is_sorted(frames.begin(), frames.end()));
+  BOOST_TEST_REQUIRE(!dut.keyframes().empty());
+  BOOST_TEST(dut.keyframes().front() == 0);
+
+  // Step forward, then jump back.
+  for (const size_t index : {0, 1, 2, 10, 3}) {
+    const auto image = WaitFor(&dut, frames[index]);
+    BOOST_TEST_REQUIRE(!!image);
+    BOOST_TEST(image->pts == frames[index]);
+    BOOST_TEST(image->data.size() == 640u * 480u * 3u);
+  }
+
+  // Times between frames give the earlier one.
+  {
+    const auto image = WaitFor(&dut, frames[5] + (frames[6] - frames[5]) / 2);
+    BOOST_TEST_REQUIRE(!!image);
+    BOOST_TEST(image->pts == frames[5]);
+  }
+
+  // The final frames are only returned by the decoder once it is
+  // told the file has ended.
+  {
+    const auto image = WaitFor(&dut, frames.back());
+    BOOST_TEST_REQUIRE(!!image);
+    BOOST_TEST(image->pts == frames.back());
+  }
+}
@@ -0,0 +1,214 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gl/instanced_mesh_render_list.h"
+
+namespace mjmech {
+namespace gl {
+
+namespace {
+constexpr const char* kVertexShaderSource = R"XX(
+
+#version 400
+
+in vec3 inVertex;
+in vec3 inNormal;
+in vec4 inColor;
+in mat4 instanceMatrix;
+in vec4 instanceColor;
+uniform mat4 projMatrix;
+uniform mat4 viewMatrix;
+uniform mat4 modelMatrix;
+out vec4 fragColor;
+out vec3 fragNormal;
+out vec3 fragPos;
+void main(){
+  fragColor = inColor * instanceColor;
+  fragNormal = normalize(
+      transpose(inverse(mat3(instanceMatrix))) * inNormal);
+
+  // Switch things to a right handed view coordinate system.
+  vec4 world = instanceMatrix * vec4(inVertex, 1.0);
+  vec4 vertex = vec4(world.x, world.y, -world.z, 1.0);
+  fragPos = vec3(viewMatrix * modelMatrix * vertex);
+  gl_Position = projMatrix * viewMatrix * modelMatrix * vertex;
+}
+
+)XX";
+
+constexpr const char* kFragmentShaderSource = R"XX(
+
+#version 400
+in vec4 fragColor;
+in vec3 fragNormal;
+in vec3 fragPos;
+uniform float ambient;
+uniform vec3 lightPos;
+void main() {
+  vec3 lightDir = normalize(lightPos - fragPos);
+  float diff = max(dot(fragNormal, lightDir), 0);
+  float light = min(diff + ambient, 1.0);
+  vec4 lightModel = vec4(light * vec3(1.0, 1.0, 1.0), 1.0);
+  gl_FragColor = lightModel * fragColor;
+}
+
+)XX";
+}
+
+InstancedMeshRenderList::InstancedMeshRenderList()
+    : vertex_shader_(kVertexShaderSource, GL_VERTEX_SHADER),
+      fragment_shader_(kFragmentShaderSource, GL_FRAGMENT_SHADER),
+      program_(vertex_shader_, fragment_shader_) {
+  program_.use();
+  vao_.bind();
+
+  vertices_.bind(GL_ARRAY_BUFFER);
+
+  program_.VertexAttribPointer(
+      program_.attribute("inVertex"), 3, GL_FLOAT, GL_FALSE, 40, 0);
+  program_.VertexAttribPointer(
+      program_.attribute("inNormal"), 3, GL_FLOAT, GL_FALSE, 40, 12);
+  program_.VertexAttribPointer(
+      program_.attribute("inColor"), 4, GL_FLOAT, GL_FALSE, 40, 24);
+
+  vao_.unbind();
+
+  program_.SetUniform(program_.uniform("lightPos"),
+                      Eigen::Vector3f({-1000, 0, -3000}));
+  SetAmbient(0.3f);
+}
+
+InstancedMeshRenderList::MeshId InstancedMeshRenderList::AddMesh(
+    const std::vector<Vertex>& vertices,
+    const std::vector<uint32_t>& indices) {
+  Mesh mesh;
+  mesh.first_vertex = vertex_data_.size() / 10;
+  mesh.first_index = indices_.size();
+  mesh.index_count = indices.size();
+
+  for (const auto& vertex : vertices) {
+    vertex_data_.insert(vertex_data_.end(),
+                        vertex.point.data(), vertex.point.data() + 3);
+    vertex_data_.insert(vertex_data_.end(),
+                        vertex.normal.data(), vertex.normal.data() + 3);
+    vertex_data_.insert(vertex_data_.end(),
+                        vertex.rgba.data(), vertex.rgba.data() + 4);
+  }
+  indices_.insert(indices_.end(), indices.begin(), indices.end());
+
+  // Meshes are only added at startup, so the whole of each buffer is
+  // just uploaded again.
+  vao_.bind();
+  vertices_.set_vector(GL_ARRAY_BUFFER, vertex_data_, GL_STATIC_DRAW);
+  elements_.set_vector(GL_ELEMENT_ARRAY_BUFFER, indices_, GL_STATIC_DRAW);
+  vao_.unbind();
+
+  meshes_.push_back(std::move(mesh));
+  return meshes_.size() - 1;
+}
+
+void InstancedMeshRenderList::Reset() {
+  for (auto& mesh : meshes_) { mesh.instances.clear(); }
+}
+
+void InstancedMeshRenderList::AddInstance(MeshId mesh_id,
+                                          const Eigen::Matrix4f& transform,
+                                          const Eigen::Vector4f& rgba) {
+  auto& instances = meshes_.at(mesh_id).instances;
+  const Eigen::Matrix4f full = transform_ * transform;
+  instances.insert(instances.end(), full.data(), full.data() + 16);
+  instances.insert(instances.end(), rgba.data(), rgba.data() + 4);
+}
+
+void InstancedMeshRenderList::Upload() {
+  instance_data_.clear();
+  for (auto& mesh : meshes_) {
+    mesh.first_instance = instance_data_.size() / kInstanceFloats;
+    mesh.instance_count = mesh.instances.size() / kInstanceFloats;
+    instance_data_.insert(instance_data_.end(),
+                          mesh.instances.begin(), mesh.instances.end());
+  }
+  if (instance_data_.empty()) { return; }
+
+  instances_.set_vector(GL_ARRAY_BUFFER, instance_data_, GL_STREAM_DRAW);
+}
+
+void InstancedMeshRenderList::SetAmbient(float value) {
+  program_.use();
+  program_.SetUniform(program_.uniform("ambient"), value);
+}
+
+void InstancedMeshRenderList::SetProjMatrix(const Eigen::Matrix4f& matrix) {
+  program_.use();
+  program_.SetUniform(program_.uniform("projMatrix"), matrix);
+}
+
+void InstancedMeshRenderList::SetViewMatrix(const Eigen::Matrix4f& matrix) {
+  program_.use();
+  program_.SetUniform(program_.uniform("viewMatrix"), matrix);
+}
+
+void InstancedMeshRenderList::SetModelMatrix(const Eigen::Matrix4f& matrix) {
+  program_.use();
+  program_.SetUniform(program_.uniform("modelMatrix"), matrix);
+}
+
+void InstancedMeshRenderList::SetLightPos(const Eigen::Vector3f& position) {
+  program_.use();
+  program_.SetUniform(program_.uniform("lightPos"), position);
+}
+
+void InstancedMeshRenderList::Render() {
+  program_.use();
+  vao_.bind();
+  instances_.bind(GL_ARRAY_BUFFER);
+
+  // A mat4 attribute occupies 4 consecutive locations, one per
+  // column.
+  const GLuint matrix = program_.attribute("instanceMatrix").get();
+  const GLuint color = program_.attribute("instanceColor").get();
+  constexpr int kStride = kInstanceFloats * sizeof(float);
+
+  for (const auto& mesh : meshes_) {
+    if (mesh.instance_count == 0) { continue; }
+
+    // GL 4.0 has no base instance, so the attributes are pointed at
+    // this mesh's instances instead.
+    const int offset = mesh.first_instance * kStride;
+    for (GLuint i = 0; i < 4; i++) {
+      program_.VertexAttribPointer(
+          Attribute(matrix + i), 4, GL_FLOAT, GL_FALSE, kStride,
+          offset + i * 4 * sizeof(float));
+      glVertexAttribDivisor(matrix + i, 1);
+    }
+    program_.VertexAttribPointer(
+        Attribute(color), 4, GL_FLOAT, GL_FALSE, kStride,
+        offset + 16 * sizeof(float));
+    glVertexAttribDivisor(color, 1);
+
+    glDrawElementsInstancedBaseVertex(
+        GL_TRIANGLES, mesh.index_count, GL_UNSIGNED_INT,
+        reinterpret_cast<void*>(mesh.first_index * sizeof(uint32_t)),
+        mesh.instance_count, mesh.first_vertex);
+  }
+
+  vao_.unbind();
+}
+
+void InstancedMeshRenderList::SetTransform(const Eigen::Matrix4f& transform) {
+  transform_ = transform;
+}
+
+}
+}
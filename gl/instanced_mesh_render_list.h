@@ -0,0 +1,112 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "gl/program.h"
+#include "gl/shader.h"
+#include "gl/vertex_array_object.h"
+#include "gl/vertex_buffer_object.h"
+
+namespace mjmech {
+namespace gl {
+
+/// Renders any number of copies of a fixed set of meshes, each with
+/// its own transform and color.
+///
+/// Meshes are uploaded to the GPU once, when they are added.  Each
+/// frame, only the per-instance transforms and colors are uploaded,
+/// and each mesh is drawn with a single instanced call.  It renders
+/// into the same right-handed coordinate system as
+/// SimpleTextureRenderList.
+class InstancedMeshRenderList {
+ public:
+  using MeshId = uint32_t;
+
+  struct Vertex {
+    Eigen::Vector3f point;
+    Eigen::Vector3f normal;
+    Eigen::Vector4f rgba;
+  };
+
+  InstancedMeshRenderList();
+
+  /// Add a mesh made of the triangles in @p indices.  It is
+  /// multiplied by the color of each instance.
+  MeshId AddMesh(const std::vector<Vertex>& vertices,
+                 const std::vector<uint32_t>& indices);
+
+  /// Get ready for the next rendering frame.
+  void Reset();
+
+  /// Queue a copy of @p mesh, transformed by @p transform, then the
+  /// current transform.
+  void AddInstance(MeshId mesh,
+                   const Eigen::Matrix4f& transform,
+                   const Eigen::Vector4f& rgba);
+
+  /// Upload the instances to the GPU.
+  void Upload();
+
+  /// Set the various uniforms.
+  void SetAmbient(float value);
+  void SetProjMatrix(const Eigen::Matrix4f&);
+  void SetViewMatrix(const Eigen::Matrix4f&);
+  void SetModelMatrix(const Eigen::Matrix4f&);
+  void SetLightPos(const Eigen::Vector3f&);
+
+  /// Draw all instances currently uploaded to the GPU.
+  void Render();
+
+  void SetTransform(const Eigen::Matrix4f&);
+
+ private:
+  struct Mesh {
+    uint32_t first_vertex = 0;
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+
+    // The instances of this mesh for the current frame, each a
+    // column-major 4x4 transform followed by a color.
+    std::vector<float> instances;
+
+    // Where they start in the uploaded buffer.
+    uint32_t first_instance = 0;
+    uint32_t instance_count = 0;
+  };
+
+  static constexpr int kInstanceFloats = 20;
+
+  std::vector<float> vertex_data_;
+  std::vector<uint32_t> indices_;
+  std::vector<Mesh> meshes_;
+  std::vector<float> instance_data_;
+
+  Eigen::Matrix4f transform_{Eigen::Matrix4f::Identity()};
+
+  Shader vertex_shader_;
+  Shader fragment_shader_;
+  Program program_;
+  VertexArrayObject vao_;
+  VertexBufferObject vertices_;
+  VertexBufferObject elements_;
+  VertexBufferObject instances_;
+};
+
+}
+}
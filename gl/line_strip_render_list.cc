@@ -0,0 +1,110 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gl/line_strip_render_list.h"
+
+namespace mjmech {
+namespace gl {
+
+namespace {
+constexpr const char* kVertexShaderSource =
+      "#version 400\n"
+      "in vec3 inVertex;\n"
+      "in vec4 inColor;\n"
+      "uniform mat4 projMatrix;\n"
+      "uniform mat4 viewMatrix;\n"
+      "uniform mat4 modelMatrix;\n"
+      "uniform mat4 transformMatrix;\n"
+      "out vec4 fragColor;\n"
+      "void main() {\n"
+      "  fragColor = inColor;\n"
+      "  vec4 p = transformMatrix * vec4(inVertex, 1.0);\n"
+      "  vec4 vertex = vec4(p.x, p.y, -p.z, 1.0);\n"
+      "  gl_Position = projMatrix * viewMatrix * modelMatrix * vertex;\n"
+      "}\n"
+      ;
+
+constexpr const char* kFragShaderSource =
+      "#version 400\n"
+      "in vec4 fragColor;\n"
+      "void main() {\n"
+      "  gl_FragColor = fragColor;\n"
+      "}\n"
+      ;
+
+}
+
+LineStripRenderList::LineStripRenderList()
+    : vertex_shader_{kVertexShaderSource, GL_VERTEX_SHADER},
+      fragment_shader_{kFragShaderSource, GL_FRAGMENT_SHADER},
+      program_{vertex_shader_, fragment_shader_} {
+  program_.use();
+  vao_.bind();
+
+  vertices_.bind(GL_ARRAY_BUFFER);
+
+  program_.VertexAttribPointer(
+      program_.attribute("inVertex"), 3, GL_FLOAT, GL_FALSE, 28, 0);
+  program_.VertexAttribPointer(
+      program_.attribute("inColor"), 4, GL_FLOAT, GL_FALSE, 28, 12);
+
+  vao_.unbind();
+
+  SetTransform(Eigen::Matrix4f::Identity());
+}
+
+void LineStripRenderList::Reset() {
+  data_.clear();
+  firsts_.clear();
+  counts_.clear();
+}
+
+void LineStripRenderList::Upload() {
+  if (data_.empty()) { return; }
+  vertices_.set_vector(GL_ARRAY_BUFFER, data_, GL_DYNAMIC_DRAW);
+}
+
+void LineStripRenderList::SetProjMatrix(const Eigen::Matrix4f& matrix) {
+  program_.use();
+  program_.SetUniform(program_.uniform("projMatrix"), matrix);
+}
+
+void LineStripRenderList::SetViewMatrix(const Eigen::Matrix4f& matrix) {
+  program_.use();
+  program_.SetUniform(program_.uniform("viewMatrix"), matrix);
+}
+
+void LineStripRenderList::SetModelMatrix(const Eigen::Matrix4f& matrix) {
+  program_.use();
+  program_.SetUniform(program_.uniform("modelMatrix"), matrix);
+}
+
+void LineStripRenderList::SetTransform(const Eigen::Matrix4f& matrix) {
+  program_.use();
+  program_.SetUniform(program_.uniform("transformMatrix"), matrix);
+}
+
+void LineStripRenderList::Render() {
+  if (counts_.empty()) { return; }
+
+  program_.use();
+  vao_.bind();
+
+  glMultiDrawArrays(GL_LINE_STRIP, firsts_.data(), counts_.data(),
+                    counts_.size());
+  vao_.unbind();
+}
+
+}
+}
@@ -0,0 +1,87 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "gl/program.h"
+#include "gl/shader.h"
+#include "gl/vertex_array_object.h"
+#include "gl/vertex_buffer_object.h"
+
+namespace mjmech {
+namespace gl {
+
+/// Renders polylines, each drawn as a single line strip.
+///
+/// Unlike SimpleLineRenderList, the transform is applied on the GPU,
+/// so the geometry only needs to be uploaded again when it changes,
+/// not when the frame it is drawn in moves.
+class LineStripRenderList {
+ public:
+  LineStripRenderList();
+
+  /// Remove all strips.
+  void Reset();
+
+  /// Add a strip through the points in [@p begin, @p end).
+  template <typename Iterator>
+  void AddStrip(Iterator begin, Iterator end, const Eigen::Vector4f& rgba) {
+    const GLint first = data_.size() / 7;
+    for (auto it = begin; it != end; ++it) {
+      const Eigen::Vector3f& p = *it;
+      data_.insert(data_.end(), p.data(), p.data() + 3);
+      data_.insert(data_.end(), rgba.data(), rgba.data() + 4);
+    }
+    const GLsizei count = data_.size() / 7 - first;
+    if (count < 2) {
+      data_.resize(first * 7);
+      return;
+    }
+    firsts_.push_back(first);
+    counts_.push_back(count);
+  }
+
+  /// Upload all geometry to the GPU.
+  void Upload();
+
+  void SetProjMatrix(const Eigen::Matrix4f&);
+  void SetViewMatrix(const Eigen::Matrix4f&);
+  void SetModelMatrix(const Eigen::Matrix4f&);
+
+  /// Unlike the other matrices, this takes effect for all strips,
+  /// including those already uploaded.
+  void SetTransform(const Eigen::Matrix4f&);
+
+  /// Draw all strips currently uploaded to the GPU.
+  void Render();
+
+ private:
+  std::vector<float> data_;
+  std::vector<GLint> firsts_;
+  std::vector<GLsizei> counts_;
+
+  Shader vertex_shader_;
+  Shader fragment_shader_;
+  Program program_;
+
+  VertexArrayObject vao_;
+  VertexBufferObject vertices_;
+};
+
+}
+}
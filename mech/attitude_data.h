@@ -14,6 +14,11 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
 #include "mjlib/base/visitor.h"
 
 #include "base/euler.h"
@@ -48,5 +53,54 @@ struct AttitudeData {
   }
 };
 
+/// All the IMU samples received over one control cycle, oldest
+/// first.
+struct ImuBatch {
+  static constexpr int kMaxSamples = 8;
+
+  struct Sample {
+    boost::posix_time::ptime timestamp;
+    base::Quaternion attitude;
+    base::Point3D rate_dps;
+    base::Point3D accel_mps2;
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(timestamp));
+      a->Visit(MJ_NVP(attitude));
+      a->Visit(MJ_NVP(rate_dps));
+      a->Visit(MJ_NVP(accel_mps2));
+    }
+  };
+
+  boost::posix_time::ptime timestamp;
+
+  // Only the first 'count' entries of 'samples' are valid.
+  int count = 0;
+
+  // The number of samples discarded because the batch was full.  The
+  // oldest are discarded first.
+  int dropped = 0;
+
+  std::array<Sample, kMaxSamples> samples = {};
+
+  void Add(const Sample& sample) {
+    if (count == kMaxSamples) {
+      std::move(samples.begin() + 1, samples.end(), samples.begin());
+      count--;
+      dropped++;
+    }
+    samples[count++] = sample;
+  }
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(timestamp));
+    a->Visit(MJ_NVP(count));
+    a->Visit(MJ_NVP(dropped));
+    a->Visit(MJ_NVP(samples));
+  }
+};
+
 }
 }
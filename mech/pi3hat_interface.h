@@ -16,6 +16,7 @@
 
 #include "mjlib/multiplex/asio_client.h"
 
+#include "mech/attitude_data.h"
 #include "mech/imu_client.h"
 #include "mech/rf_client.h"
 
@@ -30,10 +31,19 @@ class Pi3hatInterface : public ImuClient,
  public:
   ~Pi3hatInterface() override {}
 
+  /// Send @p request and collect the replies, while also reading the
+  /// IMU.  The most recent IMU sample is stored in the AttitudeData,
+  /// and if the ImuBatch is non-null, every sample received since the
+  /// previous Cycle is stored there.
   virtual void Cycle(
       AttitudeData*,
+      ImuBatch*,
       const Request*, Reply*,
       mjlib::io::ErrorCallback callback) = 0;
+
+  /// Return true if an ImuBatch can hold more samples than the one
+  /// read during its own Cycle.
+  virtual bool imu_batching() const { return false; }
 };
 
 }
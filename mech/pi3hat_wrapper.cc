@@ -14,11 +14,17 @@
 
 #include "mech/pi3hat_wrapper.h"
 
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cmath>
 #include <functional>
+#include <map>
 #include <thread>
 
 #include <fmt/format.h>
 
+#include <boost/asio/buffer.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/post.hpp>
 
@@ -45,6 +51,55 @@ template <typename T>
 uint32_t u32(T value) {
   return static_cast<uint32_t>(value);
 }
+
+/// Copy up to @p size bytes from @p data into the buffer sequence
+/// @p buffers, starting @p offset bytes into the sequence.  Return
+/// the number of bytes copied.
+template <typename Sequence>
+size_t ScatterCopy(const Sequence& buffers, size_t offset,
+                   const void* data, size_t size) {
+  size_t result = 0;
+  for (auto it = boost::asio::buffer_sequence_begin(buffers);
+       it != boost::asio::buffer_sequence_end(buffers) && result < size;
+       ++it) {
+    boost::asio::mutable_buffer buffer = *it;
+    if (offset >= buffer.size()) {
+      offset -= buffer.size();
+      continue;
+    }
+    buffer += offset;
+    offset = 0;
+    result += boost::asio::buffer_copy(
+        buffer,
+        boost::asio::buffer(static_cast<const char*>(data) + result,
+                            size - result));
+  }
+  return result;
+}
+
+/// The inverse of ScatterCopy, gather @p size bytes starting @p
+/// offset bytes into @p buffers.
+template <typename Sequence>
+size_t GatherCopy(const Sequence& buffers, size_t offset,
+                  void* data, size_t size) {
+  size_t result = 0;
+  for (auto it = boost::asio::buffer_sequence_begin(buffers);
+       it != boost::asio::buffer_sequence_end(buffers) && result < size;
+       ++it) {
+    boost::asio::const_buffer buffer = *it;
+    if (offset >= buffer.size()) {
+      offset -= buffer.size();
+      continue;
+    }
+    buffer += offset;
+    offset = 0;
+    result += boost::asio::buffer_copy(
+        boost::asio::buffer(static_cast<char*>(data) + result,
+                            size - result),
+        buffer);
+  }
+  return result;
+}
 }
 
 #ifdef COM_GITHUB_MJBOTS_RASPBERRYPI
@@ -125,6 +180,7 @@ class Pi3hatWrapper::Impl {
 
   void Cycle(
       AttitudeData* attitude,
+      ImuBatch* imu_batch,
       const Request* request,
       Reply* reply,
       mjlib::io::ErrorCallback callback) {
@@ -137,14 +193,17 @@ class Pi3hatWrapper::Impl {
 
     boost::asio::post(
         child_context_,
-        [this, callback=std::move(callback), attitude, request, reply,
+        [this, callback=std::move(callback), attitude, imu_batch,
+         request, reply,
          request_rf=(rf_remote_ != nullptr)]() mutable {
           this->CHILD_Cycle(
-              attitude, request, reply, request_rf,
+              attitude, imu_batch, request, reply, request_rf,
               std::move(callback));
         });
   }
 
+  bool imu_batching() const { return options_.imu_poll_period_s > 0.0; }
+
   mjlib::io::SharedStream MakeTunnel(
       uint8_t id,
       uint32_t channel,
@@ -153,6 +212,7 @@ class Pi3hatWrapper::Impl {
   }
 
   PowerSignal* power_signal() { return &power_signal_; }
+  ReplyLatencySignal* reply_latency_signal() { return &reply_latency_signal_; }
 
  private:
   void HandlePowerPoll(const mjlib::base::error_code& ec) {
@@ -172,9 +232,21 @@ class Pi3hatWrapper::Impl {
         : parent_(parent),
           id_(id),
           channel_(channel),
-          options_(options) {}
+          options_(options) {
+      boost::asio::post(
+          parent_->child_context_,
+          [parent=parent_, id, channel]() {
+            parent->CHILD_RegisterTunnel(id, channel, 1);
+          });
+    }
 
-    ~Tunnel() override {}
+    ~Tunnel() override {
+      boost::asio::post(
+          parent_->child_context_,
+          [parent=parent_, id=id_, channel=channel_]() {
+            parent->CHILD_RegisterTunnel(id, channel, -1);
+          });
+    }
 
     void async_read_some(mjlib::io::MutableBufferSequence buffers,
                          mjlib::io::ReadHandler handler) override {
@@ -284,9 +356,23 @@ class Pi3hatWrapper::Impl {
           c.can[4].bitrate_switch = true;
         }
 
+        for (size_t i = 0; i < can_bus_.size(); i++) {
+          auto& bus = can_bus_[i];
+          bus.fd = c.can[i].fdcan_frame;
+          bus.bitrate_switch = c.can[i].bitrate_switch;
+          bus.slow_bitrate = c.can[i].slow_bitrate;
+          bus.fast_bitrate = c.can[i].fast_bitrate;
+        }
+
         return c;
       }());
 
+    if (options_.imu_poll_period_s > 0.0) {
+      imu_poll_timer_.start(
+          base::ConvertSecondsToDuration(options_.imu_poll_period_s),
+          std::bind(&Impl::CHILD_PollImu, this, std::placeholders::_1));
+    }
+
     boost::asio::io_context::work work{child_context_};
     child_context_.run();
 
@@ -375,7 +461,74 @@ class Pi3hatWrapper::Impl {
     input->rx_can = {&d.rx_can[0], d.rx_can.size()};
   }
 
+  void CHILD_TimedCycle(const mjbots::pi3hat::Pi3Hat::Input& input) {
+    const auto start = std::chrono::steady_clock::now();
+    pi3data_.result = pi3hat_->Cycle(input);
+    const auto end = std::chrono::steady_clock::now();
+    pi3data_.cycle_us =
+        std::chrono::duration<double, std::micro>(end - start).count();
+  }
+
+  /// Return the time the attitude sample just read became available.
+  /// @p waited is true if the read waited for it.
+  boost::posix_time::ptime CHILD_ImuTimestamp(bool waited) {
+    const auto now = mjlib::io::Now(child_context_);
+
+    // The pi3hat does not timestamp attitude data, but produces it at
+    // a fixed rate.  A read which waited saw a sample as soon as it
+    // was available, so its time is known to within the CAN replies
+    // read after it in the same cycle.  Other samples could have
+    // become available any time since the previous read, so they are
+    // placed on the IMU's schedule from the last known time instead.
+    if (waited || last_imu_timestamp_.is_not_a_date_time() ||
+        options_.imu_rate_hz == 0) {
+      last_imu_timestamp_ = now;
+      return now;
+    }
+
+    const auto period =
+        base::ConvertSecondsToDuration(1.0 / options_.imu_rate_hz);
+    const int periods = std::max<int>(
+        1, std::lround(base::ConvertDurationToSeconds(
+                           now - last_imu_timestamp_) *
+                       options_.imu_rate_hz));
+    const auto result = std::min(now, last_imu_timestamp_ + period * periods);
+    last_imu_timestamp_ = result;
+    return result;
+  }
+
+  void CHILD_AddImuSample(const mjbots::pi3hat::Attitude& attitude,
+                          bool waited) {
+    ImuBatch::Sample sample;
+    sample.timestamp = CHILD_ImuTimestamp(waited);
+    sample.attitude = base::Quaternion(
+        attitude.attitude.w, attitude.attitude.x,
+        attitude.attitude.y, attitude.attitude.z);
+    sample.rate_dps = base::Point3D(
+        attitude.rate_dps.x, attitude.rate_dps.y, attitude.rate_dps.z);
+    sample.accel_mps2 = base::Point3D(
+        attitude.accel_mps2.x, attitude.accel_mps2.y, attitude.accel_mps2.z);
+    child_imu_batch_.Add(sample);
+  }
+
+  void CHILD_PollImu(const mjlib::base::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) { return; }
+    mjlib::base::FailIf(ec);
+
+    mjbots::pi3hat::Pi3Hat::Input input;
+    input.attitude = &child_attitude_;
+    input.request_attitude = true;
+    input.wait_for_attitude = false;
+    input.request_attitude_detail = options_.attitude_detail;
+
+    const auto result = pi3hat_->Cycle(input);
+    if (result.attitude_present) {
+      CHILD_AddImuSample(child_attitude_, false);
+    }
+  }
+
   void CHILD_Cycle(AttitudeData* attitude_dest,
+                   ImuBatch* imu_batch_dest,
                    const Request* request,
                    Reply* reply,
                    bool request_rf,
@@ -385,21 +538,40 @@ class Pi3hatWrapper::Impl {
     CHILD_SetupRf(&input);
     CHILD_SetupCAN(&input, request);
 
+    // If the poller has already picked up a sample since the last
+    // cycle, waiting here would just delay us until the next one.
+    const bool have_sample = child_imu_batch_.count > 0;
+
     input.attitude = &pi3data_.attitude;
     input.request_attitude = true;
-    input.wait_for_attitude = true;
+    input.wait_for_attitude = !have_sample;
     input.request_attitude_detail = options_.attitude_detail;
     input.request_rf = request_rf;
     input.timeout_ns = options_.query_timeout_s * 1e9;
     input.rx_extra_wait_ns = 0;
 
-    pi3data_.result = pi3hat_->Cycle(input);
+    CHILD_TimedCycle(input);
+    pi3data_.result.rx_can_size = CHILD_RouteTunnelReplies(
+        &pi3data_.rx_can, pi3data_.result.rx_can_size);
+
+    if (pi3data_.result.attitude_present) {
+      CHILD_AddImuSample(pi3data_.attitude, input.wait_for_attitude);
+    } else if (have_sample) {
+      pi3data_.attitude = child_attitude_;
+    }
+
+    pi3data_.imu_batch = child_imu_batch_;
+    pi3data_.imu_batch.timestamp = mjlib::io::Now(child_context_);
+    child_imu_batch_.count = 0;
+    child_imu_batch_.dropped = 0;
 
     // Now come back to the main thread.
     boost::asio::post(
         executor_,
-        [this, callback=std::move(callback), attitude_dest, reply]() mutable {
-          this->FinishCycle(attitude_dest, reply, std::move(callback));
+        [this, callback=std::move(callback), attitude_dest,
+         imu_batch_dest, reply]() mutable {
+          this->FinishCycle(attitude_dest, imu_batch_dest, reply,
+                            std::move(callback));
         });
   }
 
@@ -420,7 +592,9 @@ class Pi3hatWrapper::Impl {
     input.request_rf = request_rf;
     input.timeout_ns = options_.query_timeout_s * 1e9;
 
-    pi3data_.result = pi3hat_->Cycle(input);
+    CHILD_TimedCycle(input);
+    pi3data_.result.rx_can_size = CHILD_RouteTunnelReplies(
+        &pi3data_.rx_can, pi3data_.result.rx_can_size);
 
     // Now come back to the main thread.
     boost::asio::post(
@@ -430,144 +604,221 @@ class Pi3hatWrapper::Impl {
         });
   }
 
-  size_t CHILD_TunnelPoll(uint8_t id, uint32_t channel,
-                          mjlib::io::MutableBufferSequence buffers) {
-    mjbots::pi3hat::Pi3Hat::Input input;
+  /// Return the number of stream bytes which fit in a single tunnel
+  /// frame on @p bus, given that @p header_size bytes of it are
+  /// already used.
+  size_t CHILD_TunnelDataSize(int bus, size_t header_size) const {
+    const size_t payload = can_bus_[std::max(1, bus) - 1].fd ? 64 : 8;
+    // One more byte is needed for the size varuint itself.
+    return payload - header_size - 1;
+  }
 
-    if (pi3data_.rx_can.size() < 4) {
-      pi3data_.rx_can.resize(4);
+  /// Adjust the number of tunnels open for @p id and @p channel by
+  /// @p delta.  Replies are kept only for those which are open, and
+  /// anything not yet read is discarded when the last one closes.
+  void CHILD_RegisterTunnel(uint8_t id, uint32_t channel, int delta) {
+    const auto key = std::make_pair(id, channel);
+    auto& tunnel_data = child_tunnel_data_[key];
+    tunnel_data.tunnels += delta;
+    if (tunnel_data.tunnels <= 0) {
+      child_tunnel_data_.erase(key);
     }
+  }
 
-    for (auto& frame : pi3data_.rx_can) {
-      std::memset(&frame.data[0], 0, sizeof(frame.data));
+  size_t CHILD_TunnelPoll(uint8_t id, uint32_t channel,
+                          mjlib::io::MutableBufferSequence buffers) {
+    const size_t requested = boost::asio::buffer_size(buffers);
+
+    // The tunnel making this poll is open, so it has been registered.
+    auto& pending = child_tunnel_data_[{id, channel}].pending;
+    if (!pending.empty()) {
+      // Either a previous poll returned more than that caller had
+      // room for, or replies arrived late in some other cycle.  Give
+      // that out first without touching the bus.
+      return CHILD_TakePending(&pending, buffers);
     }
-    input.rx_can = {&pi3data_.rx_can[0], pi3data_.rx_can.size()};
-    input.force_can_check = (1 << SelectBus(id));
-    input.timeout_ns = 0;
-    input.min_tx_wait_ns = 0;
-
-    // Check for anything lying around first.
-    pi3data_.result = pi3hat_->Cycle(input);
 
-    if (pi3data_.result.rx_can_size > 0) {
-      return CHILD_ParseTunnelPoll(id, channel, buffers);
+    // We fill the caller's buffers by issuing as many poll requests
+    // as are needed (up to our in-flight limit) in a single cycle.
+    // The servo answers them in order on the bus, so the replies can
+    // be scattered directly into place.
+    const auto bus = SelectBus(id);
+    auto& tx_can = tunnel_data_.tx_can;
+    tx_can.clear();
+
+    size_t remaining = requested;
+    while (remaining > 0 &&
+           static_cast<int>(tx_can.size()) < options_.tunnel_frames) {
+      tx_can.push_back({});
+      auto& out_frame = tx_can.back();
+      mjlib::base::BufferWriteStream stream{
+        {reinterpret_cast<char*>(&out_frame.data[0]), sizeof(out_frame.data)}};
+      mjlib::multiplex::WriteStream writer{stream};
+
+      writer.WriteVaruint(
+          u32(mjlib::multiplex::Format::Subframe::kClientPollServer));
+      writer.WriteVaruint(channel);
+      const auto to_request = std::min<size_t>(
+          remaining, CHILD_TunnelDataSize(bus, stream.offset()));
+      writer.WriteVaruint(to_request);
+      remaining -= to_request;
+
+      out_frame.expect_reply = true;
+      out_frame.bus = bus;
+      out_frame.id = 0x8000 | id;
+      out_frame.size = stream.offset();
     }
 
+    // Leave room for stale replies to earlier polls which timed out.
+    auto& rx_can = tunnel_data_.rx_can;
+    rx_can.resize(std::max<size_t>(tx_can.size() * 2, 24));
+
+    mjbots::pi3hat::Pi3Hat::Input input;
+    input.tx_can = {&tx_can[0], tx_can.size()};
+    input.rx_can = {&rx_can[0], rx_can.size()};
+    input.force_can_check = (1 << bus);
     input.timeout_ns = options_.query_timeout_s * 1e9;
     input.min_tx_wait_ns = options_.min_wait_s * 1e9;
 
-    // Nope, so we should poll.
-    if (pi3data_.tx_can.size() < 1) {
-      pi3data_.tx_can.resize(1);
-    }
-
-    auto& out_frame = pi3data_.tx_can[0];
-    mjlib::base::BufferWriteStream stream{
-      {reinterpret_cast<char*>(&out_frame.data[0]), sizeof(out_frame.data)}};
-    mjlib::multiplex::WriteStream writer{stream};
-
-    writer.WriteVaruint(
-        u32(mjlib::multiplex::Format::Subframe::kClientPollServer));
-    writer.WriteVaruint(channel);
-    writer.WriteVaruint(
-        std::min<uint32_t>(48, boost::asio::buffer_size(buffers)));
-
-    out_frame.expect_reply = true;
-    out_frame.bus = SelectBus(id);
-    out_frame.id = 0x8000 | id;
-    out_frame.size = stream.offset();
+    const auto result = pi3hat_->Cycle(input);
 
-    input.tx_can = {&pi3data_.tx_can[0], 1};
-
-    pi3data_.result = pi3hat_->Cycle(input);
-
-    return CHILD_ParseTunnelPoll(id, channel, buffers);
+    // Late replies for other tunnels may be received too, those are
+    // kept for them.
+    DirectRead direct{id, channel, buffers};
+    CHILD_RouteTunnelReplies(&rx_can, result.rx_can_size, &direct);
+    return direct.copied;
   }
 
-  size_t CHILD_ParseTunnelPoll(uint8_t id, uint32_t channel,
-                               mjlib::io::MutableBufferSequence buffers) {
-    size_t result = 0;
-
-    for (size_t i = 0; i < pi3data_.result.rx_can_size; i++) {
-      const auto& src = pi3data_.rx_can[i];
-      if (((src.id >> 8) & 0xff) != id) { continue; }
-
-      mjlib::base::BufferReadStream buffer_stream{
-        {reinterpret_cast<const char*>(&src.data[0]), src.size}};
-      mjlib::multiplex::ReadStream<
-        mjlib::base::BufferReadStream> stream{buffer_stream};
-
-      const auto maybe_subframe = stream.ReadVaruint();
-      if (!maybe_subframe || *maybe_subframe !=
-          u32(mjlib::multiplex::Format::Subframe::kServerToClient)) {
-        continue;
-      }
+  size_t CHILD_TakePending(std::vector<char>* pending,
+                           mjlib::io::MutableBufferSequence buffers) {
+    const auto result = ScatterCopy(
+        buffers, 0, pending->data(), pending->size());
+    pending->erase(pending->begin(), pending->begin() + result);
+    return result;
+  }
 
-      const auto maybe_channel = stream.ReadVaruint();
-      if (!maybe_channel || *maybe_channel != channel) {
-        continue;
-      }
+  struct DirectRead {
+    uint8_t id = 0;
+    uint32_t channel = 0;
+    mjlib::io::MutableBufferSequence buffers;
+    size_t copied = 0;
+  };
 
-      const auto maybe_stream_size = stream.ReadVaruint();
-      if (!maybe_stream_size) {
-        continue;
+  /// Remove all tunnel replies from the first @p size frames of @p
+  /// rx_can, appending their data to the pending data of the tunnel
+  /// they are for.  Data for the tunnel in @p direct, if any, is
+  /// copied into its buffers for as long as they have room.  Return
+  /// the number of frames which remain.
+  size_t CHILD_RouteTunnelReplies(
+      std::vector<mjbots::pi3hat::CanFrame>* rx_can, size_t size,
+      DirectRead* direct = nullptr) {
+    size_t kept = 0;
+    for (size_t i = 0; i < size; i++) {
+      const auto& src = (*rx_can)[i];
+      if (!CHILD_RouteTunnelReply(src, direct)) {
+        if (kept != i) { (*rx_can)[kept] = src; }
+        kept++;
       }
+    }
+    return kept;
+  }
 
-      const auto stream_size = *maybe_stream_size;
-      if (stream_size == 0) { continue; }
+  /// If @p src is a tunnel reply, store its data and return true.
+  bool CHILD_RouteTunnelReply(const mjbots::pi3hat::CanFrame& src,
+                              DirectRead* direct) {
+    // Extended ids are not from servos.
+    if (src.id > 0xffff) { return false; }
+
+    mjlib::base::BufferReadStream buffer_stream{
+      {reinterpret_cast<const char*>(&src.data[0]), src.size}};
+    mjlib::multiplex::ReadStream<
+      mjlib::base::BufferReadStream> stream{buffer_stream};
+
+    const auto maybe_subframe = stream.ReadVaruint();
+    if (!maybe_subframe || *maybe_subframe !=
+        u32(mjlib::multiplex::Format::Subframe::kServerToClient)) {
+      return false;
+    }
 
-      auto remaining_data = stream_size;
-      for (auto buffer : buffers) {
-        if (remaining_data == 0) { break; }
+    const auto maybe_channel = stream.ReadVaruint();
+    const auto maybe_stream_size = stream.ReadVaruint();
+    if (!maybe_channel || !maybe_stream_size) {
+      // Malformed, but still not something anyone else can use.
+      return true;
+    }
 
-        const auto to_read = std::min<size_t>(buffer.size(), remaining_data);
-        buffer_stream.read({static_cast<char*>(buffer.data()),
-                static_cast<std::streamsize>(to_read)});
-        remaining_data -= to_read;
-        result += to_read;
-      }
+    const uint8_t id = (src.id >> 8) & 0xff;
+    const auto it = child_tunnel_data_.find({id, *maybe_channel});
+    if (it == child_tunnel_data_.end()) {
+      // No tunnel is open to read this.
+      return true;
     }
 
-    return result;
+    const auto header_size = buffer_stream.offset();
+    const auto stream_size = std::min<size_t>(
+        *maybe_stream_size, src.size - header_size);
+    const auto* const data =
+        reinterpret_cast<const char*>(&src.data[header_size]);
+    auto& pending = it->second.pending;
+
+    size_t copied = 0;
+    if (direct && direct->id == id && direct->channel == *maybe_channel &&
+        pending.empty()) {
+      copied = ScatterCopy(direct->buffers, direct->copied, data, stream_size);
+      direct->copied += copied;
+    }
+    pending.insert(pending.end(), data + copied, data + stream_size);
+    return true;
   }
 
   void CHILD_TunnelWrite(uint8_t id, uint32_t channel,
                          mjlib::io::ConstBufferSequence buffers,
                          mjlib::io::WriteHandler callback) {
-    if (pi3data_.tx_can.size() < 1) {
-      pi3data_.tx_can.resize(1);
+    // Gather as much of the caller's data as fits in our in-flight
+    // frame limit directly into frame payloads, then send them all
+    // in a single cycle.
+    const auto bus = SelectBus(id);
+    const size_t total = boost::asio::buffer_size(buffers);
+    auto& tx_can = tunnel_data_.tx_can;
+    tx_can.clear();
+
+    size_t offset = 0;
+    while (offset < total &&
+           static_cast<int>(tx_can.size()) < options_.tunnel_frames) {
+      tx_can.push_back({});
+      auto& dst = tx_can.back();
+
+      mjlib::base::BufferWriteStream stream{
+        {reinterpret_cast<char*>(&dst.data[0]), sizeof(dst.data)}};
+      mjlib::multiplex::WriteStream writer{stream};
+
+      writer.WriteVaruint(
+          u32(mjlib::multiplex::Format::Subframe::kClientToServer));
+      writer.WriteVaruint(channel);
+
+      const auto size = std::min<size_t>(
+          total - offset, CHILD_TunnelDataSize(bus, stream.offset()));
+      writer.WriteVaruint(size);
+
+      const auto header_size = stream.offset();
+      GatherCopy(buffers, offset, &dst.data[header_size], size);
+      offset += size;
+
+      dst.id = id;
+      dst.bus = bus;
+      dst.size = header_size + size;
     }
-    auto& dst = pi3data_.tx_can[0];
-
-    mjlib::base::BufferWriteStream stream{
-      {reinterpret_cast<char*>(&dst.data[0]), sizeof(dst.data)}};
-    mjlib::multiplex::WriteStream writer{stream};
 
-    writer.WriteVaruint(u32(mjlib::multiplex::Format::Subframe::kClientToServer));
-    writer.WriteVaruint(channel);
+    if (!tx_can.empty()) {
+      mjbots::pi3hat::Pi3Hat::Input input;
+      input.tx_can = {&tx_can[0], tx_can.size()};
 
-    const auto size = std::min<size_t>(48, boost::asio::buffer_size(buffers));
-    writer.WriteVaruint(size);
-    auto remaining_size = size;
-    for (auto buffer : buffers) {
-      if (remaining_size == 0) { break; }
-      const auto to_write = std::min(remaining_size, buffer.size());
-      stream.write({static_cast<const char*>(buffer.data()), to_write});
-      remaining_size -= to_write;
+      pi3hat_->Cycle(input);
     }
 
-    dst.id = id;
-    dst.bus = SelectBus(id);
-    dst.size = stream.offset();
-
-    mjbots::pi3hat::Pi3Hat::Input input;
-    input.tx_can = {&pi3data_.tx_can[0], 1};
-
-    pi3hat_->Cycle(input);
-
     boost::asio::post(
         executor_,
-        std::bind(std::move(callback), mjlib::base::error_code(), size));
+        std::bind(std::move(callback), mjlib::base::error_code(), offset));
   }
 
   void Shutdown() {
@@ -658,6 +909,127 @@ class Pi3hatWrapper::Impl {
     }
   }
 
+  /// Return the approximate time in microseconds a frame with @p
+  /// size data bytes occupies on @p bus.
+  double FrameWireUs(int bus, int size) const {
+    const auto& config = can_bus_[std::max(1, bus) - 1];
+    // Extended id, control, CRC and framing, ignoring bit stuffing.
+    const double data_bits = 8.0 * size + (config.fd ? 30.0 : 20.0);
+    const double header_bits = 47.0;
+    const double data_bitrate =
+        (config.fd && config.bitrate_switch) ?
+        config.fast_bitrate : config.slow_bitrate;
+    return 1e6 * (header_bits / config.slow_bitrate +
+                  data_bits / data_bitrate);
+  }
+
+  void UpdateLatency(boost::posix_time::ptime now) {
+    const auto& rx_can = pi3data_.rx_can;
+    const auto rx_can_size = pi3data_.result.rx_can_size;
+
+    // Frames are not individually timestamped.  The timed cycle ends
+    // once the last reply has been received, and each bus delivers
+    // its replies serially.  So a reply can have arrived no later
+    // than the end of the cycle, less the time the bus spent sending
+    // the replies received after it.
+    //
+    // The pi3hat waits for the attitude while the replies are in
+    // flight, so for cycles which waited, any part of that wait which
+    // outlasted the replies is included.
+    std::array<double, 6> bus_remaining_us = {};
+    for (size_t i = 0; i < rx_can_size; i++) {
+      const auto& src = rx_can[i];
+      if (src.bus < 1 || src.bus >= static_cast<int>(bus_remaining_us.size())) {
+        continue;
+      }
+      bus_remaining_us[src.bus] += FrameWireUs(src.bus, src.size);
+    }
+
+    std::array<std::bitset<128>, 6> received;
+    for (size_t i = 0; i < rx_can_size; i++) {
+      const auto& src = rx_can[i];
+      if (src.bus < 1 || src.bus >= static_cast<int>(bus_remaining_us.size())) {
+        continue;
+      }
+      bus_remaining_us[src.bus] -= FrameWireUs(src.bus, src.size);
+
+      // Extended ids are not from servos.
+      if (src.id > 0xffff) { continue; }
+
+      const int id = (src.id >> 8) & 0x7f;
+      const double latency_us = std::max(
+          0.0, pi3data_.cycle_us - bus_remaining_us[src.bus]);
+
+      auto& accum = GetLatency(id, src.bus);
+      const int bin = std::min<int>(
+          latency_us / options_.latency_bin_us, accum.servo.counts.size() - 1);
+      accum.servo.counts[std::max(0, bin)]++;
+      accum.servo.max_us = std::max(accum.servo.max_us, latency_us);
+      accum.total_us += latency_us;
+      accum.count++;
+
+      received[src.bus].set(id);
+    }
+
+    for (const auto& tx : pi3data_.tx_can) {
+      if (!tx.expect_reply) { continue; }
+      if (tx.bus < 1 || tx.bus >= static_cast<int>(received.size())) {
+        continue;
+      }
+      const int id = tx.id & 0x7f;
+      if (received[tx.bus].test(id)) { continue; }
+      GetLatency(id, tx.bus).servo.missing++;
+    }
+
+    if (last_latency_publish_.is_not_a_date_time()) {
+      last_latency_publish_ = now;
+      return;
+    }
+    if (base::ConvertDurationToSeconds(now - last_latency_publish_) <
+        options_.latency_period_s) {
+      return;
+    }
+
+    ReplyLatency reply_latency;
+    reply_latency.timestamp = now;
+    reply_latency.bin_us = options_.latency_bin_us;
+    for (auto& pair : latency_) {
+      auto& accum = pair.second;
+      accum.servo.mean_us =
+          accum.count ? (accum.total_us / accum.count) : 0.0;
+      reply_latency.servos.push_back(accum.servo);
+
+      // Reset for the next period.
+      std::fill(accum.servo.counts.begin(), accum.servo.counts.end(), 0);
+      accum.servo.missing = 0;
+      accum.servo.max_us = 0.0;
+      accum.servo.mean_us = 0.0;
+      accum.total_us = 0.0;
+      accum.count = 0;
+    }
+
+    last_latency_publish_ = now;
+    reply_latency_signal_(&reply_latency);
+  }
+
+  struct LatencyAccumulator {
+    ReplyLatency::Servo servo;
+    double total_us = 0.0;
+    int count = 0;
+  };
+
+  LatencyAccumulator& GetLatency(int id, int bus) {
+    const auto key = std::make_pair(bus, id);
+    auto it = latency_.find(key);
+    if (it != latency_.end()) { return it->second; }
+
+    auto& result = latency_[key];
+    result.servo.id = id;
+    result.servo.bus = bus;
+    result.servo.counts.resize(std::max(1, options_.latency_bins) + 1);
+    return result;
+  }
+
   void FinishAttitude(boost::posix_time::ptime now, AttitudeData* attitude) {
     auto make_point = [](const auto& p) {
       return base::Point3D(p.x, p.y, p.z);
@@ -706,12 +1078,17 @@ class Pi3hatWrapper::Impl {
 
 
   void FinishCycle(AttitudeData* attitude,
+                   ImuBatch* imu_batch,
                    Reply* reply,
                    mjlib::io::ErrorCallback callback) {
     const auto now = mjlib::io::Now(executor_.context());
 
+    UpdateLatency(now);
     FinishCAN(reply);
     FinishAttitude(now, attitude);
+    if (imu_batch) {
+      *imu_batch = pi3data_.imu_batch;
+    }
     FinishRF(now);
 
     boost::asio::post(
@@ -722,6 +1099,7 @@ class Pi3hatWrapper::Impl {
   void FinishTransmit(Reply* reply, mjlib::io::ErrorCallback callback) {
     const auto now = mjlib::io::Now(executor_.context());
 
+    UpdateLatency(now);
     FinishCAN(reply);
 
     if (attitude_) {
@@ -779,8 +1157,43 @@ class Pi3hatWrapper::Impl {
 
   // Only accessed from the thread.
   std::optional<mjbots::pi3hat::Pi3Hat> pi3hat_;
+
+  // How each of the 5 CAN buses is configured.  Written once when the
+  // child thread starts.
+  struct CanBus {
+    bool fd = false;
+    bool bitrate_switch = false;
+    double slow_bitrate = 1000000.0;
+    double fast_bitrate = 1000000.0;
+  };
+  std::array<CanBus, 5> can_bus_ = {};
   boost::asio::io_context child_context_;
 
+  // IMU samples collected between calls to Cycle.
+  mjlib::io::RepeatingTimer imu_poll_timer_{child_context_.get_executor()};
+  mjbots::pi3hat::Attitude child_attitude_;
+  ImuBatch child_imu_batch_;
+  boost::posix_time::ptime last_imu_timestamp_;
+
+  // Tunnels are serviced on the child thread in between the cycles
+  // requested by the parent, so they have their own buffers.
+  struct TunnelData {
+    std::vector<mjbots::pi3hat::CanFrame> tx_can;
+    std::vector<mjbots::pi3hat::CanFrame> rx_can;
+  };
+  TunnelData tunnel_data_;
+
+  // An entry for each (id, channel) with at least one open tunnel.
+  struct TunnelData {
+    int tunnels = 0;
+
+    // Stream data received which has not yet been read, either
+    // because it did not fit in the caller's buffers, or because it
+    // arrived in a cycle made for someone else.
+    std::vector<char> pending;
+  };
+  std::map<std::pair<uint8_t, uint32_t>, TunnelData> child_tunnel_data_;
+
   // The following are accessed by both threads, but never at the same
   // time.  They can either be accessed inside CHILD_Register, or in
   // the parent until the callback is invoked.
@@ -794,6 +1207,8 @@ class Pi3hatWrapper::Impl {
     uint16_t rf_to_send = 0;
 
     mjbots::pi3hat::Pi3Hat::Output result;
+    double cycle_us = 0.0;
+    ImuBatch imu_batch;
   };
   Pi3Data pi3data_;
 
@@ -802,6 +1217,11 @@ class Pi3hatWrapper::Impl {
   double last_energy_Whr_ = 0.0;
   boost::posix_time::ptime last_power_status_;
   PowerSignal power_signal_;
+
+  // Keyed by (bus, id), as ids may be reused on different buses.
+  std::map<std::pair<int, int>, LatencyAccumulator> latency_;
+  boost::posix_time::ptime last_latency_publish_;
+  ReplyLatencySignal reply_latency_signal_;
 };
 #else
 
@@ -815,14 +1235,17 @@ class Pi3hatWrapper::Impl {
   void tx_slot(int, int, const Slot&) {}
   Slot tx_slot(int, int) { return {}; }
   void AsyncTransmit(const Request*, Reply*, mjlib::io::ErrorCallback) {}
-  void Cycle(AttitudeData*, const Request*, Reply*,
+  void Cycle(AttitudeData*, ImuBatch*, const Request*, Reply*,
              mjlib::io::ErrorCallback) {}
+  bool imu_batching() const { return false; }
   mjlib::io::SharedStream MakeTunnel(uint8_t, uint32_t, const TunnelOptions&) {
     return {};
   }
   PowerSignal* power_signal() { return &power_signal_; }
+  ReplyLatencySignal* reply_latency_signal() { return &reply_latency_signal_; }
 
   PowerSignal power_signal_;
+  ReplyLatencySignal reply_latency_signal_;
 };
 #endif
 
@@ -878,15 +1301,24 @@ Pi3hatWrapper::Stats Pi3hatWrapper::stats() const {
 }
 
 void Pi3hatWrapper::Cycle(AttitudeData* attitude,
+                          ImuBatch* imu_batch,
                           const Request* request,
                           Reply* reply,
                           mjlib::io::ErrorCallback callback) {
-  impl_->Cycle(attitude, request, reply, std::move(callback));
+  impl_->Cycle(attitude, imu_batch, request, reply, std::move(callback));
+}
+
+bool Pi3hatWrapper::imu_batching() const {
+  return impl_->imu_batching();
 }
 
 Pi3hatWrapper::PowerSignal* Pi3hatWrapper::power_signal() {
   return impl_->power_signal();
 }
 
+Pi3hatWrapper::ReplyLatencySignal* Pi3hatWrapper::reply_latency_signal() {
+  return impl_->reply_latency_signal();
+}
+
 }
 }
@@ -16,6 +16,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/asio/any_io_executor.hpp>
 #include <boost/signals2.hpp>
@@ -71,11 +72,30 @@ class Pi3hatWrapper : public Pi3hatInterface {
     double power_poll_period_s = 0.1;
     double shutdown_timeout_s = 15.0;
     uint32_t imu_rate_hz = 400;
+
+    // Between cycles, poll the IMU this often so that every sample
+    // can be reported in the ImuBatch.  This is only useful when
+    // imu_rate_hz is faster than the control rate, and then should be
+    // about half of 1 / imu_rate_hz.  Each poll is an SPI transaction
+    // on the same thread as the control cycle.  0 disables polling,
+    // so that each ImuBatch has only the sample from its cycle, and
+    // imu_batching() is false.
+    double imu_poll_period_s = 0.0;
     bool attitude_detail = false;
     int force_bus = -1;
 
     int power_dist_rev = 0x0403;
 
+    // The maximum number of CAN frames a diagnostic tunnel will have
+    // in flight in a single cycle, for both reads and writes.
+    int tunnel_frames = 4;
+
+    // Reply latency histograms are accumulated over this period, then
+    // published and reset.
+    double latency_period_s = 1.0;
+    double latency_bin_us = 50.0;
+    int latency_bins = 40;
+
     template <typename Archive>
     void Serialize(Archive* a) {
       a->Visit(MJ_NVP(cpu_affinity));
@@ -86,9 +106,14 @@ class Pi3hatWrapper : public Pi3hatInterface {
       a->Visit(MJ_NVP(power_poll_period_s));
       a->Visit(MJ_NVP(shutdown_timeout_s));
       a->Visit(MJ_NVP(imu_rate_hz));
+      a->Visit(MJ_NVP(imu_poll_period_s));
       a->Visit(MJ_NVP(attitude_detail));
       a->Visit(MJ_NVP(force_bus));
       a->Visit(MJ_NVP(power_dist_rev));
+      a->Visit(MJ_NVP(tunnel_frames));
+      a->Visit(MJ_NVP(latency_period_s));
+      a->Visit(MJ_NVP(latency_bin_us));
+      a->Visit(MJ_NVP(latency_bins));
     }
   };
 
@@ -135,6 +160,55 @@ class Pi3hatWrapper : public Pi3hatInterface {
   using PowerSignal = boost::signals2::signal<void (const Power*)>;
   PowerSignal* power_signal();
 
+  /// Histograms of when each servo's reply arrived relative to the
+  /// start of the cycle it was requested in, one per bus and id.  The
+  /// pi3hat does not timestamp individual frames, so these are
+  /// estimated.
+  ///
+  /// Each estimate is an upper bound: the time from sending the
+  /// requests until the last reply was received, less the time its
+  /// bus took to send the replies received after it.  In cycles which
+  /// wait for the IMU, that wait is included where it outlasts the
+  /// replies.
+  struct ReplyLatency {
+    boost::posix_time::ptime timestamp;
+    double bin_us = 0.0;
+
+    struct Servo {
+      int id = 0;
+      int bus = 0;
+
+      // Estimated reply latencies, in bins of bin_us.  The final bin
+      // counts everything beyond the end of the histogram.
+      std::vector<int> counts;
+      int missing = 0;
+      double max_us = 0.0;
+      double mean_us = 0.0;
+
+      template <typename Archive>
+      void Serialize(Archive* a) {
+        a->Visit(MJ_NVP(id));
+        a->Visit(MJ_NVP(bus));
+        a->Visit(MJ_NVP(counts));
+        a->Visit(MJ_NVP(missing));
+        a->Visit(MJ_NVP(max_us));
+        a->Visit(MJ_NVP(mean_us));
+      }
+    };
+
+    std::vector<Servo> servos;
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(timestamp));
+      a->Visit(MJ_NVP(bin_us));
+      a->Visit(MJ_NVP(servos));
+    }
+  };
+  using ReplyLatencySignal = boost::signals2::signal<
+    void (const ReplyLatency*)>;
+  ReplyLatencySignal* reply_latency_signal();
+
   struct Stats {
     template <typename Archive>
     void Serialize(Archive* a) {
@@ -164,10 +238,13 @@ class Pi3hatWrapper : public Pi3hatInterface {
   Slot tx_slot(int remote, int slot_idx) override;
 
   void Cycle(AttitudeData*,
+             ImuBatch*,
              const Request* request,
              Reply* reply,
              mjlib::io::ErrorCallback callback) override;
 
+  bool imu_batching() const override;
+
  private:
   class Impl;
   std::unique_ptr<Impl> impl_;
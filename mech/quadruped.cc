@@ -68,6 +68,8 @@ class Quadruped::Impl {
                if (pi3hat) {
                  log_.warn("Registering power");
                  telemetry_registry_->Register("power", pi3hat->power_signal());
+                 telemetry_registry_->Register(
+                     "reply_latency", pi3hat->reply_latency_signal());
                }
                std::move(callback)(ec);
              });
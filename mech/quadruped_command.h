@@ -38,6 +38,10 @@ struct QuadrupedCommand {
 
     kDisable,
     kEnable,
+
+    // Write the flight recorder history, leaving the on-disk log
+    // unchanged.
+    kSnapshot,
   };
 
   Log log = kUnset;
@@ -296,6 +300,7 @@ struct IsEnum<mjmech::mech::QuadrupedCommand::Log> {
         { M::kUnset, "unset" },
         { M::kDisable, "disable" },
         { M::kEnable, "enable" },
+        { M::kSnapshot, "snapshot" },
       }};
   }
 };
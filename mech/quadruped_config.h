@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <string>
 #include <vector>
 
 #include "mjlib/base/visitor.h"
@@ -65,6 +66,26 @@ struct QuadrupedConfig {
 
   std::vector<Leg> legs;
 
+  // Persistent servo configuration which is made to match during
+  // startup.  Only values which differ from what the servo reports
+  // are written.
+  struct ServoConfig {
+    std::string key;
+    std::string value;
+
+    // If empty, this applies to all joints.
+    std::vector<int> ids;
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(key));
+      a->Visit(MJ_NVP(value));
+      a->Visit(MJ_NVP(ids));
+    }
+  };
+
+  std::vector<ServoConfig> servo_config;
+
   struct Bounds {
     double min_z_B = 0.0;
     double max_z_B = 0.30;
@@ -305,6 +326,7 @@ struct QuadrupedConfig {
     a->Visit(MJ_NVP(joints));
     a->Visit(MJ_NVP(rezero_threshold_deg));
     a->Visit(MJ_NVP(legs));
+    a->Visit(MJ_NVP(servo_config));
     a->Visit(MJ_NVP(bounds));
     a->Visit(MJ_NVP(mass_kg));
     a->Visit(MJ_NVP(leg_mass_kg));
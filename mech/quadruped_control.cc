@@ -15,6 +15,7 @@
 #include "mech/quadruped_control.h"
 
 #include <fstream>
+#include <numeric>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/asio/post.hpp>
@@ -31,6 +32,7 @@
 #include "base/fit_plane.h"
 #include "base/interpolate.h"
 #include "base/logging.h"
+#include "base/segmented_log.h"
 #include "base/sophus.h"
 #include "base/telemetry_registry.h"
 #include "base/timestamped_log.h"
@@ -42,6 +44,7 @@
 #include "mech/quadruped_context.h"
 #include "mech/quadruped_trot.h"
 #include "mech/quadruped_util.h"
+#include "mech/servo_config_uploader.h"
 #include "mech/swing_trajectory.h"
 #include "mech/trajectory.h"
 
@@ -146,13 +149,24 @@ struct CommandLog {
 
 QC CommandLog::ignored_command;
 }
+}
+
+namespace base {
+// CommandLog only points to the command, so the flight recorder
+// must serialize it immediately.
+template <>
+struct TelemetryFlightRecorderCopy<mech::CommandLog> : std::false_type {};
+}
+
+namespace mech {
 
 class QuadrupedControl::Impl {
  public:
   Impl(base::Context& context,
        Pi3hatGetter pi3hat_getter)
       : executor_(context.executor),
-        telemetry_log_(context.telemetry_log.get()),
+        telemetry_registry_(context.telemetry_registry.get()),
+        segmented_log_(context.segmented_log.get()),
         timer_(executor_),
         pi3hat_getter_(pi3hat_getter) {
     context.telemetry_registry->Register("qc_status", &status_signal_);
@@ -160,6 +174,8 @@ class QuadrupedControl::Impl {
     context.telemetry_registry->Register("qc_control", &control_signal_);
     context.telemetry_registry->Register("imu", &imu_signal_);
     context.telemetry_registry->Register("servo_config", &servo_config_signal_);
+    context.telemetry_registry->Register(
+        "servo_config_upload", &servo_config_upload_signal_);
   }
 
   void AsyncStart(mjlib::io::ErrorCallback callback) {
@@ -167,6 +183,13 @@ class QuadrupedControl::Impl {
 
     BOOST_ASSERT(!!pi3hat_);
 
+    // Each cycle's own sample is already logged as "imu", so batches
+    // are only worth logging when they can hold more.
+    imu_batching_ = pi3hat_->imu_batching();
+    if (imu_batching_) {
+      telemetry_registry_->Register("imu_batch", &imu_batch_signal_);
+    }
+
     // Load our configuration.
     std::vector<std::string> configs;
     boost::split(configs, parameters_.config, boost::is_any_of(" "));
@@ -189,6 +212,18 @@ class QuadrupedControl::Impl {
 
     context_.emplace(config_, &current_command_, &status_.state);
 
+    if (!config_.servo_config.empty()) {
+      servo_config_uploader_.emplace(
+          executor_, pi3hat_,
+          [&]() {
+            ServoConfigUploader::Options options;
+            options.persist = parameters_.servo_config_persist;
+            options.timeout_s = parameters_.servo_config_timeout_s;
+            return options;
+          }());
+      servo_config_state_ = kServoConfigIdle;
+    }
+
     PopulateStatusRequest();
 
     period_s_ = config_.period_s;
@@ -215,20 +250,23 @@ class QuadrupedControl::Impl {
     command_log.timestamp = now;
     command_log.command = &command;
 
+    const auto old_log = current_command_.log;
     current_command_ = command;
     current_command_timestamp_ = now;
 
     // Update our logging status.
     if (command.log != QuadrupedCommand::Log::kUnset) {
       if (command.log == QuadrupedCommand::Log::kEnable &&
-          !telemetry_log_->IsOpen()) {
-        base::OpenMaybeTimestampedLog(
-            telemetry_log_,
-            parameters_.log_filename_base,
-            base::kTimestamped);
+          !segmented_log_->IsOpen()) {
+        segmented_log_->Open(parameters_.log_filename_base,
+                             base::kTimestamped);
       } else if (command.log == QuadrupedCommand::Log::kDisable &&
-                 telemetry_log_->IsOpen()) {
-        telemetry_log_->Close();
+                 segmented_log_->IsOpen()) {
+        segmented_log_->Close();
+      } else if (command.log == QuadrupedCommand::Log::kSnapshot &&
+                 old_log != QuadrupedCommand::Log::kSnapshot) {
+        // Commands are repeated, so only dump once per request.
+        telemetry_registry_->DumpFlightRecorder();
       }
     }
 
@@ -236,20 +274,54 @@ class QuadrupedControl::Impl {
   }
 
   void PopulateStatusRequest() {
-    status_request_ = {};
-    for (const auto& joint : config_.joints) {
-      status_request_.push_back({});
-      auto& current = status_request_.back();
-      current.id = joint.id;
+    const int power_decimate = std::max(1, parameters_.power_decimate);
+    const int debug_decimate =
+        parameters_.servo_debug ?
+        std::max(1, parameters_.servo_debug_decimate) : 1;
+
+    // We pre-compute one request for every phase of the schedule.
+    const int schedule_length = std::lcm(power_decimate, debug_decimate);
+    if (schedule_length > 10000) {
+      throw mjlib::base::system_error::einval(
+          fmt::format("status schedule too long: lcm({}, {}) = {}",
+                      power_decimate, debug_decimate, schedule_length));
+    }
 
-      // Read mode, position, velocity, and torque.
-      current.request.ReadMultiple(moteus::Register::kMode, 4, 1);
-      current.request.ReadMultiple(moteus::Register::kVoltage, 3, 0);
+    const int num_joints = config_.joints.size();
+
+    // Spread each servo's slow groups evenly across the phases, so
+    // that each cycle has a similar number of them.
+    auto is_scheduled = [&](int phase, int joint_index, int decimate) {
+      const int offset = joint_index * decimate / std::max(1, num_joints);
+      return ((phase + offset) % decimate) == 0;
+    };
 
-      if (parameters_.servo_debug) {
-        current.request.ReadMultiple(moteus::Register::kPositionKp, 5, 1);
+    status_request_schedule_.clear();
+    status_request_schedule_.resize(schedule_length);
+    for (int phase = 0; phase < schedule_length; phase++) {
+      auto& this_request = status_request_schedule_[phase];
+      for (int i = 0; i < num_joints; i++) {
+        const auto& joint = config_.joints[i];
+        this_request.push_back({});
+        auto& current = this_request.back();
+        current.id = joint.id;
+
+        // Read mode, position, velocity, and torque.
+        current.request.ReadMultiple(moteus::Register::kMode, 4, 1);
+        current.request.ReadMultiple(moteus::Register::kFault, 1, 0);
+
+        if (is_scheduled(phase, i, power_decimate)) {
+          // Voltage and temperature.
+          current.request.ReadMultiple(moteus::Register::kVoltage, 2, 0);
+        }
+
+        if (parameters_.servo_debug &&
+            is_scheduled(phase, i, debug_decimate)) {
+          current.request.ReadMultiple(moteus::Register::kPositionKp, 5, 1);
+        }
       }
     }
+    status_request_phase_ = 0;
 
     config_status_request_ = {};
     for (const auto& joint : config_.joints) {
@@ -259,6 +331,9 @@ class QuadrupedControl::Impl {
 
       // While configuring, we request a few more things.
       current.request.ReadMultiple(moteus::Register::kMode, 4, 1);
+      // Voltage, temperature, and fault, so that they are populated
+      // before the decimated schedule starts.
+      current.request.ReadMultiple(moteus::Register::kVoltage, 3, 0);
       current.request.ReadMultiple(moteus::Register::kRezeroState, 4, 0);
       current.request.ReadMultiple(moteus::Register::kRegisterMapVersion, 1, 2);
       current.request.ReadMultiple(moteus::Register::kSerialNumber, 3, 2);
@@ -291,9 +366,12 @@ class QuadrupedControl::Impl {
       if (status_.mode == QM::kConfiguring) {
         return &config_status_request_;
       }
-      return &status_request_;
+      auto* const result = &status_request_schedule_[status_request_phase_];
+      status_request_phase_ =
+          (status_request_phase_ + 1) % status_request_schedule_.size();
+      return result;
     }();
-    pi3hat_->Cycle(&imu_data_, request, &status_reply_,
+    pi3hat_->Cycle(&imu_data_, &imu_batch_, request, &status_reply_,
                    std::bind(&Impl::HandleStatus, this, pl::_1));
   }
 
@@ -303,6 +381,7 @@ class QuadrupedControl::Impl {
     timing_.finish_query();
 
     imu_signal_(&imu_data_);
+    if (imu_batching_) { imu_batch_signal_(&imu_batch_); }
 
     // If we don't have all 12 servos, then skip this cycle.
     const uint16_t servo_bitmask = [&]() {
@@ -354,8 +433,21 @@ class QuadrupedControl::Impl {
 
     timing_.finish_status();
 
-    if (std::abs(imu_data_.euler_deg.roll) > 45 ||
-        std::abs(imu_data_.euler_deg.pitch) > 45) {
+    const bool tipping = [&]() {
+      auto check = [](const base::Euler& euler_deg) {
+        return std::abs(euler_deg.roll) > 45 || std::abs(euler_deg.pitch) > 45;
+      };
+      if (check(imu_data_.euler_deg)) { return true; }
+      // Also catch any excursion between control cycles.
+      for (int i = 0; i < imu_batch_.count; i++) {
+        if (check((180.0 / M_PI) *
+                  imu_batch_.samples[i].attitude.euler_rad())) {
+          return true;
+        }
+      }
+      return false;
+    }();
+    if (tipping) {
       if (status_.mode != QM::kFault) {
         Fault("Tipping over");
       }
@@ -412,6 +504,11 @@ class QuadrupedControl::Impl {
       return result;
     };
 
+    for (auto& joint : status_.state.joints) {
+      if (joint.power_age < 255) { joint.power_age++; }
+      if (joint.debug_age < 255) { joint.debug_age++; }
+    }
+
     for (const auto& reply : status_reply_) {
       const auto maybe_sign = MaybeGetSign(reply.id);
       if (!maybe_sign) {
@@ -447,6 +544,7 @@ class QuadrupedControl::Impl {
         }
         case moteus::kVoltage: {
           out_joint.voltage = moteus::ReadVoltage(value);
+          out_joint.power_age = 0;
           break;
         }
         case moteus::kTemperature: {
@@ -459,6 +557,7 @@ class QuadrupedControl::Impl {
         }
         case moteus::kPositionKp: {
           out_joint.kp_Nm = sign * moteus::ReadTorque(value);
+          out_joint.debug_age = 0;
           break;
         }
         case moteus::kPositionKi: {
@@ -576,7 +675,16 @@ class QuadrupedControl::Impl {
     };
 
     frame_AB.pose = AC * CB;
-    frame_AB.w = (M_PI / 180.0) * imu_data_.rate_dps;
+    // Average the rate over every IMU sample from this cycle, which
+    // is less noisy than any one of them.
+    frame_AB.w = (M_PI / 180.0) * [&]() {
+      if (imu_batch_.count == 0) { return imu_data_.rate_dps; }
+      base::Point3D total_dps = base::Point3D::Zero();
+      for (int i = 0; i < imu_batch_.count; i++) {
+        total_dps += imu_batch_.samples[i].rate_dps;
+      }
+      return base::Point3D(total_dps / imu_batch_.count);
+    }();
 
     // Now the M frame (CoM)
     auto& frame_MB = status_.state.robot.frame_MB;
@@ -787,6 +895,11 @@ class QuadrupedControl::Impl {
       // register map version.
       if (!IsConfiguringDone()) { return; }
     }
+    if (status_.mode == QM::kFault &&
+        servo_config_state_ == kServoConfigFailed) {
+      // Servos which could not be configured are never used.
+      return;
+    }
 
     switch (current_command_.mode) {
       case QM::kConfiguring:
@@ -914,6 +1027,7 @@ class QuadrupedControl::Impl {
         }
       }
       status_.mode_start = Now();
+      telemetry_registry_->TriggerLog();
     }
   }
 
@@ -964,11 +1078,70 @@ class QuadrupedControl::Impl {
       }
     }
 
+    switch (servo_config_state_) {
+      case kServoConfigIdle:
+      case kServoConfigRunning: {
+        status_.fault = "configuring servos";
+        return false;
+      }
+      case kServoConfigFailed: {
+        status_.fault = servo_config_error_;
+        return false;
+      }
+      case kServoConfigDone: {
+        break;
+      }
+    }
+
     status_.fault = "";
     return true;
   }
 
+  void StartServoConfig() {
+    ServoConfigUploader::Desired desired;
+    for (const auto& joint : config_.joints) {
+      auto& items = desired[joint.id];
+      for (const auto& item : config_.servo_config) {
+        if (!item.ids.empty() &&
+            std::find(item.ids.begin(), item.ids.end(), joint.id) ==
+            item.ids.end()) {
+          continue;
+        }
+        items.push_back({item.key, item.value});
+      }
+    }
+
+    servo_config_state_ = kServoConfigRunning;
+    servo_config_uploader_->AsyncUpload(
+        desired, std::bind(&Impl::HandleServoConfig, this, pl::_1));
+  }
+
+  void HandleServoConfig(const mjlib::base::error_code& ec) {
+    servo_config_upload_signal_(&servo_config_uploader_->status());
+
+    if (ec) {
+      servo_config_attempt_++;
+      servo_config_error_ = fmt::format(
+          "servo config attempt {}/{}: {}",
+          servo_config_attempt_, parameters_.servo_config_attempts,
+          ec.message());
+      log_.warn(servo_config_error_);
+      // DoControl_Configuring will either try again or fault.
+      servo_config_state_ =
+          (servo_config_attempt_ < parameters_.servo_config_attempts) ?
+          kServoConfigIdle : kServoConfigFailed;
+      return;
+    }
+
+    servo_config_state_ = kServoConfigDone;
+  }
+
   void DoControl_Configuring() {
+    if (servo_config_state_ == kServoConfigFailed) {
+      Fault(servo_config_error_);
+      return;
+    }
+
     // If we are configuring, and have received a status that *all* of
     // our servos are not zeroed, then we skip a control cycle and
     // instead rezero them.
@@ -980,6 +1153,16 @@ class QuadrupedControl::Impl {
       return total;
     }();
 
+    // Once we have heard from everyone, and they have all been
+    // rezeroed, we can make their configuration match what we expect.
+    // All servos are handled concurrently in the background while we
+    // continue to poll.
+    if (servo_config_state_ == kServoConfigIdle &&
+        reported_servo_config_.servos.size() == kNumServos &&
+        need_rezero_count == 0) {
+      StartServoConfig();
+    }
+
     if (need_rezero_count == kNumServos) {
       // Instead of sending a normal command, we will tell our servos
       // to rezero.
@@ -1011,6 +1194,8 @@ class QuadrupedControl::Impl {
     status_.mode = QM::kFault;
     status_.fault = message;
     status_.mode_start = Now();
+    telemetry_registry_->TriggerLog();
+    telemetry_registry_->DumpFlightRecorder();
 
     log_.warn("Fault: " + std::string(message));
 
@@ -2244,7 +2429,8 @@ class QuadrupedControl::Impl {
   }
 
   boost::asio::any_io_executor executor_;
-  mjlib::telemetry::FileWriter* const telemetry_log_;
+  base::TelemetryRegistry* const telemetry_registry_;
+  base::SegmentedLog* const segmented_log_;
   Parameters parameters_;
 
   base::LogRef log_ = base::GetLogInstance("QuadrupedControl");
@@ -2270,7 +2456,8 @@ class QuadrupedControl::Impl {
   Pi3hatInterface* pi3hat_ = nullptr;
 
   using Request = Client::Request;
-  Request status_request_;
+  std::vector<Request> status_request_schedule_;
+  size_t status_request_phase_ = 0;
   Request config_status_request_;
   Client::Reply status_reply_;
 
@@ -2282,16 +2469,33 @@ class QuadrupedControl::Impl {
 
   int outstanding_status_requests_ = 0;
   AttitudeData imu_data_;
+  ImuBatch imu_batch_;
+  bool imu_batching_ = false;
 
   boost::signals2::signal<void (const Status*)> status_signal_;
   boost::signals2::signal<void (const CommandLog*)> command_signal_;
   boost::signals2::signal<void (const ControlLog*)> control_signal_;
   boost::signals2::signal<void (const AttitudeData*)> imu_signal_;
+  boost::signals2::signal<void (const ImuBatch*)> imu_batch_signal_;
   boost::signals2::signal<
     void (const ReportedServoConfig*)> servo_config_signal_;
 
   std::vector<moteus::Value> values_cache_;
 
+  enum ServoConfigState {
+    kServoConfigIdle,
+    kServoConfigRunning,
+    kServoConfigDone,
+    kServoConfigFailed,
+  };
+
+  std::optional<ServoConfigUploader> servo_config_uploader_;
+  ServoConfigState servo_config_state_ = kServoConfigDone;
+  int servo_config_attempt_ = 0;
+  std::string servo_config_error_;
+  boost::signals2::signal<
+    void (const ServoConfigUploader::Status*)> servo_config_upload_signal_;
+
   std::vector<int> all_leg_ids_{0, 1, 2, 3};
 
   boost::posix_time::ptime last_warn_timestamp_;
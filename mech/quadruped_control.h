@@ -53,6 +53,20 @@ class QuadrupedControl : boost::noncopyable {
 
     double command_timeout_s = 1.0;
 
+    // Position, velocity, torque, and fault are requested from every
+    // servo every cycle.  The remaining register groups are requested
+    // once every N cycles, staggered across servos so that each cycle
+    // has a similar amount of bus traffic.
+    int power_decimate = 100;
+    int servo_debug_decimate = 4;
+
+    // Controls for making the servo configuration match the
+    // "servo_config" section of the config file during startup.  If
+    // every attempt fails, we fault and stay faulted.
+    bool servo_config_persist = false;
+    double servo_config_timeout_s = 10.0;
+    int servo_config_attempts = 3;
+
     template <typename Archive>
     void Serialize(Archive* a) {
       a->Visit(MJ_NVP(max_torque_Nm));
@@ -61,6 +75,11 @@ class QuadrupedControl : boost::noncopyable {
       a->Visit(MJ_NVP(enable_imu));
       a->Visit(MJ_NVP(servo_debug));
       a->Visit(MJ_NVP(command_timeout_s));
+      a->Visit(MJ_NVP(power_decimate));
+      a->Visit(MJ_NVP(servo_debug_decimate));
+      a->Visit(MJ_NVP(servo_config_persist));
+      a->Visit(MJ_NVP(servo_config_timeout_s));
+      a->Visit(MJ_NVP(servo_config_attempts));
     }
   };
 
@@ -16,6 +16,8 @@
 
 #include <optional>
 
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
 #include "sophus/se3.hpp"
 
 #include "mjlib/base/visitor.h"
@@ -51,6 +53,12 @@ struct QuadrupedState {
     double feedforward_Nm = 0.0;
     double command_Nm = 0.0;
 
+    // Not every value is requested every cycle.  These count the
+    // status cycles since the voltage/temperature and the PID terms
+    // respectively were last received, saturating at 255.
+    uint8_t power_age = 255;
+    uint8_t debug_age = 255;
+
     template <typename Archive>
     void Serialize(Archive* a) {
       a->Visit(MJ_NVP(id));
@@ -66,6 +74,8 @@ struct QuadrupedState {
       a->Visit(MJ_NVP(kd_Nm));
       a->Visit(MJ_NVP(feedforward_Nm));
       a->Visit(MJ_NVP(command_Nm));
+      a->Visit(MJ_NVP(power_age));
+      a->Visit(MJ_NVP(debug_age));
     }
   };
 
@@ -0,0 +1,429 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mech/servo_config_uploader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <istream>
+#include <optional>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/time_conversions.h"
+#include "mjlib/io/deadline_timer.h"
+#include "mjlib/io/now.h"
+
+#include "base/logging.h"
+
+namespace mjmech {
+namespace mech {
+
+namespace {
+std::optional<double> ParseDouble(const std::string& value) {
+  if (value.empty()) { return {}; }
+  char* end = nullptr;
+  const double result = std::strtod(value.c_str(), &end);
+  if (end != value.c_str() + value.size()) { return {}; }
+  return result;
+}
+
+mjlib::base::error_code MakeError(boost::asio::error::basic_errors code,
+                                  const std::string& message) {
+  mjlib::base::error_code result(boost::asio::error::make_error_code(code));
+  result.Append(message);
+  return result;
+}
+}
+
+class ServoConfigUploader::Impl {
+ public:
+  Impl(const boost::asio::any_io_executor& executor,
+       mjlib::multiplex::AsioClient* client,
+       const Options& options)
+      : executor_(executor),
+        client_(client),
+        options_(options),
+        timer_(executor) {}
+
+  void AsyncUpload(const Desired& desired, mjlib::io::ErrorCallback callback) {
+    MJ_ASSERT(!callback_);
+
+    callback_ = std::move(callback);
+    start_ = Now();
+    sessions_.clear();
+    status_ = {};
+
+    // Reserve up front, so that the pointers each session holds to
+    // its status remain valid.
+    status_.servos.reserve(desired.size());
+
+    for (const auto& pair : desired) {
+      status_.servos.push_back({});
+      auto& servo_status = status_.servos.back();
+      servo_status.id = pair.first;
+
+      auto stream = client_->MakeTunnel(pair.first, options_.channel, {});
+      if (!stream) {
+        // Some clients, like the simulator, have no tunnel support.
+        // There is nothing for us to do for this servo.
+        servo_status.done = true;
+        continue;
+      }
+
+      sessions_.push_back(
+          std::make_shared<Session>(
+              this, stream, pair.second, &servo_status));
+    }
+
+    outstanding_ = sessions_.size();
+    if (outstanding_ == 0) {
+      Finish();
+      return;
+    }
+
+    timer_.expires_from_now(
+        mjlib::base::ConvertSecondsToDuration(options_.timeout_s));
+    timer_.async_wait(std::bind(&Impl::HandleTimeout, this,
+                                std::placeholders::_1));
+
+    for (auto& session : sessions_) {
+      session->Start();
+    }
+  }
+
+  const Status& status() const { return status_; }
+
+ private:
+  class Session : public std::enable_shared_from_this<Session> {
+   public:
+    using Items = std::vector<std::pair<std::string, std::string>>;
+    using LinesCallback = std::function<void (const mjlib::base::error_code&)>;
+
+    Session(Impl* parent,
+            mjlib::io::SharedStream stream,
+            const Items& items,
+            Status::Servo* status)
+        : parent_(parent),
+          stream_(stream),
+          items_(items),
+          status_(status) {}
+
+    void Start() {
+      // Any telemetry which is being emitted on this channel would
+      // interleave with our responses, so stop it first.
+      Batch({"tel stop"},
+            std::bind(&Session::HandleStop, shared_from_this(),
+                      std::placeholders::_1));
+    }
+
+    void Cancel() {
+      stream_->cancel();
+    }
+
+   private:
+    void HandleStop(const mjlib::base::error_code& ec) {
+      if (ec) { Complete(ec); return; }
+
+      std::vector<std::string> commands;
+      for (const auto& item : items_) {
+        commands.push_back("conf get " + item.first);
+      }
+      Batch(commands,
+            std::bind(&Session::HandleRead, shared_from_this(),
+                      std::placeholders::_1));
+    }
+
+    void HandleRead(const mjlib::base::error_code& ec) {
+      if (ec) { Complete(ec); return; }
+
+      status_->checked = items_.size();
+
+      std::vector<std::string> commands;
+      for (size_t i = 0; i < items_.size(); i++) {
+        const auto& item = items_[i];
+        if (ValuesMatch(item.second, lines_[i],
+                        parent_->options_.float_tolerance)) {
+          continue;
+        }
+        changed_.push_back(i);
+        commands.push_back(
+            fmt::format("conf set {} {}", item.first, item.second));
+      }
+
+      status_->changed = changed_.size();
+
+      if (commands.empty()) {
+        // Everything already matches, we are done.
+        Complete({});
+        return;
+      }
+
+      Batch(commands,
+            std::bind(&Session::HandleSet, shared_from_this(),
+                      std::placeholders::_1));
+    }
+
+    void HandleSet(const mjlib::base::error_code& ec) {
+      if (ec) { Complete(ec); return; }
+
+      for (size_t i = 0; i < lines_.size(); i++) {
+        if (lines_[i].substr(0, 2) != "OK") {
+          Complete(MakeError(
+                       boost::asio::error::invalid_argument,
+                       fmt::format("servo {} rejected '{}': {}",
+                                   status_->id,
+                                   items_[changed_[i]].first,
+                                   lines_[i])));
+          return;
+        }
+      }
+
+      // Now read back everything we changed in a single batch.
+      std::vector<std::string> commands;
+      for (const auto index : changed_) {
+        commands.push_back("conf get " + items_[index].first);
+      }
+      Batch(commands,
+            std::bind(&Session::HandleVerify, shared_from_this(),
+                      std::placeholders::_1));
+    }
+
+    void HandleVerify(const mjlib::base::error_code& ec) {
+      if (ec) { Complete(ec); return; }
+
+      std::string mismatch;
+      for (size_t i = 0; i < changed_.size(); i++) {
+        const auto& item = items_[changed_[i]];
+        if (!ValuesMatch(item.second, lines_[i],
+                         parent_->options_.float_tolerance)) {
+          status_->verify_failed++;
+          if (!mismatch.empty()) { mismatch += ", "; }
+          mismatch += fmt::format("{}={}!={}",
+                                  item.first, lines_[i], item.second);
+        }
+      }
+
+      if (!mismatch.empty()) {
+        Complete(MakeError(
+                     boost::asio::error::invalid_argument,
+                     fmt::format("servo {} verify failed: {}",
+                                 status_->id, mismatch)));
+        return;
+      }
+
+      if (!parent_->options_.persist) {
+        Complete({});
+        return;
+      }
+
+      Batch({"conf write"},
+            [self=shared_from_this()](const mjlib::base::error_code& ec) {
+              self->Complete(ec);
+            });
+    }
+
+    /// Send all @p commands in a single write, then read exactly one
+    /// response line for each into lines_.
+    void Batch(const std::vector<std::string>& commands,
+               LinesCallback callback) {
+      write_buffer_.clear();
+      for (const auto& command : commands) {
+        write_buffer_ += command + "\n";
+      }
+      lines_.clear();
+      expected_lines_ = commands.size();
+      lines_callback_ = std::move(callback);
+
+      boost::asio::async_write(
+          *stream_,
+          boost::asio::buffer(write_buffer_),
+          [self=shared_from_this()](const auto& ec, size_t) {
+            if (ec) {
+              self->lines_callback_(ec);
+              return;
+            }
+            self->ReadLine();
+          });
+    }
+
+    void ReadLine() {
+      if (lines_.size() >= expected_lines_) {
+        boost::asio::post(
+            stream_->get_executor(),
+            std::bind(std::move(lines_callback_), mjlib::base::error_code()));
+        return;
+      }
+
+      boost::asio::async_read_until(
+          *stream_,
+          streambuf_,
+          "\n",
+          [self=shared_from_this()](const auto& ec, size_t) {
+            if (ec) {
+              self->lines_callback_(ec);
+              return;
+            }
+            std::istream istr(&self->streambuf_);
+            std::string line;
+            std::getline(istr, line);
+            boost::trim(line);
+            if (line.empty()) {
+              // Blank lines carry no response.
+              self->ReadLine();
+              return;
+            }
+            self->lines_.push_back(line);
+            self->ReadLine();
+          });
+    }
+
+    void Complete(const mjlib::base::error_code& ec) {
+      if (ec) {
+        status_->error = ec.message();
+      }
+      status_->done = true;
+      parent_->HandleSessionDone(status_->id, ec);
+    }
+
+    Impl* const parent_;
+    mjlib::io::SharedStream stream_;
+    const Items items_;
+    Status::Servo* const status_;
+
+    std::vector<size_t> changed_;
+
+    std::string write_buffer_;
+    boost::asio::streambuf streambuf_;
+    std::vector<std::string> lines_;
+    size_t expected_lines_ = 0;
+    LinesCallback lines_callback_;
+  };
+
+  void HandleSessionDone(int id, const mjlib::base::error_code& ec) {
+    if (ec) {
+      log_.warn(fmt::format("servo {} config failed: {}", id, ec.message()));
+      if (!error_) { error_ = ec; }
+    }
+
+    MJ_ASSERT(outstanding_ > 0);
+    outstanding_--;
+    if (outstanding_ == 0) {
+      timer_.cancel();
+      Finish();
+    }
+  }
+
+  void HandleTimeout(const mjlib::base::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) { return; }
+    if (outstanding_ == 0) { return; }
+
+    if (!error_) {
+      error_ = MakeError(boost::asio::error::timed_out,
+                         "timeout configuring servos");
+    }
+    for (auto& session : sessions_) {
+      session->Cancel();
+    }
+  }
+
+  void Finish() {
+    status_.timestamp = Now();
+    status_.elapsed_s =
+        mjlib::base::ConvertDurationToSeconds(status_.timestamp - start_);
+
+    int changed = 0;
+    for (const auto& servo : status_.servos) { changed += servo.changed; }
+    log_.warn(fmt::format("servo config: {} servos, {} values changed, {:.2f}s",
+                          status_.servos.size(), changed, status_.elapsed_s));
+
+    auto error = error_;
+    error_ = {};
+    sessions_.clear();
+    boost::asio::post(
+        executor_,
+        std::bind(std::move(callback_), error));
+    callback_ = {};
+  }
+
+  boost::posix_time::ptime Now() const {
+    return mjlib::io::Now(executor_.context());
+  }
+
+  boost::asio::any_io_executor executor_;
+  mjlib::multiplex::AsioClient* const client_;
+  const Options options_;
+
+  base::LogRef log_ = base::GetLogInstance("ServoConfigUploader");
+
+  mjlib::io::DeadlineTimer timer_;
+  mjlib::io::ErrorCallback callback_;
+  boost::posix_time::ptime start_;
+
+  std::vector<std::shared_ptr<Session>> sessions_;
+  size_t outstanding_ = 0;
+  mjlib::base::error_code error_;
+
+  Status status_;
+};
+
+ServoConfigUploader::ServoConfigUploader(
+    const boost::asio::any_io_executor& executor,
+    mjlib::multiplex::AsioClient* client,
+    const Options& options)
+    : impl_(std::make_unique<Impl>(executor, client, options)) {}
+
+ServoConfigUploader::~ServoConfigUploader() {}
+
+void ServoConfigUploader::AsyncUpload(const Desired& desired,
+                                      mjlib::io::ErrorCallback callback) {
+  impl_->AsyncUpload(desired, std::move(callback));
+}
+
+const ServoConfigUploader::Status& ServoConfigUploader::status() const {
+  return impl_->status();
+}
+
+bool ServoConfigUploader::ValuesMatch(const std::string& desired_in,
+                                      const std::string& actual_in,
+                                      double float_tolerance) {
+  const auto desired = boost::trim_copy(desired_in);
+  const auto actual = boost::trim_copy(actual_in);
+
+  const auto maybe_desired = ParseDouble(desired);
+  const auto maybe_actual = ParseDouble(actual);
+  if (maybe_desired && maybe_actual) {
+    // Several moteus limits are disabled by setting them to nan.
+    if (std::isnan(*maybe_desired) || std::isnan(*maybe_actual)) {
+      return std::isnan(*maybe_desired) && std::isnan(*maybe_actual);
+    }
+    const double scale =
+        std::max(1.0, std::max(std::abs(*maybe_desired),
+                               std::abs(*maybe_actual)));
+    return std::abs(*maybe_desired - *maybe_actual) <= float_tolerance * scale;
+  }
+
+  return desired == actual;
+}
+
+}
+}
@@ -0,0 +1,113 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "mjlib/base/visitor.h"
+#include "mjlib/io/async_types.h"
+#include "mjlib/multiplex/asio_client.h"
+
+namespace mjmech {
+namespace mech {
+
+/// Bring a set of servos into agreement with a desired set of
+/// persistent configuration values.
+///
+/// One diagnostic tunnel is opened per servo and all servos are
+/// processed concurrently.  For each servo, every desired key is read
+/// back in a single pipelined batch, only those that differ are
+/// written, and the written values are verified with a second
+/// batched read.
+class ServoConfigUploader : boost::noncopyable {
+ public:
+  struct Options {
+    uint32_t channel = 1;
+    double timeout_s = 10.0;
+
+    // Numeric values within this relative tolerance are considered
+    // equal, since the servo reports floats with limited precision.
+    double float_tolerance = 1e-4;
+
+    // If true, issue "conf write" on each servo that was changed.
+    bool persist = false;
+  };
+
+  /// The desired configuration, as (key, value) pairs for each servo
+  /// id.
+  using Desired = std::map<int, std::vector<std::pair<std::string, std::string>>>;
+
+  ServoConfigUploader(const boost::asio::any_io_executor&,
+                      mjlib::multiplex::AsioClient*,
+                      const Options&);
+  ~ServoConfigUploader();
+
+  void AsyncUpload(const Desired&, mjlib::io::ErrorCallback);
+
+  struct Status {
+    boost::posix_time::ptime timestamp;
+
+    struct Servo {
+      int id = 0;
+      int checked = 0;
+      int changed = 0;
+      int verify_failed = 0;
+      bool done = false;
+      std::string error;
+
+      template <typename Archive>
+      void Serialize(Archive* a) {
+        a->Visit(MJ_NVP(id));
+        a->Visit(MJ_NVP(checked));
+        a->Visit(MJ_NVP(changed));
+        a->Visit(MJ_NVP(verify_failed));
+        a->Visit(MJ_NVP(done));
+        a->Visit(MJ_NVP(error));
+      }
+    };
+
+    std::vector<Servo> servos;
+    double elapsed_s = 0.0;
+
+    template <typename Archive>
+    void Serialize(Archive* a) {
+      a->Visit(MJ_NVP(timestamp));
+      a->Visit(MJ_NVP(servos));
+      a->Visit(MJ_NVP(elapsed_s));
+    }
+  };
+
+  const Status& status() const;
+
+  /// Return true if @p actual, as reported by a servo, should be
+  /// considered equal to @p desired.
+  static bool ValuesMatch(const std::string& desired,
+                          const std::string& actual,
+                          double float_tolerance);
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
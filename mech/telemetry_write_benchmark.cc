@@ -0,0 +1,548 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Measure what it costs to log the records the quadruped emits at
+/// high rate.
+///
+/// First, each record type is serialized repeatedly in isolation to
+/// find the cost and size of one record, both with the generic
+/// archive and, where possible, with TelemetryFixedWriter.  Then all
+/// of them are emitted at the configured rates through a
+/// TelemetryLogRegistrar into a FileWriter for the configured
+/// duration, reporting the time spent in each emit, the number of
+/// write syscalls, and the latency from emitting a record until it
+/// can be read back from the file.
+///
+/// The file system under test is selected by the output path, for
+/// instance /dev/shm for tmpfs.  With --fsync, latency is measured
+/// until the data has been synced, either after every marker record
+/// ("every") or on a fixed period ("periodic").
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/clipp.h"
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/system_error.h"
+#include "mjlib/telemetry/binary_write_archive.h"
+#include "mjlib/telemetry/file_writer.h"
+
+#include "base/system_fd.h"
+#include "base/telemetry_fixed_writer.h"
+#include "base/telemetry_log_registrar.h"
+
+#include "mech/attitude_data.h"
+#include "mech/pi3hat_wrapper.h"
+#include "mech/quadruped_control.h"
+
+namespace mjmech {
+namespace mech {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string output = "/tmp/telemetry_write_benchmark.log";
+  double duration_s = 10.0;
+
+  double status_hz = 400.0;
+  double control_hz = 400.0;
+  double imu_hz = 400.0;
+  double power_hz = 10.0;
+
+  int serialize_iterations = 20000;
+  bool blocking = false;
+
+  // One of "none", "every", or "periodic".
+  std::string fsync = "none";
+  double fsync_period_s = 1.0;
+  double marker_hz = 20.0;
+};
+
+/// A record with an unpredictable value, which can be searched for
+/// in the file to find when the data emitted with it has landed.
+struct Marker {
+  uint64_t nonce = 0;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(nonce));
+  }
+};
+
+QuadrupedControl::Status MakeStatus() {
+  QuadrupedControl::Status result;
+  for (int i = 0; i < 12; i++) {
+    QuadrupedState::Joint joint;
+    joint.id = i + 1;
+    joint.angle_deg = 10.0 * i;
+    joint.velocity_dps = 0.5 * i;
+    joint.torque_Nm = 0.1 * i;
+    result.state.joints.push_back(joint);
+  }
+  for (int i = 0; i < 4; i++) {
+    QuadrupedState::Leg leg;
+    leg.leg = i;
+    leg.position = base::Point3D(0.1 * i, 0.2, 0.3);
+    result.state.legs_B.push_back(leg);
+  }
+  return result;
+}
+
+QuadrupedControl::ControlLog MakeControlLog() {
+  QuadrupedControl::ControlLog result;
+  result.joints.resize(12);
+  for (int i = 0; i < 12; i++) { result.joints[i].id = i + 1; }
+  result.leg_pds.resize(4);
+  result.legs_B.resize(4);
+  result.legs_R.resize(4);
+  return result;
+}
+
+AttitudeData MakeAttitude() {
+  AttitudeData result;
+  result.rate_dps = base::Point3D(1.0, 2.0, 3.0);
+  result.accel_mps2 = base::Point3D(0.0, 0.0, 9.81);
+  return result;
+}
+
+Pi3hatWrapper::Power MakePower() {
+  Pi3hatWrapper::Power result;
+  result.output_V = 20.0;
+  result.output_A = 3.0;
+  return result;
+}
+
+template <typename Function>
+double TimePerIteration(int iterations, Function function) {
+  const auto start = Clock::now();
+  for (int i = 0; i < iterations; i++) { function(); }
+  const auto end = Clock::now();
+  return std::chrono::duration<double, std::nano>(
+      end - start).count() / iterations;
+}
+
+/// Report the cost of serializing @p data with BinaryWriteArchive,
+/// and with TelemetryFixedWriter if the type supports it.
+template <typename T>
+void BenchmarkSerialize(const std::string& name, const T& data,
+                        int iterations) {
+  const double generic_ns = TimePerIteration(iterations, [&]() {
+      mjlib::base::FastOStringStream stream;
+      mjlib::telemetry::BinaryWriteArchive(stream).Accept(&data);
+    });
+
+  mjlib::base::FastOStringStream stream;
+  mjlib::telemetry::BinaryWriteArchive(stream).Accept(&data);
+  const size_t bytes = stream.str().size();
+
+  std::string fixed = "n/a";
+  if (base::TelemetryFixedWriter<T>::layout().fixed) {
+    const double fixed_ns = TimePerIteration(iterations, [&]() {
+        mjlib::base::FastOStringStream fixed_stream;
+        base::WriteTelemetry(fixed_stream, &data);
+      });
+    fixed = fmt::format("{:.1f} ns ({:.1f}x)", fixed_ns,
+                        generic_ns / fixed_ns);
+  }
+
+  std::cout << fmt::format(
+      "serialize {:<14} {:8.1f} ns/record {:6d} bytes/record  fixed: {}\n",
+      name, generic_ns, bytes, fixed);
+}
+
+/// The number of write syscalls this process has made.
+uint64_t WriteSyscalls() {
+  std::ifstream inf("/proc/self/io");
+  std::string key;
+  uint64_t value = 0;
+  while (inf >> key >> value) {
+    if (key == "syscw:") { return value; }
+  }
+  return 0;
+}
+
+std::string FileSystemName(const std::string& path) {
+  struct statfs buf = {};
+  const auto dir = path.substr(0, path.find_last_of('/') + 1);
+  if (::statfs(dir.empty() ? "." : dir.c_str(), &buf) < 0) {
+    return "unknown";
+  }
+  switch (static_cast<uint32_t>(buf.f_type)) {
+    case 0x01021994: { return "tmpfs"; }
+    case 0xef53: { return "ext2/3/4"; }
+    case 0x58465342: { return "xfs"; }
+    case 0x9123683e: { return "btrfs"; }
+  }
+  return fmt::format("0x{:x}", static_cast<uint32_t>(buf.f_type));
+}
+
+/// Watches the log file from a separate thread, reporting when each
+/// marker becomes visible, and optionally syncing it.
+class LatencyMonitor {
+ public:
+  LatencyMonitor(const Options& options)
+      : options_(options),
+        thread_(std::bind(&LatencyMonitor::Run, this)) {}
+
+  ~LatencyMonitor() {
+    done_ = true;
+    thread_.join();
+  }
+
+  void Expect(uint64_t nonce, Clock::time_point emitted) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    pending_.push_back({nonce, emitted});
+  }
+
+  /// Stop once every outstanding marker has been seen, or a timeout
+  /// passes.
+  void Finish() {
+    const auto deadline = Clock::now() + std::chrono::seconds(5);
+    while (Clock::now() < deadline) {
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (pending_.empty() && unsynced_.empty()) { break; }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    done_ = true;
+  }
+
+  std::vector<double> latencies_us() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return latencies_us_;
+  }
+
+  int fsyncs() const { return fsyncs_; }
+
+  size_t lost() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return pending_.size() + unsynced_.size();
+  }
+
+ private:
+  struct Pending {
+    uint64_t nonce = 0;
+    Clock::time_point emitted;
+  };
+
+  void Run() {
+    base::SystemFd fd;
+    while (!done_ && fd < 0) {
+      fd = base::SystemFd(::open(options_.output.c_str(), O_RDONLY));
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::string window;
+    auto next_sync = Clock::now() +
+        std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options_.fsync_period_s));
+    char buf[65536] = {};
+
+    while (!done_) {
+      const auto got = ::read(fd, buf, sizeof(buf));
+      if (got > 0) {
+        // Keep enough of the previous read to find a marker split
+        // across reads.
+        if (window.size() > sizeof(uint64_t)) {
+          window.erase(0, window.size() - sizeof(uint64_t) + 1);
+        }
+        window.append(buf, got);
+        Search(window);
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+
+      const bool sync_now =
+          (options_.fsync == "every" && unsynced_count_ != 0) ||
+          (options_.fsync == "periodic" && Clock::now() >= next_sync);
+      if (sync_now) {
+        ::fdatasync(fd);
+        fsyncs_++;
+        next_sync = Clock::now() +
+            std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(options_.fsync_period_s));
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (const auto& item : unsynced_) { Complete(item); }
+        unsynced_.clear();
+        unsynced_count_ = 0;
+      }
+    }
+  }
+
+  void Search(const std::string& window) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      const std::string needle(
+          reinterpret_cast<const char*>(&it->nonce), sizeof(it->nonce));
+      if (window.find(needle) == std::string::npos) {
+        ++it;
+        continue;
+      }
+      if (options_.fsync == "none") {
+        Complete(*it);
+      } else {
+        unsynced_.push_back(*it);
+        unsynced_count_ = unsynced_.size();
+      }
+      it = pending_.erase(it);
+    }
+  }
+
+  void Complete(const Pending& item) {
+    latencies_us_.push_back(std::chrono::duration<double, std::micro>(
+                                Clock::now() - item.emitted).count());
+  }
+
+  const Options options_;
+
+  mutable std::mutex mutex_;
+  std::deque<Pending> pending_;
+  std::vector<Pending> unsynced_;
+  std::vector<double> latencies_us_;
+  std::atomic<bool> done_{false};
+  std::atomic<int> fsyncs_{0};
+  std::atomic<size_t> unsynced_count_{0};
+
+  std::thread thread_;
+};
+
+double Percentile(std::vector<double> values, double fraction) {
+  if (values.empty()) { return 0.0; }
+  std::sort(values.begin(), values.end());
+  const size_t index = std::min(
+      values.size() - 1, static_cast<size_t>(fraction * values.size()));
+  return values[index];
+}
+
+struct Stream {
+  std::string name;
+  double hz = 0.0;
+  std::function<void ()> emit;
+
+  Clock::time_point next;
+  uint64_t count = 0;
+  std::vector<double> emit_ns;
+};
+
+template <typename T>
+Stream MakeStream(base::TelemetryLogRegistrar* registrar,
+                  const std::string& name, double hz,
+                  boost::signals2::signal<void (const T*)>* signal,
+                  const T& data) {
+  registrar->Register(name, signal);
+  Stream result;
+  result.name = name;
+  result.hz = hz;
+  result.emit = [signal, data]() { (*signal)(&data); };
+  return result;
+}
+
+int Run(const Options& options) {
+  const auto status = MakeStatus();
+  const auto control_log = MakeControlLog();
+  const auto attitude = MakeAttitude();
+  const auto power = MakePower();
+
+  BenchmarkSerialize("qc_status", status, options.serialize_iterations);
+  BenchmarkSerialize("qc_control", control_log, options.serialize_iterations);
+  BenchmarkSerialize("imu", attitude, options.serialize_iterations);
+  BenchmarkSerialize("power", power, options.serialize_iterations);
+  BenchmarkSerialize("timing", status.timing, options.serialize_iterations);
+  BenchmarkSerialize("joint", status.state.joints.front(),
+                     options.serialize_iterations);
+
+  if (options.fsync != "none" && options.fsync != "every" &&
+      options.fsync != "periodic") {
+    throw mjlib::base::system_error::einval(
+        "unknown fsync policy: " + options.fsync);
+  }
+
+  boost::asio::io_context context;
+  mjlib::telemetry::FileWriter writer{[&]() {
+      mjlib::telemetry::FileWriter::Options writer_options;
+      writer_options.blocking = options.blocking;
+      return writer_options;
+    }()};
+  base::TelemetryLogRegistrar registrar{context, &writer};
+
+  boost::signals2::signal<void (const QuadrupedControl::Status*)> status_signal;
+  boost::signals2::signal<void (const QuadrupedControl::ControlLog*)>
+      control_signal;
+  boost::signals2::signal<void (const AttitudeData*)> imu_signal;
+  boost::signals2::signal<void (const Pi3hatWrapper::Power*)> power_signal;
+  boost::signals2::signal<void (const Marker*)> marker_signal;
+
+  std::vector<Stream> streams;
+  streams.push_back(MakeStream(&registrar, "qc_status", options.status_hz,
+                               &status_signal, status));
+  streams.push_back(MakeStream(&registrar, "qc_control", options.control_hz,
+                               &control_signal, control_log));
+  streams.push_back(MakeStream(&registrar, "imu", options.imu_hz,
+                               &imu_signal, attitude));
+  streams.push_back(MakeStream(&registrar, "power", options.power_hz,
+                               &power_signal, power));
+  registrar.Register("marker", &marker_signal);
+
+  ::unlink(options.output.c_str());
+  writer.Open(options.output);
+
+  LatencyMonitor monitor{options};
+  std::mt19937_64 random{std::random_device()()};
+
+  const auto start = Clock::now();
+  const auto end = start +
+      std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(options.duration_s));
+  const auto marker_period =
+      std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1.0 / options.marker_hz));
+  auto next_marker = start;
+
+  for (auto& stream : streams) { stream.next = start; }
+
+  const uint64_t syscalls_start = WriteSyscalls();
+
+  while (true) {
+    auto* next = &*std::min_element(
+        streams.begin(), streams.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.next < rhs.next; });
+    if (next->next >= end) { break; }
+
+    std::this_thread::sleep_until(next->next);
+
+    const auto before = Clock::now();
+    next->emit();
+    const auto after = Clock::now();
+    next->emit_ns.push_back(
+        std::chrono::duration<double, std::nano>(after - before).count());
+    next->count++;
+    next->next += std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / next->hz));
+
+    if (after >= next_marker) {
+      Marker marker;
+      marker.nonce = random();
+      monitor.Expect(marker.nonce, Clock::now());
+      marker_signal(&marker);
+      next_marker += marker_period;
+    }
+
+    context.poll();
+  }
+
+  monitor.Finish();
+  writer.Close();
+
+  const uint64_t syscalls = WriteSyscalls() - syscalls_start;
+  const double elapsed_s =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  struct stat file_stat = {};
+  ::stat(options.output.c_str(), &file_stat);
+
+  uint64_t total_records = 0;
+  std::cout << fmt::format("\nwrite path: {} ({}), fsync={}, blocking={}\n",
+                           options.output, FileSystemName(options.output),
+                           options.fsync, options.blocking);
+  for (const auto& stream : streams) {
+    total_records += stream.count;
+    const double mean = stream.emit_ns.empty() ? 0.0 :
+        std::accumulate(stream.emit_ns.begin(), stream.emit_ns.end(), 0.0) /
+        stream.emit_ns.size();
+    std::cout << fmt::format(
+        "emit {:<14} {:8d} records {:8.1f} ns mean {:8.1f} ns p99 "
+        "{:8.1f} ns max\n",
+        stream.name, stream.count, mean,
+        Percentile(stream.emit_ns, 0.99),
+        Percentile(stream.emit_ns, 1.0));
+  }
+
+  const auto latencies = monitor.latencies_us();
+  std::cout << fmt::format(
+      "file {:.1f} MB, {:.2f} MB/s, {:.1f} bytes/record\n",
+      file_stat.st_size / 1e6, file_stat.st_size / 1e6 / elapsed_s,
+      total_records ? static_cast<double>(file_stat.st_size) / total_records :
+      0.0);
+  std::cout << fmt::format(
+      "write syscalls {} ({:.3f}/record), fsyncs {}\n",
+      syscalls,
+      total_records ? static_cast<double>(syscalls) / total_records : 0.0,
+      monitor.fsyncs());
+  std::cout << fmt::format(
+      "latency to {} over {} markers: p50 {:.1f} us p99 {:.1f} us "
+      "max {:.1f} us, {} never seen\n",
+      options.fsync == "none" ? "file" : "disk",
+      latencies.size(),
+      Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+      Percentile(latencies, 1.0), monitor.lost());
+
+  return 0;
+}
+
+}
+}
+}
+
+int main(int argc, char** argv) {
+  mjmech::mech::Options options;
+
+  auto group = clipp::group(
+      (clipp::option("o", "output") & clipp::value("", options.output)) %
+      "log file to write, its file system is the one measured",
+      (clipp::option("d", "duration_s") &
+       clipp::value("", options.duration_s)),
+      (clipp::option("status_hz") & clipp::value("", options.status_hz)),
+      (clipp::option("control_hz") & clipp::value("", options.control_hz)),
+      (clipp::option("imu_hz") & clipp::value("", options.imu_hz)),
+      (clipp::option("power_hz") & clipp::value("", options.power_hz)),
+      (clipp::option("serialize_iterations") &
+       clipp::value("", options.serialize_iterations)),
+      (clipp::option("blocking").set(options.blocking)) %
+      "write from the emitting thread",
+      (clipp::option("fsync") & clipp::value("", options.fsync)) %
+      "none, every, or periodic",
+      (clipp::option("fsync_period_s") &
+       clipp::value("", options.fsync_period_s)),
+      (clipp::option("marker_hz") & clipp::value("", options.marker_hz)) %
+      "how often to sample latency"
+  );
+
+  mjlib::base::ClippParse(argc, argv, group);
+
+  return mjmech::mech::Run(options);
+}
@@ -0,0 +1,206 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mech/servo_config_uploader.h"
+
+#include <map>
+#include <sstream>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/io/async_stream.h"
+
+namespace {
+using Dut = mjmech::mech::ServoConfigUploader;
+
+/// Answers the diagnostic protocol the way a servo would, from an
+/// in-memory configuration.
+class FakeTunnel : public mjlib::io::AsyncStream {
+ public:
+  FakeTunnel(const boost::asio::any_io_executor& executor,
+             const std::map<std::string, std::string>& config)
+      : executor_(executor),
+        config_(config) {}
+
+  void async_read_some(mjlib::io::MutableBufferSequence buffers,
+                       mjlib::io::ReadHandler handler) override {
+    const auto size = boost::asio::buffer_copy(
+        buffers, boost::asio::buffer(output_));
+    output_.erase(0, size);
+    boost::asio::post(
+        executor_,
+        std::bind(std::move(handler), mjlib::base::error_code(), size));
+  }
+
+  void async_write_some(mjlib::io::ConstBufferSequence buffers,
+                        mjlib::io::WriteHandler handler) override {
+    const auto size = boost::asio::buffer_size(buffers);
+    std::string data(size, '\0');
+    boost::asio::buffer_copy(boost::asio::buffer(data), buffers);
+    input_ += data;
+
+    while (true) {
+      const auto pos = input_.find('\n');
+      if (pos == std::string::npos) { break; }
+      const auto line = input_.substr(0, pos);
+      input_.erase(0, pos + 1);
+      commands.push_back(line);
+      output_ += Respond(line) + "\r\n";
+    }
+
+    boost::asio::post(
+        executor_,
+        std::bind(std::move(handler), mjlib::base::error_code(), size));
+  }
+
+  boost::asio::any_io_executor get_executor() override { return executor_; }
+  void cancel() override {}
+
+  std::vector<std::string> commands;
+  bool written = false;
+
+ private:
+  std::string Respond(const std::string& line) {
+    std::istringstream istr(line);
+    std::string group, verb, key, value;
+    istr >> group >> verb >> key >> value;
+
+    if (group == "tel") { return "OK"; }
+    if (group != "conf") { return "ERR unknown command"; }
+    if (verb == "get") {
+      const auto it = config_.find(key);
+      return it == config_.end() ? "ERR unknown value" : it->second;
+    }
+    if (verb == "set") {
+      config_[key] = value;
+      return "OK";
+    }
+    if (verb == "write") {
+      written = true;
+      return "OK";
+    }
+    return "ERR unknown command";
+  }
+
+  boost::asio::any_io_executor executor_;
+  std::map<std::string, std::string> config_;
+  std::string input_;
+  std::string output_;
+};
+
+class FakeClient : public mjlib::multiplex::AsioClient {
+ public:
+  void AsyncTransmit(const Request*, Reply*,
+                     mjlib::io::ErrorCallback) override {
+    BOOST_FAIL("unexpected transmit");
+  }
+
+  mjlib::io::SharedStream MakeTunnel(
+      uint8_t id, uint32_t, const TunnelOptions&) override {
+    return tunnels.at(id);
+  }
+
+  std::map<int, std::shared_ptr<FakeTunnel>> tunnels;
+};
+}
+
+BOOST_AUTO_TEST_CASE(ServoConfigValuesMatchTest) {
+  BOOST_TEST(Dut::ValuesMatch("1", "1", 1e-4));
+  BOOST_TEST(Dut::ValuesMatch("1", "1.000000", 1e-4));
+  BOOST_TEST(Dut::ValuesMatch(" 2.5", "2.500000 ", 1e-4));
+  BOOST_TEST(Dut::ValuesMatch("0.1", "0.100000", 1e-4));
+  BOOST_TEST(Dut::ValuesMatch("1000", "1000.05", 1e-4));
+  BOOST_TEST(!Dut::ValuesMatch("1000", "1001", 1e-4));
+  BOOST_TEST(!Dut::ValuesMatch("0.1", "0.2", 1e-4));
+  BOOST_TEST(!Dut::ValuesMatch("1", "", 1e-4));
+  BOOST_TEST(!Dut::ValuesMatch("1", "ERR unknown", 1e-4));
+  BOOST_TEST(Dut::ValuesMatch("nan", "nan", 1e-4));
+  BOOST_TEST(!Dut::ValuesMatch("nan", "0.5", 1e-4));
+  BOOST_TEST(Dut::ValuesMatch("abc", "abc", 1e-4));
+  BOOST_TEST(!Dut::ValuesMatch("abc", "abd", 1e-4));
+}
+
+BOOST_AUTO_TEST_CASE(ServoConfigUploadTest) {
+  boost::asio::io_context context;
+  FakeClient client;
+  auto servo1 = std::make_shared<FakeTunnel>(
+      context.get_executor(),
+      std::map<std::string, std::string>{
+        {"servo.pid_position.kp", "4.000000"},
+        {"servo.max_current_A", "50.000000"},
+      });
+  auto servo2 = std::make_shared<FakeTunnel>(
+      context.get_executor(),
+      std::map<std::string, std::string>{
+        {"servo.pid_position.kp", "5.000000"},
+        {"servo.max_current_A", "30.000000"},
+      });
+  client.tunnels[1] = servo1;
+  client.tunnels[2] = servo2;
+
+  Dut::Options options;
+  options.persist = true;
+  Dut dut(context.get_executor(), &client, options);
+
+  const Dut::Desired desired = {
+    {1, {{"servo.pid_position.kp", "4"}, {"servo.max_current_A", "30"}}},
+    {2, {{"servo.pid_position.kp", "5"}, {"servo.max_current_A", "30"}}},
+  };
+
+  int done = 0;
+  mjlib::base::error_code result;
+  dut.AsyncUpload(desired, [&](const mjlib::base::error_code& ec) {
+      done++;
+      result = ec;
+    });
+  context.run();
+
+  BOOST_TEST(done == 1);
+  BOOST_TEST(!result);
+
+  // The first servo has one value which differs.  It is read, set,
+  // verified and then written.
+  const std::vector<std::string> expected1 = {
+    "tel stop",
+    "conf get servo.pid_position.kp",
+    "conf get servo.max_current_A",
+    "conf set servo.max_current_A 30",
+    "conf get servo.max_current_A",
+    "conf write",
+  };
+  BOOST_TEST(servo1->commands == expected1, boost::test_tools::per_element());
+  BOOST_TEST(servo1->written);
+
+  // The second already matches, so is only read.
+  const std::vector<std::string> expected2 = {
+    "tel stop",
+    "conf get servo.pid_position.kp",
+    "conf get servo.max_current_A",
+  };
+  BOOST_TEST(servo2->commands == expected2, boost::test_tools::per_element());
+  BOOST_TEST(!servo2->written);
+
+  const auto& status = dut.status();
+  BOOST_TEST_REQUIRE(status.servos.size() == 2);
+  BOOST_TEST(status.servos[0].id == 1);
+  BOOST_TEST(status.servos[0].checked == 2);
+  BOOST_TEST(status.servos[0].changed == 1);
+  BOOST_TEST(status.servos[0].verify_failed == 0);
+  BOOST_TEST(status.servos[0].done);
+  BOOST_TEST(status.servos[1].changed == 0);
+  BOOST_TEST(status.servos[1].done);
+}
@@ -19,7 +19,7 @@
 #include "mjlib/base/clipp.h"
 
 #include "base/logging.h"
-#include "base/timestamped_log.h"
+#include "base/segmented_log.h"
 
 #include "simulator/simulator_window.h"
 
@@ -58,10 +58,7 @@ int main(int argc, char** argv) {
   }
 
   if (!log_file.empty()) {
-    mjmech::base::OpenMaybeTimestampedLog(
-        context.telemetry_log.get(),
-        log_file,
-        mjmech::base::kTimestamped);
+    context.segmented_log->Open(log_file, mjmech::base::kTimestamped);
   }
 
   glutInit(&argc, argv);
@@ -581,9 +581,17 @@ class SimPi3hat : public mech::Pi3hatInterface {
   }
 
   void Cycle(mech::AttitudeData* attitude,
+             mech::ImuBatch* imu_batch,
              const Request* request, Reply* reply,
              mjlib::io::ErrorCallback callback) override {
     DoAttitude(attitude);
+    if (imu_batch) {
+      // The simulated IMU produces exactly one sample per cycle.
+      imu_batch->timestamp = attitude->timestamp;
+      imu_batch->count = 0;
+      imu_batch->Add({attitude->timestamp, attitude->attitude,
+                      attitude->rate_dps, attitude->accel_mps2});
+    }
     mjlib::base::error_code ec;
     DoCan(request, reply, &ec);
 
@@ -0,0 +1,163 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "mjlib/telemetry/file_reader.h"
+
+#include "base/telemetry_delta.h"
+
+namespace mjmech {
+namespace utils {
+
+/// Present records which were logged with delta encoding (as
+/// "foo.delta") as if they were ordinary items of the original
+/// record ("foo").
+///
+/// Items must be passed to Decode in file order.  Decoding can only
+/// start at a keyframe, which Keyframe can be used to find.
+class DeltaLog {
+ public:
+  using FileReader = mjlib::telemetry::FileReader;
+  using Record = FileReader::Record;
+
+  DeltaLog(FileReader* reader) : reader_(reader) {
+    const std::string suffix = base::kTelemetryDeltaSuffix;
+    for (const auto* record : reader->records()) {
+      if (!boost::ends_with(record->name, suffix)) { continue; }
+      const auto* plain = reader->record(
+          record->name.substr(0, record->name.size() - suffix.size()));
+      if (!plain) { continue; }
+
+      channels_[record].plain = plain;
+      delta_names_[plain->name] = record->name;
+    }
+  }
+
+  bool empty() const { return channels_.empty(); }
+
+  /// Return the name of the record which holds the data for
+  /// @p name.  This is the delta record if one exists.
+  std::string source(const std::string& name) const {
+    const auto it = delta_names_.find(name);
+    return it == delta_names_.end() ? name : it->second;
+  }
+
+  /// Return true if @p record holds delta encoded data.
+  bool is_delta(const Record* record) const {
+    return channels_.count(record) != 0;
+  }
+
+  /// Items from non-delta records are returned unchanged.  Items
+  /// from delta records are returned as the decoded item of the
+  /// original record, or nothing if no keyframe has been seen yet.
+  ///
+  /// The returned data remains valid until the next item from the
+  /// same record is decoded.
+  std::optional<FileReader::Item> Decode(const FileReader::Item& item) {
+    auto it = channels_.find(item.record);
+    if (it == channels_.end()) { return item; }
+
+    auto& channel = it->second;
+
+    FileReader::Item result = item;
+    result.record = channel.plain;
+
+    if (channel.last_index && item.index <= *channel.last_index) {
+      // We have already applied this one, possibly as part of a seek.
+      if (item.index != *channel.last_index) { return {}; }
+      result.data = channel.decoded;
+      return result;
+    }
+
+    const auto maybe_encoded = base::ParseTelemetryDeltaRecord(item.data);
+    if (!maybe_encoded ||
+        !channel.decoder.Decode(*maybe_encoded, &channel.decoded)) {
+      return {};
+    }
+    channel.last_index = item.index;
+
+    result.data = channel.decoded;
+    return result;
+  }
+
+  /// Forget all decoding state.
+  void Reset() {
+    for (auto& pair : channels_) {
+      pair.second.decoder.Reset();
+      pair.second.last_index.reset();
+    }
+  }
+
+  /// Return the index of the last keyframe of @p delta_record at or
+  /// before @p timestamp.
+  std::optional<FileReader::Index> Keyframe(
+      const Record* delta_record, boost::posix_time::ptime timestamp) {
+    auto it = channels_.find(delta_record);
+    if (it == channels_.end()) { return {}; }
+    auto& channel = it->second;
+
+    if (!channel.keyframes_valid) {
+      // Find them all once.
+      auto items = reader_->items([&]() {
+          FileReader::ItemsOptions options;
+          options.records.push_back(delta_record->name);
+          return options;
+        }());
+      for (const auto& item : items) {
+        const auto maybe_encoded = base::ParseTelemetryDeltaRecord(item.data);
+        if (maybe_encoded &&
+            base::TelemetryDeltaDecoder::IsKeyframe(*maybe_encoded)) {
+          channel.keyframes.push_back({item.timestamp, item.index});
+        }
+      }
+      channel.keyframes_valid = true;
+    }
+
+    const auto kf_it = std::upper_bound(
+        channel.keyframes.begin(), channel.keyframes.end(), timestamp,
+        [](const auto& lhs, const auto& rhs) { return lhs < rhs.first; });
+    if (kf_it == channel.keyframes.begin()) { return {}; }
+    return std::prev(kf_it)->second;
+  }
+
+ private:
+  struct Channel {
+    const Record* plain = nullptr;
+    base::TelemetryDeltaDecoder decoder;
+    std::string decoded;
+    std::optional<FileReader::Index> last_index;
+
+    std::vector<std::pair<boost::posix_time::ptime,
+                          FileReader::Index>> keyframes;
+    bool keyframes_valid = false;
+  };
+
+  FileReader* const reader_;
+  std::map<const Record*, Channel> channels_;
+  std::map<std::string, std::string> delta_names_;
+};
+
+}
+}
@@ -0,0 +1,441 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "mjlib/telemetry/file_reader.h"
+
+#include "base/system_fd.h"
+#include "base/system_mmap.h"
+
+namespace mjmech {
+namespace utils {
+
+/// A sparse index of a telemetry log, mapping timestamps to item
+/// positions for every record, so that seeking is a binary search
+/// plus a short forward scan rather than a walk through the file.
+///
+/// The index is stored alongside the log as "<log>.idx", and memory
+/// mapped when it is present and matches the log's size.  Otherwise
+/// it is rebuilt with one pass over the log, and saved if possible.
+///
+/// The file is a Header, then Header::records RecordEntry, then the
+/// record names, then for each record an array of Entry, all in host
+/// byte order.
+///
+/// Until the index is available, Seek and the other accessors are
+/// answered by the FileReader directly.
+class LogIndex {
+ public:
+  using FileReader = mjlib::telemetry::FileReader;
+  using Record = FileReader::Record;
+
+  // Every this many items of a record is added to its table.
+  static constexpr uint32_t kStride = 64;
+
+  struct Options {
+    // If the index must be rebuilt, do so on a separate thread with
+    // its own FileReader, and use it once Poll reports it is ready.
+    bool background = false;
+
+    // Only use an existing index, never build one.
+    bool load_only = false;
+
+    Options() {}
+  };
+
+  LogIndex(const std::string& log_filename, FileReader* reader,
+           const Options& options = {})
+      : reader_(reader),
+        index_filename_(log_filename + ".idx") {
+    const uint64_t log_size = FileSize(log_filename);
+    if (Load(log_size)) {
+      Attach();
+      return;
+    }
+
+    // The first and last items are cheap to find without an index.
+    {
+      auto items = reader_->items([&]() {
+          FileReader::ItemsOptions items_options;
+          items_options.start = reader_->final_item();
+          return items_options;
+        }());
+      end_ = (*items.begin()).timestamp;
+      final_item_ = (*items.begin()).index;
+    }
+    start_ = (*reader_->items().begin()).timestamp;
+
+    if (options.load_only) { return; }
+
+    if (!options.background) {
+      built_ = Build(reader_, log_size, nullptr);
+      Save(index_filename_, built_);
+      Attach();
+      return;
+    }
+
+    thread_ = std::thread([this, log_filename, log_size]() {
+        FileReader thread_reader{log_filename};
+        auto built = Build(&thread_reader, log_size, &cancel_);
+        if (cancel_.load()) { return; }
+        Save(index_filename_, built);
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        pending_ = std::move(built);
+      });
+  }
+
+  ~LogIndex() {
+    cancel_.store(true);
+    if (thread_.joinable()) { thread_.join(); }
+  }
+
+  LogIndex(const LogIndex&) = delete;
+  LogIndex& operator=(const LogIndex&) = delete;
+
+  /// Start using the index if a background build has finished.
+  /// Return true if the index is in use.
+  bool Poll() {
+    if (ready_) { return true; }
+
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (!pending_) { return false; }
+      built_ = std::move(*pending_);
+      pending_.reset();
+    }
+    thread_.join();
+    Attach();
+    return true;
+  }
+
+  bool ready() const { return ready_; }
+
+  boost::posix_time::ptime start() const { return start_; }
+  boost::posix_time::ptime end() const { return end_; }
+  FileReader::Index final_item() const { return final_item_; }
+
+  /// Return the position of the last item of @p record at or before
+  /// @p timestamp, if there is one.
+  std::optional<FileReader::Index> Find(
+      const Record* record, boost::posix_time::ptime timestamp) const {
+    const auto it = tables_.find(record);
+    if (it == tables_.end() || it->second.size == 0) { return {}; }
+    const auto& table = it->second;
+
+    const int64_t target = ToMicroseconds(timestamp);
+    const auto* found = std::upper_bound(
+        table.entries, table.entries + table.size, target,
+        [](int64_t lhs, const Entry& rhs) { return lhs < rhs.timestamp_us; });
+    if (found == table.entries) { return {}; }
+    --found;
+
+    // Scan forward from the sparse entry to find the exact item.
+    FileReader::Index result = found->index;
+    auto items = reader_->items([&]() {
+        FileReader::ItemsOptions options;
+        options.records.push_back(record->name);
+        options.start = found->index;
+        return options;
+      }());
+    uint32_t count = 0;
+    for (const auto& item : items) {
+      if (item.timestamp > timestamp || count > kStride) { break; }
+      result = item.index;
+      count++;
+    }
+    return result;
+  }
+
+  /// Equivalent to FileReader::Seek.
+  std::map<const Record*, FileReader::Index> Seek(
+      boost::posix_time::ptime timestamp) const {
+    if (!ready_) { return reader_->Seek(timestamp); }
+
+    std::map<const Record*, FileReader::Index> result;
+    for (const auto& pair : tables_) {
+      const auto maybe_index = Find(pair.first, timestamp);
+      if (maybe_index) { result[pair.first] = *maybe_index; }
+    }
+    return result;
+  }
+
+ private:
+  static constexpr char kMagic[8] = {'T', 'L', 'O', 'G', 'I', 'D', 'X', '1'};
+
+  struct Header {
+    char magic[8] = {};
+    uint64_t log_size = 0;
+    int64_t start_us = 0;
+    int64_t end_us = 0;
+    int64_t final_index = 0;
+    uint32_t records = 0;
+    uint32_t stride = 0;
+  };
+
+  struct RecordEntry {
+    uint64_t name_offset = 0;
+    uint64_t name_size = 0;
+    uint64_t table_offset = 0;
+    uint64_t count = 0;
+  };
+
+  struct Entry {
+    int64_t timestamp_us = 0;
+    int64_t index = 0;
+  };
+
+  struct Table {
+    const Entry* entries = nullptr;
+    uint64_t size = 0;
+  };
+
+  static uint64_t FileSize(const std::string& filename) {
+    struct stat buf = {};
+    if (::stat(filename.c_str(), &buf) < 0) { return 0; }
+    return buf.st_size;
+  }
+
+  static int64_t ToMicroseconds(boost::posix_time::ptime timestamp) {
+    return (timestamp - kEpoch()).total_microseconds();
+  }
+
+  static boost::posix_time::ptime ToPtime(int64_t us) {
+    return kEpoch() + boost::posix_time::microseconds(us);
+  }
+
+  static boost::posix_time::ptime kEpoch() {
+    return boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1));
+  }
+
+  const char* data() const {
+    return mapped_ ? mapped_ : built_.data();
+  }
+
+  const Header* header() const {
+    return reinterpret_cast<const Header*>(data());
+  }
+
+  const RecordEntry* record_entries() const {
+    return reinterpret_cast<const RecordEntry*>(data() + sizeof(Header));
+  }
+
+  void Attach() {
+    const auto* header = this->header();
+    start_ = ToPtime(header->start_us);
+    end_ = ToPtime(header->end_us);
+    final_item_ = header->final_index;
+
+    const auto* records = record_entries();
+    for (uint32_t i = 0; i < header->records; i++) {
+      const auto& entry = records[i];
+      const std::string name(data() + entry.name_offset, entry.name_size);
+      const auto* record = reader_->record(name);
+      if (!record) { continue; }
+      tables_[record] = Table{
+        reinterpret_cast<const Entry*>(data() + entry.table_offset),
+        entry.count};
+    }
+    ready_ = true;
+  }
+
+  bool Load(uint64_t log_size) {
+    base::SystemFd fd{::open(index_filename_.c_str(), O_RDONLY)};
+    if (fd < 0) { return false; }
+    const uint64_t size = FileSize(index_filename_);
+    if (size < sizeof(Header)) { return false; }
+
+    base::SystemMmap mmap(fd, size, 0, PROT_READ);
+    const auto* header = static_cast<const Header*>(mmap.ptr());
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+        header->log_size != log_size ||
+        header->stride != kStride ||
+        !Valid(static_cast<const char*>(mmap.ptr()), size)) {
+      return false;
+    }
+
+    mapped_ = static_cast<const char*>(mmap.ptr());
+    mmap_ = std::move(mmap);
+    return true;
+  }
+
+  /// Return true if every offset and size in the index at @p data
+  /// lies within its @p size bytes.  The file may have been truncated
+  /// or written by something else, and Attach trusts them.
+  static bool Valid(const char* data, uint64_t size) {
+    const auto* header = reinterpret_cast<const Header*>(data);
+    const uint64_t records_end =
+        sizeof(Header) + uint64_t(header->records) * sizeof(RecordEntry);
+    if (records_end > size) { return false; }
+
+    const auto* records =
+        reinterpret_cast<const RecordEntry*>(data + sizeof(Header));
+    for (uint32_t i = 0; i < header->records; i++) {
+      const auto& entry = records[i];
+      // Each comparison is arranged so that it cannot overflow.
+      if (entry.name_offset > size ||
+          entry.name_size > size - entry.name_offset) {
+        return false;
+      }
+      if (entry.table_offset > size ||
+          entry.table_offset % alignof(Entry) != 0 ||
+          entry.count > (size - entry.table_offset) / sizeof(Entry)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Read all of @p reader and return the contents of the index.
+  /// Stop early if @p cancel is set.
+  static std::string Build(FileReader* reader, uint64_t log_size,
+                           const std::atomic<bool>* cancel) {
+    struct Builder {
+      uint64_t count = 0;
+      std::vector<Entry> entries;
+    };
+    std::map<std::string, Builder> builders;
+    for (const auto* record : reader->records()) {
+      builders[record->name];
+    }
+
+    Header header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.log_size = log_size;
+    header.stride = kStride;
+
+    bool first = true;
+    uint64_t count = 0;
+    for (const auto& item : reader->items()) {
+      if (cancel && (++count % 4096) == 0 && cancel->load()) { break; }
+      const int64_t us = ToMicroseconds(item.timestamp);
+      if (first) {
+        header.start_us = us;
+        first = false;
+      }
+      header.end_us = us;
+      header.final_index = item.index;
+
+      auto& builder = builders[item.record->name];
+      if (builder.count % kStride == 0) {
+        builder.entries.push_back({us, item.index});
+      }
+      builder.count++;
+    }
+
+    header.records = builders.size();
+
+    // Lay out the names, then the tables, keeping the latter aligned.
+    std::string names;
+    std::vector<RecordEntry> records;
+    for (const auto& pair : builders) {
+      RecordEntry entry;
+      entry.name_offset = names.size();
+      entry.name_size = pair.first.size();
+      entry.count = pair.second.entries.size();
+      names += pair.first;
+      records.push_back(entry);
+    }
+    const uint64_t names_start =
+        sizeof(Header) + records.size() * sizeof(RecordEntry);
+    uint64_t tables_start = names_start + names.size();
+    tables_start = (tables_start + 7) & ~static_cast<uint64_t>(7);
+
+    uint64_t offset = tables_start;
+    {
+      size_t i = 0;
+      for (const auto& pair : builders) {
+        records[i].name_offset += names_start;
+        records[i].table_offset = offset;
+        offset += pair.second.entries.size() * sizeof(Entry);
+        i++;
+      }
+    }
+
+    std::string result(offset, '\0');
+    std::memcpy(result.data(), &header, sizeof(header));
+    std::memcpy(result.data() + sizeof(Header), records.data(),
+                records.size() * sizeof(RecordEntry));
+    std::memcpy(result.data() + names_start, names.data(), names.size());
+    {
+      size_t i = 0;
+      for (const auto& pair : builders) {
+        const auto& entries = pair.second.entries;
+        if (!entries.empty()) {
+          std::memcpy(result.data() + records[i].table_offset,
+                      entries.data(), entries.size() * sizeof(Entry));
+        }
+        i++;
+      }
+    }
+    return result;
+  }
+
+  /// Write the index next to the log.  Failures, for instance when
+  /// the directory is read only, just mean it will be rebuilt next
+  /// time.
+  static void Save(const std::string& filename, const std::string& data) {
+    const std::string temp = filename + ".tmp";
+    std::FILE* file = std::fopen(temp.c_str(), "wb");
+    if (!file) { return; }
+    const bool success =
+        std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    std::fclose(file);
+    if (!success || std::rename(temp.c_str(), filename.c_str()) != 0) {
+      std::remove(temp.c_str());
+    }
+  }
+
+  FileReader* const reader_;
+  const std::string index_filename_;
+
+  // Exactly one of these holds the index.
+  base::SystemMmap mmap_;
+  const char* mapped_ = nullptr;
+  std::string built_;
+
+  std::map<const Record*, Table> tables_;
+  bool ready_ = false;
+
+  boost::posix_time::ptime start_;
+  boost::posix_time::ptime end_;
+  FileReader::Index final_item_ = {};
+
+  std::thread thread_;
+  std::atomic<bool> cancel_{false};
+  std::mutex mutex_;
+  std::optional<std::string> pending_;
+};
+
+}
+}
@@ -0,0 +1,614 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Compute summary statistics for telemetry logs, so that a day's
+/// worth of logs can be checked without opening each in tplot2.
+///
+/// Every numeric leaf field of every record is a channel, named as
+/// log_to_columns names its columns, like
+/// "qc_status.state.joints.3.temperature_C".  For each channel, the
+/// count, minimum, maximum, mean, and standard deviation are exact.
+/// The percentiles and histogram are estimated from a uniform sample
+/// of its values.  Non-finite values are only counted.
+///
+/// Logs with a "qc_status" record also report the time spent in each
+/// QuadrupedCommand::Mode, how many control cycles took longer than
+/// the control period, and the peak temperature of each joint.
+///
+/// Each path may be a log, or a directory, in which case every
+/// "*.log" file in it is used.  Logs are divided among worker
+/// threads, each reading its logs in a single pass.
+///
+/// The output is either CSV, with one "file,name,statistic,value" row
+/// per value, or JSON.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/clipp.h"
+#include "mjlib/base/fail.h"
+#include "mjlib/base/time_conversions.h"
+#include "mjlib/telemetry/file_reader.h"
+#include "mjlib/telemetry/mapped_binary_reader.h"
+
+#include "base/reservoir_sampler.h"
+#include "mech/quadruped_config.h"
+#include "mech/quadruped_control.h"
+
+#include "utils/delta_log.h"
+
+namespace fs = boost::filesystem;
+
+using Element = mjlib::telemetry::BinarySchemaParser::Element;
+using FileReader = mjlib::telemetry::FileReader;
+using FT = mjlib::telemetry::Format::Type;
+
+namespace mjmech {
+namespace utils {
+namespace {
+
+// Percentiles and histograms are estimated from this many samples of
+// each channel.
+constexpr size_t kSampleSize = 2048;
+
+const double kPercentiles[] = {1, 5, 25, 50, 75, 95, 99};
+
+struct Options {
+  std::vector<std::string> paths;
+  std::string output;
+  bool json = false;
+  std::vector<std::string> records;
+  int threads = 0;
+  int bins = 20;
+  double period_s = mech::QuadrupedConfig().period_s;
+};
+
+class ChannelStats {
+ public:
+  void Add(double value) {
+    if (!std::isfinite(value)) {
+      nonfinite_++;
+      return;
+    }
+
+    count_++;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+
+    // Welford's method, to avoid cancellation in the variance.
+    const double delta = value - mean_;
+    mean_ += delta / count_;
+    m2_ += delta * (value - mean_);
+
+    sample_.Add(value);
+  }
+
+  /// Call @p emit with the name and value of each statistic.
+  template <typename Emit>
+  void Report(int bins, Emit emit) const {
+    emit("count", count_);
+    emit("nonfinite", nonfinite_);
+    if (count_ == 0) { return; }
+
+    emit("min", min_);
+    emit("max", max_);
+    emit("mean", mean_);
+    emit("stddev", count_ > 1 ? std::sqrt(m2_ / (count_ - 1)) : 0.0);
+
+    std::vector<float> sorted(sample_.begin(), sample_.end());
+    std::sort(sorted.begin(), sorted.end());
+    for (const double percentile : kPercentiles) {
+      const double position = percentile / 100.0 * (sorted.size() - 1);
+      const size_t lower = static_cast<size_t>(position);
+      const size_t upper = std::min(lower + 1, sorted.size() - 1);
+      const double fraction = position - lower;
+      emit(fmt::format("p{:02.0f}", percentile),
+           sorted[lower] + fraction * (sorted[upper] - sorted[lower]));
+    }
+
+    // The estimated number of values in each of the equal width bins
+    // between the minimum and maximum.
+    std::vector<double> histogram(bins);
+    const double scale = static_cast<double>(count_) / sorted.size();
+    const double width = (max_ - min_) / bins;
+    for (const float value : sorted) {
+      const int bin = (width > 0.0) ?
+          std::clamp<int>((value - min_) / width, 0, bins - 1) : 0;
+      histogram[bin] += scale;
+    }
+    for (int i = 0; i < bins; i++) {
+      emit(fmt::format("hist{:02d}", i), histogram[i]);
+    }
+  }
+
+ private:
+  uint64_t count_ = 0;
+  uint64_t nonfinite_ = 0;
+  double min_ = std::numeric_limits<double>::infinity();
+  double max_ = -std::numeric_limits<double>::infinity();
+  double mean_ = 0.0;
+  double m2_ = 0.0;
+  base::ReservoirSampler<float> sample_{kSampleSize};
+};
+
+/// Accumulates every numeric leaf of one record.
+///
+/// The schema is mirrored by a tree of Nodes, extended as array
+/// elements are first seen, so that no names are formatted per item.
+class RecordStats {
+ public:
+  RecordStats(const std::string& name) {
+    root_.name = name;
+  }
+
+  void Add(const FileReader::Item& item) {
+    mjlib::base::BufferReadStream stream{item.data};
+    Visit(&root_, item.record->schema->root(), stream);
+  }
+
+  /// Call @p handler with the name and statistics of each channel, in
+  /// schema order.
+  template <typename Handler>
+  void ForEach(Handler handler) const {
+    ForEach(root_, handler);
+  }
+
+ private:
+  struct Node {
+    std::string name;
+    std::unique_ptr<ChannelStats> stats;
+    std::vector<std::unique_ptr<Node>> children;
+  };
+
+  template <typename Handler>
+  static void ForEach(const Node& node, Handler& handler) {
+    if (node.stats) { handler(node.name, *node.stats); }
+    for (const auto& child : node.children) { ForEach(*child, handler); }
+  }
+
+  template <typename Suffix>
+  Node* Child(Node* node, size_t index, Suffix suffix) {
+    while (node->children.size() <= index) {
+      node->children.push_back(std::make_unique<Node>());
+      node->children.back()->name =
+          node->name + "." + suffix(node->children.size() - 1);
+    }
+    return node->children[index].get();
+  }
+
+  Node* Child(Node* node, size_t index) {
+    return Child(node, index, [](size_t i) { return std::to_string(i); });
+  }
+
+  ChannelStats* Leaf(Node* node) {
+    if (!node->stats) { node->stats = std::make_unique<ChannelStats>(); }
+    return node->stats.get();
+  }
+
+  void Visit(Node* node, const Element* element,
+             mjlib::base::ReadStream& stream) {
+    switch (element->type) {
+      case FT::kFinal:
+      case FT::kNull: {
+        return;
+      }
+      case FT::kBoolean: {
+        Leaf(node)->Add(element->ReadBoolean(stream) ? 1.0 : 0.0);
+        return;
+      }
+      case FT::kFixedInt:
+      case FT::kVarint: {
+        Leaf(node)->Add(element->ReadIntLike(stream));
+        return;
+      }
+      case FT::kFixedUInt:
+      case FT::kVaruint: {
+        Leaf(node)->Add(element->ReadUIntLike(stream));
+        return;
+      }
+      case FT::kFloat32:
+      case FT::kFloat64: {
+        Leaf(node)->Add(element->ReadFloatLike(stream));
+        return;
+      }
+      case FT::kTimestamp:
+      case FT::kDuration:
+      case FT::kEnum:
+      case FT::kBytes:
+      case FT::kString:
+      case FT::kMap: {
+        // These have no meaningful numeric statistics.
+        element->Ignore(stream);
+        return;
+      }
+      case FT::kObject: {
+        const auto& fields = element->fields;
+        for (size_t i = 0; i < fields.size(); i++) {
+          Visit(Child(node, i, [&](size_t j) { return fields[j].name; }),
+                fields[i].element, stream);
+        }
+        return;
+      }
+      case FT::kArray:
+      case FT::kFixedArray: {
+        const uint64_t size =
+            (element->type == FT::kArray) ?
+            element->ReadArraySize(stream) : element->array_size;
+        for (uint64_t i = 0; i < size; i++) {
+          Visit(Child(node, i), element->children.front(), stream);
+        }
+        return;
+      }
+      case FT::kUnion: {
+        const auto index = element->ReadUnionIndex(stream);
+        const bool optional =
+            element->children.size() == 2 &&
+            element->children.front()->type == FT::kNull;
+        Visit(optional ? node : Child(node, index),
+              element->children[index], stream);
+        return;
+      }
+    }
+  }
+
+  Node root_;
+};
+
+/// Quadruped specific results from "qc_status".
+class QuadrupedStats {
+ public:
+  using Status = mech::QuadrupedControl::Status;
+
+  QuadrupedStats(const Element* root, double period_s)
+      : reader_(root),
+        period_s_(period_s) {}
+
+  void Add(const FileReader::Item& item) {
+    const auto status = reader_.Read(item.data);
+
+    // Each item's mode is assumed to last until the next item.
+    if (last_mode_) {
+      mode_s_[*last_mode_] += mjlib::base::ConvertDurationToSeconds(
+          item.timestamp - last_timestamp_);
+    }
+    last_mode_ = status.mode;
+    last_timestamp_ = item.timestamp;
+
+    cycles_++;
+    if (status.timing.cycle_s > period_s_) { overruns_++; }
+    max_cycle_s_ = std::max(max_cycle_s_, status.timing.cycle_s);
+    max_delta_s_ = std::max(max_delta_s_, status.timing.delta_s);
+
+    for (const auto& joint : status.state.joints) {
+      auto it = temperature_C_.find(joint.id);
+      if (it == temperature_C_.end()) {
+        temperature_C_[joint.id] = joint.temperature_C;
+      } else {
+        it->second = std::max(it->second, joint.temperature_C);
+      }
+    }
+  }
+
+  template <typename Emit>
+  void Report(Emit emit) const {
+    const auto names = mjlib::base::IsEnum<mech::QuadrupedCommand::Mode>::map();
+    for (const auto& pair : mode_s_) {
+      emit(fmt::format("quadruped.mode_s.{}", names.at(pair.first)),
+           pair.second);
+    }
+    emit("quadruped.cycles", cycles_);
+    emit("quadruped.overruns", overruns_);
+    emit("quadruped.max_cycle_s", max_cycle_s_);
+    emit("quadruped.max_delta_s", max_delta_s_);
+    for (const auto& pair : temperature_C_) {
+      emit(fmt::format("quadruped.peak_temperature_C.{}", pair.first),
+           pair.second);
+    }
+  }
+
+ private:
+  mjlib::telemetry::MappedBinaryReader<Status> reader_;
+  const double period_s_;
+
+  std::optional<mech::QuadrupedCommand::Mode> last_mode_;
+  boost::posix_time::ptime last_timestamp_;
+  std::map<mech::QuadrupedCommand::Mode, double> mode_s_;
+
+  uint64_t cycles_ = 0;
+  uint64_t overruns_ = 0;
+  double max_cycle_s_ = 0.0;
+  double max_delta_s_ = 0.0;
+  std::map<int, double> temperature_C_;
+};
+
+/// Everything found in one log.
+struct LogStats {
+  boost::posix_time::ptime start;
+  boost::posix_time::ptime end;
+  std::vector<std::unique_ptr<RecordStats>> records;
+  std::unique_ptr<QuadrupedStats> quadruped;
+
+  /// Call @p emit with the name and value of every result.
+  template <typename Emit>
+  void Report(int bins, Emit emit) const {
+    emit("log", "duration_s",
+         start.is_not_a_date_time() ? 0.0 :
+         mjlib::base::ConvertDurationToSeconds(end - start));
+    for (const auto& record : records) {
+      record->ForEach([&](const std::string& name,
+                          const ChannelStats& stats) {
+          stats.Report(bins, [&](const std::string& statistic,
+                                 double value) {
+              emit(name, statistic, value);
+            });
+        });
+    }
+    if (quadruped) {
+      quadruped->Report([&](const std::string& name, double value) {
+          emit(name, "value", value);
+        });
+    }
+  }
+};
+
+/// Read all of one log with its own reader, so that workers share
+/// nothing.
+std::unique_ptr<LogStats> ProcessLog(
+    const Options& options, const std::string& filename) {
+  FileReader reader{filename};
+  DeltaLog delta_log{&reader};
+
+  std::vector<std::string> names = options.records;
+  if (names.empty()) {
+    for (const auto* record : reader.records()) {
+      // Delta records are reported under their original name.
+      if (delta_log.is_delta(record)) { continue; }
+      names.push_back(record->name);
+    }
+  }
+
+  auto result = std::make_unique<LogStats>();
+  std::map<const FileReader::Record*, RecordStats*> by_record;
+  FileReader::ItemsOptions items_options;
+  for (const auto& name : names) {
+    const auto* record = reader.record(name);
+    if (!record) { continue; }
+    result->records.push_back(std::make_unique<RecordStats>(name));
+    by_record[record] = result->records.back().get();
+    items_options.records.push_back(delta_log.source(name));
+  }
+
+  const auto* qc_status = reader.record("qc_status");
+  if (qc_status) {
+    result->quadruped = std::make_unique<QuadrupedStats>(
+        qc_status->schema->root(), options.period_s);
+    if (by_record.count(qc_status) == 0) {
+      items_options.records.push_back(delta_log.source("qc_status"));
+    }
+  }
+  if (items_options.records.empty()) { return result; }
+
+  for (const auto& encoded : reader.items(items_options)) {
+    const auto maybe_item = delta_log.Decode(encoded);
+    if (!maybe_item) { continue; }
+    const auto& item = *maybe_item;
+
+    if (result->start.is_not_a_date_time()) { result->start = item.timestamp; }
+    result->end = item.timestamp;
+
+    const auto it = by_record.find(item.record);
+    if (it != by_record.end()) { it->second->Add(item); }
+    if (item.record == qc_status) { result->quadruped->Add(item); }
+  }
+
+  return result;
+}
+
+/// Expand directories into the logs they contain.
+std::vector<std::string> FindLogs(const std::vector<std::string>& paths) {
+  std::vector<std::string> result;
+  for (const auto& path : paths) {
+    if (!fs::is_directory(path)) {
+      result.push_back(path);
+      continue;
+    }
+
+    std::vector<std::string> found;
+    for (const auto& entry : fs::directory_iterator(path)) {
+      if (!fs::is_regular_file(entry.status())) { continue; }
+      if (entry.path().extension() != ".log") { continue; }
+      found.push_back(entry.path().native());
+    }
+    std::sort(found.begin(), found.end());
+    result.insert(result.end(), found.begin(), found.end());
+  }
+  return result;
+}
+
+std::string FormatValue(double value) {
+  if (!std::isfinite(value)) { return "nan"; }
+  return fmt::format("{}", value);
+}
+
+std::string JsonString(const std::string& value) {
+  std::string result = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') { result += '\\'; }
+    result += c;
+  }
+  return result + "\"";
+}
+
+std::string CsvField(const std::string& value) {
+  if (value.find_first_of(",\"\n") == std::string::npos) { return value; }
+  std::string result = "\"";
+  for (char c : value) {
+    if (c == '"') { result += '"'; }
+    result += c;
+  }
+  return result + "\"";
+}
+
+void WriteCsv(std::ostream& out, const Options& options,
+              const std::vector<std::string>& logs,
+              const std::vector<std::unique_ptr<LogStats>>& results) {
+  out << "file,name,statistic,value\n";
+  for (size_t i = 0; i < logs.size(); i++) {
+    if (!results[i]) { continue; }
+    const std::string file = CsvField(logs[i]);
+    results[i]->Report(
+        options.bins,
+        [&](const std::string& name, const std::string& statistic,
+            double value) {
+          out << file << "," << CsvField(name) << "," << statistic << ","
+              << FormatValue(value) << "\n";
+        });
+  }
+}
+
+void WriteJson(std::ostream& out, const Options& options,
+               const std::vector<std::string>& logs,
+               const std::vector<std::unique_ptr<LogStats>>& results) {
+  out << "{\n  \"logs\": [";
+  bool first_log = true;
+  for (size_t i = 0; i < logs.size(); i++) {
+    if (!results[i]) { continue; }
+    out << (first_log ? "\n" : ",\n");
+    first_log = false;
+    out << "    {\"file\": " << JsonString(logs[i]) << ", \"values\": {";
+
+    // Results are grouped by name, which the reports emit
+    // contiguously.
+    std::string current;
+    bool first_name = true;
+    bool first_statistic = true;
+    results[i]->Report(
+        options.bins,
+        [&](const std::string& name, const std::string& statistic,
+            double value) {
+          if (first_name || name != current) {
+            if (!first_name) { out << "}"; }
+            out << (first_name ? "\n" : ",\n");
+            out << "      " << JsonString(name) << ": {";
+            current = name;
+            first_name = false;
+            first_statistic = true;
+          }
+          out << (first_statistic ? "" : ", ")
+              << JsonString(statistic) << ": "
+              << (std::isfinite(value) ? FormatValue(value) : "null");
+          first_statistic = false;
+        });
+    if (!first_name) { out << "}"; }
+    out << "\n    }}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int Run(const Options& options) {
+  const auto logs = FindLogs(options.paths);
+
+  const int nthreads = std::max<int>(
+      1, std::min<int>(
+          logs.size(),
+          options.threads > 0 ? options.threads :
+          std::max(1u, std::thread::hardware_concurrency())));
+
+  std::vector<std::unique_ptr<LogStats>> results(logs.size());
+  std::atomic<size_t> next{0};
+  std::mutex errors_mutex;
+  std::vector<std::string> errors;
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < nthreads; i++) {
+    workers.emplace_back([&]() {
+        while (true) {
+          const size_t index = next++;
+          if (index >= logs.size()) { return; }
+          try {
+            results[index] = ProcessLog(options, logs[index]);
+          } catch (std::exception& e) {
+            std::lock_guard<std::mutex> guard(errors_mutex);
+            errors.push_back(fmt::format("{}: {}", logs[index], e.what()));
+          }
+        }
+      });
+  }
+  for (auto& worker : workers) { worker.join(); }
+
+  for (const auto& error : errors) {
+    std::cerr << error << "\n";
+  }
+
+  std::ofstream file;
+  if (!options.output.empty()) { file.open(options.output); }
+  std::ostream& out = options.output.empty() ? std::cout : file;
+  if (options.json) {
+    WriteJson(out, options, logs, results);
+  } else {
+    WriteCsv(out, options, logs, results);
+  }
+
+  return errors.empty() ? 0 : 1;
+}
+
+}
+}
+}
+
+int main(int argc, char** argv) {
+  mjmech::utils::Options options;
+
+  auto group = clipp::group(
+      clipp::values("log file or directory", options.paths),
+      (clipp::option("o", "output") & clipp::value("FILE", options.output)) %
+      "write here instead of stdout",
+      clipp::option("json").set(options.json) % "write JSON instead of CSV",
+      (clipp::option("r", "record") &
+       clipp::values("RECORD", options.records)) %
+      "only report these records",
+      (clipp::option("j", "threads") & clipp::value("N", options.threads)) %
+      "worker threads, defaults to the number of cores",
+      (clipp::option("bins") & clipp::value("N", options.bins)) %
+      "histogram bins",
+      (clipp::option("period") & clipp::value("S", options.period_s)) %
+      "control period used to count overruns"
+  );
+
+  mjlib::base::ClippParse(argc, argv, group);
+
+  options.bins = std::max(1, options.bins);
+
+  return mjmech::utils::Run(options);
+}
@@ -0,0 +1,100 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <exception>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "mjlib/telemetry/file_reader.h"
+
+#include "utils/delta_log.h"
+
+namespace mjmech {
+namespace utils {
+
+/// Follows a log which FileWriter is still appending to, reporting
+/// each item as it becomes available.
+///
+/// It has its own FileReader, which is left open and read onward from
+/// the last item seen whenever the file grows.  Only records which
+/// were in the log when it was opened are known.
+class LogTail {
+ public:
+  using FileReader = mjlib::telemetry::FileReader;
+
+  /// Items up to and including @p last_index, at @p last_timestamp,
+  /// are assumed to have been read already.
+  LogTail(const std::string& filename,
+          FileReader::Index last_index,
+          boost::posix_time::ptime last_timestamp)
+      : filename_(filename),
+        reader_(filename),
+        last_index_(last_index),
+        last_timestamp_(last_timestamp) {}
+
+  FileReader* reader() { return &reader_; }
+
+  /// The last item which has been reported.
+  FileReader::Index last_index() const { return last_index_; }
+  boost::posix_time::ptime last_timestamp() const { return last_timestamp_; }
+
+  /// If the log has grown, call @p handler with each item written
+  /// since the last call, in order.  Delta encoded records are
+  /// decoded, once a keyframe has been seen.
+  template <typename Handler>
+  void Poll(Handler handler) {
+    struct stat buf = {};
+    if (::stat(filename_.c_str(), &buf) < 0) { return; }
+    if (buf.st_size == last_size_) { return; }
+    last_size_ = buf.st_size;
+
+    auto items = reader_.items([&]() {
+        FileReader::ItemsOptions options;
+        options.start = last_index_;
+        return options;
+      }());
+    try {
+      for (const auto& raw_item : items) {
+        if (raw_item.index <= last_index_) { continue; }
+        last_index_ = raw_item.index;
+        last_timestamp_ = raw_item.timestamp;
+
+        const auto maybe_item = delta_log_.Decode(raw_item);
+        if (!maybe_item) { continue; }
+        handler(*maybe_item);
+      }
+    } catch (std::exception&) {
+      // The final item may be only partially written.  It will be
+      // read again on the next poll.
+      last_size_ = -1;
+    }
+  }
+
+ private:
+  const std::string filename_;
+  FileReader reader_;
+  DeltaLog delta_log_{&reader_};
+  FileReader::Index last_index_ = {};
+  boost::posix_time::ptime last_timestamp_;
+  int64_t last_size_ = -1;
+};
+
+}
+}
@@ -0,0 +1,711 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Convert a telemetry log into a directory of columns, one
+/// contiguous little endian array per flattened leaf field, so that
+/// analysis tools can memory map and slice them rather than decode
+/// every item.
+///
+/// Each record "foo" results in a "foo.__timestamp__.bin" column of
+/// int64 microseconds since the epoch, and one column per leaf, like
+/// "foo.state.joints.3.angle_deg.bin".  Every column of a record has
+/// one row per item of that record.  Values which are absent from an
+/// item (a shorter array, or an empty optional) are NaN for floating
+/// point columns and 0 otherwise.  Strings, bytes, and maps are not
+/// exported.
+///
+/// "index.json" in the output directory lists every column with its
+/// record, numpy style dtype, row count, and file.
+///
+/// The log is split into ranges of items which are converted in
+/// parallel, so that each part of it is read only once.  Each worker
+/// appends its columns to a single scratch file, and the columns are
+/// assembled from those once every range is done.  Delta encoded
+/// records must be decoded from the start, so if any are converted, a
+/// single range is used.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/clipp.h"
+#include "mjlib/base/fail.h"
+#include "mjlib/base/system_error.h"
+#include "mjlib/telemetry/file_reader.h"
+
+#include "utils/delta_log.h"
+#include "utils/log_index.h"
+
+namespace fs = boost::filesystem;
+
+using Element = mjlib::telemetry::BinarySchemaParser::Element;
+using FileReader = mjlib::telemetry::FileReader;
+using FT = mjlib::telemetry::Format::Type;
+
+namespace mjmech {
+namespace utils {
+namespace {
+
+// Every column of every range has a buffer of up to this size.
+constexpr size_t kFlushBytes = 1 << 13;
+
+const boost::posix_time::ptime kEpoch(boost::gregorian::date(1970, 1, 1));
+
+enum class ColumnType {
+  kFloat32,
+  kFloat64,
+  kInt64,
+  kUInt64,
+  kBool,
+};
+
+const char* DType(ColumnType type) {
+  switch (type) {
+    case ColumnType::kFloat32: { return "<f4"; }
+    case ColumnType::kFloat64: { return "<f8"; }
+    case ColumnType::kInt64: { return "<i8"; }
+    case ColumnType::kUInt64: { return "<u8"; }
+    case ColumnType::kBool: { return "|u1"; }
+  }
+  mjlib::base::AssertNotReached();
+}
+
+size_t Width(ColumnType type) {
+  switch (type) {
+    case ColumnType::kFloat32: { return 4; }
+    case ColumnType::kFloat64: { return 8; }
+    case ColumnType::kInt64: { return 8; }
+    case ColumnType::kUInt64: { return 8; }
+    case ColumnType::kBool: { return 1; }
+  }
+  mjlib::base::AssertNotReached();
+}
+
+/// Append one row of the value used for absent fields.
+void AppendDefault(ColumnType type, std::string* buffer) {
+  auto append = [&](auto value) {
+    buffer->append(reinterpret_cast<const char*>(&value), sizeof(value));
+  };
+  switch (type) {
+    case ColumnType::kFloat32: {
+      append(std::numeric_limits<float>::quiet_NaN());
+      return;
+    }
+    case ColumnType::kFloat64: {
+      append(std::numeric_limits<double>::quiet_NaN());
+      return;
+    }
+    case ColumnType::kInt64:
+    case ColumnType::kUInt64:
+    case ColumnType::kBool: {
+      buffer->append(Width(type), '\0');
+      return;
+    }
+  }
+}
+
+/// A scratch file which blocks of column data are appended to, so
+/// that a worker keeps only one file open no matter how many columns
+/// it has.  It is removed from the directory as soon as it is
+/// created, and so disappears when closed.
+class Spill {
+ public:
+  explicit Spill(const fs::path& filename) {
+    file_ = std::fopen(filename.c_str(), "w+b");
+    if (file_ == nullptr) {
+      throw mjlib::base::system_error::syserrno(
+          "opening " + filename.native());
+    }
+    fs::remove(filename);
+  }
+
+  ~Spill() { std::fclose(file_); }
+
+  Spill(const Spill&) = delete;
+  Spill& operator=(const Spill&) = delete;
+
+  /// Return the offset @p data was written at.
+  uint64_t Append(const std::string& data) {
+    const uint64_t offset = size_;
+    if (std::fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+      throw mjlib::base::system_error::syserrno("writing scratch file");
+    }
+    size_ += data.size();
+    return offset;
+  }
+
+  /// Write out anything buffered.  Must be called after the last
+  /// Append and before the first CopyTo.
+  void Finish() {
+    if (std::fflush(file_) != 0) {
+      throw mjlib::base::system_error::syserrno("writing scratch file");
+    }
+  }
+
+  /// Copy @p size bytes from @p offset to @p dest.
+  void CopyTo(uint64_t offset, uint64_t size, std::FILE* dest) const {
+    char buffer[kFlushBytes];
+    while (size > 0) {
+      const size_t to_copy = std::min<uint64_t>(size, sizeof(buffer));
+      if (::pread(::fileno(file_), buffer, to_copy, offset) !=
+          static_cast<ssize_t>(to_copy)) {
+        throw mjlib::base::system_error::syserrno("reading scratch file");
+      }
+      if (std::fwrite(buffer, 1, to_copy, dest) != to_copy) {
+        throw mjlib::base::system_error::syserrno("writing column");
+      }
+      offset += to_copy;
+      size -= to_copy;
+    }
+  }
+
+ private:
+  std::FILE* file_ = nullptr;
+  uint64_t size_ = 0;
+};
+
+/// One output column, for one range.  Rows are buffered in memory
+/// and appended to the range's Spill in blocks.
+///
+/// Flush must be called once the last row is written.
+///
+/// NOTE: Values are written in host byte order, which is assumed to
+/// be little endian.
+class Column {
+ public:
+  Column(std::string name, ColumnType type, Spill* spill)
+      : name_(std::move(name)),
+        type_(type),
+        spill_(spill) {}
+
+  const std::string& name() const { return name_; }
+  ColumnType type() const { return type_; }
+  uint64_t rows() const { return rows_; }
+
+  template <typename T>
+  void Write(uint64_t row, T value) {
+    Pad(row);
+    const char* ptr = reinterpret_cast<const char*>(&value);
+    buffer_.append(ptr, sizeof(value));
+    rows_++;
+    if (buffer_.size() >= kFlushBytes) { Flush(); }
+  }
+
+  /// Fill any rows before @p row with the default value.
+  void Pad(uint64_t row) {
+    while (rows_ < row) {
+      AppendDefault(type_, &buffer_);
+      rows_++;
+      if (buffer_.size() >= kFlushBytes) { Flush(); }
+    }
+  }
+
+  void Flush() {
+    if (buffer_.empty()) { return; }
+    blocks_.push_back({spill_->Append(buffer_), buffer_.size()});
+    buffer_.clear();
+  }
+
+  /// Write every flushed row to @p file.
+  void CopyTo(std::FILE* file) const {
+    for (const auto& block : blocks_) {
+      spill_->CopyTo(block.first, block.second, file);
+    }
+  }
+
+ private:
+  const std::string name_;
+  const ColumnType type_;
+  Spill* const spill_;
+  std::string buffer_;
+  uint64_t rows_ = 0;
+
+  // The (offset, size) of each block written to the spill.
+  std::vector<std::pair<uint64_t, uint64_t>> blocks_;
+};
+
+/// Decodes every item of one record within one range into its
+/// columns.
+///
+/// The schema is mirrored by a tree of Nodes, which is extended as
+/// array elements are first seen, so that no names are formatted
+/// per item.
+class RecordConverter {
+ public:
+  RecordConverter(const std::string& name, Spill* spill)
+      : spill_(spill) {
+    root_.name = name;
+    timestamp_ = MakeColumn(name + ".__timestamp__", ColumnType::kInt64);
+  }
+
+  void Convert(const FileReader::Item& item) {
+    timestamp_->Write<int64_t>(
+        row_, (item.timestamp - kEpoch).total_microseconds());
+
+    mjlib::base::BufferReadStream stream{item.data};
+    Visit(&root_, item.record->schema->root(), stream);
+    row_++;
+  }
+
+  /// Pad every column out to the final row count, and write
+  /// everything still buffered.
+  void Finish() {
+    for (auto& column : columns_) {
+      column->Pad(row_);
+      column->Flush();
+    }
+  }
+
+  const std::vector<std::unique_ptr<Column>>& columns() const {
+    return columns_;
+  }
+
+  const std::string& name() const { return root_.name; }
+  uint64_t rows() const { return row_; }
+
+  /// Return the column named @p name, if any items in this range had
+  /// it.
+  const Column* column(const std::string& name) const {
+    const auto it = by_name_.find(name);
+    return (it == by_name_.end()) ? nullptr : it->second;
+  }
+
+ private:
+  struct Node {
+    std::string name;
+    Column* column = nullptr;
+    std::vector<std::unique_ptr<Node>> children;
+  };
+
+  Column* MakeColumn(const std::string& name, ColumnType type) {
+    columns_.push_back(std::make_unique<Column>(name, type, spill_));
+    by_name_[name] = columns_.back().get();
+    return columns_.back().get();
+  }
+
+  template <typename Suffix>
+  Node* Child(Node* node, size_t index, Suffix suffix) {
+    while (node->children.size() <= index) {
+      node->children.push_back(std::make_unique<Node>());
+      node->children.back()->name =
+          node->name + "." + suffix(node->children.size() - 1);
+    }
+    return node->children[index].get();
+  }
+
+  Node* Child(Node* node, size_t index) {
+    return Child(node, index, [](size_t i) { return std::to_string(i); });
+  }
+
+  Column* Leaf(Node* node, ColumnType type) {
+    if (!node->column) { node->column = MakeColumn(node->name, type); }
+    return node->column;
+  }
+
+  void Visit(Node* node, const Element* element,
+             mjlib::base::ReadStream& stream) {
+    switch (element->type) {
+      case FT::kFinal:
+      case FT::kNull: {
+        return;
+      }
+      case FT::kBoolean: {
+        Leaf(node, ColumnType::kBool)->Write<uint8_t>(
+            row_, element->ReadBoolean(stream) ? 1 : 0);
+        return;
+      }
+      case FT::kFixedInt:
+      case FT::kVarint:
+      case FT::kTimestamp:
+      case FT::kDuration: {
+        Leaf(node, ColumnType::kInt64)->Write<int64_t>(
+            row_, element->ReadIntLike(stream));
+        return;
+      }
+      case FT::kFixedUInt:
+      case FT::kVaruint: {
+        Leaf(node, ColumnType::kUInt64)->Write<uint64_t>(
+            row_, element->ReadUIntLike(stream));
+        return;
+      }
+      case FT::kEnum: {
+        Leaf(node, ColumnType::kUInt64)->Write<uint64_t>(
+            row_, element->children.front()->ReadUIntLike(stream));
+        return;
+      }
+      case FT::kFloat32: {
+        Leaf(node, ColumnType::kFloat32)->Write<float>(
+            row_, element->ReadFloatLike(stream));
+        return;
+      }
+      case FT::kFloat64: {
+        Leaf(node, ColumnType::kFloat64)->Write<double>(
+            row_, element->ReadFloatLike(stream));
+        return;
+      }
+      case FT::kBytes:
+      case FT::kString:
+      case FT::kMap: {
+        element->Ignore(stream);
+        return;
+      }
+      case FT::kObject: {
+        const auto& fields = element->fields;
+        for (size_t i = 0; i < fields.size(); i++) {
+          Visit(Child(node, i, [&](size_t j) { return fields[j].name; }),
+                fields[i].element, stream);
+        }
+        return;
+      }
+      case FT::kArray:
+      case FT::kFixedArray: {
+        const uint64_t size =
+            (element->type == FT::kArray) ?
+            element->ReadArraySize(stream) : element->array_size;
+        for (uint64_t i = 0; i < size; i++) {
+          Visit(Child(node, i), element->children.front(), stream);
+        }
+        return;
+      }
+      case FT::kUnion: {
+        const auto index = element->ReadUnionIndex(stream);
+        // The common case of an optional value is flattened as if it
+        // were not optional.  Otherwise each alternative gets its own
+        // index.
+        const bool optional =
+            element->children.size() == 2 &&
+            element->children.front()->type == FT::kNull;
+        Visit(optional ? node : Child(node, index),
+              element->children[index], stream);
+        return;
+      }
+    }
+  }
+
+  Spill* const spill_;
+
+  std::vector<std::unique_ptr<Column>> columns_;
+  std::map<std::string, const Column*> by_name_;
+  Column* timestamp_ = nullptr;
+  Node root_;
+  uint64_t row_ = 0;
+};
+
+struct Options {
+  std::string log_filename;
+  std::string output;
+  std::vector<std::string> records;
+  int threads = 0;
+};
+
+/// Everything converted from one range of the log.
+struct Range {
+  std::optional<FileReader::Index> start;
+  std::optional<FileReader::Index> end;
+
+  std::unique_ptr<Spill> spill;
+
+  // One for each record name, in the same order.
+  std::vector<std::unique_ptr<RecordConverter>> converters;
+};
+
+/// Convert every item with an index in [start, end) of @p range,
+/// reading from its own reader so that workers share nothing.
+void ConvertRange(const Options& options,
+                  const std::vector<std::string>& names,
+                  Range* range) {
+  FileReader reader{options.log_filename};
+  DeltaLog delta_log{&reader};
+
+  FileReader::ItemsOptions items_options;
+  std::map<const FileReader::Record*, RecordConverter*> by_record;
+  for (const auto& name : names) {
+    range->converters.push_back(
+        std::make_unique<RecordConverter>(name, range->spill.get()));
+    by_record[reader.record(name)] = range->converters.back().get();
+    items_options.records.push_back(delta_log.source(name));
+  }
+  if (range->start) { items_options.start = *range->start; }
+
+  for (const auto& encoded : reader.items(items_options)) {
+    if (range->end && encoded.index >= *range->end) { break; }
+    const auto maybe_item = delta_log.Decode(encoded);
+    if (!maybe_item) { continue; }
+    const auto it = by_record.find(maybe_item->record);
+    if (it == by_record.end()) { continue; }
+    it->second->Convert(*maybe_item);
+  }
+
+  for (auto& converter : range->converters) { converter->Finish(); }
+  range->spill->Finish();
+}
+
+/// Split the log into about @p count ranges with similar durations,
+/// at the positions LogIndex gives for the records in @p sources.
+std::vector<Range> MakeRanges(const Options& options,
+                              FileReader* reader,
+                              const std::set<std::string>& sources,
+                              int count) {
+  std::vector<Range> result(1);
+  if (count <= 1) { return result; }
+
+  // Without an index, the reader answers more slowly, but still
+  // without reading the whole log.
+  const LogIndex index{options.log_filename, reader, []() {
+      LogIndex::Options index_options;
+      index_options.load_only = true;
+      return index_options;
+    }()};
+
+  const auto start = index.start();
+  const auto duration = index.end() - start;
+  for (int i = 1; i < count; i++) {
+    const auto seek = index.Seek(start + duration * i / count);
+    std::optional<FileReader::Index> bound;
+    for (const auto& pair : seek) {
+      if (sources.count(pair.first->name) == 0) { continue; }
+      if (!bound || pair.second < *bound) { bound = pair.second; }
+    }
+    if (!bound) { continue; }
+    if (result.back().start && *bound <= *result.back().start) { continue; }
+    result.back().end = bound;
+    result.push_back({});
+    result.back().start = bound;
+  }
+  return result;
+}
+
+struct IndexEntry {
+  std::string name;
+  std::string record;
+  ColumnType type = ColumnType::kFloat64;
+  uint64_t rows = 0;
+  fs::path filename;
+};
+
+/// Write each column of record @p record_index, concatenating its
+/// rows from every range in order.  A column which first appears in
+/// a later range is padded out over the earlier ones.
+void AssembleRecord(const Options& options,
+                    const std::vector<Range>& ranges,
+                    size_t record_index,
+                    std::vector<IndexEntry>* index) {
+  std::vector<std::string> names;
+  std::map<std::string, ColumnType> types;
+  for (const auto& range : ranges) {
+    for (const auto& column :
+             range.converters[record_index]->columns()) {
+      if (types.insert({column->name(), column->type()}).second) {
+        names.push_back(column->name());
+      }
+    }
+  }
+
+  std::string padding;
+  for (const auto& name : names) {
+    IndexEntry entry;
+    entry.name = name;
+    entry.record = ranges.front().converters[record_index]->name();
+    entry.type = types.at(name);
+    entry.filename = fs::path(options.output) / (name + ".bin");
+
+    std::FILE* file = std::fopen(entry.filename.c_str(), "wb");
+    if (file == nullptr) {
+      throw mjlib::base::system_error::syserrno(
+          "opening " + entry.filename.native());
+    }
+    try {
+      for (const auto& range : ranges) {
+        const auto& converter = *range.converters[record_index];
+        const Column* column = converter.column(name);
+        if (column) {
+          column->CopyTo(file);
+        } else {
+          padding.clear();
+          for (uint64_t i = 0; i < converter.rows(); i++) {
+            AppendDefault(entry.type, &padding);
+          }
+          if (std::fwrite(padding.data(), 1, padding.size(), file) !=
+              padding.size()) {
+            throw mjlib::base::system_error::syserrno(
+                "writing " + entry.filename.native());
+          }
+        }
+        entry.rows += converter.rows();
+      }
+    } catch (...) {
+      std::fclose(file);
+      throw;
+    }
+    if (std::fclose(file) != 0) {
+      throw mjlib::base::system_error::syserrno(
+          "writing " + entry.filename.native());
+    }
+    index->push_back(std::move(entry));
+  }
+}
+
+std::string JsonString(const std::string& value) {
+  std::string result = "\"";
+  for (char c : value) {
+    switch (c) {
+      case '"': { result += "\\\""; break; }
+      case '\\': { result += "\\\\"; break; }
+      case '\b': { result += "\\b"; break; }
+      case '\f': { result += "\\f"; break; }
+      case '\n': { result += "\\n"; break; }
+      case '\r': { result += "\\r"; break; }
+      case '\t': { result += "\\t"; break; }
+      default: {
+        if (static_cast<unsigned char>(c) < 0x20) {
+          result += fmt::format("\\u{:04x}", static_cast<int>(c));
+        } else {
+          result += c;
+        }
+        break;
+      }
+    }
+  }
+  return result + "\"";
+}
+
+int Run(const Options& options) {
+  FileReader reader{options.log_filename};
+  DeltaLog delta_log{&reader};
+
+  std::vector<std::string> names = options.records;
+  if (names.empty()) {
+    for (const auto* record : reader.records()) {
+      // Delta records are exported under their original name.
+      if (delta_log.is_delta(record)) { continue; }
+      names.push_back(record->name);
+    }
+  }
+
+  std::set<std::string> sources;
+  bool any_delta = false;
+  for (const auto& name : names) {
+    if (reader.record(name) == nullptr) {
+      std::cerr << fmt::format("{}: no such record\n", name);
+      return 1;
+    }
+    const auto source = delta_log.source(name);
+    sources.insert(source);
+    if (source != name) { any_delta = true; }
+  }
+
+  fs::create_directories(options.output);
+
+  const int nthreads = any_delta ? 1 : std::max<int>(
+      1, options.threads > 0 ? options.threads :
+      std::max(1u, std::thread::hardware_concurrency()));
+
+  auto ranges = MakeRanges(options, &reader, sources, nthreads);
+  for (size_t i = 0; i < ranges.size(); i++) {
+    ranges[i].spill = std::make_unique<Spill>(
+        fs::path(options.output) / fmt::format(".range{}.tmp", i));
+  }
+
+  std::mutex errors_mutex;
+  std::vector<std::string> errors;
+
+  std::vector<std::thread> workers;
+  for (auto& range : ranges) {
+    workers.emplace_back([&, range=&range]() {
+        try {
+          ConvertRange(options, names, range);
+        } catch (std::exception& e) {
+          std::lock_guard<std::mutex> guard(errors_mutex);
+          errors.push_back(e.what());
+        }
+      });
+  }
+  for (auto& worker : workers) { worker.join(); }
+
+  // Every range has every record, so a failure in any of them leaves
+  // nothing complete to write.
+  if (!errors.empty()) {
+    for (const auto& error : errors) { std::cerr << error << "\n"; }
+    return 1;
+  }
+
+  std::vector<IndexEntry> entries;
+  try {
+    for (size_t i = 0; i < names.size(); i++) {
+      AssembleRecord(options, ranges, i, &entries);
+    }
+  } catch (std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+
+  std::ofstream index((fs::path(options.output) / "index.json").native());
+  index << "{\n  \"columns\": [";
+  bool first = true;
+  for (const auto& entry : entries) {
+    index << (first ? "\n" : ",\n");
+    first = false;
+    index << fmt::format(
+        "    {{\"name\": {}, \"record\": {}, \"dtype\": \"{}\", "
+        "\"rows\": {}, \"file\": {}}}",
+        JsonString(entry.name), JsonString(entry.record),
+        DType(entry.type), entry.rows,
+        JsonString(entry.filename.filename().native()));
+  }
+  index << "\n  ]\n}\n";
+
+  return 0;
+}
+
+}
+}
+}
+
+int main(int argc, char** argv) {
+  mjmech::utils::Options options;
+
+  auto group = clipp::group(
+      clipp::value("log file", options.log_filename),
+      clipp::value("output directory", options.output),
+      (clipp::option("r", "record") &
+       clipp::values("RECORD", options.records)) %
+      "only convert these records",
+      (clipp::option("j", "threads") & clipp::value("N", options.threads)) %
+      "worker threads, defaults to the number of cores"
+  );
+
+  mjlib::base::ClippParse(argc, argv, group);
+
+  return mjmech::utils::Run(options);
+}
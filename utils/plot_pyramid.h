@@ -0,0 +1,198 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace mjmech {
+namespace utils {
+
+/// A multi-resolution min/max envelope of a line plot, so that only
+/// about as many points as there are pixels need be drawn no matter
+/// how many samples are in view, while keeping every peak visible.
+///
+/// Level k summarizes buckets of 2^(k+2) samples with two points,
+/// the minimum and the maximum, in the order they occur.  This only
+/// applies when x is non-decreasing, as it is for time plots.
+/// Otherwise every sample is always drawn.
+///
+/// The samples themselves are not retained, and must be passed to
+/// Get and Extend.
+class PlotPyramid {
+ public:
+  struct Span {
+    const double* x = nullptr;
+    const double* y = nullptr;
+    size_t size = 0;
+  };
+
+  PlotPyramid() {}
+
+  PlotPyramid(const std::vector<double>& x, const std::vector<double>& y) {
+    // NaNs don't sort, so they are treated as in order here.
+    if (!std::is_sorted(x.begin(), x.end())) { return; }
+    monotonic_ = true;
+    Update(x, y, 0);
+  }
+
+  /// Incorporate samples appended to @p x and @p y, of which the
+  /// first @p first were already present.  Only the buckets at the end
+  /// of each level are recomputed.
+  void Extend(const std::vector<double>& x, const std::vector<double>& y,
+              size_t first) {
+    if (first == 0) {
+      *this = PlotPyramid(x, y);
+      return;
+    }
+    if (!monotonic_) { return; }
+    if (!std::is_sorted(x.begin() + (first - 1), x.end())) {
+      monotonic_ = false;
+      levels_.clear();
+      return;
+    }
+    Update(x, y, first);
+  }
+
+  /// Return the points of @p x and @p y, which must be the same as
+  /// this was constructed with, to draw for the range [@p xmin,
+  /// @p xmax] when it is @p pixels wide.
+  Span Get(const std::vector<double>& x, const std::vector<double>& y,
+           double xmin, double xmax, double pixels) const {
+    if (!monotonic_ || levels_.empty()) {
+      return {x.data(), y.data(), x.size()};
+    }
+
+    const size_t start = std::lower_bound(x.begin(), x.end(), xmin) -
+        x.begin();
+    const size_t end = std::upper_bound(x.begin(), x.end(), xmax) -
+        x.begin();
+    const size_t visible = end > start ? end - start : 0;
+    const size_t max_points = std::max<size_t>(
+        kMinBuckets, 2 * static_cast<size_t>(std::max(0.0, pixels)));
+
+    // Include one sample on either side, so lines continue off the
+    // edge of the plot.
+    if (visible <= max_points) {
+      const size_t first = start > 0 ? start - 1 : 0;
+      const size_t last = std::min(x.size(), end + 1);
+      return {x.data() + first, y.data() + first, last - first};
+    }
+
+    // Find the first level which is coarse enough.
+    size_t level = 0;
+    size_t bucket = 4;
+    while (level + 1 < levels_.size() &&
+           2 * visible / bucket > max_points) {
+      level++;
+      bucket *= 2;
+    }
+
+    const auto& points = levels_[level];
+    const size_t nbuckets = points.x.size() / 2;
+    const size_t first = std::min(nbuckets, start / bucket);
+    const size_t first_bucket = first > 0 ? first - 1 : 0;
+    const size_t last_bucket = std::min(nbuckets, end / bucket + 2);
+    return {points.x.data() + 2 * first_bucket,
+            points.y.data() + 2 * first_bucket,
+            2 * (last_bucket - first_bucket)};
+  }
+
+  size_t levels() const { return levels_.size(); }
+
+ private:
+  static constexpr size_t kMinBuckets = 512;
+
+  struct Level {
+    std::vector<double> x;
+    std::vector<double> y;
+  };
+
+  struct Point {
+    double x = std::numeric_limits<double>::quiet_NaN();
+    double y = std::numeric_limits<double>::quiet_NaN();
+  };
+
+  static void Emit(Level* level, Point min, Point max) {
+    // Keep them in x order, so the line is drawn correctly.
+    if (max.x < min.x) { std::swap(min, max); }
+    level->x.push_back(min.x);
+    level->y.push_back(min.y);
+    level->x.push_back(max.x);
+    level->y.push_back(max.y);
+  }
+
+  /// Fold the point at @p x, @p y into a bucket's extremes.
+  static void Accumulate(double x, double y, Point* min, Point* max) {
+    if (!std::isfinite(y)) { return; }
+    if (!std::isfinite(min->y) || y < min->y) { *min = {x, y}; }
+    if (!std::isfinite(max->y) || y > max->y) { *max = {x, y}; }
+  }
+
+  /// Recompute every level from sample @p first onward.
+  void Update(const std::vector<double>& x, const std::vector<double>& y,
+              size_t first) {
+    // Each bucket of one level is 2 points, so 4 make up a bucket of
+    // the next, just as 4 samples make up a bucket of the first.
+    for (size_t level = 0; ; level++) {
+      const auto& source_x = level == 0 ? x : levels_[level - 1].x;
+      const auto& source_y = level == 0 ? y : levels_[level - 1].y;
+      if (source_x.size() / 4 < kMinBuckets) {
+        levels_.resize(level);
+        return;
+      }
+      if (level == levels_.size()) {
+        // Adding a level may move the others.
+        Level next;
+        first = Summarize(source_x, source_y, 0, &next);
+        levels_.push_back(std::move(next));
+        continue;
+      }
+      first = Summarize(source_x, source_y, first, &levels_[level]);
+    }
+  }
+
+  /// Update @p level, which summarizes @p x and @p y, for changes
+  /// from index @p first onward.  Return the first point of @p level
+  /// which changed.
+  static size_t Summarize(const std::vector<double>& x,
+                          const std::vector<double>& y,
+                          size_t first, Level* level) {
+    // The bucket which held the first changed sample and all after it
+    // are recomputed.
+    const size_t start = (first / 4) * 4;
+    level->x.resize(start / 2);
+    level->y.resize(start / 2);
+    level->x.reserve(x.size() / 2 + 2);
+    level->y.reserve(x.size() / 2 + 2);
+    for (size_t i = start; i < x.size(); i += 4) {
+      Point min;
+      Point max;
+      for (size_t j = i; j < std::min(i + 4, x.size()); j++) {
+        Accumulate(x[j], y[j], &min, &max);
+      }
+      Emit(level, min, max);
+    }
+    return start / 2;
+  }
+
+  bool monotonic_ = false;
+  std::vector<Level> levels_;
+};
+
+}
+}
@@ -14,8 +14,6 @@
 
 #include "utils/quadruped_tplot2.h"
 
-#include "mjlib/telemetry/mapped_binary_reader.h"
-
 #include "mech/quadruped_control.h"
 
 #include "utils/tree_view.h"
@@ -25,7 +23,7 @@ namespace utils {
 
 namespace {
 struct Force {
-  Eigen::Vector3d force_N;
+  Eigen::Vector3d force_N = Eigen::Vector3d::Zero();
 
   template <typename Archive>
   void Serialize(Archive* a) {
@@ -34,53 +32,36 @@ struct Force {
 };
 }
 
-void AddQuadrupedDerived(mjlib::telemetry::FileReader* file_reader,
-                         TreeView* tree_view) {
-  auto qc_reader = std::make_shared<mjlib::telemetry::MappedBinaryReader<
-    mech::QuadrupedControl::ControlLog>>(
-        file_reader->record("qc_control")->schema->root());
-  auto qs_reader = std::make_shared<mjlib::telemetry::MappedBinaryReader<
-    mech::QuadrupedControl::Status>>(
-        file_reader->record("qc_status")->schema->root());
-  tree_view->AddDerived(
-      "control_CoM_N",
-      [qc_reader](const CurrentLogData& data) {
-        const auto maybe_d = data.get("qc_control");
-        if (!maybe_d) { return Force(); }
+void AddQuadrupedDerived(TreeView* tree_view) {
+  using ControlLog = mech::QuadrupedControl::ControlLog;
+  using Status = mech::QuadrupedControl::Status;
+
+  tree_view->AddDerived<ControlLog>(
+      "control_CoM_N", {"qc_control"},
+      [](const ControlLog* qc) {
+        if (!qc) { return Force(); }
 
-        auto qc = qc_reader->Read(*maybe_d);
-        Eigen::Vector3d result_N;
-        for (const auto& leg_B : qc.legs_B) {
+        Force result;
+        for (const auto& leg_B : qc->legs_B) {
           if (leg_B.stance != 0.0) {
-            result_N += leg_B.force_N;
+            result.force_N += leg_B.force_N;
           }
         }
-
-        Force result;
-        result.force_N = result_N;
         return result;
       });
-  tree_view->AddDerived(
-      "status_CoM_N",
-      [qc_reader, qs_reader](const CurrentLogData& data) {
-        const auto maybe_c = data.get("qc_control");
-        const auto maybe_s = data.get("qc_status");
-        if (!maybe_c || !maybe_s) { return Force(); }
-
-        auto qc = qc_reader->Read(*maybe_c);
-        auto qs = qs_reader->Read(*maybe_s);
-        if (qc.legs_B.size() != qs.state.legs_B.size()) {
+  tree_view->AddDerived<ControlLog, Status>(
+      "status_CoM_N", {"qc_control", "qc_status"},
+      [](const ControlLog* qc, const Status* qs) {
+        if (!qc || !qs) { return Force(); }
+        if (qc->legs_B.size() != qs->state.legs_B.size()) {
           return Force();
         }
 
-        Eigen::Vector3d result_N;
-        for (size_t i = 0; i < qs.state.legs_B.size(); i++) {
-          if (qc.legs_B[i].stance == 0.0) { continue; }
-          result_N += qs.state.legs_B[i].force_N;
-        }
-
         Force result;
-        result.force_N = result_N;
+        for (size_t i = 0; i < qs->state.legs_B.size(); i++) {
+          if (qc->legs_B[i].stance == 0.0) { continue; }
+          result.force_N += qs->state.legs_B[i].force_N;
+        }
         return result;
       });
 }
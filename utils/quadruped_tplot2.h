@@ -14,14 +14,12 @@
 
 #pragma once
 
-#include "mjlib/telemetry/file_reader.h"
-
 #include "utils/tree_view.h"
 
 namespace mjmech {
 namespace utils {
 
-void AddQuadrupedDerived(mjlib::telemetry::FileReader*, TreeView*);
+void AddQuadrupedDerived(TreeView*);
 
 }
 }
@@ -0,0 +1,97 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Join a telemetry multicast group, as published by
+/// TelemetryMulticastPublisher, and write everything received to a
+/// log file readable by tplot2 and the other log tools.
+
+#include <iostream>
+
+#include <boost/asio/io_context.hpp>
+
+#include <fmt/format.h>
+
+#include "mjlib/base/clipp.h"
+#include "mjlib/base/fail.h"
+#include "mjlib/base/time_conversions.h"
+#include "mjlib/io/repeating_timer.h"
+#include "mjlib/telemetry/file_writer.h"
+
+#include "base/logging.h"
+#include "base/telemetry_multicast.h"
+#include "base/timestamped_log.h"
+#include "base/udp_data_link.h"
+
+using namespace mjmech;
+
+int main(int argc, char** argv) {
+  std::string source;
+  std::string output = "mcast.log";
+  bool short_name = false;
+  double stats_period_s = 5.0;
+
+  auto group = clipp::group(
+      (clipp::option("s", "source") & clipp::value("", source)) %
+      "multicast group to join, as IP:PORT",
+      (clipp::option("o", "output") & clipp::value("", output)) %
+      "log file to write",
+      (clipp::option("L", "log_short_name").set(short_name)) %
+      "do not insert timestamp in log file name",
+      (clipp::option("stats_period_s") & clipp::value("", stats_period_s))
+  );
+  group.push_back(base::MakeLoggingOptions());
+
+  mjlib::base::ClippParse(argc, argv, group);
+  base::InitLogging();
+
+  boost::asio::io_context context;
+  auto executor = context.get_executor();
+
+  mjlib::telemetry::FileWriter writer;
+  base::OpenMaybeTimestampedLog(
+      &writer, output, short_name ? base::kShort : base::kTimestamped);
+
+  base::TelemetryMulticastReceiver receiver;
+  receiver.WriteTo(&writer);
+
+  base::LogRef log = base::GetLogInstance("telemetry_mcast_recorder");
+
+  base::UdpDataLink::Parameters link_params;
+  link_params.source = source;
+  // We only listen.
+  link_params.dest = ":";
+  base::UdpDataLink link(executor, log, link_params);
+  link.data_signal()->connect(
+      [&](const std::string& data, const base::UdpDataLink::PeerInfo&) {
+        receiver.Feed(data);
+      });
+
+  mjlib::io::RepeatingTimer stats_timer(executor);
+  stats_timer.start(
+      mjlib::base::ConvertSecondsToDuration(stats_period_s),
+      [&](const mjlib::base::error_code& ec) {
+        mjlib::base::FailIf(ec);
+        const auto& stats = receiver.stats();
+        std::cout << fmt::format(
+            "datagrams={} lost={} malformed={} incomplete={} records={} "
+            "restarts={}\n",
+            stats.datagrams, stats.lost_datagrams, stats.malformed,
+            stats.incomplete_records, stats.records, stats.restarts);
+      });
+
+  context.run();
+  return 0;
+}
@@ -21,14 +21,10 @@
 //  * render a grid on ground (with units)
 //  * render text velocities/forces near the arrows
 //  * it would be nice to start with legs down
-//  * plot time trajectories over a time window, or perhaps just
-//    resettable trailers
 //  * make line rendering be anti-aliased and support line width
 //  * show exaggerated pitch and roll
 //  * show some indication of foot slip
 // * Video
-//  * after rewinding, video sometimes doesn't start playing for a
-//    good while
 //  * pan / zoom
 //  * hw accelerated decoding or color xform
 // * multiple render/plot/tree widgets
@@ -37,8 +33,21 @@
 // * search/filtering in tree widget
 
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
 #include <string>
+#include <thread>
 #include <variant>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -60,29 +69,31 @@
 #include "mjlib/telemetry/mapped_binary_reader.h"
 #include "mjlib/imgui/imgui_application.h"
 
-#include "ffmpeg/codec.h"
-#include "ffmpeg/file.h"
 #include "ffmpeg/ffmpeg.h"
-#include "ffmpeg/frame.h"
-#include "ffmpeg/packet.h"
-#include "ffmpeg/swscale.h"
+#include "ffmpeg/frame_cache.h"
 
 #include "gl/flat_rgb_texture.h"
 #include "gl/framebuffer.h"
+#include "gl/instanced_mesh_render_list.h"
+#include "gl/line_strip_render_list.h"
 #include "gl/orthographic_camera.h"
 #include "gl/perspective_camera.h"
 #include "gl/program.h"
 #include "gl/renderbuffer.h"
 #include "gl/shader.h"
 #include "gl/simple_line_render_list.h"
-#include "gl/simple_texture_render_list.h"
 #include "gl/trackball.h"
 #include "gl/vertex_array_object.h"
 #include "gl/vertex_buffer_object.h"
 
 #include "mech/attitude_data.h"
+#include "mech/pi3hat_wrapper.h"
 #include "mech/quadruped_control.h"
 
+#include "utils/delta_log.h"
+#include "utils/log_index.h"
+#include "utils/log_tail.h"
+#include "utils/plot_pyramid.h"
 #include "utils/quadruped_tplot2.h"
 #include "utils/tree_view.h"
 
@@ -98,20 +109,21 @@ namespace {
 
 class Timeline {
  public:
-  Timeline(FileReader* reader) {
-    {
-      const auto final_item = reader->final_item();
-      auto items = reader->items([&]() {
-          FileReader::ItemsOptions options;
-          options.start = final_item;
-          return options;
-        }());
-      end_ = (*items.begin()).timestamp;
-    }
-    {
-      auto items = reader->items();
-      start_ = (*items.begin()).timestamp;
+  Timeline(const LogIndex* index, bool follow)
+      : follow_(follow),
+        start_(index->start()),
+        end_(index->end()),
+        float_range_(mjlib::base::ConvertDurationToSeconds(end_ - start_)) {
+    if (follow_) {
+      mode_ = kLive;
+      float_time_ = float_range_;
     }
+  }
+
+  /// Lengthen the timeline, for a log which is still being written.
+  void Extend(boost::posix_time::ptime end) {
+    if (end <= end_) { return; }
+    end_ = end;
     float_range_ = mjlib::base::ConvertDurationToSeconds(end_ - start_);
   }
 
@@ -140,6 +152,10 @@ class Timeline {
     }
     ImGui::SameLine();
     if (ImGui::RadioButton("FF", mode_ == kFastForward)) { mode_ = kFastForward; }
+    if (follow_) {
+      ImGui::SameLine();
+      if (ImGui::RadioButton("Live", mode_ == kLive)) { mode_ = kLive; }
+    }
     ImGui::SetNextItemWidth(150);
     ImGui::InputFloat("Step", &step_, 0.001, 0.01);
     ImGui::SameLine(0, 20.0);
@@ -173,6 +189,10 @@ class Timeline {
         float_time_ += fast_speed_ * dt_s;
         break;
       }
+      case kLive: {
+        float_time_ = float_range_;
+        break;
+      }
     }
   }
 
@@ -180,6 +200,9 @@ class Timeline {
     return start_ + mjlib::base::ConvertSecondsToDuration(float_time_);
   }
 
+  boost::posix_time::ptime start() const { return start_; }
+  boost::posix_time::ptime end() const { return end_; }
+
  private:
   enum Mode {
     kFastRewind,
@@ -187,8 +210,10 @@ class Timeline {
     kStop,
     kPlay,
     kFastForward,
+    kLive,
   };
 
+  const bool follow_;
   Mode mode_ = kStop;
 
   boost::posix_time::ptime start_;
@@ -281,6 +306,8 @@ class ValueRetrieve {
         next = tokenizer.next();
       }
     }();
+
+    if (valid_) { CompileFixedOffset(root); }
   }
 
   bool valid() const {
@@ -296,6 +323,14 @@ class ValueRetrieve {
 
     const Element* element = item.record->schema->root();
     auto it = chain_.begin();
+
+    if (fixed_leaf_) {
+      // Everything before the leaf has a fixed size, so we can jump
+      // straight to it.
+      stream.ignore(fixed_offset_);
+      element = fixed_leaf_;
+      it = chain_.end() - 1;
+    }
     while (it != chain_.end()) {
       const auto& link = *it;
       switch (element->type) {
@@ -388,10 +423,58 @@ class ValueRetrieve {
   using Link = std::variant<const Element*, uint64_t>;
   using Chain = std::vector<Link>;
 
+  /// If every element preceding the leaf is of fixed size, find the
+  /// byte offset of the leaf.
+  void CompileFixedOffset(const Element* root) {
+    const Element* element = root;
+    size_t offset = 0;
+    for (auto it = chain_.begin(); it != chain_.end(); ++it) {
+      switch (element->type) {
+        case FT::kObject: {
+          const auto* desired_child = std::get<const Element*>(*it);
+          for (const auto& field : element->fields) {
+            if (field.element == desired_child) { break; }
+            if (field.element->maybe_fixed_size < 0) { return; }
+            offset += field.element->maybe_fixed_size;
+          }
+          element = desired_child;
+          break;
+        }
+        case FT::kFixedArray: {
+          const uint64_t index = std::get<uint64_t>(*it);
+          const auto* child = element->children.front();
+          if (index >= element->array_size ||
+              child->maybe_fixed_size < 0) {
+            return;
+          }
+          offset += index * child->maybe_fixed_size;
+          element = child;
+          break;
+        }
+        case FT::kArray:
+        case FT::kMap:
+        case FT::kUnion: {
+          // The position of anything after these depends upon the
+          // data.
+          return;
+        }
+        default: {
+          // This is the leaf, which is always the final link.
+          fixed_offset_ = offset;
+          fixed_leaf_ = element;
+          return;
+        }
+      }
+    }
+  }
+
   boost::posix_time::ptime log_start_;
   bool valid_ = false;
   bool is_timestamp_ = false;
   Chain chain_;
+
+  const Element* fixed_leaf_ = nullptr;
+  size_t fixed_offset_ = 0;
 };
 
 class PlotRetrieve {
@@ -420,6 +503,10 @@ class PlotRetrieve {
     return result;
   }
 
+  const std::string& record() const {
+    return root_.record;
+  }
+
  private:
   struct Root {
     const Element* root;
@@ -474,6 +561,274 @@ class PlotRetrieve {
   ValueRetrieve y_{root_.root, log_start_, root_.y_name};
 };
 
+/// The data of one plot as it is extracted, shared between the
+/// threads doing that and the PlotView, which collects whatever has
+/// been published so far once a frame.
+struct PlotLoad {
+  struct Samples {
+    std::vector<boost::posix_time::ptime> timestamps;
+    std::vector<double> xvals;
+    std::vector<double> yvals;
+
+    size_t size() const { return timestamps.size(); }
+
+    void push_back(boost::posix_time::ptime timestamp, double x, double y) {
+      timestamps.push_back(timestamp);
+      xvals.push_back(x);
+      yvals.push_back(y);
+    }
+
+    void append(const Samples& rhs) {
+      timestamps.insert(timestamps.end(),
+                        rhs.timestamps.begin(), rhs.timestamps.end());
+      xvals.insert(xvals.end(), rhs.xvals.begin(), rhs.xvals.end());
+      yvals.insert(yvals.end(), rhs.yvals.begin(), rhs.yvals.end());
+    }
+
+    void clear() {
+      timestamps.clear();
+      xvals.clear();
+      yvals.clear();
+    }
+  };
+
+  /// Prepare for @p count ranges of the log to be published.
+  void Start(size_t count) {
+    std::lock_guard<std::mutex> guard(mutex);
+    chunks.resize(count);
+    progress.resize(count);
+    complete.resize(count);
+  }
+
+  /// Move @p samples to the end of the data for range @p index, of
+  /// which @p fraction has now been read.
+  void Publish(size_t index, Samples* samples, double fraction) {
+    Add(index, samples, fraction, false);
+  }
+
+  /// Move the final @p samples of range @p index.
+  void Complete(size_t index, Samples* samples) {
+    Add(index, samples, 1.0, true);
+  }
+
+  void Finish() {
+    std::lock_guard<std::mutex> guard(mutex);
+    done = true;
+    changed = true;
+  }
+
+  // Set by the PlotView to abandon the extraction.
+  std::atomic<bool> cancel{false};
+
+  std::mutex mutex;
+
+  // Everything below is guarded by mutex.
+
+  // One for each range of the log, in order.  The PlotView takes the
+  // samples out of chunks as it collects them.
+  std::vector<Samples> chunks;
+  std::vector<double> progress;
+  std::vector<bool> complete;
+  bool changed = false;
+  bool done = false;
+
+ private:
+  void Add(size_t index, Samples* samples, double fraction, bool last) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (chunks.size() <= index) {
+      chunks.resize(index + 1);
+      progress.resize(index + 1);
+      complete.resize(index + 1);
+    }
+    chunks[index].append(*samples);
+    progress[index] = fraction;
+    if (last) { complete[index] = true; }
+    changed = true;
+    samples->clear();
+  }
+};
+
+/// Extracts the values for any number of plots with a single pass
+/// over the log.
+///
+/// The log is split into as many time ranges as there are threads,
+/// each of which is read with its own FileReader.  If any of the
+/// records are delta encoded, decoding must proceed from the start,
+/// and a single thread is used.
+///
+/// Results are published to each plot's PlotLoad as they are
+/// produced, and plots which are cancelled are skipped.
+class PlotExtract {
+ public:
+  using Tokens = std::pair<std::string, std::string>;
+
+  // Samples are published in batches of at least this many.
+  static constexpr size_t kPublishSize = 65536;
+
+  /// Extract the items before index @p end, or all of them.
+  static void Extract(
+      const std::string& filename,
+      boost::posix_time::ptime log_start,
+      const std::vector<Tokens>& tokens,
+      const std::vector<std::shared_ptr<PlotLoad>>& loads,
+      std::optional<FileReader::Index> end) {
+    if (tokens.empty()) { return; }
+
+    FileReader reader{filename};
+    DeltaLog delta_log{&reader};
+
+    std::set<std::string> sources;
+    bool any_delta = false;
+    for (size_t i = 0; i < tokens.size(); i++) {
+      PlotRetrieve getter(&reader, log_start,
+                          tokens[i].first, tokens[i].second);
+      if (!getter.valid()) {
+        loads[i]->Finish();
+        continue;
+      }
+      const auto source = delta_log.source(getter.record());
+      sources.insert(source);
+      if (source != getter.record()) { any_delta = true; }
+    }
+    if (sources.empty()) { return; }
+
+    // The index may still be being built for the first time, in which
+    // case this falls back to the reader.
+    const LogIndex index{filename, &reader, []() {
+        LogIndex::Options options;
+        options.load_only = true;
+        return options;
+      }()};
+
+    const auto boundaries = [&]() {
+      std::vector<std::optional<FileReader::Index>> bounds = {
+        std::nullopt,
+      };
+      const int nthreads = any_delta ? 1 :
+          std::max(1u, std::thread::hardware_concurrency());
+      if (nthreads == 1) { return bounds; }
+
+      const auto start = index.start();
+      const auto duration = index.end() - start;
+      for (int i = 1; i < nthreads; i++) {
+        const auto seek = index.Seek(start + duration * i / nthreads);
+        std::optional<FileReader::Index> bound;
+        for (const auto& pair : seek) {
+          if (sources.count(pair.first->name) == 0) { continue; }
+          if (!bound || pair.second < *bound) { bound = pair.second; }
+        }
+        if (!bound) { continue; }
+        if (end && *bound >= *end) { continue; }
+        if (bounds.size() > 1 && *bound <= *bounds.back()) { continue; }
+        bounds.push_back(bound);
+      }
+      return bounds;
+    }();
+
+    for (const auto& load : loads) { load->Start(boundaries.size()); }
+
+    const FileReader::Index final_item = index.final_item();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < boundaries.size(); i++) {
+      const auto range_end = (i + 1 < boundaries.size()) ?
+          boundaries[i + 1] : end;
+      threads.emplace_back([&, i, range_end]() {
+          ExtractRange(filename, log_start, tokens, sources, loads, i,
+                       boundaries[i], range_end, final_item);
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+  }
+
+ private:
+  /// Extract every item with an index in [@p start, @p end) into
+  /// range @p range_index of each load.
+  static void ExtractRange(
+      const std::string& filename,
+      boost::posix_time::ptime log_start,
+      const std::vector<Tokens>& tokens,
+      const std::set<std::string>& sources,
+      const std::vector<std::shared_ptr<PlotLoad>>& loads,
+      size_t range_index,
+      std::optional<FileReader::Index> start,
+      std::optional<FileReader::Index> end,
+      FileReader::Index final_item) {
+    // Each range has its own reader, and the getters hold pointers
+    // into its schemas, so they have to be made here.
+    FileReader reader{filename};
+    DeltaLog delta_log{&reader};
+
+    std::vector<std::unique_ptr<PlotRetrieve>> getters;
+    std::map<const FileReader::Record*, std::vector<size_t>> by_record;
+    for (size_t i = 0; i < tokens.size(); i++) {
+      getters.push_back(std::make_unique<PlotRetrieve>(
+                            &reader, log_start,
+                            tokens[i].first, tokens[i].second));
+      if (!getters.back()->valid()) { continue; }
+      by_record[reader.record(getters.back()->record())].push_back(i);
+    }
+
+    std::vector<PlotLoad::Samples> result(tokens.size());
+
+    const double first_index = start.value_or(0);
+    const double last_index = end ? *end : (final_item + 1);
+    auto publish = [&](double fraction) {
+      for (const auto& pair : by_record) {
+        for (const auto index : pair.second) {
+          loads[index]->Publish(range_index, &result[index], fraction);
+        }
+      }
+    };
+
+    auto all_cancelled = [&]() {
+      for (const auto& pair : by_record) {
+        for (const auto index : pair.second) {
+          if (!loads[index]->cancel.load()) { return false; }
+        }
+      }
+      return true;
+    };
+
+    FileReader::ItemsOptions options;
+    options.records.insert(options.records.end(),
+                           sources.begin(), sources.end());
+    if (start) { options.start = *start; }
+
+    size_t pending = 0;
+    for (const auto& raw_item : reader.items(options)) {
+      if (end && raw_item.index >= *end) { break; }
+      const auto maybe_item = delta_log.Decode(raw_item);
+      if (!maybe_item) { continue; }
+      const auto& item = *maybe_item;
+
+      const auto it = by_record.find(item.record);
+      if (it == by_record.end()) { continue; }
+      for (const auto index : it->second) {
+        if (loads[index]->cancel.load(std::memory_order_relaxed)) {
+          continue;
+        }
+        result[index].push_back(item.timestamp,
+                                getters[index]->x(item),
+                                getters[index]->y(item));
+        pending++;
+      }
+
+      if (pending >= kPublishSize) {
+        if (all_cancelled()) { return; }
+        publish(std::min(1.0, (item.index - first_index) /
+                         std::max(1.0, last_index - first_index)));
+        pending = 0;
+      }
+    }
+
+    for (const auto& pair : by_record) {
+      for (const auto index : pair.second) {
+        loads[index]->Complete(range_index, &result[index]);
+      }
+    }
+  }
+};
+
 class PlotView {
  public:
   struct State {
@@ -516,21 +871,33 @@ class PlotView {
     }
   };
 
-  PlotView(FileReader* reader,
+  /// If @p tail is non-null, log plots are extended with each new
+  /// item it reports.
+  PlotView(const std::string& log_filename,
            TreeView* tree_view,
            boost::posix_time::ptime log_start,
-           const State& initial)
-      : reader_(reader),
+           const State& initial,
+           LogTail* tail = nullptr)
+      : log_filename_(log_filename),
         tree_view_(tree_view),
-        log_start_(log_start) {
+        log_start_(log_start),
+        tail_(tail) {
+    // Extract all the log plots at once, which only requires a
+    // single pass through the log.  The saved axis limits are kept,
+    // rather than fitting each plot as it arrives.
+    std::vector<PlotExtract::Tokens> log_tokens;
+    std::vector<std::shared_ptr<PlotLoad>> log_loads;
     for (const auto& plot : initial.plots) {
       current_axis_ = plot.axis;
       if (plot.deriv) {
-        AddDerivPlot(plot.y_token);
+        AddDerivPlot(plot.y_token, false);
       } else {
-        AddLogPlot(plot.x_token, plot.y_token);
+        log_tokens.push_back({plot.x_token, plot.y_token});
+        log_loads.push_back(
+            AddPlot(plot.x_token, plot.y_token, false, false)->load);
       }
     }
+    StartLogExtract(log_tokens, log_loads);
 
     if (std::isfinite(initial.x_axis.min) &&
         std::isfinite(initial.x_axis.max)) {
@@ -543,8 +910,13 @@ class PlotView {
         ImPlot::SetNextPlotLimitsY(y.min, y.max, ImGuiCond_Always, i);
       }
     }
+  }
 
-    fit_plot_ = {};
+  ~PlotView() {
+    for (auto& worker : workers_) {
+      for (auto& load : worker.loads) { load->cancel.store(true); }
+      worker.thread.join();
+    }
   }
 
   State state() {
@@ -577,17 +949,28 @@ class PlotView {
     ImGui::SetNextWindowSize(ImVec2(800, 620), ImGuiCond_FirstUseEver);
     gl::ImGuiWindow file_window("Plot");
 
-    if (fit_plot_) {
-      const auto& p = **fit_plot_;
+    const double old_end = data_end();
+    Follow();
+    const double new_end = data_end();
+    const auto fit_plot = CollectLoads();
+    if (!fit_plot && std::isfinite(old_end) && new_end > old_end &&
+        x_limits_.X.Max > x_limits_.X.Min && x_limits_.X.Max >= old_end) {
+      // The end of the data was in view, so scroll to keep it there.
+      const double shift = new_end - old_end;
+      ImPlot::SetNextPlotLimitsX(x_limits_.X.Min + shift,
+                                 x_limits_.X.Max + shift, ImGuiCond_Always);
+    }
+    if (fit_plot) {
+      const auto& p = plots_[*fit_plot];
       double xmin = std::numeric_limits<float>::infinity();
       double xmax = -std::numeric_limits<float>::infinity();
       for (const auto& plot : plots_) {
+        if (plot.xvals.empty()) { continue; }
         xmin = std::min(xmin, plot.min_x);
         xmax = std::max(xmax, plot.max_x);
       }
       ImPlot::SetNextPlotLimitsX(xmin, xmax, ImGuiCond_Always);
       ImPlot::SetNextPlotLimitsY(p.min_y, p.max_y, ImGuiCond_Always, p.axis);
-      fit_plot_ = {};
     }
     const int extra_flags = [&]() {
       int result = 0;
@@ -600,6 +983,14 @@ class PlotView {
       }
       return result;
     }();
+    // The limits from the previous frame are used to pick which
+    // points to draw in this one.
+    const double plot_width = ImGui::GetContentRegionAvail().x;
+    const bool have_limits = x_limits_.X.Max > x_limits_.X.Min;
+    const double x_min = have_limits ?
+        x_limits_.X.Min : -std::numeric_limits<double>::infinity();
+    const double x_max = have_limits ?
+        x_limits_.X.Max : std::numeric_limits<double>::infinity();
     if (ImPlot::BeginPlot("Plot", "time", nullptr, ImVec2(-1, -25),
                          ImPlotFlags_Default | extra_flags)) {
       for (const auto& plot : plots_) {
@@ -610,10 +1001,11 @@ class PlotView {
         for (const auto& pair : plot.int_styles) {
           ImPlot::PushStyleVar(pair.first, pair.second);
         }
+        const auto span = plot.pyramid.Get(
+            plot.xvals, plot.yvals,
+            x_min, x_max, plot_width);
         ImPlot::PlotLine(
-            plot.legend.c_str(),
-            plot.xvals.data(), plot.yvals.data(),
-            plot.xvals.size());
+            plot.legend.c_str(), span.x, span.y, span.size);
         ImPlot::PopStyleVar(plot.float_styles.size() + plot.int_styles.size());
 
         const auto it = std::upper_bound(
@@ -648,7 +1040,7 @@ class PlotView {
       if (deriv_payload) {
         std::string token(static_cast<char*>(deriv_payload->Data),
                           deriv_payload->DataSize);
-        AddDerivPlot(token);
+        AddDerivPlot(token, true);
       }
       ImGui::EndDragDropTarget();
     }
@@ -661,7 +1053,9 @@ class PlotView {
       ImGui::OpenPopup("Plot Properties");
     }
     ImGui::SameLine(0, 20.0);
-    if (ImGui::Button("Remove")) {
+    if (ImGui::Button("Remove") && current_plot_index_ < plots_.size()) {
+      auto& load = plots_[current_plot_index_].load;
+      if (load) { load->cancel.store(true); }
       plots_.erase(plots_.begin() + current_plot_index_);
       if (current_plot_index_ > 0 && current_plot_index_ >= plots_.size()) {
         current_plot_index_--;
@@ -678,6 +1072,22 @@ class PlotView {
       ImGui::EndCombo();
     }
 
+    {
+      int loading = 0;
+      double progress = 0.0;
+      for (const auto& plot : plots_) {
+        if (!plot.load) { continue; }
+        loading++;
+        progress += plot.progress;
+      }
+      if (loading) {
+        ImGui::SameLine(0, 20.0);
+        ImGui::ProgressBar(
+            progress / loading, ImVec2(150, 0),
+            fmt::format("Loading {}", loading).c_str());
+      }
+    }
+
     if (ImGui::BeginPopup("Plot Properties")) {
       if (current_plot_index_ < plots_.size()) {
         auto& plot = plots_[current_plot_index_];
@@ -714,6 +1124,7 @@ class PlotView {
     std::vector<boost::posix_time::ptime> timestamps;
     std::vector<double> xvals;
     std::vector<double> yvals;
+    PlotPyramid pyramid;
 
     double min_x = {};
     double max_x = {};
@@ -734,6 +1145,31 @@ class PlotView {
     bool deriv = false;
     std::string x_token;
     std::string y_token;
+
+    // Present while the data is still being extracted.
+    std::shared_ptr<PlotLoad> load;
+    double progress = 0.0;
+
+    // Samples taken from the load which cannot be appended yet,
+    // because an earlier range is still incomplete.  Ranges before
+    // next_chunk have been appended in full.
+    std::vector<PlotLoad::Samples> chunks;
+    std::vector<bool> complete;
+    size_t next_chunk = 0;
+
+    // Fit the axes to this plot once it is loaded.
+    bool fit = false;
+
+    // When following a log, how to read new items, and those which
+    // arrived while the plot was still loading.
+    const FileReader::Record* tail_record = nullptr;
+    std::unique_ptr<PlotRetrieve> tail_retrieve;
+    PlotLoad::Samples tail_samples;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::vector<std::shared_ptr<PlotLoad>> loads;
   };
 
   std::string current_plot_name() const {
@@ -752,73 +1188,285 @@ class PlotView {
     return fmt::format("time vs {}", x);
   }
 
-  void AddLogPlot(const std::string& x_token, const std::string& y_token) {
-    PlotRetrieve getter(reader_, log_start_, x_token, y_token);
-    if (!getter.valid()) {
-      return;
-    }
-
+  /// Add a plot, whose data will be filled in as it is extracted.
+  Plot* AddPlot(const std::string& x_token, const std::string& y_token,
+                bool deriv, bool fit) {
     plots_.push_back({});
     auto& plot = plots_.back();
-    plot.deriv = false;
+    plot.deriv = deriv;
     plot.x_token = x_token;
     plot.y_token = y_token;
-
     plot.legend = MakeLegend(x_token, y_token);
-
-    for (auto item : reader_->items(getter.items())) {
-      plot.timestamps.push_back(item.timestamp);
-      plot.xvals.push_back(getter.x(item));
-      plot.yvals.push_back(getter.y(item));
+    plot.axis = current_axis_;
+    plot.load = std::make_shared<PlotLoad>();
+
+    if (tail_ && !deriv) {
+      plot.tail_retrieve = std::make_unique<PlotRetrieve>(
+          tail_->reader(), log_start_, x_token, y_token);
+      if (plot.tail_retrieve->valid()) {
+        plot.tail_record =
+            tail_->reader()->record(plot.tail_retrieve->record());
+      }
     }
 
-    if (plot.xvals.empty()) {
-      plots_.pop_back();
-      return;
+    // If this is the only plot on this axis, then re-fit things.
+    plot.fit = fit && (1 == std::count_if(
+        plots_.begin(), plots_.end(),
+        [&](const auto& plt) { return plt.axis == current_axis_; }));
+
+    current_plot_index_ = plots_.size() - 1;
+    return &plot;
+  }
+
+  void AddLogPlot(const std::string& x_token, const std::string& y_token) {
+    StartLogExtract({{x_token, y_token}},
+                    {AddPlot(x_token, y_token, false, true)->load});
+  }
+
+  void StartLogExtract(const std::vector<PlotExtract::Tokens>& tokens,
+                       const std::vector<std::shared_ptr<PlotLoad>>& loads) {
+    if (tokens.empty()) { return; }
+    // When following, everything after what the tail has reported is
+    // left to it.
+    const auto end = tail_ ?
+        std::make_optional(tail_->last_index() + 1) : std::nullopt;
+    StartWorker(loads, [filename = log_filename_, log_start = log_start_,
+                        tokens, loads, end]() {
+        PlotExtract::Extract(filename, log_start, tokens, loads, end);
+      });
+  }
+
+  void AddDerivPlot(const std::string& token, bool fit) {
+    auto load = AddPlot("", token, true, fit)->load;
+    StartWorker({load}, [filename = log_filename_, log_start = log_start_,
+                         tree_view = tree_view_, token, load]() {
+        FileReader reader{filename};
+        const LogIndex index{filename, &reader, []() {
+            LogIndex::Options options;
+            options.load_only = true;
+            return options;
+          }()};
+        const double duration_s = std::max(
+            1e-3, mjlib::base::ConvertDurationToSeconds(
+                index.end() - index.start()));
+
+        PlotLoad::Samples samples;
+        tree_view->ExtractDeriv(
+            &reader, token,
+            [&](boost::posix_time::ptime timestamp, double value) {
+              const double x = mjlib::base::ConvertDurationToSeconds(
+                  timestamp - log_start);
+              samples.push_back(timestamp, x, value);
+              if (samples.size() >= PlotExtract::kPublishSize) {
+                load->Publish(0, &samples, std::min(1.0, x / duration_s));
+              }
+              return !load->cancel.load();
+            });
+        load->Complete(0, &samples);
+      });
+  }
+
+  /// Run @p work on its own thread, after which @p loads are
+  /// finished.
+  void StartWorker(const std::vector<std::shared_ptr<PlotLoad>>& loads,
+                   std::function<void ()> work) {
+    workers_.push_back({});
+    auto& worker = workers_.back();
+    worker.loads = loads;
+    worker.thread = std::thread([loads, work = std::move(work)]() {
+        work();
+        for (const auto& load : loads) { load->Finish(); }
+      });
+  }
+
+  double data_end() const {
+    double result = -std::numeric_limits<double>::infinity();
+    for (const auto& plot : plots_) {
+      if (plot.xvals.empty()) { continue; }
+      result = std::max(result, plot.max_x);
     }
+    return result;
+  }
+
+  /// Add any items which have been appended to a log being followed.
+  void Follow() {
+    if (!tail_) { return; }
+
+    std::vector<size_t> sizes;
+    for (const auto& plot : plots_) { sizes.push_back(plot.xvals.size()); }
 
-    FinishPlot(&plot);
+    tail_->Poll([&](const FileReader::Item& item) {
+        for (auto& plot : plots_) {
+          if (plot.tail_record != item.record) { continue; }
+          const double x = plot.tail_retrieve->x(item);
+          const double y = plot.tail_retrieve->y(item);
+          if (plot.load) {
+            plot.tail_samples.push_back(item.timestamp, x, y);
+          } else {
+            plot.timestamps.push_back(item.timestamp);
+            plot.xvals.push_back(x);
+            plot.yvals.push_back(y);
+          }
+        }
+      });
+
+    for (size_t i = 0; i < plots_.size(); i++) {
+      auto& plot = plots_[i];
+      if (plot.xvals.size() == sizes[i]) { continue; }
+      RefreshPlot(&plot, sizes[i]);
+    }
   }
 
-  void AddDerivPlot(const std::string& token) {
-    plots_.push_back({});
-    auto& plot = plots_.back();
+  /// Bring in whatever data has been published since the last
+  /// frame.  Return the index of a plot to fit the axes to, if any.
+  std::optional<size_t> CollectLoads() {
+    const auto now = boost::posix_time::microsec_clock::universal_time();
+    const bool refresh = last_collect_.is_not_a_date_time() ||
+        (now - last_collect_) > kCollectInterval;
+    if (refresh) { last_collect_ = now; }
+
+    std::vector<Plot*> fit;
+    for (auto& plot : plots_) {
+      if (!plot.load) { continue; }
+
+      bool updated = false;
+      bool done = false;
+      {
+        auto& load = *plot.load;
+        std::lock_guard<std::mutex> guard(load.mutex);
+        done = load.done;
+        // Only what was published since the last collection is taken,
+        // and that is usually just a swap.  Collecting is still
+        // limited to a few times a second, so that each refresh of
+        // the plot covers a reasonable amount of data.
+        if (load.changed && (refresh || done)) {
+          load.changed = false;
+          updated = true;
+
+          plot.chunks.resize(std::max(plot.chunks.size(),
+                                      load.chunks.size()));
+          plot.complete.resize(plot.chunks.size());
+          for (size_t i = plot.next_chunk; i < load.chunks.size(); i++) {
+            auto& chunk = load.chunks[i];
+            if (plot.chunks[i].size() == 0) {
+              std::swap(plot.chunks[i], chunk);
+            } else {
+              plot.chunks[i].append(chunk);
+            }
+            chunk.clear();
+            plot.complete[i] = load.complete[i];
+          }
+        }
+        plot.progress = load.progress.empty() ? 0.0 :
+            std::accumulate(load.progress.begin(), load.progress.end(), 0.0) /
+            load.progress.size();
+      }
 
-    plot.deriv = true;
-    plot.y_token = token;
+      if (updated) { AppendChunks(&plot, done); }
+      if (done) {
+        plot.load.reset();
+        if (plot.fit && !plot.xvals.empty()) { fit.push_back(&plot); }
+      }
+    }
 
-    plot.legend = MakeLegend("", token);
+    std::optional<size_t> result;
+    for (size_t i = 0; i < plots_.size(); i++) {
+      if (std::find(fit.begin(), fit.end(), &plots_[i]) != fit.end()) {
+        result = i;
+      }
+    }
 
-    auto data = tree_view_->ExtractDeriv(token);
-    plot.timestamps = std::move(data.timestamps);
-    plot.xvals = std::move(data.xvals);
-    plot.yvals = std::move(data.yvals);
+    // Plots which finished without any data are dropped.
+    for (size_t i = 0; i < plots_.size();) {
+      if (plots_[i].load || !plots_[i].xvals.empty()) {
+        i++;
+        continue;
+      }
+      plots_.erase(plots_.begin() + i);
+      if (result && *result > i) { (*result)--; }
+      if (current_plot_index_ > 0 && current_plot_index_ >= i) {
+        current_plot_index_--;
+      }
+    }
 
-    if (plot.xvals.empty()) {
-      plots_.pop_back();
-      return;
+    // Threads whose plots are all finished can be reaped.
+    for (auto it = workers_.begin(); it != workers_.end();) {
+      const bool finished = std::all_of(
+          it->loads.begin(), it->loads.end(), [](const auto& load) {
+            std::lock_guard<std::mutex> guard(load->mutex);
+            return load->done;
+          });
+      if (!finished) {
+        ++it;
+        continue;
+      }
+      it->thread.join();
+      it = workers_.erase(it);
+    }
+
+    return result;
+  }
+
+  /// Append to @p plot the samples collected for each range, in
+  /// order, stopping after the first which is incomplete.  Once the
+  /// load is @p done, everything is appended, with any samples which
+  /// arrived from following the log last.
+  void AppendChunks(Plot* plot, bool done) {
+    const size_t first = plot->xvals.size();
+    auto append = [&](PlotLoad::Samples* samples) {
+      plot->timestamps.insert(plot->timestamps.end(),
+                              samples->timestamps.begin(),
+                              samples->timestamps.end());
+      plot->xvals.insert(plot->xvals.end(),
+                         samples->xvals.begin(), samples->xvals.end());
+      plot->yvals.insert(plot->yvals.end(),
+                         samples->yvals.begin(), samples->yvals.end());
+      samples->clear();
+    };
+
+    while (plot->next_chunk < plot->chunks.size()) {
+      append(&plot->chunks[plot->next_chunk]);
+      if (!done && !plot->complete[plot->next_chunk]) { break; }
+      plot->next_chunk++;
+    }
+    if (done) {
+      append(&plot->tail_samples);
+      plot->chunks.clear();
+      plot->complete.clear();
     }
 
-    FinishPlot(&plot);
+    if (plot->xvals.size() != first) { RefreshPlot(plot, first); }
   }
 
-  void FinishPlot(Plot* plot) {
+  /// Update the summary of @p plot for samples from @p first on.
+  void RefreshPlot(Plot* plot, size_t first = 0) {
+    if (plot->xvals.empty()) { return; }
+
     // Switch all non-finite numbers to NaN.
-    for (auto& value : plot->xvals) {
-      if (!std::isfinite(value)) {
-        value = std::numeric_limits<double>::quiet_NaN();
+    for (size_t i = first; i < plot->xvals.size(); i++) {
+      if (!std::isfinite(plot->xvals[i])) {
+        plot->xvals[i] = std::numeric_limits<double>::quiet_NaN();
       }
-    }
-    for (auto& value : plot->yvals) {
-      if (!std::isfinite(value)) {
-        value = std::numeric_limits<double>::quiet_NaN();
+      if (!std::isfinite(plot->yvals[i])) {
+        plot->yvals[i] = std::numeric_limits<double>::quiet_NaN();
       }
     }
 
-    plot->min_x = *std::min_element(plot->xvals.begin(), plot->xvals.end());
-    plot->max_x = *std::max_element(plot->xvals.begin(), plot->xvals.end());
-    plot->min_y = *std::min_element(plot->yvals.begin(), plot->yvals.end());
-    plot->max_y = *std::max_element(plot->yvals.begin(), plot->yvals.end());
+    const auto x_range = std::minmax_element(
+        plot->xvals.begin() + first, plot->xvals.end());
+    const auto y_range = std::minmax_element(
+        plot->yvals.begin() + first, plot->yvals.end());
+    if (first == 0) {
+      plot->min_x = *x_range.first;
+      plot->max_x = *x_range.second;
+      plot->min_y = *y_range.first;
+      plot->max_y = *y_range.second;
+    } else {
+      plot->min_x = std::min(plot->min_x, *x_range.first);
+      plot->max_x = std::max(plot->max_x, *x_range.second);
+      plot->min_y = std::min(plot->min_y, *y_range.first);
+      plot->max_y = std::max(plot->max_y, *y_range.second);
+    }
     if (plot->max_y <= plot->min_y) {
       plot->max_y = plot->min_y + 1.0f;
     }
@@ -826,21 +1474,13 @@ class PlotView {
       plot->max_x = plot->max_x + 1.0f;
     }
 
-    plot->axis = current_axis_;
-
-    // If this is the only plot on this axis, then re-fit things.
-    if (1 == std::count_if(
-            plots_.begin(), plots_.end(),
-            [&](const auto& plt) { return plt.axis == current_axis_; })) {
-      fit_plot_ = plot;
-    }
-
-    current_plot_index_ = plots_.size() - 1;
+    plot->pyramid.Extend(plot->xvals, plot->yvals, first);
   }
 
-  FileReader* const reader_;
+  const std::string log_filename_;
   TreeView* const tree_view_;
   boost::posix_time::ptime log_start_;
+  LogTail* const tail_;
 
   static inline constexpr const char * kAxisNames[] = {
     "Left",
@@ -848,148 +1488,66 @@ class PlotView {
     "Aux",
   };
 
+  static inline const boost::posix_time::time_duration kCollectInterval =
+      boost::posix_time::milliseconds(250);
+
   std::vector<Plot> plots_;
-  std::optional<Plot*> fit_plot_;
   size_t current_plot_index_ = 0;
   int current_axis_ = 0;
 
   ImPlotLimits x_limits_ = {};
   std::array<ImPlotLimits, 3> y_limits_ = {};
+
+  boost::posix_time::ptime last_collect_;
+  std::list<Worker> workers_;
 };
 
+/// Shows the frame of a video which corresponds to the current time.
+///
+/// Frames are decoded on a background thread, and those around the
+/// current time are kept, so that playing and scrubbing in either
+/// direction do not wait on the decoder.
 class Video {
  public:
   Video(boost::posix_time::ptime log_start, std::string_view filename,
         double time_offset_s)
       : log_start_(log_start),
         time_offset_s_(time_offset_s),
-        file_(filename),
-        stream_(file_.FindBestStream(ffmpeg::File::kVideo)),
-        codec_(stream_) {
-    // Read until we get the first frame, so we know what the first
-    // timestamp is.
-    while (true) {
-      auto maybe_packet_ref = file_.Read(&packet_);
-      if (!maybe_packet_ref) {
-        mjlib::base::system_error::einval(
-            "Could not find frames in video");
-      }
-      if ((*maybe_packet_ref)->stream_index !=
-          stream_.av_stream()->index) { continue; }
-
-      codec_.SendPacket(*maybe_packet_ref);
-
-      auto maybe_frame_ref = codec_.GetFrame(&frame_);
-      if (maybe_frame_ref) {
-        start_pts_ = (*maybe_frame_ref)->pts;
-        break;
-      }
-    }
-  }
+        cache_(filename) {}
 
   void Update(boost::posix_time::ptime timestamp) {
     gl::ImGuiWindow video("Video");
 
     if (video) {
-      if (last_timestamp_.is_not_a_date_time() ||
-          timestamp < last_timestamp_ ||
-          (timestamp - last_timestamp_) > boost::posix_time::seconds(1)) {
-        Seek(timestamp);
-      } else if (timestamp >= last_video_timestamp_) {
-        Step(timestamp);
+      const auto delta_s = mjlib::base::ConvertDurationToSeconds(
+          timestamp - log_start_) - time_offset_s_;
+      const int64_t pts = std::max<int64_t>(
+          0, delta_s * time_base_.den / time_base_.num);
+
+      // Until the requested frame is decoded, the last one shown
+      // remains.
+      const auto image = cache_.Get(pts);
+      if (image && image->pts != shown_pts_) {
+        texture_.Store(image->data.data());
+        shown_pts_ = image->pts;
       }
 
-      last_timestamp_ = timestamp;
-
       const auto ws = ImGui::GetContentRegionAvail();
-      const auto p = base::MaintainAspectRatio(codec_.size(), {ws.x, ws.y});
+      const auto p = base::MaintainAspectRatio(cache_.size(), {ws.x, ws.y});
       ImGui::SameLine(p.min().x());
       ImGui::Image(reinterpret_cast<ImTextureID>(texture_.id()),
                    ImVec2(p.sizes().x(), p.sizes().y()));
     }
   }
 
-  void Step(boost::posix_time::ptime timestamp) {
-    ReadUntil(timestamp, false);
-  }
-
-  void Seek(boost::posix_time::ptime timestamp) {
-    last_video_timestamp_ = {};
-
-    const auto delta_s = mjlib::base::ConvertDurationToSeconds(
-        timestamp - log_start_) - time_offset_s_;
-    const int pts = std::max<int>(
-        0, delta_s * time_base_.den / time_base_.num);
-    ffmpeg::File::SeekOptions seek_options;
-    seek_options.backward = true;
-    file_.Seek(stream_, pts, seek_options);
-
-    ReadUntil(timestamp, true);
-  }
-
-  void ReadUntil(boost::posix_time::ptime timestamp, bool discard_first) {
-    int discard_count = discard_first ? 1 : 0;
-    while (true) {
-      auto maybe_pref = file_.Read(&packet_);
-      if (!maybe_pref) {
-        // EOF?
-        return;
-      }
-
-      if ((*maybe_pref)->stream_index !=
-          stream_.av_stream()->index) { continue; }
-
-      codec_.SendPacket(*maybe_pref);
-
-      auto maybe_fref = codec_.GetFrame(&frame_);
-      if (!maybe_fref) { continue; }
-
-      if (discard_count) {
-        discard_count--;
-        continue;
-      }
-
-      if (!swscale_) {
-        swscale_.emplace(codec_, dest_frame_.size(), dest_frame_.format(),
-                         ffmpeg::Swscale::kBicubic);
-      }
-
-      swscale_->Scale(*maybe_fref, dest_frame_ptr_);
-
-      texture_.Store(dest_frame_ptr_->data[0]);
-
-      last_video_timestamp_ =
-          log_start_ +
-          mjlib::base::ConvertSecondsToDuration(
-              time_offset_s_ +
-              static_cast<double>((*maybe_fref)->pts) *
-              time_base_.num / time_base_.den);
-
-      if (last_video_timestamp_ >= timestamp) {
-        break;
-      }
-    }
-  }
-
   boost::posix_time::ptime log_start_;
   double time_offset_s_ = 0.0;
-  ffmpeg::File file_;
-  ffmpeg::Stream stream_;
-  ffmpeg::Codec codec_;
-  std::optional<ffmpeg::Swscale> swscale_;
-  ffmpeg::Packet packet_;
-  ffmpeg::Frame frame_;
-  ffmpeg::Frame dest_frame_;
-  ffmpeg::Frame::Ref dest_frame_ptr_{dest_frame_.Allocate(
-        AV_PIX_FMT_RGB24, codec_.size(), 1)};
-
-  gl::FlatRgbTexture texture_{codec_.size()};
-
-  AVRational time_base_ = stream_.av_stream()->time_base;
-  int64_t start_pts_ = 0;
-
-  boost::posix_time::ptime last_timestamp_;
-  boost::posix_time::ptime last_video_timestamp_;
+  ffmpeg::FrameCache cache_;
+
+  gl::FlatRgbTexture texture_{cache_.size()};
+
+  AVRational time_base_ = cache_.time_base();
+  std::optional<int64_t> shown_pts_;
 };
 
 class SphereModel {
@@ -1061,6 +1619,194 @@ class SphereModel {
   };
 };
 
+/// A columnar cache of the leg and body positions from qc_status and
+/// qc_control over a window of time, all in the R frame.
+///
+/// As the window moves, only the items it newly covers are read and
+/// decoded, and those it no longer covers are dropped.
+class MechTrail {
+ public:
+  static constexpr int kNumLegs = 4;
+
+  struct Series {
+    std::deque<boost::posix_time::ptime> timestamps;
+    std::array<std::deque<Eigen::Vector3f>, kNumLegs> legs_R;
+    std::deque<Eigen::Vector3f> body_R;
+
+    void clear() {
+      timestamps.clear();
+      for (auto& leg : legs_R) { leg.clear(); }
+      body_R.clear();
+    }
+
+    /// Remove samples outside of [@p start, @p end).
+    void Trim(boost::posix_time::ptime start, boost::posix_time::ptime end) {
+      while (!timestamps.empty() && timestamps.front() < start) {
+        timestamps.pop_front();
+        for (auto& leg : legs_R) { leg.pop_front(); }
+        if (!body_R.empty()) { body_R.pop_front(); }
+      }
+      while (!timestamps.empty() && timestamps.back() >= end) {
+        timestamps.pop_back();
+        for (auto& leg : legs_R) { leg.pop_back(); }
+        if (!body_R.empty()) { body_R.pop_back(); }
+      }
+    }
+
+    /// Add all of @p other to the front.
+    void Prepend(const Series& other) {
+      timestamps.insert(timestamps.begin(),
+                        other.timestamps.begin(), other.timestamps.end());
+      for (int i = 0; i < kNumLegs; i++) {
+        legs_R[i].insert(legs_R[i].begin(),
+                         other.legs_R[i].begin(), other.legs_R[i].end());
+      }
+      body_R.insert(body_R.begin(), other.body_R.begin(), other.body_R.end());
+    }
+  };
+
+  MechTrail(const std::string& filename)
+      : reader_(filename),
+        index_(filename, &reader_, []() {
+            LogIndex::Options options;
+            options.load_only = true;
+            return options;
+          }()),
+        status_reader_(reader_.record("qc_status")->schema->root()),
+        control_reader_(reader_.record("qc_control")->schema->root()) {
+    for (const auto* name : {"qc_status", "qc_control"}) {
+      sources_.push_back(delta_log_.source(name));
+    }
+  }
+
+  /// Measured positions, with the body.
+  const Series& status() const { return status_; }
+
+  /// Commanded positions, without the body.
+  const Series& control() const { return control_; }
+
+  /// Incremented whenever the contents change.
+  uint64_t version() const { return version_; }
+
+  /// Cover [@p start, @p end).
+  void Update(boost::posix_time::ptime start, boost::posix_time::ptime end) {
+    if (start == requested_start_ && end == requested_end_) { return; }
+    requested_start_ = start;
+    requested_end_ = end;
+
+    if (start_.is_not_a_date_time() || start >= end_ || end <= start_) {
+      status_.clear();
+      control_.clear();
+      start_ = start;
+      end_ = Read(start, end, &status_, &control_);
+    } else {
+      if (start < start_) {
+        Series status;
+        Series control;
+        Read(start, start_, &status, &control);
+        status_.Prepend(status);
+        control_.Prepend(control);
+      }
+      start_ = start;
+      if (end > end_) {
+        end_ = Read(end_, end, &status_, &control_);
+      }
+    }
+    if (end < end_) { end_ = end; }
+
+    status_.Trim(start_, end_);
+    control_.Trim(start_, end_);
+    version_++;
+  }
+
+ private:
+  /// Append the items in [@p start, @p end).  Return the time up to
+  /// which the log has been read, which is before @p end if the log
+  /// ends first.
+  boost::posix_time::ptime Read(boost::posix_time::ptime start,
+                                boost::posix_time::ptime end,
+                                Series* status, Series* control) {
+    // Delta encoded records can only be decoded from a keyframe.
+    delta_log_.Reset();
+    std::optional<FileReader::Index> first;
+    const auto seek = index_.Seek(start);
+    for (const auto& source : sources_) {
+      const auto* record = reader_.record(source);
+      const auto maybe_index = [&]() -> std::optional<FileReader::Index> {
+        if (delta_log_.is_delta(record)) {
+          return delta_log_.Keyframe(record, start);
+        }
+        const auto it = seek.find(record);
+        if (it == seek.end()) { return {}; }
+        return it->second;
+      }();
+      if (!maybe_index) {
+        first.reset();
+        break;
+      }
+      if (!first || *maybe_index < *first) { first = maybe_index; }
+    }
+
+    FileReader::ItemsOptions options;
+    options.records = sources_;
+    if (first) { options.start = *first; }
+
+    auto result = start;
+    try {
+      for (const auto& raw_item : reader_.items(options)) {
+        if (raw_item.timestamp >= end) { return end; }
+        const auto maybe_item = delta_log_.Decode(raw_item);
+        if (!maybe_item) { continue; }
+        const auto& item = *maybe_item;
+        result = item.timestamp + boost::posix_time::microseconds(1);
+        if (item.timestamp < start) { continue; }
+
+        if (item.record->name == "qc_status") {
+          const auto qs = status_reader_.Read(item.data);
+          if (qs.state.legs_B.size() != kNumLegs) { continue; }
+          const auto& pose_RB = qs.state.robot.frame_RB.pose;
+          status->timestamps.push_back(item.timestamp);
+          for (int i = 0; i < kNumLegs; i++) {
+            status->legs_R[i].push_back(
+                (pose_RB * qs.state.legs_B[i].position).cast<float>());
+          }
+          status->body_R.push_back(pose_RB.translation().cast<float>());
+        } else {
+          const auto qc = control_reader_.Read(item.data);
+          if (qc.legs_R.size() != kNumLegs) { continue; }
+          control->timestamps.push_back(item.timestamp);
+          for (int i = 0; i < kNumLegs; i++) {
+            control->legs_R[i].push_back(qc.legs_R[i].position.cast<float>());
+          }
+        }
+      }
+    } catch (std::exception&) {
+      // A log which is still being written may end with a partial
+      // item.  It will be read the next time the window moves.
+    }
+    return result;
+  }
+
+  FileReader reader_;
+  const LogIndex index_;
+  DeltaLog delta_log_{&reader_};
+  std::vector<std::string> sources_;
+  mjlib::telemetry::MappedBinaryReader<
+    mech::QuadrupedControl::Status> status_reader_;
+  mjlib::telemetry::MappedBinaryReader<
+    mech::QuadrupedControl::ControlLog> control_reader_;
+
+  boost::posix_time::ptime requested_start_;
+  boost::posix_time::ptime requested_end_;
+
+  // The range which has been read.
+  boost::posix_time::ptime start_;
+  boost::posix_time::ptime end_;
+  Series status_;
+  Series control_;
+  uint64_t version_ = 0;
+};
+
 class MechRender {
  public:
   struct State {
@@ -1075,6 +1821,9 @@ class MechRender {
     bool support_command = true;
     bool target = true;
     bool terrain = false;
+    bool trail = false;
+    // The trail covers this long before and after the cursor.
+    float trail_s = 1.0f;
 
     template <typename Archive>
     void Serialize(Archive* a) {
@@ -1089,6 +1838,8 @@ class MechRender {
       a->Visit(MJ_NVP(support_command));
       a->Visit(MJ_NVP(target));
       a->Visit(MJ_NVP(terrain));
+      a->Visit(MJ_NVP(trail));
+      a->Visit(MJ_NVP(trail_s));
     }
   };
 
@@ -1104,6 +1855,8 @@ class MechRender {
           return parent_->tf_MB_.matrix().cast<float>();
         } else if (std::string(frame) == "A") {
           return parent_->tf_AB_.matrix().cast<float>();
+        } else if (std::string(frame) == "R") {
+          return parent_->tf_RB_.matrix().cast<float>();
         } else if (std::string(frame) == "T") {
           return (parent_->tf_TA_.matrix() * parent_->tf_AB_.matrix()).cast<float>();
         }
@@ -1135,13 +1888,13 @@ class MechRender {
       }();
 
       parent_->transform_ = tf_YX;
-      parent_->triangle_.SetTransform(tf_YX);
+      parent_->meshes_.SetTransform(tf_YX);
       parent_->lines_.SetTransform(tf_YX);
     }
 
     ~RenderFrame() {
       parent_->transform_ = old_transform_;
-      parent_->triangle_.SetTransform(parent_->transform_);
+      parent_->meshes_.SetTransform(parent_->transform_);
       parent_->lines_.SetTransform(parent_->transform_);
     }
 
@@ -1149,18 +1902,16 @@ class MechRender {
     Eigen::Matrix4f old_transform_;
   };
 
-  MechRender(FileReader* reader, TreeView* tree_view, State state)
-      : reader_(reader->record("qc_status")->schema->root()),
+  MechRender(const std::string& log_filename, FileReader* reader,
+             TreeView* tree_view, State state)
+      : log_filename_(log_filename),
+        reader_(reader->record("qc_status")->schema->root()),
         control_reader_(reader->record("qc_control")->schema->root()),
         imu_reader_(reader->record("imu")->schema->root()),
         tree_view_(tree_view),
         state_(state) {
-    triangle_.SetLightPos({-1000, 0, -3000});
-
-    // For now, our rendering texture will consist of a single white
-    // pixel, which will just let us use the passed in color.
-    const uint8_t white[4] = {255, 255, 255, 255};
-    texture_.Store(white);
+    meshes_.SetLightPos({-1000, 0, -3000});
+    AddMeshes();
   }
 
   State state() const {
@@ -1230,6 +1981,12 @@ class MechRender {
       DrawTerrain();
     }
 
+    if (state_.trail && trail_) {
+      // The trail is already on the GPU, so only its frame is updated.
+      RenderFrame tf_R(this, "R");
+      strips_.SetTransform(transform_);
+    }
+
     if (state_.body) {
       AddBox({0, 0, 0},
              {0.230, 0, 0},
@@ -1304,7 +2061,6 @@ class MechRender {
     RenderFrame tf_T(this, "T");
 
     DrawPlane(kGroundSize,
-              Eigen::Vector3f(0, 0, -1),
               Eigen::Vector3f(0, 0, 0),
               Eigen::Vector4f(0.3, 0.0, 0.3, 1.0));
   }
@@ -1331,41 +2087,26 @@ class MechRender {
 
     if (state_.ground) {
       DrawPlane(kGroundSize,
-                Eigen::Vector3f(0, 0, -1),
                 Eigen::Vector3f(0, 0, max_z_M),
                 Eigen::Vector4f(0.3, 0.3, 0.3, 1.0));
     }
   }
 
-  void DrawPlane(double l, Eigen::Vector3f normal, Eigen::Vector3f offset,
-                 Eigen::Vector4f rgba) {
-    Eigen::Vector2f uv(0, 0);
-
-    auto ic = triangle_.AddVertex(offset, normal, uv, rgba);
-    for (int i = 0; i < 16; i++) {
-      const double t1 = 2 * M_PI * (static_cast<double>(i) / 16);
-      Eigen::Vector3f p1_M =
-          Eigen::Vector3f(l * std::cos(t1), l * std::sin(t1), 0) + offset;
-
-      // This could be more optimal and re-use edge indices as well.
-      const double t2 = 2 * M_PI * (static_cast<double>((i + 1) % 16) / 16);
-      Eigen::Vector3f p2_M =
-          Eigen::Vector3f(l * std::cos(t2), l * std::sin(t2), 0) + offset;
-
-      auto i1 = triangle_.AddVertex(p1_M, normal, uv, rgba);
-      auto i2 = triangle_.AddVertex(p2_M, normal, uv, rgba);
-
-      triangle_.AddTriangle(i1, i2, ic);
-    }
+  void DrawPlane(double l, Eigen::Vector3f offset, Eigen::Vector4f rgba) {
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    transform(0, 0) = l;
+    transform(1, 1) = l;
+    transform.block<3, 1>(0, 3) = offset;
+    meshes_.AddInstance(disc_mesh_, transform, rgba);
   }
 
   void AddBall(const Eigen::Vector3f& center,
                float radius,
                const Eigen::Vector4f& rgba) {
-    const Eigen::Vector2f uv(0.f, 0.f);
-    for (const auto& t : sphere_(center, radius)) {
-      triangle_.AddTriangle(t.p3, uv, t.p2, uv, t.p1, uv, rgba);
-    }
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    transform.block<3, 3>(0, 0) *= radius;
+    transform.block<3, 1>(0, 3) = center;
+    meshes_.AddInstance(sphere_mesh_, transform, rgba);
   }
 
   void AddBox(const Eigen::Vector3f& center,
@@ -1373,52 +2114,141 @@ class MechRender {
               const Eigen::Vector3f& width,
               const Eigen::Vector3f& height,
               const Eigen::Vector4f& rgba) {
-    const Eigen::Vector3f hl = 0.5 * length;
-    const Eigen::Vector3f hw = 0.5 * width;
-    const Eigen::Vector3f hh = 0.5 * height;
-    const Eigen::Vector2f uv(0.f, 0.f);
-    // Bottom
-    triangle_.AddQuad(center - hh - hw - hl, uv,
-                      center - hh - hw + hl, uv,
-                      center - hh + hw + hl, uv,
-                      center - hh + hw - hl, uv,
-                      rgba);
-    // Top
-    triangle_.AddQuad(center + hh + hw - hl, uv,
-                      center + hh + hw + hl, uv,
-                      center + hh - hw + hl, uv,
-                      center + hh - hw - hl, uv,
-                      rgba);
-    // Back
-    triangle_.AddQuad(center - hl - hh - hw, uv,
-                      center - hl - hh + hw, uv,
-                      center - hl + hh + hw, uv,
-                      center - hl + hh - hw, uv,
-                      Eigen::Vector4f(0.f, 0.f, 1.f, 1.f));
-    // Front
-    triangle_.AddQuad(center + hl + hh - hw, uv,
-                      center + hl + hh + hw, uv,
-                      center + hl - hh + hw, uv,
-                      center + hl - hh - hw, uv,
-                      Eigen::Vector4f(0.f, 1.f, 0.f, 1.f));
-    // Left
-    triangle_.AddQuad(center - hw - hh - hl, uv,
-                      center - hw - hh + hl, uv,
-                      center - hw + hh + hl, uv,
-                      center - hw + hh - hl, uv,
-                      rgba);
-    // Right
-    triangle_.AddQuad(center + hw + hh - hl, uv,
-                      center + hw + hh + hl, uv,
-                      center + hw - hh + hl, uv,
-                      center + hw - hh - hl, uv,
-                      rgba);
+    // This maps the unit box onto the requested one.
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    transform.block<3, 1>(0, 0) = length;
+    transform.block<3, 1>(0, 1) = width;
+    transform.block<3, 1>(0, 2) = height;
+    transform.block<3, 1>(0, 3) = center;
+    meshes_.AddInstance(box_sides_mesh_, transform, rgba);
+    meshes_.AddInstance(box_ends_mesh_, transform,
+                        Eigen::Vector4f(1.f, 1.f, 1.f, 1.f));
   }
 
-  void Update() {
-    triangle_.Reset();
+  using Vertex = gl::InstancedMeshRenderList::Vertex;
+
+  static void AddMeshQuad(std::vector<Vertex>* vertices,
+                          std::vector<uint32_t>* indices,
+                          const Eigen::Vector3f& p1,
+                          const Eigen::Vector3f& p2,
+                          const Eigen::Vector3f& p3,
+                          const Eigen::Vector3f& p4,
+                          const Eigen::Vector4f& rgba) {
+    const Eigen::Vector3f normal = (p3 - p1).cross(p2 - p1).normalized();
+    const uint32_t i = vertices->size();
+    for (const auto& p : {p1, p2, p3, p4}) {
+      vertices->push_back({p, normal, rgba});
+    }
+    for (uint32_t j : {0, 1, 2, 2, 3, 0}) { indices->push_back(i + j); }
+  }
+
+  /// Register each of the shapes we draw, at unit size, so that each
+  /// frame only needs to upload where they are.
+  void AddMeshes() {
+    const Eigen::Vector4f white(1.f, 1.f, 1.f, 1.f);
+
+    {
+      std::vector<Vertex> vertices;
+      std::vector<uint32_t> indices;
+      for (const auto& t : sphere_(Eigen::Vector3f::Zero(), 1.0f)) {
+        const Eigen::Vector3f normal =
+            (t.p1 - t.p3).cross(t.p2 - t.p3).normalized();
+        for (const auto& p : {t.p3, t.p2, t.p1}) {
+          indices.push_back(vertices.size());
+          vertices.push_back({p, normal, white});
+        }
+      }
+      sphere_mesh_ = meshes_.AddMesh(vertices, indices);
+    }
+
+    {
+      const Eigen::Vector3f hl(0.5f, 0.f, 0.f);
+      const Eigen::Vector3f hw(0.f, 0.5f, 0.f);
+      const Eigen::Vector3f hh(0.f, 0.f, 0.5f);
+
+      std::vector<Vertex> vertices;
+      std::vector<uint32_t> indices;
+      // Bottom
+      AddMeshQuad(&vertices, &indices,
+                  -hh - hw - hl, -hh - hw + hl, -hh + hw + hl, -hh + hw - hl,
+                  white);
+      // Top
+      AddMeshQuad(&vertices, &indices,
+                  hh + hw - hl, hh + hw + hl, hh - hw + hl, hh - hw - hl,
+                  white);
+      // Left
+      AddMeshQuad(&vertices, &indices,
+                  -hw - hh - hl, -hw - hh + hl, -hw + hh + hl, -hw + hh - hl,
+                  white);
+      // Right
+      AddMeshQuad(&vertices, &indices,
+                  hw + hh - hl, hw + hh + hl, hw - hh + hl, hw - hh - hl,
+                  white);
+      box_sides_mesh_ = meshes_.AddMesh(vertices, indices);
+
+      vertices.clear();
+      indices.clear();
+      // Back
+      AddMeshQuad(&vertices, &indices,
+                  -hl - hh - hw, -hl - hh + hw, -hl + hh + hw, -hl + hh - hw,
+                  Eigen::Vector4f(0.f, 0.f, 1.f, 1.f));
+      // Front
+      AddMeshQuad(&vertices, &indices,
+                  hl + hh - hw, hl + hh + hw, hl - hh + hw, hl - hh - hw,
+                  Eigen::Vector4f(0.f, 1.f, 0.f, 1.f));
+      box_ends_mesh_ = meshes_.AddMesh(vertices, indices);
+    }
+
+    {
+      const Eigen::Vector3f normal(0.f, 0.f, -1.f);
+      std::vector<Vertex> vertices;
+      std::vector<uint32_t> indices;
+      vertices.push_back({Eigen::Vector3f::Zero(), normal, white});
+      for (int i = 0; i < 16; i++) {
+        const double t = 2 * M_PI * (static_cast<double>(i) / 16);
+        vertices.push_back(
+            {Eigen::Vector3f(std::cos(t), std::sin(t), 0), normal, white});
+      }
+      for (uint32_t i = 0; i < 16; i++) {
+        indices.push_back(1 + i);
+        indices.push_back(1 + (i + 1) % 16);
+        indices.push_back(0);
+      }
+      disc_mesh_ = meshes_.AddMesh(vertices, indices);
+    }
+  }
+
+  void UpdateTrail(boost::posix_time::ptime timestamp) {
+    if (!state_.trail) { return; }
+    if (!trail_) { trail_.emplace(log_filename_); }
+
+    const auto span = boost::posix_time::microseconds(
+        static_cast<int64_t>(state_.trail_s * 1e6));
+    trail_->Update(timestamp - span, timestamp + span);
+    if (trail_->version() == strips_version_) { return; }
+    strips_version_ = trail_->version();
+
+    strips_.Reset();
+    const auto& status = trail_->status();
+    const auto& control = trail_->control();
+    for (const auto& leg : status.legs_R) {
+      strips_.AddStrip(leg.begin(), leg.end(),
+                       Eigen::Vector4f(0.f, 0.6f, 0.f, 1.f));
+    }
+    for (const auto& leg : control.legs_R) {
+      strips_.AddStrip(leg.begin(), leg.end(),
+                       Eigen::Vector4f(0.f, 0.f, 0.6f, 1.f));
+    }
+    strips_.AddStrip(status.body_R.begin(), status.body_R.end(),
+                     Eigen::Vector4f(0.6f, 0.f, 0.f, 1.f));
+    strips_.Upload();
+  }
+
+  void Update(boost::posix_time::ptime timestamp) {
+    meshes_.Reset();
     lines_.Reset();
 
+    UpdateTrail(timestamp);
     Render();
 
     {
@@ -1429,12 +2259,12 @@ class MechRender {
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
       // TRIANGLES
-      triangle_.Upload();
-      triangle_.SetProjMatrix(camera_->matrix(trackball_.zoom()));
-      triangle_.SetViewMatrix(trackball_.matrix());
-      triangle_.SetModelMatrix(model_matrix_);
+      meshes_.Upload();
+      meshes_.SetProjMatrix(camera_->matrix(trackball_.zoom()));
+      meshes_.SetViewMatrix(trackball_.matrix());
+      meshes_.SetModelMatrix(model_matrix_);
 
-      triangle_.Render();
+      meshes_.Render();
 
       // LINES
       lines_.Upload();
@@ -1442,6 +2272,13 @@ class MechRender {
       lines_.SetViewMatrix(trackball_.matrix());
       lines_.SetModelMatrix(model_matrix_);
       lines_.Render();
+
+      if (state_.trail) {
+        strips_.SetProjMatrix(camera_->matrix(trackball_.zoom()));
+        strips_.SetViewMatrix(trackball_.matrix());
+        strips_.SetModelMatrix(model_matrix_);
+        strips_.Render();
+      }
     }
 
     gl::ImGuiWindow render("Render");
@@ -1514,6 +2351,9 @@ class MechRender {
     ImGui::Checkbox("support cmd", &state_.support_command);
     ImGui::Checkbox("target", &state_.target);
     ImGui::Checkbox("terrain", &state_.terrain);
+    ImGui::Checkbox("trail", &state_.trail);
+    ImGui::DragFloat("##trail_s", &state_.trail_s, 0.05f, 0.05f, 30.0f,
+                     "%.2f s");
 
     ImGui::EndChild();
   }
@@ -1559,6 +2399,7 @@ class MechRender {
 
   SphereModel sphere_;
 
+  const std::string log_filename_;
   mjlib::telemetry::MappedBinaryReader<mech::QuadrupedControl::Status> reader_;
   mjlib::telemetry::MappedBinaryReader<
     mech::QuadrupedControl::ControlLog> control_reader_;
@@ -1581,9 +2422,17 @@ class MechRender {
     return true;
   }();
 
-  gl::FlatRgbTexture texture_{Eigen::Vector2i(1, 1), GL_RGBA};
-  gl::SimpleTextureRenderList triangle_{&texture_.texture()};
+  gl::InstancedMeshRenderList meshes_;
+  gl::InstancedMeshRenderList::MeshId sphere_mesh_ = {};
+  gl::InstancedMeshRenderList::MeshId box_sides_mesh_ = {};
+  gl::InstancedMeshRenderList::MeshId box_ends_mesh_ = {};
+  gl::InstancedMeshRenderList::MeshId disc_mesh_ = {};
   gl::SimpleLineRenderList lines_;
+  gl::LineStripRenderList strips_;
+
+  // Only read from the log once the trail is first shown.
+  std::optional<MechTrail> trail_;
+  uint64_t strips_version_ = 0;
 
   State state_;
 
@@ -1605,6 +2454,57 @@ class MechRender {
   };
 };
 
+/// Show the servo reply latency histograms from the most recent
+/// "reply_latency" record.
+class ReplyLatencyView {
+ public:
+  ReplyLatencyView(FileReader* reader, TreeView* tree_view)
+      : reader_(reader->record("reply_latency")->schema->root()),
+        tree_view_(tree_view) {}
+
+  void Update() {
+    gl::ImGuiWindow window("Reply Latency");
+    if (!window) { return; }
+
+    const auto maybe_data = tree_view_->data("reply_latency");
+    if (!maybe_data || maybe_data->empty()) { return; }
+
+    const auto latency = reader_.Read(*maybe_data);
+
+    ImGui::Checkbox("Normalize", &normalize_);
+
+    if (ImPlot::BeginPlot("Latency", "us", "count", ImVec2(-1, -1))) {
+      std::vector<double> xvals;
+      std::vector<double> yvals;
+      for (const auto& servo : latency.servos) {
+        xvals.clear();
+        yvals.clear();
+        int total = 0;
+        for (auto count : servo.counts) { total += count; }
+        for (size_t i = 0; i < servo.counts.size(); i++) {
+          xvals.push_back((i + 0.5) * latency.bin_us);
+          yvals.push_back(
+              (normalize_ && total) ?
+              static_cast<double>(servo.counts[i]) / total :
+              servo.counts[i]);
+        }
+        const auto legend = fmt::format(
+            "id {} bus {} mean {:.0f} max {:.0f} missing {}",
+            servo.id, servo.bus, servo.mean_us, servo.max_us, servo.missing);
+        ImPlot::PlotLine(legend.c_str(), xvals.data(), yvals.data(),
+                         xvals.size());
+      }
+      ImPlot::EndPlot();
+    }
+  }
+
+ private:
+  mjlib::telemetry::MappedBinaryReader<
+    mech::Pi3hatWrapper::ReplyLatency> reader_;
+  TreeView* const tree_view_;
+  bool normalize_ = false;
+};
+
 constexpr const char* kIniFileName = "tplot2.ini";
 
 class Tplot2 {
@@ -1614,6 +2514,7 @@ class Tplot2 {
     std::string config_filename;
     std::string video_filename;
     double video_time_offset_s = 0.0;
+    bool follow = false;
   };
 
   static Options Parse(int argc, char** argv) {
@@ -1626,7 +2527,9 @@ class Tplot2 {
         clipp::option("v", "video") &
         clipp::value("video", result.video_filename),
         clipp::option("voffset") &
-        clipp::value("OFF", result.video_time_offset_s)
+        clipp::value("OFF", result.video_time_offset_s),
+        clipp::option("f", "follow").set(result.follow) %
+        "follow a log which is still being written"
     );
 
     mjlib::base::ClippParse(argc, argv, group);
@@ -1651,6 +2554,8 @@ class Tplot2 {
       glClearColor(0.45f, 0.55f, 0.60f, 1.0f);
       glClear(GL_COLOR_BUFFER_BIT);
 
+      log_index_.Poll();
+      if (log_tail_) { timeline_.Extend(log_tail_->last_timestamp()); }
       timeline_.Update();
       const auto current = timeline_.current();
       tree_view_.Update(current);
@@ -1659,7 +2564,10 @@ class Tplot2 {
         video_->Update(current);
       }
       if (mech_render_) {
-        mech_render_->Update();
+        mech_render_->Update(current);
+      }
+      if (reply_latency_view_) {
+        reply_latency_view_->Update();
       }
 
       app_.Render();
@@ -1763,23 +2671,54 @@ class Tplot2 {
     return true;
   }();
 
-  const boost::posix_time::ptime log_start_ =
-      (*file_reader_.items().begin()).timestamp;
-  Timeline timeline_{&file_reader_};
-  TreeView tree_view_{&file_reader_, log_start_};
-  PlotView plot_view_{&file_reader_, &tree_view_, log_start_, initial_save_.plot};
+  // The index is built in the background when necessary, so that
+  // large logs can be viewed immediately.  A log which is still
+  // growing would never match its index, so none is built for it.
+  LogIndex log_index_{options_.log_filename, &file_reader_, [&]() {
+      LogIndex::Options options;
+      options.background = !options_.follow;
+      options.load_only = options_.follow;
+      return options;
+    }()};
+  const boost::posix_time::ptime log_start_ = log_index_.start();
+  Timeline timeline_{&log_index_, options_.follow};
+  TreeView tree_view_{&file_reader_, &log_index_, log_start_};
+
+  // Derived channels must all be present before any plots of them
+  // are extracted.
+  const bool derived_register_ = [&]() {
+    if (mech_) { AddQuadrupedDerived(&tree_view_); }
+    return true;
+  }();
+
+  std::unique_ptr<LogTail> log_tail_ = [&]() -> std::unique_ptr<LogTail> {
+    if (!options_.follow) { return {}; }
+    return std::make_unique<LogTail>(
+        options_.log_filename, log_index_.final_item(), log_index_.end());
+  }();
+
+  PlotView plot_view_{options_.log_filename, &tree_view_, log_start_,
+                      initial_save_.plot, log_tail_.get()};
 
   std::optional<Video> video_;
   std::optional<MechRender> mech_render_;
   const bool mech_register_ = [&]() {
     if (mech_) {
-      AddQuadrupedDerived(&file_reader_, &tree_view_);
-      mech_render_.emplace(&file_reader_, &tree_view_, initial_save_.mech);
+      mech_render_.emplace(options_.log_filename, &file_reader_, &tree_view_,
+                           initial_save_.mech);
     }
 
     return true;
   }();
 
+  std::optional<ReplyLatencyView> reply_latency_view_;
+  const bool reply_latency_register_ = [&]() {
+    if (file_reader_.record("reply_latency")) {
+      reply_latency_view_.emplace(&file_reader_, &tree_view_);
+    }
+    return true;
+  }();
+
   const bool video_register_ = [&]() {
     if (!options_.video_filename.empty()) {
       video_.emplace(log_start_,
@@ -14,10 +14,16 @@
 
 #pragma once
 
+#include <array>
+#include <functional>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <boost/date_time/posix_time/posix_time_types.hpp>
@@ -28,8 +34,11 @@
 #include "mjlib/base/fail.h"
 #include "mjlib/micro/serializable_handler.h"
 #include "mjlib/telemetry/file_reader.h"
+#include "mjlib/telemetry/mapped_binary_reader.h"
 
+#include "utils/delta_log.h"
 #include "utils/imgui_tree_archive.h"
+#include "utils/log_index.h"
 
 #include "gl/gl_imgui.h"
 
@@ -57,18 +66,28 @@ class TreeView {
   using Format = mjlib::telemetry::Format;
   using FT = Format::Type;
 
-  TreeView(FileReader* reader, boost::posix_time::ptime log_start)
+  TreeView(FileReader* reader, const LogIndex* index,
+           boost::posix_time::ptime log_start)
       : reader_(reader),
+        index_(index),
         log_start_(log_start) {
     for (const auto* record : reader->records()) {
       data_.names.insert(std::make_pair(record->name, record));
     }
   }
 
-  template <typename DerivedOperator>
-  void AddDerived(std::string_view name, DerivedOperator derived_operator) {
-    derived_.push_back(std::make_unique<Concrete<DerivedOperator>>(
-                           name, std::move(derived_operator)));
+  /// Add a channel named @p name which is computed from the most
+  /// recent value of each record named in @p inputs, decoded as the
+  /// corresponding type in Inputs.  @p derived_operator is called
+  /// with a const pointer to each, which is nullptr until that record
+  /// has been seen, and must return a serializable structure.
+  template <typename... Inputs, typename DerivedOperator>
+  void AddDerived(std::string_view name,
+                  const std::array<std::string, sizeof...(Inputs)>& inputs,
+                  DerivedOperator derived_operator) {
+    derived_.push_back(
+        std::make_unique<Concrete<DerivedOperator, Inputs...>>(
+            reader_, name, inputs, std::move(derived_operator)));
   }
 
   std::optional<std::string> data(const std::string& name) {
@@ -325,8 +344,15 @@ class TreeView {
     for (auto record : reader_->records()) { data_.data[record] = ""; }
     last_index_ = {};
 
-    const auto records = reader_->Seek(timestamp);
+    delta_log_.Reset();
+
+    const auto records = index_->Seek(timestamp);
     for (const auto& pair : records) {
+      if (delta_log_.is_delta(pair.first)) {
+        SeekDelta(pair.first, pair.second, timestamp);
+        continue;
+      }
+
       const auto item = (*reader_->items([&]() {
           FileReader::ItemsOptions options;
           options.start = pair.second;
@@ -351,36 +377,59 @@ class TreeView {
         break;
       }
       if (item.index > last_index_) { last_index_ = item.index; }
-      data_.data[item.record] = item.data;
+      const auto maybe_item = delta_log_.Decode(item);
+      if (maybe_item) {
+        data_.data[maybe_item->record] = maybe_item->data;
+      }
     }
   }
 
-  struct ExtractResult {
-    std::vector<boost::posix_time::ptime> timestamps;
-    std::vector<double> xvals;
-    std::vector<double> yvals;
-  };
+  /// Delta encoded records have to be decoded forward from the
+  /// keyframe preceding @p timestamp.
+  void SeekDelta(const FileReader::Record* record,
+                 FileReader::Index index,
+                 boost::posix_time::ptime timestamp) {
+    const auto maybe_keyframe = delta_log_.Keyframe(record, timestamp);
+    if (!maybe_keyframe) { return; }
 
-  ExtractResult ExtractDeriv(const std::string& token) {
+    auto items = reader_->items([&]() {
+        FileReader::ItemsOptions options;
+        options.records.push_back(record->name);
+        options.start = *maybe_keyframe;
+        return options;
+      }());
+    for (const auto& item : items) {
+      if (item.index > index) { break; }
+      const auto maybe_item = delta_log_.Decode(item);
+      if (maybe_item) {
+        data_.data[maybe_item->record] = maybe_item->data;
+      }
+    }
+    if (index > last_index_) { last_index_ = index; }
+  }
+
+  /// Called with each sample of a derived channel.  Returning false
+  /// stops the evaluation.
+  using ExtractCallback =
+      std::function<bool (boost::posix_time::ptime, double)>;
+
+  /// Evaluate the derived channel @p token over the whole log, read
+  /// with @p reader.  This may be called from any thread, as long as
+  /// @p reader is only used by that thread.  A sample is produced each
+  /// time one of the channel's inputs changes.
+  ///
+  /// Return false if there is no such channel.
+  bool ExtractDeriv(FileReader* reader, const std::string& token,
+                    const ExtractCallback& callback) const {
     mjlib::base::Tokenizer tokenizer(token, ".");
     auto prefix = tokenizer.next();
     for (const auto& derived : derived_) {
       if (derived->name() != prefix) { continue; }
 
-      ExtractResult result;
-      auto current_data = data_;
-      current_data.data = {};
-      for (const auto& item : reader_->items()) {
-        current_data.data[item.record] = item.data;
-        result.timestamps.push_back(item.timestamp);
-        result.xvals.push_back(
-            mjlib::base::ConvertDurationToSeconds(item.timestamp - log_start_));
-        result.yvals.push_back(
-            derived->Extract(tokenizer.remaining(), current_data));
-      }
-      return result;
+      derived->Extract(reader, tokenizer.remaining(), callback);
+      return true;
     }
-    return {};
+    return false;
   }
 
  private:
@@ -390,8 +439,8 @@ class TreeView {
     virtual std::string_view name() const = 0;
 
     virtual void Visit(const CurrentLogData&) const = 0;
-    virtual double Extract(std::string_view token,
-                           const CurrentLogData& log_data) const = 0;
+    virtual void Extract(FileReader* reader, std::string_view token,
+                         const ExtractCallback&) const = 0;
   };
 
   class StringStream : public mjlib::micro::AsyncWriteStream {
@@ -408,17 +457,30 @@ class TreeView {
     std::ostringstream ostr_;
   };
 
-  template <typename DerivedOperator>
+  template <typename DerivedOperator, typename... Inputs>
   class Concrete : public DerivedBase {
    public:
-    Concrete(std::string_view name, DerivedOperator derived_operator) :
-        name_(name),
-        derived_operator_(std::move(derived_operator)) {}
+    using Result = std::invoke_result_t<DerivedOperator, const Inputs*...>;
+    using Values = std::tuple<std::optional<Inputs>...>;
+    using Sequence = std::index_sequence_for<Inputs...>;
+    using Names = std::array<std::string, sizeof...(Inputs)>;
+
+    Concrete(FileReader* reader, std::string_view name, const Names& inputs,
+             DerivedOperator derived_operator)
+        : name_(name),
+          inputs_(inputs),
+          derived_operator_(std::move(derived_operator)),
+          schema_(MakeSchema(reader, inputs_, Sequence())) {}
 
     std::string_view name() const override { return name_; }
 
     void Visit(const CurrentLogData& log_data) const override {
-      auto result = derived_operator_(log_data);
+      Values values;
+      for (const auto& pair : log_data.data) {
+        if (pair.second.empty()) { continue; }
+        Decode(schema_, pair.first, pair.second, &values, Sequence());
+      }
+      auto result = Evaluate(values, Sequence());
       const bool expanded = ImGui::TreeNode(name_.c_str());
       ImGui::NextColumn();
       ImGui::NextColumn();
@@ -429,21 +491,90 @@ class TreeView {
       }
     }
 
-    double Extract(std::string_view token,
-                   const CurrentLogData& log_data) const override {
-      auto result = derived_operator_(log_data);
-      char buf[256] = {};
-      StringStream streambuf;
+    void Extract(FileReader* reader, std::string_view token,
+                 const ExtractCallback& callback) const override {
+      // The schemas belong to the reader, so @p reader needs its own.
+      const auto schema = MakeSchema(reader, inputs_, Sequence());
+
+      // Only the input records are read, and each is decoded once,
+      // when it changes.
+      DeltaLog delta_log{reader};
+      FileReader::ItemsOptions options;
+      for (const auto* record : schema.records) {
+        if (!record) { continue; }
+        options.records.push_back(delta_log.source(record->name));
+      }
+      if (options.records.empty()) { return; }
+
+      Values values;
+      Result result;
       mjlib::micro::SerializableHandler handler(&result);
-      handler.Read(token, buf, streambuf, [](auto&&) {});
-      return std::stod(streambuf.str());
+      for (const auto& raw_item : reader->items(options)) {
+        const auto maybe_item = delta_log.Decode(raw_item);
+        if (!maybe_item) { continue; }
+        const auto& item = *maybe_item;
+        if (!Decode(schema, item.record, item.data, &values, Sequence())) {
+          continue;
+        }
+
+        result = Evaluate(values, Sequence());
+        char buf[256] = {};
+        StringStream streambuf;
+        handler.Read(token, buf, streambuf, [](auto&&) {});
+        if (!callback(item.timestamp, std::stod(streambuf.str()))) {
+          return;
+        }
+      }
+    }
+
+   private:
+    /// The input records of one FileReader, and their decoders.
+    struct Schema {
+      std::array<const FileReader::Record*, sizeof...(Inputs)> records = {};
+      std::tuple<std::unique_ptr<
+        mjlib::telemetry::MappedBinaryReader<Inputs>>...> readers;
     };
 
+    template <size_t... I>
+    static Schema MakeSchema(FileReader* reader, const Names& inputs,
+                             std::index_sequence<I...>) {
+      Schema result;
+      for (size_t i = 0; i < inputs.size(); i++) {
+        result.records[i] = reader->record(inputs[i]);
+      }
+      ((std::get<I>(result.readers) = result.records[I] ?
+        std::make_unique<mjlib::telemetry::MappedBinaryReader<Inputs>>(
+            result.records[I]->schema->root()) : nullptr), ...);
+      return result;
+    }
+
+    /// Store @p data as the value of any input which is @p record.
+    /// Return true if there was one.
+    template <size_t... I>
+    static bool Decode(const Schema& schema,
+                       const FileReader::Record* record,
+                       std::string_view data,
+                       Values* values, std::index_sequence<I...>) {
+      return ((record == schema.records[I] &&
+               (std::get<I>(*values) =
+                std::get<I>(schema.readers)->Read(data), true)) | ...);
+    }
+
+    template <size_t... I>
+    Result Evaluate(const Values& values, std::index_sequence<I...>) const {
+      return derived_operator_(
+          (std::get<I>(values) ? &*std::get<I>(values) : nullptr)...);
+    }
+
     const std::string name_;
+    const Names inputs_;
     DerivedOperator derived_operator_;
+    const Schema schema_;
   };
 
   FileReader* const reader_;
+  const LogIndex* const index_;
+  DeltaLog delta_log_{reader_};
   boost::posix_time::ptime log_start_;
   boost::posix_time::ptime last_timestamp_;
   FileReader::Index last_index_ = {};